@@ -0,0 +1,316 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+
+#include "addrtrie.h"
+
+/*
+ * This is a path compressed binary trie.  Each node has the full
+ * prefix leading to it, a node is only made where prefixes branch or
+ * end, so a lookup visits at most one node per branch point instead
+ * of one per bit.
+ *
+ * Nodes are kept in one array and refer to each other by index, that
+ * keeps them close together and halves the size of the links.  Index
+ * 0 is never a child (the roots are 0 and 1), so it means no child.
+ * The roots are real nodes, a /0 prefix ends at the root itself, so
+ * running out of memory is NO_NODE, not 0.
+ */
+struct addrtrie_node {
+    uint8_t key[16];		/* The prefix, bits past len are zero. */
+    uint8_t len;		/* Prefix length in bits. */
+    bool any_port;		/* A prefix ending here allows any port. */
+    uint16_t nports;
+    uint32_t child[2];
+    uint16_t *ports;		/* Ports allowed for a prefix ending here. */
+};
+
+#define ROOT_V4	0
+#define ROOT_V6	1
+#define NO_NODE	UINT32_MAX
+
+struct addrtrie {
+    struct addrtrie_node *nodes;
+    uint32_t num_nodes;
+    uint32_t size;
+    size_t ports_size;
+};
+
+struct addrtrie *
+addrtrie_alloc(void)
+{
+    struct addrtrie *t;
+
+    t = malloc(sizeof(*t));
+    if (!t)
+	return NULL;
+    t->size = 16;
+    t->nodes = calloc(t->size, sizeof(*t->nodes));
+    if (!t->nodes) {
+	free(t);
+	return NULL;
+    }
+    t->num_nodes = 2;
+    t->ports_size = 0;
+    return t;
+}
+
+void
+addrtrie_free(struct addrtrie *t)
+{
+    uint32_t i;
+
+    if (!t)
+	return;
+    for (i = 0; i < t->num_nodes; i++)
+	free(t->nodes[i].ports);
+    free(t->nodes);
+    free(t);
+}
+
+/*
+ * Get the address bytes, the root and the port (in host order) for a
+ * sockaddr.  Returns the number of address bits, 0 if the address is
+ * not usable.
+ */
+static unsigned int
+addrtrie_key(const struct sockaddr *addr, socklen_t len,
+	     const uint8_t **bytes, uint32_t *root, uint16_t *port)
+{
+    static const uint8_t v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0,
+					  0, 0, 0xff, 0xff };
+
+    if (addr->sa_family == AF_INET && len >= sizeof(struct sockaddr_in)) {
+	const struct sockaddr_in *s4 = (const struct sockaddr_in *) addr;
+
+	*bytes = (const uint8_t *) &s4->sin_addr;
+	*root = ROOT_V4;
+	*port = ntohs(s4->sin_port);
+	return 32;
+    }
+    if (addr->sa_family == AF_INET6 && len >= sizeof(struct sockaddr_in6)) {
+	const struct sockaddr_in6 *s6 = (const struct sockaddr_in6 *) addr;
+
+	*bytes = s6->sin6_addr.s6_addr;
+	*port = ntohs(s6->sin6_port);
+	if (memcmp(*bytes, v4mapped, sizeof(v4mapped)) == 0) {
+	    *bytes += sizeof(v4mapped);
+	    *root = ROOT_V4;
+	    return 32;
+	}
+	*root = ROOT_V6;
+	return 128;
+    }
+    return 0;
+}
+
+#define KEY_BIT(bytes, i) (((bytes)[(i) / 8] >> (7 - (i) % 8)) & 1)
+
+/* Does the address start with the len bit prefix in key? */
+static bool
+prefix_eq(const uint8_t *key, const uint8_t *addr, unsigned int len)
+{
+    unsigned int bytes = len / 8, bits = len % 8;
+
+    if (memcmp(key, addr, bytes) != 0)
+	return false;
+    return !bits || !((key[bytes] ^ addr[bytes]) & (0xff << (8 - bits)));
+}
+
+/* Number of leading bits a and b have in common, up to max. */
+static unsigned int
+common_len(const uint8_t *a, const uint8_t *b, unsigned int max)
+{
+    unsigned int i = 0;
+    uint8_t x;
+
+    while (i < max) {
+	x = a[i / 8] ^ b[i / 8];
+	if (!x) {
+	    i += 8;
+	    continue;
+	}
+	while (!(x & 0x80)) {
+	    x <<= 1;
+	    i++;
+	}
+	break;
+    }
+    return i < max ? i : max;
+}
+
+/* Make a node for the first len bits of bytes, NO_NODE if no memory. */
+static uint32_t
+new_node(struct addrtrie *t, const uint8_t *bytes, unsigned int len)
+{
+    struct addrtrie_node *n;
+    unsigned int nbytes = (len + 7) / 8;
+
+    if (t->num_nodes == t->size) {
+	n = realloc(t->nodes, t->size * 2 * sizeof(*n));
+	if (!n)
+	    return NO_NODE;
+	memset(n + t->size, 0, t->size * sizeof(*n));
+	t->nodes = n;
+	t->size *= 2;
+    }
+    n = &t->nodes[t->num_nodes];
+    memcpy(n->key, bytes, nbytes);
+    if (len % 8)
+	n->key[nbytes - 1] &= 0xff << (8 - len % 8);
+    n->len = len;
+    return t->num_nodes++;
+}
+
+/* Find or make the node for the prefix, NO_NODE if no memory. */
+static uint32_t
+addrtrie_insert(struct addrtrie *t, uint32_t idx, const uint8_t *bytes,
+		unsigned int prefixlen)
+{
+    uint32_t c, m, l;
+    unsigned int bit, common;
+
+    for (;;) {
+	/* Here the prefix matches the node and is at least as long. */
+	if (t->nodes[idx].len == prefixlen)
+	    return idx;
+
+	bit = KEY_BIT(bytes, t->nodes[idx].len);
+	c = t->nodes[idx].child[bit];
+	if (!c) {
+	    l = new_node(t, bytes, prefixlen);
+	    if (l != NO_NODE)
+		t->nodes[idx].child[bit] = l;
+	    return l;
+	}
+
+	common = common_len(bytes, t->nodes[c].key,
+			    prefixlen < t->nodes[c].len ?
+			    prefixlen : t->nodes[c].len);
+	if (common == t->nodes[c].len) {
+	    idx = c;
+	    continue;
+	}
+
+	/* The prefix branches off in the middle of c, split it. */
+	m = new_node(t, bytes, common);
+	if (m == NO_NODE)
+	    return NO_NODE;
+	t->nodes[m].child[KEY_BIT(t->nodes[c].key, common)] = c;
+	t->nodes[idx].child[bit] = m;
+	if (common == prefixlen)
+	    return m;
+	l = new_node(t, bytes, prefixlen);
+	if (l != NO_NODE)
+	    t->nodes[m].child[KEY_BIT(bytes, common)] = l;
+	return l;
+    }
+}
+
+int
+addrtrie_add(struct addrtrie *t, const struct sockaddr *addr,
+	     unsigned int prefixlen, bool port)
+{
+    const uint8_t *bytes;
+    struct addrtrie_node *n;
+    uint32_t idx, i;
+    uint16_t portnum;
+    unsigned int bits;
+    uint16_t *ports;
+
+    bits = addrtrie_key(addr, sizeof(struct sockaddr_storage), &bytes, &idx,
+			&portnum);
+    if (!bits || prefixlen > bits)
+	return EINVAL;
+
+    idx = addrtrie_insert(t, idx, bytes, prefixlen);
+    if (idx == NO_NODE)
+	return ENOMEM;
+
+    n = &t->nodes[idx];
+    if (!port || portnum == 0) {
+	n->any_port = true;
+	return 0;
+    }
+    for (i = 0; i < n->nports; i++) {
+	if (n->ports[i] == portnum)
+	    return 0;
+    }
+    ports = realloc(n->ports, (n->nports + 1) * sizeof(*ports));
+    if (!ports)
+	return ENOMEM;
+    ports[n->nports++] = portnum;
+    n->ports = ports;
+    t->ports_size += sizeof(*ports);
+    return 0;
+}
+
+static bool
+addrtrie_node_match(const struct addrtrie_node *n, uint16_t port)
+{
+    uint16_t i;
+
+    if (n->any_port)
+	return true;
+    for (i = 0; i < n->nports; i++) {
+	if (n->ports[i] == port)
+	    return true;
+    }
+    return false;
+}
+
+bool
+addrtrie_match(const struct addrtrie *t, const struct sockaddr *addr,
+	       socklen_t len)
+{
+    const struct addrtrie_node *n;
+    const uint8_t *bytes;
+    uint32_t idx;
+    uint16_t port;
+    unsigned int bits;
+
+    bits = addrtrie_key(addr, len, &bytes, &idx, &port);
+    if (!bits)
+	return false;
+
+    /* Any prefix on the way down will do, it's an allow list. */
+    for (;;) {
+	n = &t->nodes[idx];
+	if (!prefix_eq(n->key, bytes, n->len))
+	    return false;
+	if (addrtrie_node_match(n, port))
+	    return true;
+	if (n->len == bits)
+	    return false;
+	idx = n->child[KEY_BIT(bytes, n->len)];
+	if (!idx)
+	    return false;
+    }
+}
+
+size_t
+addrtrie_size(const struct addrtrie *t)
+{
+    return sizeof(*t) + t->size * sizeof(*t->nodes) + t->ports_size;
+}
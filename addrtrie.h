@@ -0,0 +1,57 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ADDRTRIE_H
+#define ADDRTRIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+/*
+ * A set of IPv4 and IPv6 prefixes, each optionally limited to one
+ * remote port, for checking remote addresses.  It is a binary trie
+ * per address family, so a lookup looks at no more than 32 or 128
+ * nodes however many prefixes there are.  IPv4 mapped IPv6 addresses
+ * are checked as IPv4.  The trie is built at config time and only
+ * read after that, so it needs no locking.
+ */
+
+struct addrtrie;
+
+struct addrtrie *addrtrie_alloc(void);
+void addrtrie_free(struct addrtrie *t);
+
+/*
+ * Add the prefix of the given length from the address.  If port is
+ * true only connections from the port in the address match.  Returns
+ * 0, ENOMEM, or EINVAL if the family is not IPv4 or IPv6 or the
+ * prefix is too long for it.
+ */
+int addrtrie_add(struct addrtrie *t, const struct sockaddr *addr,
+		 unsigned int prefixlen, bool port);
+
+/* Is the address (and port) in the set? */
+bool addrtrie_match(const struct addrtrie *t, const struct sockaddr *addr,
+		    socklen_t len);
+
+/* Memory used by the trie, for showmem. */
+size_t addrtrie_size(const struct addrtrie *t);
+
+#endif /* ADDRTRIE_H */
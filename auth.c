@@ -18,12 +18,353 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <syslog.h>
 #include <limits.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 #include <gensio/gensio.h>
 
+#include "ser2net.h"
+#include "controller.h"
+#include "auth.h"
+
+#define AUTH_CACHE_BUCKETS	64
+#define AUTH_CACHE_MAX		1024	/* Entries before a flush. */
+
+enum auth_state {
+    AUTH_UNKNOWN,	/* Not looked at yet. */
+    AUTH_PRESENT,
+    AUTH_ABSENT
+};
+
+struct auth_entry {
+    struct auth_entry *next;
+    char *authdir;
+    char user[100];
+
+    enum auth_state pw_state;
+    char password[100];		/* First line of the password file. */
+    const char *pw_errstr;	/* Why there is no password. */
+    int pw_errno;
+
+    enum auth_state certs_state;	/* Does allowed_certs exist? */
+};
+
+static struct gensio_lock *auth_lock;
+static struct auth_entry *auth_cache[AUTH_CACHE_BUCKETS];
+static unsigned int auth_entries;
+static int auth_inotify_fd = -1;
+static unsigned long auth_hits;
+static unsigned long auth_misses;
+static unsigned long auth_flushes;
+
+#ifdef HAVE_SYS_INOTIFY_H
+#define AUTH_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | \
+			 IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+			 IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+static unsigned int
+auth_hash(const char *authdir, const char *user)
+{
+    unsigned int h = 5381;
+
+    while (*authdir)
+	h = h * 33 + (unsigned char) *authdir++;
+    while (*user)
+	h = h * 33 + (unsigned char) *user++;
+    return h % AUTH_CACHE_BUCKETS;
+}
+
+static void
+auth_cache_flush(void)
+{
+    struct auth_entry *e;
+    unsigned int i;
+
+    for (i = 0; i < AUTH_CACHE_BUCKETS; i++) {
+	while ((e = auth_cache[i])) {
+	    auth_cache[i] = e->next;
+	    free(e->authdir);
+	    free(e);
+	}
+    }
+    auth_entries = 0;
+}
+
+/*
+ * Drop every entry along with the watches that were added for them.
+ * A watch is shared by every entry under the same directory, so
+ * rather than counting users of each one, start over with a new
+ * inotify instance; closing the old one removes all its watches.
+ * If a new instance can't be had, caching is just off from here on.
+ * Called with auth_lock held.
+ */
+static void
+auth_cache_reset(void)
+{
+    auth_cache_flush();
+#ifdef HAVE_SYS_INOTIFY_H
+    if (auth_inotify_fd >= 0)
+	close(auth_inotify_fd);
+    auth_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+/*
+ * Drop the cache if anything changed on the filesystem since the
+ * last look.  Called with auth_lock held.
+ */
+static void
+auth_cache_check(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    char buf[4096]
+	__attribute__ ((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+
+    while (read(auth_inotify_fd, buf, sizeof(buf)) > 0)
+	changed = true;
+    if (changed) {
+	auth_cache_reset();
+	auth_flushes++;
+    }
+#endif
+}
+
+/*
+ * Watch the authdir and the user's directory.  The user's directory
+ * may not exist, the authdir watch will see it created.  This is done
+ * before the files are read so no change can be missed.
+ */
+static bool
+auth_watch(const char *authdir, const char *user)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    char dirname[PATH_MAX];
+
+    if (inotify_add_watch(auth_inotify_fd, authdir, AUTH_WATCH_MASK) < 0)
+	return false;
+    snprintf(dirname, sizeof(dirname), "%s/%s", authdir, user);
+    if (inotify_add_watch(auth_inotify_fd, dirname, AUTH_WATCH_MASK) < 0 &&
+		errno != ENOENT)
+	return false;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Find the cache entry for the user, creating it if necessary.
+ * Returns NULL if the user can't be cached, the caller should use
+ * the tmp entry then.  Called with auth_lock held.
+ */
+static struct auth_entry *
+auth_entry_get(const char *authdir, const char *user, struct auth_entry *tmp)
+{
+    unsigned int h;
+    struct auth_entry *e;
+
+    memset(tmp, 0, sizeof(*tmp));
+    snprintf(tmp->user, sizeof(tmp->user), "%s", user);
+    if (auth_inotify_fd < 0 || strcmp(tmp->user, user) != 0)
+	return tmp;
+
+    auth_cache_check();
+    h = auth_hash(authdir, user);
+    for (e = auth_cache[h]; e; e = e->next) {
+	if (strcmp(e->user, user) == 0 && strcmp(e->authdir, authdir) == 0)
+	    return e;
+    }
+
+    if (auth_entries >= AUTH_CACHE_MAX) {
+	auth_cache_reset();
+	if (auth_inotify_fd < 0)
+	    return tmp;
+    }
+    if (!auth_watch(authdir, user))
+	return tmp;
+
+    e = malloc(sizeof(*e));
+    if (!e)
+	return tmp;
+    *e = *tmp;
+    e->authdir = strdup(authdir);
+    if (!e->authdir) {
+	free(e);
+	return tmp;
+    }
+    e->next = auth_cache[h];
+    auth_cache[h] = e;
+    auth_entries++;
+    return e;
+}
+
+static void
+auth_load_password(struct auth_entry *e, const char *authdir)
+{
+    char filename[PATH_MAX];
+    FILE *pwfile;
+    char *s;
+
+    snprintf(filename, sizeof(filename), "%s/%s/password",
+	     authdir, e->user);
+    pwfile = fopen(filename, "r");
+    if (!pwfile) {
+	e->pw_state = AUTH_ABSENT;
+	e->pw_errstr = "Can't open";
+	e->pw_errno = errno;
+	return;
+    }
+    s = fgets(e->password, sizeof(e->password), pwfile);
+    e->pw_errno = errno;
+    fclose(pwfile);
+    if (!s) {
+	e->pw_state = AUTH_ABSENT;
+	e->pw_errstr = "Can't read";
+	return;
+    }
+    s = strchr(e->password, '\n');
+    if (s)
+	*s = '\0';
+    e->pw_state = AUTH_PRESENT;
+}
+
+/*
+ * Fetch the user's password into pw.  Returns false, with the failure
+ * logged, if there isn't one.
+ */
+static bool
+auth_get_password(const char *authdir, const char *user, char *pw,
+		  size_t pwlen)
+{
+    struct auth_entry tmp, *e;
+    const char *errstr = NULL;
+    int err = 0;
+
+    so->lock(auth_lock);
+    e = auth_entry_get(authdir, user, &tmp);
+    if (e->pw_state == AUTH_UNKNOWN) {
+	auth_misses++;
+	auth_load_password(e, authdir);
+    } else {
+	auth_hits++;
+    }
+    if (e->pw_state == AUTH_PRESENT) {
+	strncpy(pw, e->password, pwlen - 1);
+	pw[pwlen - 1] = '\0';
+    } else {
+	errstr = e->pw_errstr;
+	err = e->pw_errno;
+    }
+    so->unlock(auth_lock);
+
+    if (errstr) {
+	syslog(LOG_ERR, "%s password file %s/%s/password: %s", errstr,
+	       authdir, user, strerror(err));
+	return false;
+    }
+    return true;
+}
+
+/* Does the user have an allowed_certs directory? */
+static bool
+auth_have_certs(const char *authdir, const char *user, const char *dirname)
+{
+    struct auth_entry tmp, *e;
+    struct stat st;
+    bool rv;
+
+    so->lock(auth_lock);
+    e = auth_entry_get(authdir, user, &tmp);
+    if (e->certs_state == AUTH_UNKNOWN) {
+	auth_misses++;
+	if (stat(dirname, &st) == 0 && S_ISDIR(st.st_mode))
+	    e->certs_state = AUTH_PRESENT;
+	else
+	    e->certs_state = AUTH_ABSENT;
+    } else {
+	auth_hits++;
+    }
+    rv = e->certs_state == AUTH_PRESENT;
+    so->unlock(auth_lock);
+
+    return rv;
+}
+
+/*
+ * Compare the passwords without stopping at the first difference, so
+ * the time taken doesn't tell how much of the password was right.
+ */
+static bool
+auth_password_match(const char *expected, const char *given)
+{
+    size_t elen = strlen(expected), glen = strlen(given), i;
+    unsigned char diff = elen != glen;
+
+    for (i = 0; i < elen; i++)
+	diff |= ((unsigned char) expected[i] ^
+		 (unsigned char) (i < glen ? given[i] : 0));
+    return diff == 0;
+}
+
+int
+auth_cache_init(void)
+{
+    auth_lock = so->alloc_lock(so);
+    if (!auth_lock)
+	return ENOMEM;
+#ifdef HAVE_SYS_INOTIFY_H
+    /* If this fails logins just don't get cached. */
+    auth_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    return 0;
+}
+
+void
+auth_cache_shutdown(void)
+{
+    auth_cache_flush();
+    if (auth_inotify_fd >= 0) {
+	close(auth_inotify_fd);
+	auth_inotify_fd = -1;
+    }
+    if (auth_lock) {
+	so->free_lock(auth_lock);
+	auth_lock = NULL;
+    }
+}
+
+void
+showauth(struct controller_info *cntlr)
+{
+    unsigned long hits, misses, flushes;
+    unsigned int entries;
+
+    so->lock(auth_lock);
+    auth_cache_check();
+    hits = auth_hits;
+    misses = auth_misses;
+    flushes = auth_flushes;
+    entries = auth_entries;
+    so->unlock(auth_lock);
+
+    controller_outputf(cntlr, "auth cache: %s\r\n",
+		       auth_inotify_fd >= 0 ? "on" : "off (no inotify)");
+    controller_outputf(cntlr, "  entries: %u\r\n", entries);
+    controller_outputf(cntlr, "  hits: %lu\r\n", hits);
+    controller_outputf(cntlr, "  misses: %lu\r\n", misses);
+    controller_outputf(cntlr, "  invalidations: %lu\r\n", flushes);
+}
+
 /*
  * The next few functions are for authentication handling.
  */
@@ -91,6 +432,9 @@ handle_precert(struct gensio *net, const char *authdir)
 
     snprintf(filename, sizeof(filename), "%s/%s/allowed_certs/",
 	     authdir, s);
+    /* Without the directory the control would fail with not found. */
+    if (!auth_have_certs(authdir, s, filename))
+	return GE_NOTSUP;
     err = gensio_control(net, 0, false, GENSIO_CONTROL_CERT_AUTH,
 			 filename, &len);
     if (err && err != GE_CERTNOTFOUND) {
@@ -105,9 +449,7 @@ handle_password(struct gensio *net, const char *authdir, const char *password)
 {
     gensiods len;
     char username[100];
-    char filename[PATH_MAX];
-    FILE *pwfile;
-    char readpw[100], *s;
+    char readpw[100];
     int err;
 
     len = sizeof(username);
@@ -119,25 +461,9 @@ handle_password(struct gensio *net, const char *authdir, const char *password)
 	return GE_AUTHREJECT;
     }
 
-    snprintf(filename, sizeof(filename), "%s/%s/password",
-	     authdir, username);
-    pwfile = fopen(filename, "r");
-    if (!pwfile) {
-	syslog(LOG_ERR, "Can't open password file %s: %s", filename,
-	       strerror(errno));
+    if (!auth_get_password(authdir, username, readpw, sizeof(readpw)))
 	return GE_AUTHREJECT;
-    }
-    s = fgets(readpw, sizeof(readpw), pwfile);
-    fclose(pwfile);
-    if (!s) {
-	syslog(LOG_ERR, "Can't read password file %s: %s", filename,
-	       strerror(errno));
-	return GE_AUTHREJECT;
-    }
-    s = strchr(readpw, '\n');
-    if (s)
-	*s = '\0';
-    if (strcmp(readpw, password) == 0)
+    if (auth_password_match(readpw, password))
 	return 0;
     return GE_NOTSUP;
 }
@@ -0,0 +1,42 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef AUTH_H
+#define AUTH_H
+
+struct controller_info;
+
+/*
+ * The password files and allowed_certs directories under an authdir
+ * are cached per user, so a burst of logins does not go to the
+ * filesystem for each one.  The cache is dropped whenever inotify
+ * reports a change in an authdir or a user's directory.  Without
+ * inotify nothing is cached.
+ */
+
+/* Allocate the lock and set up inotify, call before any logins. */
+int auth_cache_init(void);
+
+/* Free the cache and close the inotify descriptor. */
+void auth_cache_shutdown(void);
+
+/* Show the cache statistics on a control port. */
+void showauth(struct controller_info *cntlr);
+
+#endif /* AUTH_H */
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <errno.h>
 #include <syslog.h>
+#include <ctype.h>
 
 #include <gensio/selector.h>
 #include <gensio/gensio.h>
@@ -31,6 +32,10 @@
 #include "controller.h"
 #include "dataxfer.h"
 #include "readconfig.h"
+#include "pool.h"
+#include "events.h"
+#include "auth.h"
+#include "resolve.h"
 
 /** BASED ON sshd.c FROM openssh.com */
 #ifdef HAVE_TCPD_H
@@ -54,6 +59,21 @@ static int num_controller_ports = 0;	/* How many control connections
 
 #define INBUF_SIZE 255	/* The size of the maximum input command. */
 
+#define MAX_ARGS 16	/* The most tokens a command may have. */
+#define MAX_ID_LEN 64	/* Longest JSON request id. */
+
+/*
+ * Output goes through a ring of this size.  Monitor data is only
+ * queued up to the high water mark, past that it is dropped and
+ * counted.  Command output is never dropped, if it doesn't fit the
+ * ring is grown and shrunk back when it empties.  If the output gets
+ * past the high water mark, reading commands is stopped until it
+ * drains to the low water mark.
+ */
+#define OUTBUF_SIZE		16384
+#define OUTBUF_HIGH_WATER	(OUTBUF_SIZE * 3 / 4)
+#define OUTBUF_LOW_WATER	(OUTBUF_SIZE / 4)
+
 char *prompt = "-> ";
 
 /* This data structure is kept for each control connection. */
@@ -67,20 +87,56 @@ typedef struct controller_info {
     int  inbuf_count;			/* The number of bytes currently
 					   in the inbuf. */
 
-    char *outbuf;			/* The output buffer, NULL if
-					   no output. */
-    int  outbufsize;			/* Total size of the memory
+    /*
+     * Protects the output ring and drop counts.  Monitor data comes
+     * in with port locks held, so no other ser2net lock is taken
+     * while holding this.  The net's read and write callbacks are
+     * enabled and disabled with it held, that only takes gensio's own
+     * lock and never calls back into ser2net.
+     */
+    struct gensio_lock *outlock;
+    char *outbuf;			/* The output ring. */
+    gensiods outbufsize;		/* Total size of the memory
 					   allocated in outbuf. */
-    int  outbuf_pos;			/* The current position in the
+    gensiods outbuf_pos;		/* The current position in the
 					   output buffer. */
-    int  outbuf_count;			/* The number of bytes
+    gensiods outbuf_count;		/* The number of bytes
 					   (starting at outbuf_pos)
 					   left to transmit. */
-
-    void *monitor_port_id;		/* When port monitoring, this is
-					   the id given when the monitoring
-					   is started.  It is used to stop
-					   monitoring. */
+    bool read_blocked;			/* Reading stopped, too much
+					   output is pending. */
+
+    gensiods monitor_dropped;		/* Total monitor bytes dropped. */
+    gensiods drop_notice;		/* Monitor bytes dropped since
+					   the last notice was sent. */
+
+    bool monitoring;			/* A monitor has been started, they
+					   must be stopped on shutdown. */
+
+    /*
+     * JSON mode, see process_json_line().  The flag is changed with
+     * outlock held, monitor data looks at it.  The rest is only
+     * used with the controller lock held.
+     */
+    bool json;
+    bool json_first;			/* No value yet in the current
+					   object or array. */
+    char json_id[MAX_ID_LEN + 1];	/* Id of the current request as
+					   given, "null" if none. */
+    char *capture;			/* Command output in JSON mode, it
+					   is sent in the response. */
+    gensiods capture_len;
+    gensiods capture_size;
+    bool capturing;
+
+    /*
+     * A showport of all ports in JSON mode is sent a port at a time
+     * as the output drains, no more commands are read until it is
+     * done.
+     */
+    bool streaming;
+    unsigned int stream_pos;		/* Index of the next port. */
+    unsigned int stream_gen;		/* Port list generation at start. */
 
     struct controller_info *next;	/* Used to keep these items in
 					   a linked list. */
@@ -107,11 +163,12 @@ controller_close_done(struct gensio *net, void *cb_data)
     gensio_free(net);
 
     so->free_lock(cntlr->lock);
+    so->free_lock(cntlr->outlock);
 
-    if (cntlr->outbuf != NULL) {
-	free(cntlr->outbuf);
-    }
+    pool_free(cntlr->outbuf);
     cntlr->outbuf = NULL;
+    pool_free(cntlr->capture);
+    cntlr->capture = NULL;
 
     /* Remove it from the linked list. */
     prev = NULL;
@@ -152,10 +209,11 @@ shutdown_controller(controller_info_t *cntlr)
 	return;
     }
 
-    if (cntlr->monitor_port_id != NULL) {
-	data_monitor_stop(cntlr, cntlr->monitor_port_id);
-	cntlr->monitor_port_id = NULL;
+    if (cntlr->monitoring) {
+	data_monitor_stop(cntlr, NULL);
+	cntlr->monitoring = false;
     }
+    events_subscribe(cntlr, 0);
 
     cntlr->in_shutdown = 1;
     so->unlock(cntlr->lock);
@@ -163,74 +221,107 @@ shutdown_controller(controller_info_t *cntlr)
     gensio_close(cntlr->net, controller_close_done, NULL);
 }
 
-/* Send some output to the control connection.  This allocates and
-   free a buffer in blocks of 1024 and increases the size of the
-   buffer as necessary. */
-void
-controller_output(struct controller_info *cntlr,
-		  const char             *data,
-		  int                    count)
+/* Copy data into the output ring, there must be room. */
+static void
+outbuf_put(struct controller_info *cntlr, const char *data, gensiods count)
 {
-    if (cntlr->outbuf != NULL) {
-	/* Already outputting data, just add more onto it. */
-	int  new_size = cntlr->outbuf_count + count;
-
-	if (new_size <= cntlr->outbufsize) {
-	    /* It will fit into the current buffer, just move things
-	       around and append it. */
-	    if (cntlr->outbuf_pos > 0) {
-		int i;
-
-		for (i = 0; i < cntlr->outbuf_count; i++) {
-		    cntlr->outbuf[i] = cntlr->outbuf[cntlr->outbuf_pos + i];
-		}
-	    }
-	    memcpy(&(cntlr->outbuf[cntlr->outbuf_count]), data, count);
-	} else {
-	    /* We need to allocate a larger buffer. */
-	    char *newbuf;
-
-	    /* Allocate the next even multiple of 1024 bytes. */
-	    new_size = ((new_size / 1024) * 1024) + 1024;
-	    newbuf = malloc(new_size);
-
-	    if (newbuf == NULL) {
-		/* Out of memory, just ignore the request */
-		return;
-	    }
+    gensiods end, len;
+
+    end = (cntlr->outbuf_pos + cntlr->outbuf_count) % cntlr->outbufsize;
+    len = cntlr->outbufsize - end;
+    if (len > count)
+	len = count;
+    memcpy(cntlr->outbuf + end, data, len);
+    memcpy(cntlr->outbuf, data + len, count - len);
+    cntlr->outbuf_count += count;
+}
 
-	    cntlr->outbufsize = new_size;
+/* Move the ring into a new buffer of the given size. */
+static int
+outbuf_resize(struct controller_info *cntlr, gensiods size)
+{
+    char *newbuf;
+    gensiods len;
+
+    newbuf = pool_alloc(size);
+    if (!newbuf)
+	return ENOMEM;
+
+    len = cntlr->outbufsize - cntlr->outbuf_pos;
+    if (len > cntlr->outbuf_count)
+	len = cntlr->outbuf_count;
+    memcpy(newbuf, cntlr->outbuf + cntlr->outbuf_pos, len);
+    memcpy(newbuf + len, cntlr->outbuf, cntlr->outbuf_count - len);
+    pool_free(cntlr->outbuf);
+    cntlr->outbuf = newbuf;
+    cntlr->outbufsize = size;
+    cntlr->outbuf_pos = 0;
+    return 0;
+}
 
-	    /* Copy all the data into a new buffer. */
-	    memcpy(newbuf,
-		   &(cntlr->outbuf[cntlr->outbuf_pos]),
-		   cntlr->outbuf_count);
-	    memcpy(newbuf + cntlr->outbuf_count, data, count);
-	    free(cntlr->outbuf);
-	    cntlr->outbuf = newbuf;
-	}
-	cntlr->outbuf_pos = 0;
-	cntlr->outbuf_count += count;
-    } else {
-	/* We are starting a new buffer, just get it. */
-	char *newbuf;
-	int  new_size = ((count / 1024) * 1024) + 1024;
+/* Called with outlock held after data is added to the ring. */
+static void
+outbuf_start_write(struct controller_info *cntlr)
+{
+    gensio_set_write_callback_enable(cntlr->net, true);
+    if (!cntlr->read_blocked && cntlr->outbuf_count >= OUTBUF_HIGH_WATER) {
+	cntlr->read_blocked = true;
+	gensio_set_read_callback_enable(cntlr->net, false);
+    }
+}
 
-	newbuf = malloc(new_size);
-	if (newbuf == NULL) {
-	    /* Out of memory, just ignore thre request */
+/* Save command output to send in a JSON response. */
+static void
+capture_put(struct controller_info *cntlr, const char *data, gensiods count)
+{
+    gensiods size = cntlr->capture_size;
+    char *newbuf;
+
+    if (cntlr->capture_len + count > size) {
+	if (size == 0)
+	    size = 256;
+	while (size < cntlr->capture_len + count)
+	    size *= 2;
+	newbuf = pool_alloc(size);
+	if (!newbuf)
+	    /* Out of memory, just ignore the request */
 	    return;
-	}
+	if (cntlr->capture)
+	    memcpy(newbuf, cntlr->capture, cntlr->capture_len);
+	pool_free(cntlr->capture);
+	cntlr->capture = newbuf;
+	cntlr->capture_size = size;
+    }
+    memcpy(cntlr->capture + cntlr->capture_len, data, count);
+    cntlr->capture_len += count;
+}
 
-	cntlr->outbufsize = new_size;
+/* Send some output to the control connection.  If it doesn't fit in
+   the ring, the ring is grown as necessary. */
+void
+controller_output(struct controller_info *cntlr,
+		  const char             *data,
+		  int                    count)
+{
+    gensiods size;
 
-	memcpy(newbuf, data, count);
-	cntlr->outbuf = newbuf;
-	cntlr->outbuf_pos = 0;
-	cntlr->outbuf_count = count;
-	gensio_set_read_callback_enable(cntlr->net, false);
-	gensio_set_write_callback_enable(cntlr->net, true);
+    so->lock(cntlr->outlock);
+    if (cntlr->capturing) {
+	capture_put(cntlr, data, count);
+	goto out;
+    }
+    if (cntlr->outbuf_count + count > cntlr->outbufsize) {
+	size = cntlr->outbufsize;
+	while (size < cntlr->outbuf_count + count)
+	    size *= 2;
+	if (outbuf_resize(cntlr, size))
+	    /* Out of memory, just ignore the request */
+	    goto out;
     }
+    outbuf_put(cntlr, data, count);
+    outbuf_start_write(cntlr);
+ out:
+    so->unlock(cntlr->outlock);
 }
 
 int
@@ -262,32 +353,318 @@ void controller_outs(struct controller_info *cntlr, char *s)
 }
 
 
-/* Write some data directly to the controllers output port. */
+/*
+ * Escape data for a JSON string.  Bytes that are not printable ASCII
+ * are written as \u00XX, so binary data comes out as latin-1.  out
+ * must have room for 6 times len.
+ */
+static gensiods
+json_escape(char *out, const unsigned char *in, gensiods len)
+{
+    static const char hex[] = "0123456789abcdef";
+    gensiods i, o = 0;
+
+    for (i = 0; i < len; i++) {
+	unsigned char c = in[i];
+
+	if (c == '"' || c == '\\') {
+	    out[o++] = '\\';
+	    out[o++] = c;
+	} else if (c == '\n') {
+	    out[o++] = '\\';
+	    out[o++] = 'n';
+	} else if (c == '\r') {
+	    out[o++] = '\\';
+	    out[o++] = 'r';
+	} else if (c == '\t') {
+	    out[o++] = '\\';
+	    out[o++] = 't';
+	} else if (c < 0x20 || c >= 0x7f) {
+	    memcpy(out + o, "\\u00", 4);
+	    o += 4;
+	    out[o++] = hex[c >> 4];
+	    out[o++] = hex[c & 0xf];
+	} else {
+	    out[o++] = c;
+	}
+    }
+    return o;
+}
+
+void
+controller_out_jstr(struct controller_info *cntlr, const char *s,
+		    gensiods len)
+{
+    char buf[6 * 128];
+    gensiods n;
+
+    controller_output(cntlr, "\"", 1);
+    while (len > 0) {
+	n = len > 128 ? 128 : len;
+	controller_output(cntlr, buf,
+			  json_escape(buf, (const unsigned char *) s, n));
+	s += n;
+	len -= n;
+    }
+    controller_output(cntlr, "\"", 1);
+}
+
+/* Put out the separator and key for the next value. */
+static void
+json_key(struct controller_info *cntlr, const char *key)
+{
+    if (!cntlr->json_first)
+	controller_output(cntlr, ",", 1);
+    cntlr->json_first = false;
+    if (key) {
+	controller_out_jstr(cntlr, key, strlen(key));
+	controller_output(cntlr, ":", 1);
+    }
+}
+
+void
+controller_json_open(struct controller_info *cntlr, const char *key, char c)
+{
+    json_key(cntlr, key);
+    controller_output(cntlr, &c, 1);
+    cntlr->json_first = true;
+}
+
+void
+controller_json_close(struct controller_info *cntlr, char c)
+{
+    controller_output(cntlr, &c, 1);
+    cntlr->json_first = false;
+}
+
+void
+controller_json_str(struct controller_info *cntlr, const char *key,
+		    const char *val)
+{
+    json_key(cntlr, key);
+    if (val)
+	controller_out_jstr(cntlr, val, strlen(val));
+    else
+	controller_outs(cntlr, "null");
+}
+
+void
+controller_json_num(struct controller_info *cntlr, const char *key,
+		    unsigned long val)
+{
+    json_key(cntlr, key);
+    controller_outputf(cntlr, "%lu", val);
+}
+
 void
-controller_write(struct controller_info *cntlr, const char *data,
-		 gensiods count)
+controller_json_bool(struct controller_info *cntlr, const char *key,
+		     bool val)
 {
-    gensio_write(cntlr->net, NULL, data, count, NULL);
+    json_key(cntlr, key);
+    controller_outs(cntlr, val ? "true" : "false");
+}
+
+void
+controller_json_begin(struct controller_info *cntlr)
+{
+    cntlr->json_first = true;
+    controller_json_open(cntlr, NULL, '{');
+    json_key(cntlr, "id");
+    controller_outs(cntlr, cntlr->json_id);
+}
+
+void
+controller_json_end(struct controller_info *cntlr)
+{
+    controller_json_close(cntlr, '}');
+    controller_output(cntlr, "\n", 1);
+}
+
+/*
+ * Format a monitor record for JSON mode into a pool buffer, returns
+ * NULL if out of memory.
+ */
+static char *
+json_monitor_rec(const char *port, const char *dir, const char *data,
+		 gensiods count, gensiods *len)
+{
+    gensiods size = 48 + 6 * (strlen(port) + strlen(dir) + count);
+    char *rec = pool_alloc(size);
+    gensiods n;
+
+    if (!rec)
+	return NULL;
+    n = sprintf(rec, "{\"monitor\":\"");
+    n += json_escape(rec + n, (const unsigned char *) port, strlen(port));
+    n += sprintf(rec + n, "\",\"dir\":\"");
+    n += json_escape(rec + n, (const unsigned char *) dir, strlen(dir));
+    n += sprintf(rec + n, "\",\"data\":\"");
+    n += json_escape(rec + n, (const unsigned char *) data, count);
+    n += sprintf(rec + n, "\"}\n");
+    *len = n;
+    return rec;
+}
+
+/*
+ * Queue monitor data to the controller.  If the ring is past the high
+ * water mark the data is dropped, the next data that fits is preceded
+ * by a notice of how much was dropped.  Returns the number of bytes
+ * dropped.  In JSON mode the data goes out as a record with the port
+ * and direction.
+ */
+gensiods
+controller_write(struct controller_info *cntlr, const char *port,
+		 const char *dir, const char *data, gensiods count)
+{
+    char notice[64];
+    char *rec = NULL;
+    gensiods reclen = count;
+    int len = 0;
+
+    so->lock(cntlr->outlock);
+    if (cntlr->json) {
+	rec = json_monitor_rec(port, dir, data, count, &reclen);
+	if (!rec)
+	    goto out_drop;
+	data = rec;
+    }
+    if (cntlr->drop_notice)
+	len = snprintf(notice, sizeof(notice),
+		       cntlr->json ? "{\"dropped\":%lu}\n"
+				   : "\r\n[dropped %lu bytes]\r\n",
+		       (unsigned long) cntlr->drop_notice);
+    if (cntlr->outbuf_count + len + reclen > OUTBUF_HIGH_WATER)
+	goto out_drop;
+    if (len) {
+	outbuf_put(cntlr, notice, len);
+	cntlr->drop_notice = 0;
+    }
+    outbuf_put(cntlr, data, reclen);
+    outbuf_start_write(cntlr);
+    so->unlock(cntlr->outlock);
+    pool_free(rec);
+    return 0;
+
+ out_drop:
+    cntlr->drop_notice += count;
+    cntlr->monitor_dropped += count;
+    so->unlock(cntlr->outlock);
+    pool_free(rec);
+    return count;
+}
+
+/* Put a string into an event record, escaped for JSON if needed. */
+static gensiods
+event_str(struct controller_info *cntlr, char *out, const char *s)
+{
+    gensiods len = strlen(s);
+
+    if (cntlr->json)
+	return json_escape(out, (const unsigned char *) s, len);
+    memcpy(out, s, len);
+    return len;
+}
+
+/*
+ * Queue an event, like monitor data it is dropped if the output is
+ * past the high water mark.  The text form is
+ *   event <seq> <sec>.<usec> <type> <port> key="value" ...
+ * and the JSON form is a record with "event" set to the type.
+ */
+bool
+controller_event(struct controller_info *cntlr, unsigned long seq,
+		 const struct timespec *ts, const char *type,
+		 const char *port, const char * const *kv, unsigned int nkv)
+{
+    gensiods size, n;
+    unsigned int i;
+    char *rec;
+    bool rv = false;
+
+    size = 96 + 6 * (strlen(type) + strlen(port));
+    for (i = 0; i < nkv * 2; i++)
+	size += 8 + 6 * strlen(kv[i]);
+    rec = pool_alloc(size);
+    if (!rec)
+	return false;
+
+    so->lock(cntlr->outlock);
+    if (cntlr->json) {
+	n = sprintf(rec, "{\"event\":\"");
+	n += event_str(cntlr, rec + n, type);
+	n += sprintf(rec + n, "\",\"seq\":%lu,\"time\":%ld.%06ld,\"port\":\"",
+		     seq, (long) ts->tv_sec, ts->tv_nsec / 1000);
+	n += event_str(cntlr, rec + n, port);
+	rec[n++] = '"';
+	for (i = 0; i < nkv; i++) {
+	    n += sprintf(rec + n, ",\"");
+	    n += event_str(cntlr, rec + n, kv[i * 2]);
+	    n += sprintf(rec + n, "\":\"");
+	    n += event_str(cntlr, rec + n, kv[i * 2 + 1]);
+	    rec[n++] = '"';
+	}
+	n += sprintf(rec + n, "}\n");
+    } else {
+	n = sprintf(rec, "event %lu %ld.%06ld ", seq,
+		    (long) ts->tv_sec, ts->tv_nsec / 1000);
+	n += event_str(cntlr, rec + n, type);
+	rec[n++] = ' ';
+	n += event_str(cntlr, rec + n, port);
+	for (i = 0; i < nkv; i++) {
+	    rec[n++] = ' ';
+	    n += event_str(cntlr, rec + n, kv[i * 2]);
+	    rec[n++] = '=';
+	    rec[n++] = '"';
+	    n += event_str(cntlr, rec + n, kv[i * 2 + 1]);
+	    rec[n++] = '"';
+	}
+	n += sprintf(rec + n, "\r\n");
+    }
+    if (cntlr->outbuf_count + n <= OUTBUF_HIGH_WATER) {
+	outbuf_put(cntlr, rec, n);
+	outbuf_start_write(cntlr);
+	rv = true;
+    }
+    so->unlock(cntlr->outlock);
+    pool_free(rec);
+
+    return rv;
 }
 
 static char *help_str =
 "exit - leave the program.\r\n"
 "help - display this help.\r\n"
 "version - display the version of this program.\r\n"
-"monitor <type> <tcp port> - display all the input for a given port on\r\n"
-"       the calling control port.  Only one direction may be monitored\r\n"
-"       at a time.  The type field may be 'tcp' or 'term' and specifies\r\n"
-"       whether to monitor data from the net port or from the serial port\r\n"
+"monitor <type> <tcp port> [<filter>] - display all the input for a\r\n"
+"       given port on the calling control port.  The type field may be\r\n"
+"       'tcp', 'term' or 'both' and specifies whether to monitor data\r\n"
+"       from the net port, from the serial port, or both.  The filter\r\n"
+"       is pattern=<str>,sample=<n> to only show data containing str\r\n"
+"       or one chunk of data out of every n.\r\n"
 "       Note that data monitoring is best effort, if the controller port\r\n"
-"       cannot keep up the data will be silently dropped.  A controller\r\n"
-"       may only monitor one thing and a port may only be monitored by\r\n"
-"       one controller.\r\n"
-"monitor stop - stop the current monitor.\r\n"
+"       cannot keep up the data will be dropped and a notice of how\r\n"
+"       much was dropped is displayed.  A controller may monitor any\r\n"
+"       number of ports and a port may be monitored by any number of\r\n"
+"       controllers.\r\n"
+"monitor stop [<tcp port>] - stop the monitors on the port, or all\r\n"
+"       monitors if no port is given.\r\n"
+"subscribe [<types>] - send port events to this control port as they\r\n"
+"       happen.  Types is a comma separated list of connect, disconnect,\r\n"
+"       shutdown, deverror, modemstate, and linestate, or all, the\r\n"
+"       default.  Each event has a sequence number, a gap in it means\r\n"
+"       events were dropped because the output was backed up.\r\n"
+"unsubscribe - stop sending port events.\r\n"
 "disconnect <tcp port> - disconnect the tcp connection on the port.\r\n"
 "showport [<tcp port>] - Show information about a port. If no port is\r\n"
 "       given, all ports are displayed.\r\n"
 "showshortport [<tcp port>] - Show information about a port in a one-line\r\n"
 "       format. If no port is given, all ports are displayed.\r\n"
+"showmem - Show the memory used per port, with and without sharing the\r\n"
+"       configuration between ports.\r\n"
+"showpools - Show the memory pool statistics.\r\n"
+"showauth - Show the authentication cache statistics.\r\n"
+"showresolver - Show the address lookup cache and latency statistics.\r\n"
+"json - Switch to JSON mode, one JSON request and response per line.\r\n"
 "setporttimeout <tcp port> <timeout> - Set the amount of time in seconds\r\n"
 "       before the port connection will be shut down if no activity\r\n"
 "       has been seen on the port.\r\n"
@@ -300,144 +677,525 @@ static char *help_str =
 "         off - The port is shut down\r\n"
 "         on - The port is up and all I/O is transferred\r\n";
 
-/* Process a line of input.  This scans for commands, reads any
-   parameters, then calls the actual code to handle the command. */
-int
-process_input_line(controller_info_t *cntlr)
+/*
+ * Start a JSON showport.  A single port is sent now, all the ports
+ * are streamed as the output drains, see controller_stream().
+ */
+static int
+json_showports(controller_info_t *cntlr, char *portspec)
 {
-    char *strtok_data;
-    char *tok;
+    int rv;
+
+    if (portspec) {
+	/* The record goes out as is, not in the response's output. */
+	cntlr->capturing = false;
+	start_maint_op();
+	rv = showport_json(cntlr, portspec, 0);
+	end_maint_op();
+	cntlr->capturing = true;
+	if (rv) {
+	    controller_outputf(cntlr, "Invalid port number: %s\r\n", portspec);
+	    return -1;
+	}
+	return 0;
+    }
+
+    cntlr->streaming = true;
+    cntlr->stream_pos = 0;
+    cntlr->stream_gen = ports_generation();
+    gensio_set_read_callback_enable(cntlr->net, false);
+    return 0;
+}
+
+/*
+ * Send JSON ports until the output gets to the low water mark.
+ * Returns true if the stream is done.
+ */
+static bool
+controller_stream(controller_info_t *cntlr)
+{
+    bool room, read_blocked;
+    int rv;
+
+    while (cntlr->streaming) {
+	so->lock(cntlr->outlock);
+	room = cntlr->outbuf_count < OUTBUF_LOW_WATER;
+	so->unlock(cntlr->outlock);
+	if (!room)
+	    return false;
+
+	start_maint_op();
+	rv = showport_json(cntlr, NULL, cntlr->stream_pos);
+	end_maint_op();
+	if (rv == 0) {
+	    cntlr->stream_pos++;
+	    continue;
+	}
+
+	controller_json_begin(cntlr);
+	controller_json_bool(cntlr, "done", true);
+	controller_json_num(cntlr, "count", cntlr->stream_pos);
+	controller_json_bool(cntlr, "changed",
+			     cntlr->stream_gen != ports_generation());
+	controller_json_end(cntlr);
+	cntlr->streaming = false;
+
+	so->lock(cntlr->outlock);
+	read_blocked = cntlr->read_blocked;
+	so->unlock(cntlr->outlock);
+	if (!read_blocked)
+	    gensio_set_read_callback_enable(cntlr->net, true);
+    }
+    return true;
+}
+
+/* Join the arguments with spaces, for JSON requests to commands that
+   take the rest of the line. */
+static char *
+join_args(char *buf, gensiods size, int argc, char **argv)
+{
+    gensiods len = 0, n;
+    int i;
+
+    buf[0] = '\0';
+    for (i = 0; i < argc; i++) {
+	n = strlen(argv[i]);
+	if (len + n + 2 > size)
+	    break;
+	if (i > 0)
+	    buf[len++] = ' ';
+	memcpy(buf + len, argv[i], n + 1);
+	len += n;
+    }
+    return buf;
+}
+
+static int
+subscribe_cmd(controller_info_t *cntlr, int argc, char **argv)
+{
+    unsigned int i, mask = EVENT_ALL;
+    unsigned long seq, dropped;
+    const char *err;
+
+    if (argc >= 2) {
+	err = event_parse_types(argv[1], &mask);
+	if (err) {
+	    controller_outputf(cntlr, "%s\r\n", err);
+	    return -1;
+	}
+    }
+    if (events_subscribe(cntlr, mask)) {
+	controller_outs(cntlr, "Out of memory\r\n");
+	return -1;
+    }
+
+    events_subscription(cntlr, &mask, &seq, &dropped);
+    controller_outs(cntlr, "subscribed:");
+    for (i = 0; i < EVENT_NUM_TYPES; i++) {
+	if (mask & (1 << i))
+	    controller_outputf(cntlr, " %s", event_type_name(i));
+    }
+    controller_outputf(cntlr, "\r\n  seq: %lu\r\n  dropped: %lu\r\n",
+		       seq, dropped);
+    return 0;
+}
+
+/*
+ * Run a command.  Returns 1 if the controller was shut down, -1 if
+ * the command was invalid, and 0 otherwise.
+ */
+static int
+process_command(controller_info_t *cntlr, int argc, char **argv)
+{
+    char controls[INBUF_SIZE + 1];
     char *str;
 
-    tok = strtok_r((char *) cntlr->inbuf, " \t", &strtok_data);
-    if (tok == NULL) {
+    if (argc == 0) {
 	/* Empty line, just ignore it. */
-    } else if (strcmp(tok, "exit") == 0) {
+    } else if (strcmp(argv[0], "exit") == 0) {
 	shutdown_controller(cntlr);
 	return 1; /* We don't want a prompt any more. */
-    } else if (strcmp(tok, "quit") == 0) {
+    } else if (strcmp(argv[0], "quit") == 0) {
 	shutdown_controller(cntlr);
 	return 1; /* We don't want a prompt any more. */
-    } else if (strcmp(tok, "help") == 0) {
+    } else if (strcmp(argv[0], "help") == 0) {
 	controller_outs(cntlr, help_str);
-    } else if (strcmp(tok, "version") == 0) {
+    } else if (strcmp(argv[0], "version") == 0) {
 	str = "ser2net version ";
 	controller_outs(cntlr, str);
 	str = VERSION;
 	controller_outs(cntlr, str);
 	controller_outs(cntlr, "\r\n");
-    } else if (strcmp(tok, "showport") == 0) {
-	tok = strtok_r(NULL, " \t", &strtok_data);
+    } else if (strcmp(argv[0], "showport") == 0) {
+	if (cntlr->json)
+	    return json_showports(cntlr, argv[1]);
+	start_maint_op();
+	showports(cntlr, argv[1]);
+	end_maint_op();
+    } else if (strcmp(argv[0], "showshortport") == 0) {
+	if (cntlr->json)
+	    return json_showports(cntlr, argv[1]);
 	start_maint_op();
-	showports(cntlr, tok);
+	showshortports(cntlr, argv[1]);
 	end_maint_op();
-    } else if (strcmp(tok, "showshortport") == 0) {
-	tok = strtok_r(NULL, " \t", &strtok_data);
+    } else if (strcmp(argv[0], "showpools") == 0) {
+	showpools(cntlr);
+    } else if (strcmp(argv[0], "showauth") == 0) {
+	showauth(cntlr);
+    } else if (strcmp(argv[0], "showresolver") == 0) {
+	showresolver(cntlr);
+    } else if (strcmp(argv[0], "showmem") == 0) {
 	start_maint_op();
-	showshortports(cntlr, tok);
+	showmem(cntlr);
 	end_maint_op();
-    } else if (strcmp(tok, "monitor") == 0) {
-	tok = strtok_r(NULL, " \t", &strtok_data);
-	if (tok == NULL) {
+    } else if (strcmp(argv[0], "monitor") == 0) {
+	if (argc < 2) {
 	    char *err = "No monitor type given\r\n";
 	    controller_outs(cntlr, err);
-	    goto out;
+	    return -1;
 	}
-	if (strcmp(tok, "stop") == 0) {
-	    if (cntlr->monitor_port_id != NULL) {
+	if (strcmp(argv[1], "stop") == 0) {
+	    if (cntlr->monitoring) {
 		start_maint_op();
-		data_monitor_stop(cntlr, cntlr->monitor_port_id);
+		data_monitor_stop(cntlr, argv[2]);
 		end_maint_op();
-		cntlr->monitor_port_id = NULL;
+		if (!argv[2])
+		    cntlr->monitoring = false;
 	    }
 	} else {
-	    if (cntlr->monitor_port_id != NULL) {
-		char *err = "Already monitoring a port\r\n";
-		controller_outs(cntlr, err);
-		goto out;
-	    }
-
-	    str = strtok_r(NULL, " \t", &strtok_data);
-	    if (str == NULL) {
+	    if (argc < 3) {
 		char *err = "No tcp port given\r\n";
 		controller_outs(cntlr, err);
-		goto out;
+		return -1;
 	    }
 	    start_maint_op();
-	    cntlr->monitor_port_id = data_monitor_start(cntlr, tok, str);
+	    if (data_monitor_start(cntlr, argv[1], argv[2], argv[3]) == 0)
+		cntlr->monitoring = true;
 	    end_maint_op();
 	}
-    } else if (strcmp(tok, "disconnect") == 0) {
-	tok = strtok_r(NULL, " \t", &strtok_data);
-	if (tok == NULL) {
+    } else if (strcmp(argv[0], "subscribe") == 0) {
+	return subscribe_cmd(cntlr, argc, argv);
+    } else if (strcmp(argv[0], "unsubscribe") == 0) {
+	events_subscribe(cntlr, 0);
+    } else if (strcmp(argv[0], "disconnect") == 0) {
+	if (argc < 2) {
 	    char *err = "No port given\r\n";
 	    controller_outs(cntlr, err);
-	    goto out;
+	    return -1;
 	}
 	start_maint_op();
-	disconnect_port(cntlr, tok);
+	disconnect_port(cntlr, argv[1]);
 	end_maint_op();
-    } else if (strcmp(tok, "setporttimeout") == 0) {
-	tok = strtok_r(NULL, " \t", &strtok_data);
-	if (tok == NULL) {
+    } else if (strcmp(argv[0], "setporttimeout") == 0) {
+	if (argc < 2) {
 	    char *err = "No port given\r\n";
 	    controller_outs(cntlr, err);
-	    goto out;
+	    return -1;
 	}
-	str = strtok_r(NULL, " \t", &strtok_data);
-	if (str == NULL) {
+	if (argc < 3) {
 	    char *err = "No timeout given\r\n";
 	    controller_outs(cntlr, err);
-	    goto out;
+	    return -1;
 	}
 	start_maint_op();
-	setporttimeout(cntlr, tok, str);
+	setporttimeout(cntlr, argv[1], argv[2]);
 	end_maint_op();
-    } else if (strcmp(tok, "setportenable") == 0) {
-	tok = strtok_r(NULL, " \t", &strtok_data);
-	if (tok == NULL) {
+    } else if (strcmp(argv[0], "setportenable") == 0) {
+	if (argc < 2) {
 	    char *err = "No port given\r\n";
 	    controller_outs(cntlr, err);
-	    goto out;
+	    return -1;
 	}
-	str = strtok_r(NULL, " \t", &strtok_data);
-	if (str == NULL) {
+	if (argc < 3) {
 	    char *err = "No timeout given\r\n";
 	    controller_outs(cntlr, err);
-	    goto out;
+	    return -1;
 	}
 	start_maint_op();
-	setportenable(cntlr, tok, str);
+	setportenable(cntlr, argv[1], argv[2]);
 	end_maint_op();
-    } else if (strcmp(tok, "setportcontrol") == 0) {
-	tok = strtok_r(NULL, " \t", &strtok_data);
-	if (tok == NULL) {
+    } else if (strcmp(argv[0], "setportcontrol") == 0) {
+	if (argc < 2) {
 	    char *err = "No port given\r\n";
 	    controller_outs(cntlr, err);
-	    goto out;
+	    return -1;
 	}
-
-	str = strtok_r(NULL, "", &strtok_data);
-	if (str == NULL) {
+	if (argc < 3) {
 	    char *err = "No device controls\r\n";
 	    controller_outs(cntlr, err);
-	    goto out;
+	    return -1;
 	}
 	start_maint_op();
-	setportcontrol(cntlr, tok, str);
+	if (argc == 3)
+	    /* Text mode gives the rest of the line as typed. */
+	    setportcontrol(cntlr, argv[1], argv[2]);
+	else
+	    setportcontrol(cntlr, argv[1],
+			   join_args(controls, sizeof(controls),
+				     argc - 2, argv + 2));
 	end_maint_op();
     } else {
 	char *err = "Unknown command: ";
 	controller_outs(cntlr, err);
-	controller_outs(cntlr, tok);
+	controller_outs(cntlr, argv[0]);
 	controller_outs(cntlr, "\r\n");
+	return -1;
+    }
+
+    return 0;
+}
+
+/* Process a line of input.  This scans for commands, reads any
+   parameters, then calls the actual code to handle the command. */
+int
+process_input_line(controller_info_t *cntlr)
+{
+    char *strtok_data;
+    char *argv[MAX_ARGS + 1];
+    char *tok;
+    int argc = 0;
+
+    for (tok = strtok_r((char *) cntlr->inbuf, " \t", &strtok_data); tok;
+	 tok = strtok_r(NULL, " \t", &strtok_data)) {
+	if (argc == MAX_ARGS) {
+	    controller_outs(cntlr, "Too many arguments\r\n");
+	    controller_outs(cntlr, prompt);
+	    return 0;
+	}
+	argv[argc++] = tok;
+	if (argc == 2 && strcmp(argv[0], "setportcontrol") == 0) {
+	    /* The controls are the rest of the line, as typed. */
+	    tok = strtok_r(NULL, "", &strtok_data);
+	    if (tok)
+		argv[argc++] = tok;
+	    break;
+	}
     }
+    argv[argc] = NULL;
+
+    if (argc == 1 && strcmp(argv[0], "json") == 0) {
+	/* Switch to JSON mode, there is no prompt from here. */
+	so->lock(cntlr->outlock);
+	cntlr->json = true;
+	so->unlock(cntlr->outlock);
+	strcpy(cntlr->json_id, "null");
+	controller_json_begin(cntlr);
+	controller_json_bool(cntlr, "done", true);
+	controller_json_str(cntlr, "version", VERSION);
+	controller_json_end(cntlr);
+	return 0;
+    }
+
+    if (process_command(cntlr, argc, argv) == 1)
+	return 1;
 
-out:
     controller_outs(cntlr, prompt);
     return 0;
 }
 
+static const char *
+json_skip_ws(const char *p)
+{
+    while (*p == ' ' || *p == '\t')
+	p++;
+    return p;
+}
+
+/*
+ * Decode the JSON string at p (at the opening quote) in place.
+ * Returns the decoded string and sets *end past the closing quote,
+ * or returns NULL if it is invalid.  \u escapes above 0xff are
+ * replaced with '?'.
+ */
+static char *
+json_parse_str(char *p, char **end)
+{
+    char *out, *start;
+    unsigned int v;
+    int i;
+
+    if (*p != '"')
+	return NULL;
+    start = out = ++p;
+    while (*p != '"') {
+	if (*p == '\0')
+	    return NULL;
+	if (*p != '\\') {
+	    *out++ = *p++;
+	    continue;
+	}
+	p++;
+	switch (*p) {
+	case '"': case '\\': case '/': *out++ = *p; break;
+	case 'b': *out++ = '\b'; break;
+	case 'f': *out++ = '\f'; break;
+	case 'n': *out++ = '\n'; break;
+	case 'r': *out++ = '\r'; break;
+	case 't': *out++ = '\t'; break;
+	case 'u':
+	    for (v = 0, i = 1; i <= 4; i++) {
+		if (!isxdigit((unsigned char) p[i]))
+		    return NULL;
+		v = v * 16 + (isdigit((unsigned char) p[i]) ? p[i] - '0'
+			      : tolower((unsigned char) p[i]) - 'a' + 10);
+	    }
+	    *out++ = v > 0xff ? '?' : v;
+	    p += 4;
+	    break;
+	default:
+	    return NULL;
+	}
+	p++;
+    }
+    *end = p + 1;
+    *out = '\0';
+    return start;
+}
+
+/*
+ * Parse a JSON request, {"id":<id>,"cmd":"<command>","args":[...]}.
+ * id is optional and may be any string or number, it is returned as
+ * given in the response.  args is optional and must be strings.
+ * Returns NULL or an error string.
+ */
+static const char *
+json_parse_request(controller_info_t *cntlr, char *p,
+		   int *argc, char **argv)
+{
+    char *key, *val, *idstart;
+    gensiods len;
+
+    *argc = 1;
+    argv[0] = NULL;
+    p = (char *) json_skip_ws(p);
+    if (*p++ != '{')
+	return "Request is not a JSON object";
+    for (;;) {
+	p = (char *) json_skip_ws(p);
+	if (*p == '}')
+	    break;
+	key = json_parse_str(p, &p);
+	if (!key)
+	    return "Invalid key";
+	p = (char *) json_skip_ws(p);
+	if (*p++ != ':')
+	    return "Missing ':'";
+	p = (char *) json_skip_ws(p);
+
+	if (strcmp(key, "id") == 0) {
+	    /* Keep the id as given, it is not decoded. */
+	    idstart = p;
+	    if (*p == '"') {
+		for (p++; *p && *p != '"'; p++) {
+		    if (*p == '\\' && p[1])
+			p++;
+		}
+		if (*p++ != '"')
+		    return "Invalid id";
+	    } else {
+		while (*p == '-' || *p == '.' || isalnum((unsigned char) *p))
+		    p++;
+	    }
+	    len = p - idstart;
+	    if (len == 0 || len > MAX_ID_LEN)
+		return "Invalid id";
+	    memcpy(cntlr->json_id, idstart, len);
+	    cntlr->json_id[len] = '\0';
+	} else if (strcmp(key, "cmd") == 0) {
+	    argv[0] = json_parse_str(p, &p);
+	    if (!argv[0])
+		return "Invalid cmd";
+	} else if (strcmp(key, "args") == 0) {
+	    if (*p++ != '[')
+		return "args is not an array";
+	    p = (char *) json_skip_ws(p);
+	    while (*p != ']') {
+		if (*argc >= MAX_ARGS)
+		    return "Too many args";
+		val = json_parse_str(p, &p);
+		if (!val)
+		    return "Invalid arg, args must be strings";
+		argv[(*argc)++] = val;
+		p = (char *) json_skip_ws(p);
+		if (*p == ',')
+		    p = (char *) json_skip_ws(p + 1);
+		else if (*p != ']')
+		    return "Invalid args";
+	    }
+	    p++;
+	} else {
+	    return "Unknown key";
+	}
+
+	p = (char *) json_skip_ws(p);
+	if (*p == ',')
+	    p++;
+	else if (*p != '}')
+	    return "Invalid request";
+    }
+    if (!argv[0])
+	return "No cmd given";
+    argv[*argc] = NULL;
+    return NULL;
+}
+
+/*
+ * Process a line of input in JSON mode.  Each line is a request and
+ * gets one response line with "done" set, after any port records:
+ *
+ *   {"id":<id>,"done":true,"output":"<command output>"}
+ *
+ * "error" is added if the request was bad.  Requests may be sent
+ * without waiting for the responses.
+ */
+static int
+process_json_line(controller_info_t *cntlr)
+{
+    char *argv[MAX_ARGS + 1];
+    const char *errstr;
+    int argc, rv = -1;
+
+    if (json_skip_ws((char *) cntlr->inbuf)[0] == '\0')
+	/* Empty line, just ignore it. */
+	return 0;
+
+    strcpy(cntlr->json_id, "null");
+    errstr = json_parse_request(cntlr, (char *) cntlr->inbuf, &argc, argv);
+    if (!errstr && strcmp(argv[0], "text") == 0) {
+	/* Back to text mode. */
+	so->lock(cntlr->outlock);
+	cntlr->json = false;
+	so->unlock(cntlr->outlock);
+	controller_outs(cntlr, prompt);
+	return 0;
+    }
+
+    if (!errstr) {
+	cntlr->capture_len = 0;
+	cntlr->capturing = true;
+	rv = process_command(cntlr, argc, argv);
+	cntlr->capturing = false;
+	if (rv == 1)
+	    return 1;
+	if (cntlr->streaming)
+	    /* The response is sent when the stream finishes. */
+	    return 0;
+    }
+
+    controller_json_begin(cntlr);
+    controller_json_bool(cntlr, "done", true);
+    if (errstr)
+	controller_json_str(cntlr, "error", errstr);
+    else if (rv < 0)
+	controller_json_bool(cntlr, "error", true);
+    if (!errstr && cntlr->capture_len) {
+	json_key(cntlr, "output");
+	controller_out_jstr(cntlr, cntlr->capture, cntlr->capture_len);
+    }
+    controller_json_end(cntlr);
+    return 0;
+}
+
 /* Removes one or more characters starting at pos and going backwards.
    So, for instance, if inbuf holds "abcde", pos points to d, and
    count is 2, the new inbuf will be "abe".  This is used for
@@ -455,13 +1213,86 @@ remove_chars(controller_info_t *cntlr, int pos, int count) {
     return pos;
 }
 
+/*
+ * Scan the input buffer from start, handling editing characters and
+ * running complete lines.  Returns 1 if the controller was shut
+ * down.  If a command is streaming its output this stops, the rest
+ * is scanned when the stream is done.
+ */
+static int
+controller_process_inbuf(controller_info_t *cntlr, int start)
+{
+    int i, j, rv;
+
+    for (i = start; i < cntlr->inbuf_count; i++) {
+	if (cntlr->json) {
+	    /* No editing or echo in JSON mode, lines end in a newline. */
+	    if (cntlr->inbuf[i] == 0x0 || cntlr->inbuf[i] == '\r') {
+		i = remove_chars(cntlr, i, 1);
+		continue;
+	    } else if (cntlr->inbuf[i] != '\n') {
+		continue;
+	    }
+	    cntlr->inbuf[i] = '\0';
+	    rv = process_json_line(cntlr);
+	} else if (cntlr->inbuf[i] == 0x0) {
+	    /* Ignore nulls. */
+	    i = remove_chars(cntlr, i, 1);
+	    continue;
+	} else if (cntlr->inbuf[i] == '\n') {
+	    /* Ignore newlines. */
+	    i = remove_chars(cntlr, i, 1);
+	    continue;
+	} else if ((cntlr->inbuf[i] == '\b') || (cntlr->inbuf[i] == 0x7f)) {
+	    /* Got a backspace. */
+
+	    if (i == 0) {
+		/* We ignore backspaces at the beginning of the line. */
+		i = remove_chars(cntlr, i, 1);
+	    } else {
+		i = remove_chars(cntlr, i, 2);
+		controller_outs(cntlr, "\b \b");
+	    }
+	    continue;
+	} else if (cntlr->inbuf[i] == '\r') {
+	    /* We got a newline, process the command. */
+	    controller_outs(cntlr, "\r\n");
+
+	    cntlr->inbuf[i] ='\0';
+	    rv = process_input_line(cntlr);
+	} else {
+	    /* It's a normal character, just echo it. */
+	    controller_output(cntlr, (char *) &(cntlr->inbuf[i]), 1);
+	    continue;
+	}
+
+	if (rv)
+	    return 1; /* Controller was shut down. */
+
+	/* Now copy any leftover data to the beginning of the buffer. */
+	/* Don't use memcpy or strcpy because the memory might
+	   overlap */
+	i++;
+	cntlr->inbuf_count -= i;
+	for (j = 0; j < cntlr->inbuf_count; i++, j++) {
+	    cntlr->inbuf[j] = cntlr->inbuf[i];
+	}
+	i = -1;
+
+	if (cntlr->streaming && !controller_stream(cntlr))
+	    /* Wait for the output to drain. */
+	    break;
+    }
+    return 0;
+}
+
 /* Data is ready to read on the TCP port. */
 static void
 controller_read(struct gensio *net, int err,
 		unsigned char *buf, gensiods *ibuflen)
 {
     controller_info_t *cntlr = gensio_get_user_data(net);
-    int read_start, i;
+    int read_start;
     gensiods buflen = 0;
 
     so->lock(cntlr->lock);
@@ -478,6 +1309,10 @@ controller_read(struct gensio *net, int err,
 	goto out_return;
     }
 
+    if (cntlr->streaming)
+	/* Leave the data until the stream is done. */
+	goto out_unlock;
+
     buflen = *ibuflen;
 
     if (cntlr->inbuf_count == INBUF_SIZE) {
@@ -492,47 +1327,8 @@ controller_read(struct gensio *net, int err,
     memcpy(cntlr->inbuf + read_start, buf, buflen);
 
     cntlr->inbuf_count += buflen;
-    for (i = read_start; i < cntlr->inbuf_count; i++) {
-	if (cntlr->inbuf[i] == 0x0) {
-	    /* Ignore nulls. */
-	    i = remove_chars(cntlr, i, 1);
-	} else if (cntlr->inbuf[i] == '\n') {
-	    /* Ignore newlines. */
-	    i = remove_chars(cntlr, i, 1);
-	} else if ((cntlr->inbuf[i] == '\b') || (cntlr->inbuf[i] == 0x7f)) {
-	    /* Got a backspace. */
-
-	    if (i == 0) {
-		/* We ignore backspaces at the beginning of the line. */
-		i = remove_chars(cntlr, i, 1);
-	    } else {
-		i = remove_chars(cntlr, i, 2);
-		controller_outs(cntlr, "\b \b");
-	    }
-	} else if (cntlr->inbuf[i] == '\r') {
-	    /* We got a newline, process the command. */
-	    int j;
-
-	    controller_outs(cntlr, "\r\n");
-
-	    cntlr->inbuf[i] ='\0';
-	    if (process_input_line(cntlr))
-		goto out; /* Controller was shut down. */
-
-	    /* Now copy any leftover data to the beginning of the buffer. */
-	    /* Don't use memcpy or strcpy because the memory might
-               overlap */
-	    i++;
-	    cntlr->inbuf_count -= i;
-	    for (j = 0; j < cntlr->inbuf_count; i++, j++) {
-		cntlr->inbuf[j] = cntlr->inbuf[i];
-	    }
-	    i = -1;
-	} else {
-	    /* It's a normal character, just echo it. */
-	    controller_output(cntlr, (char *) &(cntlr->inbuf[i]), 1);
-	}
-    }
+    if (controller_process_inbuf(cntlr, read_start))
+	goto out; /* Controller was shut down. */
  out_unlock:
     so->unlock(cntlr->lock);
  out:
@@ -549,36 +1345,53 @@ controller_write_ready(struct gensio *net)
 {
     controller_info_t *cntlr = gensio_get_user_data(net);
     int err;
-    gensiods write_count;
+    gensiods write_count, len;
 
     so->lock(cntlr->lock);
     if (cntlr->in_shutdown)
 	goto out;
 
-    err = gensio_write(net, &write_count,
-		       &(cntlr->outbuf[cntlr->outbuf_pos]),
-		       cntlr->outbuf_count, NULL);
-    if (err == EAGAIN) {
-	/* This again was due to O_NONBso->lock, just ignore it. */
-    } else if (err == EPIPE) {
-	goto out_fail;
-    } else if (err) {
-	/* Some other bad error. */
-	syslog(LOG_ERR, "The tcp write for controller had error: %m");
-	goto out_fail;
-    }
-
-    cntlr->outbuf_count -= write_count;
-    if (cntlr->outbuf_count != 0) {
-	/* We didn't write all the data, continue writing. */
-	cntlr->outbuf_pos += write_count;
-    } else {
-	/* We are done writing, turn the reader back on. */
-	free(cntlr->outbuf);
-	cntlr->outbuf = NULL;
-	gensio_set_read_callback_enable(net, true);
+    so->lock(cntlr->outlock);
+    while (cntlr->outbuf_count > 0) {
+	len = cntlr->outbufsize - cntlr->outbuf_pos;
+	if (len > cntlr->outbuf_count)
+	    len = cntlr->outbuf_count;
+	err = gensio_write(net, &write_count,
+			   cntlr->outbuf + cntlr->outbuf_pos, len, NULL);
+	if (err) {
+	    so->unlock(cntlr->outlock);
+	    if (err != GE_REMCLOSE)
+		syslog(LOG_ERR, "The tcp write for controller had error: %s",
+		       gensio_err_to_str(err));
+	    goto out_fail;
+	}
+	cntlr->outbuf_count -= write_count;
+	cntlr->outbuf_pos = (cntlr->outbuf_pos + write_count) %
+	    cntlr->outbufsize;
+	if (write_count < len)
+	    /* No more room, wait for the next callback. */
+	    break;
+    }
+
+    if (cntlr->outbuf_count == 0) {
+	/* All written, go back to the normal size if it was grown. */
+	cntlr->outbuf_pos = 0;
+	if (cntlr->outbufsize > OUTBUF_SIZE)
+	    outbuf_resize(cntlr, OUTBUF_SIZE);
 	gensio_set_write_callback_enable(net, false);
     }
+    if (cntlr->read_blocked && cntlr->outbuf_count <= OUTBUF_LOW_WATER) {
+	cntlr->read_blocked = false;
+	if (!cntlr->streaming)
+	    gensio_set_read_callback_enable(net, true);
+    }
+    so->unlock(cntlr->outlock);
+
+    if (cntlr->streaming && controller_stream(cntlr)) {
+	/* Run any commands that came in while streaming. */
+	if (controller_process_inbuf(cntlr, 0))
+	    return; /* Controller was shut down. */
+    }
  out:
     so->unlock(cntlr->lock);
     return;
@@ -631,15 +1444,33 @@ controller_acc_new_child(struct gensio *net)
 	goto errout;
     }
 
+    cntlr->outlock = so->alloc_lock(so);
+    if (!cntlr->outlock) {
+	so->free_lock(cntlr->lock);
+	free(cntlr);
+	err = "Out of memory allocating lock";
+	goto errout;
+    }
+
+    cntlr->outbuf = pool_alloc(OUTBUF_SIZE);
+    if (!cntlr->outbuf) {
+	so->free_lock(cntlr->outlock);
+	so->free_lock(cntlr->lock);
+	free(cntlr);
+	err = "Out of memory allocating output buffer";
+	goto errout;
+    }
+    cntlr->outbufsize = OUTBUF_SIZE;
+
     cntlr->net = net;
 
     gensio_set_callback(net, controller_io_event, cntlr);
 
     cntlr->inbuf_count = 0;
-    cntlr->outbuf = NULL;
-    cntlr->monitor_port_id = NULL;
+    cntlr->monitoring = false;
 
     controller_outs(cntlr, prompt);
+    gensio_set_read_callback_enable(net, true);
 
     cntlr->next = controllers;
     controllers = cntlr;
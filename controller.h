@@ -21,6 +21,8 @@
 #define CONTROLLER
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
 
 #define CONTROLLER_INVALID_TCP_SPEC	-1
 #define CONTROLLER_CANT_OPEN_PORT	-2
@@ -52,11 +54,46 @@ int controller_outputf(struct controller_info *cntlr,
 int controller_voutputf(struct controller_info *cntlr,
 			const char *str, va_list ap);
 
-/* Write some data directly to the controllers output port. */
-void controller_write(struct controller_info *cntlr,
-		      const char *data, gensiods count);
+/* Queue monitor data from the port in the given direction ("tcp"
+   or "term") to the controller.  This will drop the data if too much
+   is already queued, the number of bytes dropped is returned. */
+gensiods controller_write(struct controller_info *cntlr,
+			  const char *port, const char *dir,
+			  const char *data, gensiods count);
+
+/* Queue an event to the controller, in text or JSON depending on the
+   mode.  kv holds nkv key and value pairs.  Returns false if the
+   output is backed up and the event was dropped. */
+bool controller_event(struct controller_info *cntlr, unsigned long seq,
+		      const struct timespec *ts, const char *type,
+		      const char *port, const char * const *kv,
+		      unsigned int nkv);
 
 /*  output a string  */
 void controller_outs (struct controller_info *cntlr, char *s);
 
+/*
+ * JSON output, for controllers that did the "json" command.  A
+ * record starts with controller_json_begin(), which puts out the
+ * request id, and ends with controller_json_end().  Values are added
+ * with the key they go with, the key is NULL in arrays.  Objects and
+ * arrays are started with controller_json_open() with '{' or '[' and
+ * ended with controller_json_close() with '}' or ']'.
+ */
+void controller_json_begin(struct controller_info *cntlr);
+void controller_json_end(struct controller_info *cntlr);
+void controller_json_open(struct controller_info *cntlr, const char *key,
+			  char c);
+void controller_json_close(struct controller_info *cntlr, char c);
+void controller_json_str(struct controller_info *cntlr, const char *key,
+			 const char *val);
+void controller_json_num(struct controller_info *cntlr, const char *key,
+			 unsigned long val);
+void controller_json_bool(struct controller_info *cntlr, const char *key,
+			  bool val);
+
+/* Output a quoted JSON string. */
+void controller_out_jstr(struct controller_info *cntlr, const char *s,
+			 gensiods len);
+
 #endif /* CONTROLLER */
@@ -41,6 +41,14 @@
 #include "dataxfer.h"
 #include "readconfig.h"
 #include "led.h"
+#include "pcapng.h"
+#include "pool.h"
+#include "tap.h"
+#include "events.h"
+#include "stats.h"
+#include "addrtrie.h"
+#include "resolve.h"
+#include "probes.h"
 
 #define SERIAL "term"
 #define NET    "tcp "
@@ -64,17 +72,34 @@ static char *progname = "ser2net";
 char *state_str[] = { "closed", "unconnected", "waiting input",
 		      "waiting output", "closing" };
 
+/*
+ * Change the dev_to_net_state or net_to_dev_state of a port, firing
+ * the probe of the same name with the old and new state.
+ */
+#define port_set_state(port, which, state)				\
+    do {								\
+	S2N_PROBE3(which, (port)->name, (port)->which, state);		\
+	(port)->which = (state);					\
+    } while (0)
+
+/* The index of a connection in its port's netcons, for the probes. */
+#define netcon_index(netcon) ((netcon) - (netcon)->port->netcons)
+
 char *enabled_str[] = { "off", "on" };
 
 typedef struct trace_info_s
 {
     bool hexdump;     /* output each block as a hexdump */
     bool timestamp;   /* preceed each line with a timestamp */
-    char *filename;   /* open file.  NULL if not used */
+    const char *filename; /* file name, in the port's shared config */
     int  fd;          /* open file.  -1 if not used */
+    bool pcapng;      /* write pcapng instead of text */
+    struct pcapng_clock clk; /* time base for pcapng timestamps */
 } trace_info_t;
 
 typedef struct port_info port_info_t;
+struct rot_member;
+struct data_stage;
 typedef struct net_info net_info_t;
 
 struct gbuf {
@@ -97,6 +122,30 @@ gbuf_append(struct gbuf *buf, unsigned char *data, gensiods len)
     buf->pos += len;
 }
 
+/*
+ * Append to the buffer, throwing away the oldest data in the buffer
+ * to make room if necessary.  This only uses cursize, pos is ignored.
+ */
+static void
+gbuf_append_keep_newest(struct gbuf *buf, unsigned char *data, gensiods len)
+{
+    gensiods drop;
+
+    if (len >= buf->maxsize) {
+	memcpy(buf->buf, data + len - buf->maxsize, buf->maxsize);
+	buf->cursize = buf->maxsize;
+	return;
+    }
+
+    if (len > gbuf_room_left(buf)) {
+	drop = len - gbuf_room_left(buf);
+	memmove(buf->buf, buf->buf + drop, buf->cursize - drop);
+	buf->cursize -= drop;
+    }
+    memcpy(buf->buf + buf->cursize, data, len);
+    buf->cursize += len;
+}
+
 static gensiods
 gbuf_cursize(struct gbuf *buf)
 {
@@ -113,7 +162,7 @@ gbuf_reset(struct gbuf *buf)
 static int
 gbuf_init(struct gbuf *buf, gensiods size)
 {
-    buf->buf = malloc(size);
+    buf->buf = pool_alloc(size);
     if (!buf->buf)
 	return ENOMEM;
 
@@ -123,6 +172,23 @@ gbuf_init(struct gbuf *buf, gensiods size)
     return 0;
 }
 
+static void
+gbuf_free(struct gbuf *buf)
+{
+    pool_free(buf->buf);
+    buf->buf = NULL;
+    buf->cursize = 0;
+    buf->pos = 0;
+}
+
+/* Free a gbuf from process_str_to_buf() and its data. */
+static void
+gbuf_free_alloced(struct gbuf *buf)
+{
+    pool_free(buf->buf);
+    pool_free(buf);
+}
+
 struct net_info {
     port_info_t	   *port;		/* My port. */
 
@@ -131,6 +197,8 @@ struct net_info {
 
     struct gensio   *net;		/* When connected, the network
 					   connection, NULL otherwise. */
+    bool up;				/* Set up on the port, see
+					   netcon_up(). */
 
     bool remote_fixed;			/* Tells if the remote address was
 					   set in the configuration, and
@@ -139,6 +207,16 @@ struct net_info {
 					   address when data comes in. */
     const char *remote_str;
 
+    /*
+     * Connect back redialing.  cb_dialing is set while the open is
+     * in progress.  After a failure the delay in cb_backoff doubles,
+     * up to connback-retry-max, and the address is not dialed again
+     * before cb_retry_time (monotonic seconds).
+     */
+    bool cb_dialing;
+    unsigned int cb_backoff;
+    time_t cb_retry_time;
+
     gensiods bytes_received;		/* Number of bytes read from the
 					   network port. */
     gensiods bytes_sent;		/* Number of bytes written to the
@@ -173,10 +251,183 @@ struct net_info {
     struct gensio *new_net;
 };
 
+/*
+ * Ports are allocated on a cache line boundary, and the fields used
+ * when moving data come first so they are packed into as few cache
+ * lines as possible.  Configuration and rarely used fields follow,
+ * configuration that is the same between ports is in port_shared.
+ */
+#define PORT_CACHE_LINE 64
+
 struct port_info
 {
     struct gensio_lock *lock;
 
+    /*
+     * Informationd use when transferring information from the network
+     * port to the terminal device.
+     */
+    int            net_to_dev_state;		/* State of transferring
+						   data from the network port
+                                                   to the device. */
+
+    /*
+     * Information used when transferring information from the
+     * terminal device to the network port.
+     */
+    int            dev_to_net_state;		/* State of transferring
+						   data from the device to
+                                                   the network port. */
+
+    struct gbuf    net_to_dev;			/* Buffer for network
+						   to dev transfers. */
+    struct gbuf dev_to_net;
+
+    struct gensio *io; /* For handling I/O operation to the device */
+    void (*dev_write_handler)(port_info_t *);
+
+    unsigned int max_connections;	/* Maximum number of connections
+					   we can accept at a time for this
+					   port. */
+    net_info_t *netcons;		/* NULL until the first connection,
+					   see port_alloc_netcons(). */
+
+    /* Configuration strings, possibly shared with other ports. */
+    struct port_shared *sh;
+
+    /* Current position in matching sh->closeon. */
+    gensiods closeon_pos;
+
+    gensiods dev_bytes_received;    /* Number of bytes read from the device. */
+    gensiods dev_bytes_sent;        /* Number of bytes written to the device. */
+
+    struct tap_sub *taps;		/* Subscribers to the data, NULL
+					   if none.  See tap.h. */
+    struct tap_file *tapfile;		/* From the tap-file option. */
+
+    struct stats_slot *stats;		/* Shared memory stats, NULL if
+					   they are off. */
+
+    /*
+     * Rotators this port is in, and whether it has room for a
+     * connection the last time the rotators were told.  Protected
+     * by rot_lock.
+     */
+    struct rot_member *rot_members;
+    bool rot_free;
+
+    /* Device bytes from earlier sessions, for least-bytes rotators. */
+    uint64_t total_dev_bytes;
+
+    /*
+     * Pointers to the trace info below, that way if two are the same
+     * file we can just set up one and point both to it.
+     */
+    trace_info_t *tr;
+    trace_info_t *tw;
+    trace_info_t *tb;
+
+    struct gensio_timer *send_timer;	/* Used to delay a bit when
+					   waiting for characters to
+					   batch up as many characters
+					   as possible. */
+    bool send_timer_running;
+
+    bool enable_chardelay;
+
+    unsigned int chardelay;             /* The amount of time to wait after
+					   receiving a character before
+					   sending it, unless we receive
+					   another character.  Based on
+					   bit rate. */
+
+    unsigned int chardelay_scale;	/* The number of character
+					   periods to wait for the
+					   next character, in tenths of
+					   a character period. */
+    unsigned int chardelay_min;		/* The minimum chardelay, in
+					   microseconds. */
+    unsigned int chardelay_max;		/* Maximum amount of time to
+					   wait before sending the data. */
+    struct timeval send_time;		/* When using chardelay, the
+					   time when we will send the
+					   data, no matter what, set
+					   by chardelay_max. */
+
+    /* For RFC 2217 */
+    unsigned char last_modemstate;
+    unsigned char last_linestate;
+
+    /*
+     * Merging of modemstate and linestate reports.  The first change
+     * is sent right away and starts state_timer, changes that come in
+     * while it runs are merged into pend_modemstate (the change bits)
+     * and pend_linestate and sent as one report when it goes off.
+     * state_coalesce is in milliseconds, zero sends every change.
+     */
+    unsigned int state_coalesce;
+    struct gensio_timer *state_timer;
+    bool state_timer_running;
+    bool modemstate_pending;
+    bool linestate_pending;
+    unsigned char pend_modemstate;
+    unsigned char pend_linestate;
+    uint64_t modemstate_suppressed;	/* Changes merged into another. */
+    uint64_t linestate_suppressed;
+
+    /*
+     * Batching for packet (UDP) connections, see udp-batch.  Datagrams
+     * from the network are appended to net_to_dev and written to the
+     * device together when batch_timer goes off or the next one
+     * doesn't fit.  Data for the device is sent to the remotes right
+     * away instead of waiting for each one to report it can write.
+     * udp_batch is in microseconds, zero turns this off.
+     */
+    unsigned int udp_batch;
+    struct gensio_timer *batch_timer;
+    bool batch_timer_running;
+    uint64_t batch_datagrams;		/* Datagrams that were batched. */
+    uint64_t batch_writes;		/* Device writes they took. */
+
+    /*
+     * Pass data straight from one side's read buffer to the other
+     * side when nothing else needs to see it, see the relay option
+     * and port_relay_netcon().
+     */
+    bool relay;
+    uint64_t relay_bytes;		/* Bytes that took the relay. */
+
+    /*
+     * The data path, set by port_select_data_path() from the features
+     * the port has.  The stages are run on each chunk of data before
+     * it is queued, a port with no stages and nothing else that
+     * needs to look at the data gets the minimal read handlers.
+     */
+    int (*dev_read_handler)(port_info_t *port, int err, unsigned char *buf,
+			    gensiods buflen);
+    gensiods (*net_read_handler)(net_info_t *netcon, struct gensio *net,
+				 int readerr, unsigned char *buf,
+				 gensiods buflen);
+#define DATA_STAGES_MAX 4
+    const struct data_stage *dev_stages[DATA_STAGES_MAX];
+    unsigned int num_dev_stages;
+    const struct data_stage *net_stages[DATA_STAGES_MAX];
+    unsigned int num_net_stages;
+
+    /*
+     * Leave the device open and configured when the last user
+     * disconnects, so the next user doesn't have to wait for the open
+     * and openstr.  dev_idle is set while the device is open with
+     * nobody connected, data read from the device then is saved in
+     * dev_backlog (the newest data is kept) or thrown away if the
+     * backlog size is zero.
+     */
+    bool keep_dev_open;
+    bool dev_idle;
+    struct gbuf dev_backlog;
+
+    /* Everything from here down is not used when moving data. */
+
     /* If false, port is not accepting, if true it is. */
     bool enabled;
 
@@ -189,16 +440,14 @@ struct port_info
 					   wait without any I/O before
 					   we shut the port down. */
 
+    unsigned int idle_release_time;	/* Seconds after the port goes
+					   idle to free the buffers and
+					   connections, 0 to keep them. */
+
     struct gensio_timer *timer;		/* Used to timeout when the no
 					   I/O has been seen for a
 					   certain period of time. */
 
-    struct gensio_timer *send_timer;	/* Used to delay a bit when
-					   waiting for characters to
-					   batch up as many characters
-					   as possible. */
-    bool send_timer_running;
-
     unsigned int nocon_read_enable_time_left;
     /* Used if a connect back is requested an no connections could
        be made, to try again. */
@@ -217,32 +466,11 @@ struct port_info
 					   handler context that needs
 					   to be waited for exit. */
 
-    unsigned int chardelay;             /* The amount of time to wait after
-					   receiving a character before
-					   sending it, unless we receive
-					   another character.  Based on
-					   bit rate. */
-
     unsigned int bps;			/* Bits per second rate. */
     unsigned int bpc;			/* Bits per character. */
     unsigned int stopbits;
     unsigned int paritybits;
 
-    bool enable_chardelay;
-
-    unsigned int chardelay_scale;	/* The number of character
-					   periods to wait for the
-					   next character, in tenths of
-					   a character period. */
-    unsigned int chardelay_min;		/* The minimum chardelay, in
-					   microseconds. */
-    unsigned int chardelay_max;		/* Maximum amount of time to
-					   wait before sending the data. */
-    struct timeval send_time;		/* When using chardelay, the
-					   time when we will send the
-					   data, no matter what, set
-					   by chardelay_max. */
-
     /* Information about the network port. */
     char               *name;           /* The name given for the port. */
     char               *accstr;         /* The accepter string. */
@@ -250,53 +478,21 @@ struct port_info
     bool accepter_stopped;
 
     bool               remaddr_set;	/* Did a remote address get set? */
-    struct port_remaddr *remaddrs;	/* Remote addresses allowed. */
     bool has_connect_back;		/* We have connect back addresses. */
     unsigned int num_waiting_connect_backs;
+    bool connback_persist;		/* Dial connect backs when the device
+					   opens and redial when they drop,
+					   not just when data comes in. */
+    unsigned int connback_retry_max;	/* Longest redial backoff, secs. */
 
-    unsigned int max_connections;	/* Maximum number of connections
-					   we can accept at a time for this
-					   port. */
-    net_info_t *netcons;
-
-    gensiods dev_bytes_received;    /* Number of bytes read from the device. */
-    gensiods dev_bytes_sent;        /* Number of bytes written to the device. */
-
-    /*
-     * Informationd use when transferring information from the network
-     * port to the terminal device.
-     */
-    int            net_to_dev_state;		/* State of transferring
-						   data from the network port
-                                                   to the device. */
-
-    struct gbuf    net_to_dev;			/* Buffer for network
-						   to dev transfers. */
-    struct controller_info *net_monitor; /* If non-null, send any input
-					    received from the network port
-					    to this controller port. */
     struct gbuf *devstr;		 /* Outgoing string */
 
-    /*
-     * Information used when transferring information from the
-     * terminal device to the network port.
-     */
-    int            dev_to_net_state;		/* State of transferring
-						   data from the device to
-                                                   the network port. */
-
-    struct gbuf dev_to_net;
-
     /*
      * We have called shutdown_port but the accepter has not yet been
      * read disabled.
      */
     bool shutdown_started;
 
-    struct controller_info *dev_monitor; /* If non-null, send any input
-					    received from the device
-					    to this controller port. */
-
     struct port_info *next;		/* Used to keep a linked list
 					   of these. */
 
@@ -306,12 +502,6 @@ struct port_info
      */
     struct port_info *new_config;
 
-    char *rs485; /* If not NULL, rs485 was specified. */
-
-    /* For RFC 2217 */
-    unsigned char last_modemstate;
-    unsigned char last_linestate;
-
     /* Allow RFC 2217 mode */
     bool allow_2217;
 
@@ -321,6 +511,47 @@ struct port_info
     /* kickolduser mode */
     bool kickolduser_mode;
 
+    bool io_open;
+
+    /*
+     * Trace information, the filenames are in sh.  If the same, then
+     * trace information is in the same file, only one open is done.
+     */
+    trace_info_t trace_read;
+    trace_info_t trace_write;
+    trace_info_t trace_both;
+
+    char *devname;
+
+    /*
+     * devname as specified on the line, not the substituted version.  Only
+     * non-null if devname was substituted.
+     */
+    char *orig_devname;
+};
+
+/*
+ * Configuration that does not change after a port is configured.
+ * Every port has one of these.  Ports with the same configuration
+ * from the same configuration load share one, they are kept in a
+ * hash table so a new port can find an identical one.  It is freed
+ * when the last port using it is freed.
+ */
+struct port_shared
+{
+    unsigned int refcount;
+
+    /* In the hash table, with the hash of everything below. */
+    bool interned;
+    uint32_t hash;
+    struct port_shared *hnext;
+
+    /*
+     * The configuration load it came from, see shared_gen.  Not part
+     * of the hash, only the comparison.
+     */
+    unsigned int gen;
+
     /* Banner to display at startup, or NULL if none. */
     char *bannerstr;
 
@@ -338,46 +569,33 @@ struct port_info
      * serial side, or NULL if none.
      */
     char *closeon;
-    gensiods closeon_pos;
     gensiods closeon_len;
 
-    /*
-     * File to read/write trace, NULL if none.  If the same, then
-     * trace information is in the same file, only one open is done.
-     */
-    trace_info_t trace_read;
-    trace_info_t trace_write;
-    trace_info_t trace_both;
+    /* Directory that has authentication info. */
+    char *authdir;
 
-    /*
-     * Pointers to the above, that way if two are the same file we can just
-     * set up one and point both to it.
-     */
-    trace_info_t *tr;
-    trace_info_t *tw;
-    trace_info_t *tb;
+    char *rs485; /* If not NULL, rs485 was specified. */
 
-    char *devname;
-    struct gensio *io; /* For handling I/O operation to the device */
-    bool io_open;
-    void (*dev_write_handler)(port_info_t *);
+    struct port_remaddr *remaddrs;	/* Remote addresses allowed. */
+    struct addrtrie *remtrie;		/* The remaddrs compiled for
+					   checking, NULL if none. */
+    bool remaddrs_compiled;		/* remtrie has been built for
+					   this load. */
 
-    /*
-     * devname as specified on the line, not the substituted version.  Only
-     * non-null if devname was substituted.
-     */
-    char *orig_devname;
+    /* Trace file names, NULL if not used. */
+    char *trace_read_file;
+    char *trace_write_file;
+    char *trace_both_file;
+
+    /* File to send tap data to and its filter, NULL if not used. */
+    char *tap_file;
+    char *tap_filter;
 
     /*
      * LED to flash for serial traffic
      */
     struct led_s *led_tx;
     struct led_s *led_rx;
-
-    /*
-     * Directory that has authentication info.
-     */
-    char *authdir;
 };
 
 static void setup_port(port_info_t *port, net_info_t *netcon);
@@ -388,54 +606,134 @@ static int handle_net_event(struct gensio *net, void *user_data,
 
 /*
  * This infrastructure allows a list of addresses to be kept.  This is
- * for checking remote addresses
+ * for checking remote addresses.  The list is kept for display and
+ * connect backs, the addresses to check are compiled into a trie.
  */
 struct port_remaddr
 {
     char *str;
-    struct addrinfo *ai;
-    bool is_port_set;
     bool is_connect_back;
     struct port_remaddr *next;
 };
 
-/* Add a remaddr to the given list, return 0 on success or errno on fail. */
-static int
-remaddr_append(struct port_remaddr **list, const char *str)
+/*
+ * Pull a "/<bits>" prefix length off the address part of a remaddr,
+ * the address part is everything before the first comma after the
+ * slash.  Returns a copy of the string without it, or NULL with
+ * *err set.  *prefixlen is set to -1 if there was none.
+ */
+static char *
+remaddr_split_prefix(const char *str, int *prefixlen, int *err)
 {
-    struct port_remaddr *r, *r2;
-    struct addrinfo *ai = NULL;
-    bool is_port_set = false, is_connect_back = false;
-    int socktype, protocol;
-    int err = 0;
+    const char *slash, *end;
+    char *copy, *e;
+    unsigned long v;
 
-    if (*str == '!') {
-	str++;
-	is_connect_back = true;
-    } else {
-	err = gensio_scan_network_port(so, str, false, &ai,
-				       &socktype, &protocol,
-				       &is_port_set, NULL, NULL);
-	if (err)
-	    return err;
-	/* FIXME - We currently ignore the socktype and protocol. */
+    *prefixlen = -1;
+    copy = strdup(str);
+    if (!copy) {
+	*err = GE_NOMEM;
+	return NULL;
     }
 
-    r = malloc(sizeof(*r));
-    if (!r) {
-	err = GE_NOMEM;
-	goto out;
+    slash = strchr(str, '/');
+    if (!slash)
+	return copy;
+
+    v = strtoul(slash + 1, &e, 10);
+    end = e;
+    if (end == slash + 1 || (*end && *end != ',') || v > 128) {
+	free(copy);
+	*err = GE_INVAL;
+	return NULL;
+    }
+    memmove(copy + (slash - str), copy + (end - str), strlen(end) + 1);
+    *prefixlen = v;
+    return copy;
+}
+
+/*
+ * Add the addresses for a remaddr to the trie.  The address was
+ * queued for lookup by remaddr_append(), so it is normally cached.
+ */
+static int
+remaddr_compile(struct addrtrie **trie, const char *str)
+{
+    struct resolve_result *res;
+    int prefixlen;
+    char *addrstr;
+    unsigned int i;
+    int err = 0;
+
+    addrstr = remaddr_split_prefix(str, &prefixlen, &err);
+    if (!addrstr)
+	return err;
+    err = resolve_get(addrstr, find_default_int("resolver-ttl"), &res);
+    free(addrstr);
+    if (err)
+	return err;
+    /* FIXME - We currently ignore the socktype and protocol. */
+
+    if (!*trie) {
+	*trie = addrtrie_alloc();
+	if (!*trie) {
+	    err = GE_NOMEM;
+	    goto out;
+	}
+    }
+
+    for (i = 0; i < res->naddrs; i++) {
+	struct sockaddr *addr = (struct sockaddr *) &res->addrs[i].addr;
+	unsigned int len = prefixlen;
+
+	if (prefixlen < 0)
+	    len = addr->sa_family == AF_INET ? 32 : 128;
+	err = addrtrie_add(*trie, addr, len, res->is_port_set);
+	if (err) {
+	    err = err == ENOMEM ? GE_NOMEM : GE_INVAL;
+	    break;
+	}
+    }
+
+ out:
+    resolve_put(res);
+    return err;
+}
+
+/*
+ * Add a remaddr to the given list, return 0 on success or errno on
+ * fail.  Checking addresses are only queued for lookup here, they are
+ * looked up together and compiled by port_compile_remaddrs().
+ */
+static int
+remaddr_append(struct port_remaddr **list, const char *str)
+{
+    struct port_remaddr *r, *r2;
+    bool is_connect_back = false;
+    int prefixlen, err = 0;
+    char *addrstr;
+
+    if (*str == '!') {
+	str++;
+	is_connect_back = true;
+    } else {
+	addrstr = remaddr_split_prefix(str, &prefixlen, &err);
+	if (!addrstr)
+	    return err;
+	resolve_add_pending(addrstr);
+	free(addrstr);
     }
+
+    r = malloc(sizeof(*r));
+    if (!r)
+	return GE_NOMEM;
     memset(r, 0, sizeof(*r));
 
     r->str = strdup(str);
     if (!r->str) {
 	free(r);
-	err = GE_NOMEM;
-	goto out;
+	return GE_NOMEM;
     }
-    r->ai = ai;
-    r->is_port_set = is_port_set;
     r->is_connect_back = is_connect_back;
     r->next = NULL;
 
@@ -448,58 +746,83 @@ remaddr_append(struct port_remaddr **list, const char *str)
 	r2->next = r;
     }
 
- out:
-    if (err && ai)
-	gensio_free_addrinfo(so, ai);
-
-    return err;
+    return 0;
 }
 
-static bool
-ai_check(struct addrinfo *ai, const struct sockaddr *addr, socklen_t len,
-	 bool is_port_set)
+/*
+ * Build the trie for a new port's remaddrs.  Ports with the same
+ * configuration in one load share it, so this is only done once for
+ * them.  Every load gets its own, so names are looked up again (or
+ * taken from the resolver cache, see resolver-ttl) on a reread.  An
+ * address that can't be looked up is logged and left out, so it
+ * matches nothing.
+ */
+static void
+port_compile_remaddrs(port_info_t *port)
 {
-    while (ai) {
-	if (gensio_sockaddr_equal(addr, len, ai->ai_addr, ai->ai_addrlen,
-				  is_port_set))
-	    return true;
-	ai = ai->ai_next;
-    }
+    struct port_shared *sh = port->sh;
+    struct port_remaddr *r;
+    int err;
 
-    return false;
+    if (sh->remaddrs_compiled)
+	return;
+    sh->remaddrs_compiled = true;
+    for (r = sh->remaddrs; r; r = r->next) {
+	if (r->is_connect_back)
+	    continue;
+	err = remaddr_compile(&sh->remtrie, r->str);
+	if (err)
+	    syslog(LOG_ERR, "Port %s: error adding remote address '%s': %s",
+		   port->name, r->str, gensio_err_to_str(err));
+    }
 }
 
-/* Check that the given address matches something in the list. */
+/*
+ * Check that the given address matches something in the list.  If
+ * there is no list everything matches, if it only has connect backs
+ * nothing does.
+ */
 static bool
-remaddr_check(const struct port_remaddr *list,
+remaddr_check(const struct port_shared *sh,
 	      const struct sockaddr *addr, socklen_t len)
 {
-    const struct port_remaddr *r = list;
-
-    if (!r)
+    if (!sh->remaddrs)
 	return true;
-
-    while (r) {
-	if (ai_check(r->ai, addr, len, r->is_port_set))
-	    return true;
-	r = r->next;
-    }
-
-    return false;
+    if (!sh->remtrie)
+	return false;
+    return addrtrie_match(sh->remtrie, addr, len);
 }
 
 #define for_each_connection(port, netcon) \
     for (netcon = port->netcons;				\
-	 netcon < &(port->netcons[port->max_connections]);	\
+	 netcon && netcon < &(port->netcons[port->max_connections]); \
 	 netcon++)
 
 static struct gensio_lock *ports_lock;
+
+/* Protects the refcounts in struct port_shared and the hash table. */
+static struct gensio_lock *shared_lock;
+#define SHARED_HASH_SIZE 256
+static struct port_shared *shared_hash[SHARED_HASH_SIZE];
+static unsigned int num_shared;
+/*
+ * Bumped when a configuration load is applied.  Shared state is only
+ * reused within a load, the remtrie in it holds what the names in
+ * the remaddrs resolved to at that load.
+ */
+static unsigned int shared_gen;
 static port_info_t *ports = NULL; /* Linked list of ports. */
+static unsigned int ports_gen;	/* Changed when the list changes. */
 static port_info_t *new_ports = NULL; /* New ports during config/reconfig. */
 static port_info_t *new_ports_end = NULL;
 
 static void shutdown_one_netcon(net_info_t *netcon, const char *reason);
+static void port_send_backlog(port_info_t *port, net_info_t *netcon);
+static void port_rot_update(port_info_t *port);
 static int shutdown_port(port_info_t *port, const char *errreason);
+static int net_fd_write(port_info_t *port, net_info_t *netcon,
+			struct gbuf *buf, gensiods *pos);
+static void finish_dev_to_net_write(port_info_t *port);
 
 /*
  * Like above but does a new line at the end of the output, generally
@@ -565,21 +888,28 @@ init_port_data(port_info_t *port)
     port->dev_to_net.maxsize = find_default_int("dev-to-net-bufsize");
     port->net_to_dev.maxsize = find_default_int("net-to-dev-bufsize");
     port->max_connections = find_default_int("max-connections");
-    if (find_default_str("authdir", &port->authdir))
+    port->keep_dev_open = find_default_bool("keep-device-open");
+    port->dev_backlog.maxsize = find_default_int("keep-open-backlog");
+    port->connback_persist = find_default_bool("connback-persist");
+    port->connback_retry_max = find_default_int("connback-retry-max");
+    port->state_coalesce = find_default_int("state-coalesce");
+    port->udp_batch = find_default_int("udp-batch");
+    port->relay = find_default_bool("relay");
+    port->idle_release_time = find_default_int("idle-release-time");
+    if (find_default_str("authdir", &port->sh->authdir))
 	return ENOMEM;
-    if (find_default_str("signature", &port->signaturestr))
+    if (find_default_str("signature", &port->sh->signaturestr))
 	return ENOMEM;
-    if (find_default_str("banner", &port->bannerstr))
+    if (find_default_str("banner", &port->sh->bannerstr))
 	return ENOMEM;
-    if (find_default_str("openstr", &port->openstr))
+    if (find_default_str("openstr", &port->sh->openstr))
 	return ENOMEM;
-    if (find_default_str("closestr", &port->closestr))
+    if (find_default_str("closestr", &port->sh->closestr))
 	return ENOMEM;
-    if (find_default_str("closeon", &port->closeon))
+    if (find_default_str("closeon", &port->sh->closeon))
 	return ENOMEM;
-
-    port->led_tx = NULL;
-    port->led_rx = NULL;
+    if (port->sh->closeon)
+	port->sh->closeon_len = strlen(port->sh->closeon);
 
     return 0;
 }
@@ -664,32 +994,60 @@ trace_write(port_info_t *port, trace_info_t *t, const unsigned char *buf,
 }
 
 static void
-do_trace(port_info_t *port, trace_info_t *t, const unsigned char *buf,
-	 gensiods buf_len, const char *prefix)
+trace_write_failed(port_info_t *port, trace_info_t *t, int err)
+{
+    char errbuf[128];
+
+    /* Fatal error writing to the file, log it and close the file. */
+
+    if (strerror_r(err, errbuf, sizeof(errbuf)) == -1)
+	syslog(LOG_ERR, "Unable write to trace file on port %s: %d",
+	       port->name, err);
+    else
+	syslog(LOG_ERR, "Unable to write to trace file on port %s: %s",
+	       port->name, errbuf);
+
+    close(t->fd);
+    t->fd = -1;
+}
+
+/*
+ * pcapng interface 0 is the device, interface n is netcon n - 1.
+ * Everything is recorded as inbound on the interface it was read
+ * from.
+ */
+static uint32_t
+trace_pcapng_ifidx(port_info_t *port, net_info_t *netcon)
+{
+    if (!netcon)
+	return 0;
+    return netcon - port->netcons + 1;
+}
+
+static void
+do_trace(port_info_t *port, net_info_t *netcon, trace_info_t *t,
+	 const unsigned char *buf, gensiods buf_len, const char *prefix)
 {
     int rv;
 
+    if (t->pcapng) {
+	if (t->fd == -1 || buf_len == 0)
+	    return;
+	rv = pcapng_write_epb(t->fd, trace_pcapng_ifidx(port, netcon),
+			      pcapng_now(&t->clk), PCAPNG_DIR_INBOUND,
+			      buf, buf_len, NULL, 0);
+	if (rv == -1)
+	    trace_write_failed(port, t, errno);
+	return;
+    }
+
     while (buf_len > 0) {
     retry_write:
 	rv = trace_write(port, t, buf, buf_len, prefix);
 	if (rv == -1) {
-	    char errbuf[128];
-	    int err = errno;
-
-	    if (err == EINTR)
+	    if (errno == EINTR)
 		goto retry_write;
-
-	    /* Fatal error writing to the file, log it and close the file. */
-
-	    if (strerror_r(err, errbuf, sizeof(errbuf)) == -1)
-		syslog(LOG_ERR, "Unable write to trace file on port %s: %d",
-		       port->name, err);
-	    else
-		syslog(LOG_ERR, "Unable to write to trace file on port %s: %s",
-		       port->name, errbuf);
-
-	    close(t->fd);
-	    t->fd = -1;
+	    trace_write_failed(port, t, errno);
 	    return;
 	}
 
@@ -700,51 +1058,71 @@ do_trace(port_info_t *port, trace_info_t *t, const unsigned char *buf,
 }
 
 static void
-hf_out(port_info_t *port, char *buf, int len)
+hf_out_file(port_info_t *port, trace_info_t *t, net_info_t *netcon,
+	    const char *msg, int len)
+{
+    char buf[1100];
+    trace_info_t tr = { 1, 1, NULL, -1 };
+    int pos;
+
+    if (t->pcapng) {
+	/* Events are an empty packet with the message as a comment. */
+	if (t->fd != -1)
+	    pcapng_write_epb(t->fd, trace_pcapng_ifidx(port, netcon),
+			     pcapng_now(&t->clk), PCAPNG_DIR_NONE,
+			     NULL, 0, msg, len);
+	return;
+    }
+
+    if (!t->timestamp)
+	return;
+    pos = timestamp(&tr, buf, sizeof(buf));
+    pos += snprintf(buf + pos, sizeof(buf) - pos, "%.*s\n", len, msg);
+    write_ignore_fail(t->fd, buf, pos);
+}
+
+static void
+hf_out(port_info_t *port, net_info_t *netcon, const char *msg, int len)
 {
-    if (port->tr && port->tr->timestamp)
-        write_ignore_fail(port->tr->fd, buf, len);
+    if (len >= 1024)
+	len = 1023;
+
+    if (port->tr)
+	hf_out_file(port, port->tr, netcon, msg, len);
 
     /* don't output to write file if it's the same as read file */
-    if (port->tw && port->tw != port->tr && port->tw->timestamp)
-        write_ignore_fail(port->tw->fd, buf, len);
+    if (port->tw && port->tw != port->tr)
+	hf_out_file(port, port->tw, netcon, msg, len);
 
     /* don't output to both file if it's the same as read or write file */
-    if (port->tb && port->tb != port->tr && port->tb != port->tw
-		&& port->tb->timestamp)
-        write_ignore_fail(port->tb->fd, buf, len);
+    if (port->tb && port->tb != port->tr && port->tb != port->tw)
+	hf_out_file(port, port->tb, netcon, msg, len);
 }
 
 static void
 header_trace(port_info_t *port, net_info_t *netcon)
 {
     char buf[1024];
-    trace_info_t tr = { 1, 1, NULL, -1 };
     gensiods len = 0;
 
-    len += timestamp(&tr, buf, sizeof(buf));
-    if (sizeof(buf) > len)
-	len += snprintf(buf + len, sizeof(buf) - len, "OPEN (");
+    len += snprintf(buf, sizeof(buf), "OPEN (");
     gensio_raddr_to_str(netcon->net, &len, buf, sizeof(buf));
     if (sizeof(buf) > len)
-	len += snprintf(buf + len, sizeof(buf) - len, ")\n");
+	len += snprintf(buf + len, sizeof(buf) - len, ")");
 
-    hf_out(port, buf, len);
+    hf_out(port, netcon, buf, len);
 }
 
 static void
-footer_trace(port_info_t *port, char *type, const char *reason)
+footer_trace(port_info_t *port, net_info_t *netcon, char *type,
+	     const char *reason)
 {
     char buf[1024];
-    trace_info_t tr = { 1, 1, NULL, -1 };
-    int len = 0;
+    int len;
 
-    len += timestamp(&tr, buf, sizeof(buf));
-    if (sizeof(buf) > len)
-	len += snprintf(buf + len, sizeof(buf) - len,
-			"CLOSE %s (%s)\n", type, reason);
+    len = snprintf(buf, sizeof(buf), "CLOSE %s (%s)", type, reason);
 
-    hf_out(port, buf, len);
+    hf_out(port, netcon, buf, len);
 }
 
 static bool
@@ -761,6 +1139,30 @@ any_net_data_to_write(port_info_t *port)
     return false;
 }
 
+/*
+ * Send the data for the device to a packet connection now.  Returns
+ * true if it all went or the connection was shut down, false if it
+ * has to wait for the connection to be writable.
+ */
+static bool
+net_send_now(port_info_t *port, net_info_t *netcon)
+{
+    int rv;
+
+    rv = net_fd_write(port, netcon, &port->dev_to_net, &netcon->write_pos);
+    if (rv < 0)
+	return true;
+    if (rv == 0)
+	return false;
+
+    reset_timer(netcon);
+    if (netcon->close_on_output_done) {
+	netcon->close_on_output_done = false;
+	shutdown_one_netcon(netcon, "port closing");
+    }
+    return true;
+}
+
 static void
 start_net_send(port_info_t *port)
 {
@@ -769,14 +1171,24 @@ start_net_send(port_info_t *port)
     if (port->dev_to_net_state == PORT_WAITING_OUTPUT_CLEAR)
 	return;
 
+    S2N_PROBE2(start_net_send, port->name, port->dev_to_net.cursize);
     gensio_set_read_callback_enable(port->io, false);
+    port_set_state(port, dev_to_net_state, PORT_WAITING_OUTPUT_CLEAR);
     for_each_connection(port, netcon) {
 	if (!netcon->net)
 	    continue;
 	netcon->write_pos = 0;
+	/*
+	 * With udp-batch, don't go back through the select loop for
+	 * every remote, a datagram write doesn't block.
+	 */
+	if (port->udp_batch && !netcon->banner &&
+		gensio_is_packet(netcon->net) && net_send_now(port, netcon))
+	    continue;
 	gensio_set_write_callback_enable(netcon->net, true);
     }
-    port->dev_to_net_state = PORT_WAITING_OUTPUT_CLEAR;
+    if (port->udp_batch)
+	finish_dev_to_net_write(port);
 }
 
 void
@@ -792,6 +1204,7 @@ send_timeout(struct gensio_timer *timer, void *data)
     }
 
     port->send_timer_running = false;
+    S2N_PROBE2(send_timeout, port->name, port->dev_to_net.cursize);
     if (port->dev_to_net.cursize)
 	start_net_send(port);
     so->unlock(port->lock);
@@ -819,6 +1232,69 @@ enable_all_net_read(port_info_t *port)
     }
 }
 
+static time_t
+monotonic_secs(void)
+{
+    struct timeval now;
+
+    so->get_monotonic_time(so, &now);
+    return now.tv_sec;
+}
+
+/*
+ * A connect back dial failed, wait longer before the next one.  Half
+ * the delay is random so ports that lost the same collector don't all
+ * redial it at once.
+ */
+static void
+connect_back_failed(port_info_t *port, net_info_t *netcon)
+{
+    unsigned int delay;
+
+    if (netcon->cb_backoff == 0)
+	netcon->cb_backoff = 1;
+    else
+	netcon->cb_backoff *= 2;
+    if (netcon->cb_backoff > port->connback_retry_max)
+	netcon->cb_backoff = port->connback_retry_max;
+
+    delay = netcon->cb_backoff / 2;
+    delay += rand() % (netcon->cb_backoff - delay + 1);
+    if (delay == 0)
+	delay = 1;
+    netcon->cb_retry_time = monotonic_secs() + delay;
+}
+
+/* Seconds until the first connect back can be dialed again. */
+static unsigned int
+connect_back_wait(port_info_t *port)
+{
+    net_info_t *netcon;
+    time_t now = monotonic_secs(), first = 0;
+
+    for_each_connection(port, netcon) {
+	if (netcon->connect_back && !netcon->net &&
+		(first == 0 || netcon->cb_retry_time < first))
+	    first = netcon->cb_retry_time;
+    }
+    if (first <= now)
+	return 1;
+    return first - now;
+}
+
+/* Is a connect back up, not just being dialed? */
+static bool
+connect_back_connected(port_info_t *port)
+{
+    net_info_t *netcon;
+
+    for_each_connection(port, netcon) {
+	if (netcon->net && !netcon->cb_dialing)
+	    return true;
+    }
+    return false;
+}
+
 static void
 connect_back_done(struct gensio *net, int err, void *cb_data)
 {
@@ -826,37 +1302,56 @@ connect_back_done(struct gensio *net, int err, void *cb_data)
     port_info_t *port = netcon->port;
 
     so->lock(port->lock);
+    netcon->cb_dialing = false;
     if (err) {
 	netcon->net = NULL;
 	gensio_free(net);
+	connect_back_failed(port, netcon);
     } else {
+	netcon->cb_backoff = 0;
 	setup_port(port, netcon);
     }
     assert(port->num_waiting_connect_backs > 0);
     port->num_waiting_connect_backs--;
     if (port->num_waiting_connect_backs == 0) {
-	if (num_connected_net(port) == 0)
-	    /* No connections could be made. */
-	    port->nocon_read_enable_time_left = 10;
-	else
+	if (num_connected_net(port) == 0) {
+	    /*
+	     * No connections could be made.  If there is a backlog
+	     * the device keeps being read into it, otherwise hold
+	     * the device off until a redial is due.
+	     */
+	    if (!port->dev_backlog.maxsize)
+		port->nocon_read_enable_time_left = connect_back_wait(port);
+	} else {
 	    gensio_set_read_callback_enable(port->io, true);
+	}
     }
     so->unlock(port->lock);
 }
 
+/*
+ * Dial the connect back addresses that aren't connected and aren't
+ * waiting out a backoff, all at once.  Returns the number of dials in
+ * progress.
+ */
 static int
 port_check_connect_backs(port_info_t *port)
 {
     net_info_t *netcon;
     bool tried = false;
+    time_t now;
 
     if (!port->has_connect_back)
 	return 0;
 
+    now = monotonic_secs();
     for_each_connection(port, netcon) {
 	if (netcon->connect_back && !netcon->net) {
 	    int err;
 
+	    if (netcon->cb_retry_time > now)
+		continue;
+
 	    tried = true;
 	    err = gensio_acc_str_to_gensio(port->accepter, netcon->remote_str,
 					   handle_net_event, netcon,
@@ -865,6 +1360,7 @@ port_check_connect_backs(port_info_t *port)
 		syslog(LOG_ERR, "Unable to allocate connect back port %s,"
 		       " addr %s: %s\n", port->name, netcon->remote_str,
 		       gensio_err_to_str(err));
+		connect_back_failed(port, netcon);
 		continue;
 	    }
 	    err = gensio_open(netcon->net, connect_back_done, netcon);
@@ -874,18 +1370,26 @@ port_check_connect_backs(port_info_t *port)
 		syslog(LOG_ERR, "Unable to open connect back port %s,"
 		       " addr %s: %s\n", port->name, netcon->remote_str,
 		       gensio_err_to_str(err));
+		connect_back_failed(port, netcon);
 		continue;
 	    }
+	    netcon->cb_dialing = true;
 	    port->num_waiting_connect_backs++;
 	}
     }
 
-    if (tried && !port->num_waiting_connect_backs && !num_connected_net(port)) {
+    if (connect_back_connected(port) || port->dev_backlog.maxsize) {
+	/*
+	 * Device data keeps going to the connections that are up,
+	 * or into the backlog, while dialing.
+	 */
+    } else if (tried && !port->num_waiting_connect_backs) {
 	/*
 	 * This is kind of a bad situation.  We got some data, attempted
-	 * connects, but failed.  Shut down the read enable for a while.
+	 * connects, but failed.  Shut down the read enable until a
+	 * redial is due.
 	 */
-	port->nocon_read_enable_time_left = 10;
+	port->nocon_read_enable_time_left = connect_back_wait(port);
 	gensio_set_read_callback_enable(port->io, false);
     } else if (port->num_waiting_connect_backs) {
 	gensio_set_read_callback_enable(port->io, false);
@@ -894,88 +1398,364 @@ port_check_connect_backs(port_info_t *port)
     return port->num_waiting_connect_backs;
 }
 
-/* Data is ready to read on the serial port. */
-static int
-handle_dev_read(port_info_t *port, int err, unsigned char *buf,
-		gensiods buflen)
+/* Count a device error and post an event for it. */
+static void
+port_dev_error(port_info_t *port, const char *op, int err)
 {
-    gensiods count = 0;
-    bool send_now = false;
-    int nr_handlers = 0;
+    STATS_ADD(port->stats, dev_errors, 1);
+    event_post(EVENT_DEVERROR, port->name, "op", op,
+	       "error", gensio_err_to_str(err), NULL);
+}
 
-    so->lock(port->lock);
-    if (port->dev_to_net_state != PORT_WAITING_INPUT)
-	goto out_unlock;
+/*
+ * Publish a change in the port's state or connections to the shared
+ * memory stats and to the rotators it is in.
+ */
+static void
+port_publish_state(port_info_t *port)
+{
+    STATS_SET(port->stats, enabled, port->enabled);
+    STATS_SET(port->stats, state, port->net_to_dev_state);
+    if (port->rot_members)
+	port_rot_update(port);
+}
 
+/*
+ * Data came in from a device that is being kept open with nobody
+ * connected.  Save it in the backlog if there is one, otherwise just
+ * throw it away so the device doesn't back up.
+ */
+static gensiods
+handle_dev_idle_read(port_info_t *port, int err, unsigned char *buf,
+		     gensiods buflen)
+{
     if (err) {
-	if (port->dev_to_net.cursize) {
-	    /* Let the output drain before shutdown. */
-	    count = 0;
-	    send_now = true;
-	    goto do_send;
-	}
-
-	/* Got an error on the read, shut down the port. */
-	syslog(LOG_ERR, "dev read error for device on port %s: %m",
-	       port->name);
-	if (port->has_connect_back)
-	    port->enabled = false;
+	syslog(LOG_ERR, "dev read error for idle device on port %s: %s",
+	       port->name, gensio_err_to_str(err));
+	port_dev_error(port, "read", err);
+	port->dev_idle = false;
+	port_set_state(port, dev_to_net_state, PORT_WAITING_INPUT);
+	port_set_state(port, net_to_dev_state, PORT_WAITING_INPUT);
 	shutdown_port(port, "dev read error");
+	return 0;
     }
 
-    nr_handlers = port_check_connect_backs(port);
-    if (nr_handlers > 0)
-	goto out_unlock;
+    if (port->dev_backlog.maxsize)
+	gbuf_append_keep_newest(&port->dev_backlog, buf, buflen);
+    port->dev_bytes_received += buflen;
+    STATS_ADD(port->stats, dev_bytes_in, buflen);
 
-    if (gbuf_room_left(&port->dev_to_net) < buflen)
-	buflen = gbuf_room_left(&port->dev_to_net);
-    count = buflen;
+    return buflen;
+}
 
-    if (count == 0) {
-	gensio_set_read_callback_enable(port->io, false);
-	goto out_unlock;
-    }
+/*
+ * A step on the data path that needs to see each chunk of data, see
+ * port_select_data_path().  A stage may shorten the chunk, the rest
+ * of it is thrown away.  netcon is NULL for data from the device.
+ */
+struct data_stage {
+    const char *name;
+    void (*handle)(port_info_t *port, net_info_t *netcon,
+		   unsigned char *buf, gensiods *len);
+};
 
-    if (port->closeon) {
-	int i;
+static void
+dev_stage_closeon(port_info_t *port, net_info_t *unused,
+		  unsigned char *buf, gensiods *len)
+{
+    gensiods i;
 
-	for (i = 0; i < count; i++) {
-	    if (buf[i] == port->closeon[port->closeon_pos]) {
-		port->closeon_pos++;
-		if (port->closeon_pos >= port->closeon_len) {
-		    net_info_t *netcon;
+    for (i = 0; i < *len; i++) {
+	if (buf[i] == port->sh->closeon[port->closeon_pos]) {
+	    port->closeon_pos++;
+	    if (port->closeon_pos >= port->sh->closeon_len) {
+		net_info_t *netcon;
 
-		    for_each_connection(port, netcon)
-			netcon->close_on_output_done = true;
-		    /* Ignore everything after the closeon string */
-		    count = i + 1;
-		    break;
-		}
-	    } else {
-		port->closeon_pos = 0;
+		for_each_connection(port, netcon)
+		    netcon->close_on_output_done = true;
+		/* Ignore everything after the closeon string */
+		*len = i + 1;
+		break;
 	    }
+	} else {
+	    port->closeon_pos = 0;
 	}
     }
+}
 
+static void
+dev_stage_trace(port_info_t *port, net_info_t *unused,
+		unsigned char *buf, gensiods *len)
+{
     if (port->tr)
 	/* Do read tracing, ignore errors. */
-	do_trace(port, port->tr, buf, count, SERIAL);
+	do_trace(port, NULL, port->tr, buf, *len, SERIAL);
     if (port->tb)
 	/* Do both tracing, ignore errors. */
-	do_trace(port, port->tb, buf, count, SERIAL);
+	do_trace(port, NULL, port->tb, buf, *len, SERIAL);
+}
 
-    if (port->led_rx)
-	led_flash(port->led_rx);
+static void
+dev_stage_led(port_info_t *port, net_info_t *unused,
+	      unsigned char *buf, gensiods *len)
+{
+    led_flash(port->sh->led_rx);
+}
 
-    if (port->dev_monitor != NULL)
-	controller_write(port->dev_monitor, (char *) buf, count);
+static void
+dev_stage_tap(port_info_t *port, net_info_t *unused,
+	      unsigned char *buf, gensiods *len)
+{
+    tap_data(port->taps, TAP_DIR_DEV, buf, *len);
+}
 
- do_send:
-    if (nr_handlers < 0) /* Nobody to handle the data. */
-	goto out_unlock;
+static void
+net_stage_tap(port_info_t *port, net_info_t *netcon,
+	      unsigned char *buf, gensiods *len)
+{
+    tap_data(port->taps, TAP_DIR_NET, buf, *len);
+}
 
-    gbuf_append(&port->dev_to_net, buf, count);
-    port->dev_bytes_received += count;
+static void
+net_stage_trace(port_info_t *port, net_info_t *netcon,
+		unsigned char *buf, gensiods *len)
+{
+    if (port->tw)
+	/* Do write tracing, ignore errors. */
+	do_trace(port, netcon, port->tw, buf, *len, NET);
+    if (port->tb)
+	/* Do both tracing, ignore errors. */
+	do_trace(port, netcon, port->tb, buf, *len, NET);
+}
+
+static const struct data_stage stage_dev_closeon = { "closeon",
+						     dev_stage_closeon };
+static const struct data_stage stage_dev_trace = { "trace", dev_stage_trace };
+static const struct data_stage stage_dev_led = { "led", dev_stage_led };
+static const struct data_stage stage_dev_tap = { "tap", dev_stage_tap };
+static const struct data_stage stage_net_tap = { "tap", net_stage_tap };
+static const struct data_stage stage_net_trace = { "trace", net_stage_trace };
+
+static void
+run_data_stages(port_info_t *port, net_info_t *netcon,
+		const struct data_stage *const *stages, unsigned int num,
+		unsigned char *buf, gensiods *len)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++)
+	stages[i]->handle(port, netcon, buf, len);
+}
+
+static int handle_dev_read(port_info_t *port, int err, unsigned char *buf,
+			   gensiods buflen);
+static int handle_dev_read_minimal(port_info_t *port, int err,
+				   unsigned char *buf, gensiods buflen);
+static gensiods handle_net_fd_read(net_info_t *netcon, struct gensio *net,
+				   int readerr, unsigned char *buf,
+				   gensiods buflen);
+static gensiods handle_net_fd_read_minimal(net_info_t *netcon,
+					   struct gensio *net, int readerr,
+					   unsigned char *buf,
+					   gensiods buflen);
+
+/*
+ * Choose the read handlers and stages for what the port is doing
+ * now.  This must be called with the port locked whenever tracing,
+ * the taps, or chardelay change.  The other features it looks at are
+ * fixed by the configuration.
+ */
+static void
+port_select_data_path(port_info_t *port)
+{
+    port->num_dev_stages = 0;
+    if (port->sh->closeon)
+	port->dev_stages[port->num_dev_stages++] = &stage_dev_closeon;
+    if (port->tr || port->tb)
+	port->dev_stages[port->num_dev_stages++] = &stage_dev_trace;
+    if (port->sh->led_rx)
+	port->dev_stages[port->num_dev_stages++] = &stage_dev_led;
+    if (port->taps)
+	port->dev_stages[port->num_dev_stages++] = &stage_dev_tap;
+
+    port->num_net_stages = 0;
+    if (port->taps)
+	port->net_stages[port->num_net_stages++] = &stage_net_tap;
+    if (port->tw || port->tb)
+	port->net_stages[port->num_net_stages++] = &stage_net_trace;
+
+    if (port->num_dev_stages == 0 && port->chardelay == 0 &&
+		!port->has_connect_back && !port->relay)
+	port->dev_read_handler = handle_dev_read_minimal;
+    else
+	port->dev_read_handler = handle_dev_read;
+
+    if (port->num_net_stages == 0 && !port->udp_batch && !port->relay)
+	port->net_read_handler = handle_net_fd_read_minimal;
+    else
+	port->net_read_handler = handle_net_fd_read;
+}
+
+/* Print the stages as a list, or "minimal" if there are none. */
+static void
+data_stages_str(char *str, size_t len, const struct data_stage *const *stages,
+		unsigned int num, bool minimal)
+{
+    unsigned int i;
+    size_t pos = 0;
+
+    str[0] = '\0';
+    if (minimal) {
+	snprintf(str, len, "minimal");
+	return;
+    }
+    for (i = 0; i < num && pos < len; i++)
+	pos += snprintf(str + pos, len - pos, "%s%s", i ? "," : "",
+			stages[i]->name);
+    if (num == 0)
+	snprintf(str, len, "none");
+}
+
+/*
+ * With relay set, return the one connection data can be passed
+ * to directly, or NULL if something needs to see the data or there
+ * is not exactly one connection.  This is checked for every chunk,
+ * so a monitor started at run time turns the relay off for the next
+ * one.
+ */
+static net_info_t *
+port_relay_netcon(port_info_t *port)
+{
+    net_info_t *netcon, *found = NULL;
+
+    if (port->tr || port->tw || port->tb || port->taps || port->devstr ||
+		port->sh->closeon || port->sh->led_rx || port->sh->led_tx ||
+		port->has_connect_back)
+	return NULL;
+
+    for_each_connection(port, netcon) {
+	if (!netcon->net)
+	    continue;
+	if (found || netcon->banner || netcon->close_on_output_done)
+	    return NULL;
+	found = netcon;
+    }
+    return found;
+}
+
+/*
+ * Write device data to the network from the device's read buffer.
+ * Anything the network doesn't take is copied to dev_to_net and sent
+ * the normal way.  Returns the number of bytes used.
+ */
+static gensiods
+relay_dev_to_net(port_info_t *port, net_info_t *netcon,
+		 unsigned char *buf, gensiods buflen)
+{
+    struct gbuf tmp;
+    gensiods pos = 0, left;
+    int rv;
+
+    tmp.buf = buf;
+    tmp.maxsize = buflen;
+    tmp.cursize = buflen;
+    tmp.pos = 0;
+    rv = net_fd_write(port, netcon, &tmp, &pos);
+    if (rv == 0) {
+	left = buflen - pos;
+	if (left > gbuf_room_left(&port->dev_to_net))
+	    left = gbuf_room_left(&port->dev_to_net);
+	gbuf_append(&port->dev_to_net, buf + pos, left);
+	STATS_SET(port->stats, dev_to_net_queue, port->dev_to_net.cursize);
+	buflen = pos + left;
+	/* dev_to_net only holds what is left, so it starts at zero. */
+	start_net_send(port);
+    } else if (rv > 0) {
+	reset_timer(netcon);
+    }
+    /* If rv < 0 the connection is gone and so is the data. */
+
+    port->dev_bytes_received += buflen;
+    port->relay_bytes += buflen;
+    STATS_ADD(port->stats, dev_bytes_in, buflen);
+    return buflen;
+}
+
+/* Data is ready to read on the serial port. */
+static int
+handle_dev_read(port_info_t *port, int err, unsigned char *buf,
+		gensiods buflen)
+{
+    gensiods count = 0;
+    bool send_now = false;
+    int nr_handlers = 0;
+
+    so->lock(port->lock);
+    if (port->dev_idle) {
+	count = handle_dev_idle_read(port, err, buf, buflen);
+	goto out_unlock;
+    }
+
+    if (port->dev_to_net_state != PORT_WAITING_INPUT)
+	goto out_unlock;
+
+    if (err) {
+	if (port->dev_to_net.cursize) {
+	    /* Let the output drain before shutdown. */
+	    count = 0;
+	    send_now = true;
+	    goto do_send;
+	}
+
+	/* Got an error on the read, shut down the port. */
+	syslog(LOG_ERR, "dev read error for device on port %s: %m",
+	       port->name);
+	port_dev_error(port, "read", err);
+	if (port->has_connect_back)
+	    port->enabled = false;
+	shutdown_port(port, "dev read error");
+    }
+
+    nr_handlers = port_check_connect_backs(port);
+    if (port->has_connect_back && !connect_back_connected(port)) {
+	if (port->dev_backlog.maxsize) {
+	    /* Save it for the first connect back that comes up. */
+	    count = handle_dev_idle_read(port, 0, buf, buflen);
+	    goto out_unlock;
+	}
+	if (nr_handlers > 0)
+	    goto out_unlock;
+    }
+
+    if (port->relay && !err && !port->dev_to_net.cursize) {
+	net_info_t *netcon = port_relay_netcon(port);
+
+	if (netcon) {
+	    count = relay_dev_to_net(port, netcon, buf, buflen);
+	    goto out_unlock;
+	}
+    }
+
+    if (gbuf_room_left(&port->dev_to_net) < buflen)
+	buflen = gbuf_room_left(&port->dev_to_net);
+    count = buflen;
+
+    if (count == 0) {
+	gensio_set_read_callback_enable(port->io, false);
+	goto out_unlock;
+    }
+
+    run_data_stages(port, NULL, port->dev_stages, port->num_dev_stages,
+		    buf, &count);
+
+ do_send:
+    if (nr_handlers < 0) /* Nobody to handle the data. */
+	goto out_unlock;
+
+    gbuf_append(&port->dev_to_net, buf, count);
+    port->dev_bytes_received += count;
+    STATS_ADD(port->stats, dev_bytes_in, count);
+    STATS_SET(port->stats, dev_to_net_queue, port->dev_to_net.cursize);
 
     if (send_now || gbuf_room_left(&port->dev_to_net) == 0 ||
 		port->chardelay == 0) {
@@ -1008,6 +1788,43 @@ handle_dev_read(port_info_t *port, int err, unsigned char *buf,
     return count;
 }
 
+/*
+ * The device read handler for a port with no stages, chardelay,
+ * connect backs, or relay.  It just queues what fits and sends it.
+ * Anything out of the ordinary goes to handle_dev_read().
+ */
+static int
+handle_dev_read_minimal(port_info_t *port, int err, unsigned char *buf,
+			gensiods buflen)
+{
+    gensiods count;
+
+    so->lock(port->lock);
+    if (err || port->dev_idle || port->dev_to_net_state != PORT_WAITING_INPUT ||
+		port->dev_read_handler != handle_dev_read_minimal) {
+	so->unlock(port->lock);
+	return handle_dev_read(port, err, buf, buflen);
+    }
+
+    count = gbuf_room_left(&port->dev_to_net);
+    if (count > buflen)
+	count = buflen;
+    if (count == 0) {
+	gensio_set_read_callback_enable(port->io, false);
+	goto out_unlock;
+    }
+
+    gbuf_append(&port->dev_to_net, buf, count);
+    port->dev_bytes_received += count;
+    STATS_ADD(port->stats, dev_bytes_in, count);
+    STATS_SET(port->stats, dev_to_net_queue, port->dev_to_net.cursize);
+    start_net_send(port);
+
+ out_unlock:
+    so->unlock(port->lock);
+    return count;
+}
+
 static void
 handle_dev_write_ready(port_info_t *port)
 {
@@ -1016,13 +1833,133 @@ handle_dev_write_ready(port_info_t *port)
     so->unlock(port->lock);
 }
 
+/* Post a modemstate or linestate change, the value is shown in hex. */
+static void
+port_state_event(port_info_t *port, enum event_type type, unsigned int val)
+{
+    char str[16];
+
+    snprintf(str, sizeof(str), "0x%02x", val);
+    event_post(type, port->name, "value", str, NULL);
+}
+
+/* Report a modemstate to every connection that asked for it. */
+static void
+port_send_modemstate(port_info_t *port, unsigned char modemstate)
+{
+    net_info_t *netcon;
+
+    port_state_event(port, EVENT_MODEMSTATE, modemstate);
+    for_each_connection(port, netcon) {
+	struct sergensio *sio;
+
+	if (!netcon->net)
+	    continue;
+	sio = gensio_to_sergensio(netcon->net);
+	if (!sio)
+	    continue;
+
+	/*
+	 * The 0xf below is non-standard, but the spec makes no
+	 * sense in this case.  From what I can tell, the
+	 * modemstate top 4 bits is the settings, and the bottom 4
+	 * bits is telling you what changed.  So you don't want to
+	 * report a value unless something changed, and only if it
+	 * was in the modemstate mask.
+	 */
+	if (modemstate & netcon->modemstate_mask & 0xf)
+	    sergensio_modemstate(sio, modemstate & netcon->modemstate_mask);
+    }
+}
+
+static void
+port_send_linestate(port_info_t *port, unsigned char linestate)
+{
+    net_info_t *netcon;
+
+    port_state_event(port, EVENT_LINESTATE, linestate);
+    for_each_connection(port, netcon) {
+	struct sergensio *sio;
+
+	if (!netcon->net)
+	    continue;
+	sio = gensio_to_sergensio(netcon->net);
+	if (!sio)
+	    continue;
+
+	if (linestate & netcon->linestate_mask)
+	    sergensio_linestate(sio, linestate & netcon->linestate_mask);
+    }
+}
+
+/* Must be called with port->lock held. */
+static void
+port_start_state_timer(port_info_t *port)
+{
+    struct timeval timeout;
+
+    if (!port->state_coalesce)
+	return;
+    timeout.tv_sec = port->state_coalesce / 1000;
+    timeout.tv_usec = (port->state_coalesce % 1000) * 1000;
+    so->start_timer(port->state_timer, &timeout);
+    port->state_timer_running = true;
+}
+
+/*
+ * The coalesce window is over, send what came in during it.  If
+ * something was sent, start another window so a line that keeps
+ * changing is reported at most once per window.
+ */
+static void
+state_timeout(struct gensio_timer *timer, void *data)
+{
+    port_info_t *port = data;
+    bool sent = false;
+
+    so->lock(port->lock);
+    if (!port->state_timer_running)
+	goto out_unlock;
+    port->state_timer_running = false;
+    if (port->modemstate_pending) {
+	port_send_modemstate(port, ((port->last_modemstate & 0xf0) |
+				    port->pend_modemstate));
+	port->modemstate_pending = false;
+	port->pend_modemstate = 0;
+	sent = true;
+    }
+    if (port->linestate_pending) {
+	port_send_linestate(port, port->last_linestate | port->pend_linestate);
+	port->linestate_pending = false;
+	port->pend_linestate = 0;
+	sent = true;
+    }
+    if (sent)
+	port_start_state_timer(port);
+ out_unlock:
+    so->unlock(port->lock);
+}
+
+/* Throw away pending reports, the connections they were for are gone. */
+static void
+port_stop_state_timer(port_info_t *port)
+{
+    if (port->state_timer_running) {
+	so->stop_timer(port->state_timer);
+	port->state_timer_running = false;
+    }
+    port->modemstate_pending = false;
+    port->linestate_pending = false;
+    port->pend_modemstate = 0;
+    port->pend_linestate = 0;
+}
+
 static int
 handle_dev_event(struct gensio *io, void *user_data, int event, int err,
 		 unsigned char *buf, gensiods *buflen,
 		 const char *const *auxdata)
 {
     port_info_t *port = user_data;
-    net_info_t *netcon;
     gensiods len = 0;
 
     if (buflen)
@@ -1033,7 +1970,8 @@ handle_dev_event(struct gensio *io, void *user_data, int event, int err,
 	if (gensio_str_in_auxdata(auxdata, "oob"))
 	    /* Ignore out of bound data. */
 	    return 0;
-	len = handle_dev_read(port, err, buf, len);
+	S2N_PROBE3(dev_read, port->name, len, err);
+	len = port->dev_read_handler(port, err, buf, len);
 	if (buflen)
 	    *buflen = len;
 	return 0;
@@ -1045,26 +1983,16 @@ handle_dev_event(struct gensio *io, void *user_data, int event, int err,
     case GENSIO_EVENT_SER_MODEMSTATE:
 	so->lock(port->lock);
 	port->last_modemstate = *((unsigned int *) buf);
-	for_each_connection(port, netcon) {
-	    struct sergensio *sio;
-
-	    if (!netcon->net)
-		continue;
-	    sio = gensio_to_sergensio(netcon->net);
-	    if (!sio)
-		continue;
-
-	    /*
-	     * The 0xf below is non-standard, but the spec makes no
-	     * sense in this case.  From what I can tell, the
-	     * modemstate top 4 bits is the settings, and the bottom 4
-	     * bits is telling you what changed.  So you don't want to
-	     * report a value unless something changed, and only if it
-	     * was in the modemstate mask.
-	     */
-	    if (port->last_modemstate & netcon->modemstate_mask & 0xf)
-		sergensio_modemstate(sio, (port->last_modemstate &
-					   netcon->modemstate_mask));
+	if (port->state_timer_running) {
+	    if (port->modemstate_pending) {
+		port->modemstate_suppressed++;
+		STATS_ADD(port->stats, modemstate_suppressed, 1);
+	    }
+	    port->modemstate_pending = true;
+	    port->pend_modemstate |= port->last_modemstate & 0xf;
+	} else {
+	    port_send_modemstate(port, port->last_modemstate);
+	    port_start_state_timer(port);
 	}
 	so->unlock(port->lock);
 	return 0;
@@ -1072,18 +2000,16 @@ handle_dev_event(struct gensio *io, void *user_data, int event, int err,
     case GENSIO_EVENT_SER_LINESTATE:
 	so->lock(port->lock);
 	port->last_linestate = *((unsigned int *) buf);
-	for_each_connection(port, netcon) {
-	    struct sergensio *sio;
-
-	    if (!netcon->net)
-		continue;
-	    sio = gensio_to_sergensio(netcon->net);
-	    if (!sio)
-		continue;
-
-	    if (port->last_linestate & netcon->linestate_mask)
-		sergensio_linestate(sio, (port->last_linestate &
-					  netcon->linestate_mask));
+	if (port->state_timer_running) {
+	    if (port->linestate_pending) {
+		port->linestate_suppressed++;
+		STATS_ADD(port->stats, linestate_suppressed, 1);
+	    }
+	    port->linestate_pending = true;
+	    port->pend_linestate |= port->last_linestate;
+	} else {
+	    port_send_linestate(port, port->last_linestate);
+	    port_start_state_timer(port);
 	}
 	so->unlock(port->lock);
 	return 0;
@@ -1106,10 +2032,14 @@ gbuf_write(port_info_t *port, struct gbuf *buf)
 
     buf->pos += written;
     port->dev_bytes_sent += written;
+    STATS_ADD(port->stats, dev_bytes_out, written);
+    S2N_PROBE3(dev_write, port->name, written, buf->cursize - buf->pos);
     if (buf->pos >= buf->cursize) {
 	buf->pos = 0;
 	buf->cursize = 0;
     }
+    if (buf == &port->net_to_dev)
+	STATS_SET(port->stats, net_to_dev_queue, buf->cursize - buf->pos);
 
     return 0;
 }
@@ -1126,6 +2056,7 @@ dev_fd_write(port_info_t *port, struct gbuf *buf)
     if (err) {
 	syslog(LOG_ERR, "The dev write for port %s had error: %s",
 	       port->name, gensio_err_to_str(err));
+	port_dev_error(port, "write", err);
 	if (port->has_connect_back)
 	    port->enabled = false;
 	shutdown_port(port, "dev write error");
@@ -1136,7 +2067,8 @@ dev_fd_write(port_info_t *port, struct gbuf *buf)
 	/* We are done writing, turn the reader back on. */
 	enable_all_net_read(port);
 	gensio_set_write_callback_enable(port->io, false);
-	port->net_to_dev_state = PORT_WAITING_INPUT;
+	if (!port->dev_idle)
+	    port_set_state(port, net_to_dev_state, PORT_WAITING_INPUT);
     }
 }
 
@@ -1153,8 +2085,7 @@ handle_dev_fd_devstr_write(port_info_t *port)
     dev_fd_write(port, port->devstr);
     if (gbuf_cursize(port->devstr) == 0) {
 	port->dev_write_handler = handle_dev_fd_normal_write;
-	free(port->devstr->buf);
-	free(port->devstr);
+	gbuf_free_alloced(port->devstr);
 	port->devstr = NULL;
 
 	/* Send out any data we got on the TCP port. */
@@ -1162,82 +2093,198 @@ handle_dev_fd_devstr_write(port_info_t *port)
     }
 }
 
-/* Data is ready to read on the network port. */
-static gensiods
-handle_net_fd_read(net_info_t *netcon, struct gensio *net, int readerr,
-		   unsigned char *buf, gensiods buflen)
+/* Stop reading from the network until net_to_dev is written. */
+static void
+net_to_dev_wait(port_info_t *port)
+{
+    disable_all_net_read(port);
+    gensio_set_write_callback_enable(port->io, true);
+    port_set_state(port, net_to_dev_state, PORT_WAITING_OUTPUT_CLEAR);
+}
+
+/* Write what the device will take.  Returns false if the port was shut
+   down. */
+static bool
+net_to_dev_write(port_info_t *port, struct gbuf *buf)
 {
-    port_info_t *port = netcon->port;
-    gensiods rv = 0;
-    char *reason;
     int err;
 
-    so->lock(port->lock);
-    if (port->net_to_dev_state == PORT_WAITING_OUTPUT_CLEAR)
-	/* Catch a race here. */
-	goto out_unlock;
+    err = gbuf_write(port, buf);
+    if (err) {
+	syslog(LOG_ERR, "The dev write for port %s had error: %s",
+	       port->name, gensio_err_to_str(err));
+	port_dev_error(port, "write", err);
+	shutdown_port(port, "dev write error");
+	return false;
+    }
+    if (port->sh->led_tx)
+	led_flash(port->sh->led_tx);
+    return true;
+}
 
-    if (readerr) {
-	if (readerr == GE_REMCLOSE) {
-	    reason = "network read close";
-	} else {
-	    /* Got an error on the read, shut down the port. */
-	    syslog(LOG_ERR, "read error for port %s: %s", port->name,
-		   gensio_err_to_str(readerr));
-	    reason = "network read error";
-	}
-	goto out_shutdown;
+/*
+ * Write net_to_dev to the device.  If it doesn't all go, stop reading
+ * from the network until it does.  Returns false if the port was shut
+ * down.
+ */
+static bool
+net_to_dev_flush(port_info_t *port)
+{
+    /*
+     * Don't write anything to the device until devstr is written.
+     * This can happen on UDP ports, we get the first packet before
+     * the port is enabled, so there will be data in the output buffer
+     * but there will also possibly be devstr data.  We want the
+     * devstr data to go out first.
+     */
+    if (port->devstr) {
+	net_to_dev_wait(port);
+	return true;
     }
 
-    if (buflen > port->net_to_dev.maxsize)
-	buflen = port->net_to_dev.maxsize;
+    if (port->udp_batch)
+	port->batch_writes++;
+    if (!net_to_dev_write(port, &port->net_to_dev))
+	return false;
 
-    netcon->bytes_received += buflen;
+    if (gbuf_cursize(&port->net_to_dev))
+	/* We didn't write all the data, shut off the reader and
+	   start the write monitor. */
+	net_to_dev_wait(port);
+    return true;
+}
 
-    if (port->net_monitor != NULL)
-	controller_write(port->net_monitor, (char *) buf, buflen);
+/*
+ * Write network data to the device from the network's read buffer.
+ * Anything the device doesn't take is copied to net_to_dev and
+ * written the normal way.  Returns false if the port was shut down.
+ */
+static bool
+net_to_dev_relay(port_info_t *port, unsigned char *buf, gensiods buflen)
+{
+    struct gbuf tmp;
+    gensiods left;
+
+    tmp.buf = buf;
+    tmp.maxsize = buflen;
+    tmp.cursize = buflen;
+    tmp.pos = 0;
+    if (!net_to_dev_write(port, &tmp))
+	return false;
+
+    left = gbuf_cursize(&tmp);
+    if (left) {
+	memcpy(port->net_to_dev.buf, tmp.buf + tmp.pos, left);
+	port->net_to_dev.cursize = left;
+	port->net_to_dev.pos = 0;
+	STATS_SET(port->stats, net_to_dev_queue, left);
+	net_to_dev_wait(port);
+    }
+    port->relay_bytes += buflen;
+    return true;
+}
 
-    if (port->tw)
-	/* Do write tracing, ignore errors. */
-	do_trace(port, port->tw, buf, buflen, NET);
-    if (port->tb)
-	/* Do both tracing, ignore errors. */
-	do_trace(port, port->tb, buf, buflen, NET);
+/* The udp-batch time is up, write what has been collected. */
+static void
+batch_timeout(struct gensio_timer *timer, void *data)
+{
+    port_info_t *port = data;
 
-    memcpy(port->net_to_dev.buf, buf, buflen);
-    port->net_to_dev.cursize = buflen;
+    so->lock(port->lock);
+    port->batch_timer_running = false;
+    if (port->net_to_dev_state == PORT_WAITING_INPUT &&
+		gbuf_cursize(&port->net_to_dev))
+	net_to_dev_flush(port);
+    so->unlock(port->lock);
+}
 
-    port->net_to_dev.pos = 0;
+static void
+port_stop_batch_timer(port_info_t *port)
+{
+    if (port->batch_timer_running) {
+	so->stop_timer(port->batch_timer);
+	port->batch_timer_running = false;
+    }
+}
 
+/* Data is ready to read on the network port. */
+static gensiods
+handle_net_fd_read(net_info_t *netcon, struct gensio *net, int readerr,
+		   unsigned char *buf, gensiods buflen)
+{
+    port_info_t *port = netcon->port;
+    gensiods rv = 0;
+    char *reason;
 
-    /*
-     * Don't write anything to the device until devstr is written.
-     * This can happen on UDP ports, we get the first packet before
-     * the port is enabled, so there will be data in the output buffer
-     * but there will also possibly be devstr data.  We want the
-     * devstr data to go out first.
-     */
-    if (port->devstr)
-	goto stop_read_start_write;
+    so->lock(port->lock);
+    if (port->net_to_dev_state == PORT_WAITING_OUTPUT_CLEAR)
+	/* Catch a race here. */
+	goto out_unlock;
 
-    err = gbuf_write(port, &port->net_to_dev);
-    if (err) {
-	syslog(LOG_ERR, "The dev write for port %s had error: %m",
-	       port->name);
-	shutdown_port(port, "dev write error");
+    if (readerr) {
+	if (readerr == GE_REMCLOSE) {
+	    reason = "network read close";
+	} else {
+	    /* Got an error on the read, shut down the port. */
+	    syslog(LOG_ERR, "read error for port %s: %s", port->name,
+		   gensio_err_to_str(readerr));
+	    reason = "network read error";
+	    STATS_ADD(port->stats, net_errors, 1);
+	}
+	goto out_shutdown;
+    }
+
+    if (buflen > port->net_to_dev.maxsize)
+	buflen = port->net_to_dev.maxsize;
+
+    if (gbuf_room_left(&port->net_to_dev) < buflen) {
+	/*
+	 * Batched datagrams are waiting, write them first to keep the
+	 * order.  If they don't all go, this one is taken when
+	 * reading is turned back on.
+	 */
+	port_stop_batch_timer(port);
+	if (!net_to_dev_flush(port) ||
+		port->net_to_dev_state == PORT_WAITING_OUTPUT_CLEAR)
+	    goto out_unlock;
+    }
+
+    netcon->bytes_received += buflen;
+    STATS_ADD(port->stats, net_bytes_in, buflen);
+
+    if (port->relay && !gbuf_cursize(&port->net_to_dev) &&
+		port->net_to_dev_state == PORT_WAITING_INPUT &&
+		port_relay_netcon(port) == netcon) {
+	if (net_to_dev_relay(port, buf, buflen)) {
+	    reset_timer(netcon);
+	    rv = buflen;
+	}
 	goto out_unlock;
-    } else {
-	if (port->led_tx)
-	    led_flash(port->led_tx);
     }
 
-    if (gbuf_cursize(&port->net_to_dev)) {
-	/* We didn't write all the data, shut off the reader and
-	   start the write monitor. */
-    stop_read_start_write:
-	disable_all_net_read(port);
-	gensio_set_write_callback_enable(port->io, true);
-	port->net_to_dev_state = PORT_WAITING_OUTPUT_CLEAR;
+    run_data_stages(port, netcon, port->net_stages, port->num_net_stages,
+		    buf, &buflen);
+
+    /* Batched datagrams may already be here, put it after them. */
+    memcpy(port->net_to_dev.buf + port->net_to_dev.cursize, buf, buflen);
+    port->net_to_dev.cursize += buflen;
+
+    if (port->udp_batch && port->net_to_dev_state == PORT_WAITING_INPUT &&
+		!port->devstr && gensio_is_packet(net)) {
+	/* Whole datagrams only, the device gets them in order. */
+	port->batch_datagrams++;
+	if (!port->batch_timer_running) {
+	    struct timeval timeout;
+
+	    timeout.tv_sec = port->udp_batch / 1000000;
+	    timeout.tv_usec = port->udp_batch % 1000000;
+	    so->start_timer(port->batch_timer, &timeout);
+	    port->batch_timer_running = true;
+	}
+    } else {
+	port_stop_batch_timer(port);
+	if (!net_to_dev_flush(port))
+	    goto out_unlock;
     }
 
     reset_timer(netcon);
@@ -1253,6 +2300,43 @@ handle_net_fd_read(net_info_t *netcon, struct gensio *net, int readerr,
     goto out_unlock;
 }
 
+/*
+ * The network read handler for a port with no stages, udp-batch, or
+ * relay.  Anything out of the ordinary goes to handle_net_fd_read().
+ */
+static gensiods
+handle_net_fd_read_minimal(net_info_t *netcon, struct gensio *net,
+			   int readerr, unsigned char *buf, gensiods buflen)
+{
+    port_info_t *port = netcon->port;
+    gensiods rv = 0;
+
+    so->lock(port->lock);
+    if (readerr || port->net_to_dev_state != PORT_WAITING_INPUT ||
+		gbuf_cursize(&port->net_to_dev) ||
+		port->net_read_handler != handle_net_fd_read_minimal) {
+	so->unlock(port->lock);
+	return handle_net_fd_read(netcon, net, readerr, buf, buflen);
+    }
+
+    if (buflen > port->net_to_dev.maxsize)
+	buflen = port->net_to_dev.maxsize;
+
+    netcon->bytes_received += buflen;
+    STATS_ADD(port->stats, net_bytes_in, buflen);
+
+    memcpy(port->net_to_dev.buf, buf, buflen);
+    port->net_to_dev.cursize = buflen;
+    port->net_to_dev.pos = 0;
+    if (net_to_dev_flush(port)) {
+	reset_timer(netcon);
+	rv = buflen;
+    }
+
+    so->unlock(port->lock);
+    return rv;
+}
+
 /*
  * Write some network data from a buffer.  Returns -1 on something
  * causing the netcon to shut down, 0 if the write was incomplete, and
@@ -1280,15 +2364,21 @@ net_fd_write(port_info_t *port, net_info_t *netcon,
 	/* Some other bad error. */
 	syslog(LOG_ERR, "The network write for port %s had error: %s",
 	       port->name, gensio_err_to_str(reterr));
+	STATS_ADD(port->stats, net_errors, 1);
 	shutdown_one_netcon(netcon, "network write error");
 	return -1;
     }
     *pos += count;
     netcon->bytes_sent += count;
+    STATS_ADD(port->stats, net_bytes_out, count);
 
-    if (*pos < buf->cursize)
+    if (*pos < buf->cursize) {
+	S2N_PROBE4(net_write_short, port->name, netcon_index(netcon), count,
+		   buf->cursize - *pos);
 	return 0;
+    }
 
+    S2N_PROBE3(net_write_done, port->name, netcon_index(netcon), count);
     return 1;
 }
 
@@ -1300,11 +2390,12 @@ finish_dev_to_net_write(port_info_t *port)
 
     port->dev_to_net.cursize = 0;
     port->dev_to_net.pos = 0;
+    STATS_SET(port->stats, dev_to_net_queue, 0);
 
     if (port->net_to_dev_state != PORT_CLOSING) {
 	/* We are done writing on this port, turn the reader back on. */
 	gensio_set_read_callback_enable(port->io, true);
-	port->dev_to_net_state = PORT_WAITING_INPUT;
+	port_set_state(port, dev_to_net_state, PORT_WAITING_INPUT);
     }
 }
 
@@ -1323,8 +2414,7 @@ handle_net_fd_write_ready(net_info_t *netcon, struct gensio *net)
 	if (rv <= 0)
 	    goto out_unlock;
 
-	free(netcon->banner->buf);
-	free(netcon->banner);
+	gbuf_free_alloced(netcon->banner);
 	netcon->banner = NULL;
     }
 
@@ -1572,7 +2662,7 @@ s2n_signature(net_info_t *netcon, struct sergensio *sio, char *sig,
 {
     port_info_t *port = netcon->port;
 
-    sig = port->signaturestr;
+    sig = port->sh->signaturestr;
     if (!sig)
 	sig = rfc2217_signature;
     sig_len = strlen(sig);
@@ -1613,7 +2703,9 @@ handle_net_event(struct gensio *net, void *user_data, int event, int err,
 
     switch (event) {
     case GENSIO_EVENT_READ:
-	len = handle_net_fd_read(netcon, net, err, buf, len);
+	S2N_PROBE4(net_read, netcon->port->name, netcon_index(netcon), len,
+		   err);
+	len = netcon->port->net_read_handler(netcon, net, err, buf, len);
 	if (buflen)
 	    *buflen = len;
 	return 0;
@@ -1711,7 +2803,7 @@ is_device_already_inuse(port_info_t *check_port)
     while (port != NULL) {
 	if (port != check_port) {
 	    if ((strcmp(port->devname, check_port->devname) == 0)
-				&& port_in_use(port)) {
+				&& (port_in_use(port) || port->dev_idle)) {
 		return 1;
 	    }
 	}
@@ -2088,10 +3180,10 @@ process_str_to_str(port_info_t *port, net_info_t *netcon,
 	len++;
     bufop.pos = 0;
     if (len == 0)
-	/* malloc(0) sometimes return NULL */
-	bufop.str = malloc(1);
+	/* Don't allocate 0 bytes, some mallocs return NULL for that. */
+	bufop.str = pool_alloc(1);
     else
-	bufop.str = malloc(len);
+	bufop.str = pool_alloc(len);
     if (!bufop.str) {
 	syslog(LOG_ERR, "Out of memory processing string: %s", port->name);
 	return NULL;
@@ -2118,14 +3210,14 @@ process_str_to_buf(port_info_t *port, net_info_t *netcon, const char *str)
 	return NULL;
     gettimeofday(&tv, NULL);
 
-    buf = malloc(sizeof(*buf));
+    buf = pool_alloc(sizeof(*buf));
     if (!buf) {
 	syslog(LOG_ERR, "Out of memory processing string: %s", port->name);
 	return NULL;
     }
     bstr = process_str_to_str(port, netcon, str, &tv, &len, 0);
     if (!bstr) {
-	free(buf);
+	pool_free(buf);
 	syslog(LOG_ERR, "Error processing string: %s", port->name);
 	return NULL;
     }
@@ -2137,6 +3229,31 @@ process_str_to_buf(port_info_t *port, net_info_t *netcon, const char *str)
     return buf;
 }
 
+/*
+ * Start a pcapng section in a newly opened trace file, with one
+ * interface for the device and one for each network connection.
+ */
+static void
+trace_pcapng_header(port_info_t *port, trace_info_t *t)
+{
+    char name[128];
+    unsigned int i;
+    int rv;
+
+    pcapng_clock_init(&t->clk);
+    rv = pcapng_write_shb(t->fd, "ser2net " VERSION);
+    if (rv == 0) {
+	snprintf(name, sizeof(name), "%s device", port->name);
+	rv = pcapng_write_idb(t->fd, name, &t->clk);
+    }
+    for (i = 0; rv == 0 && i < port->max_connections; i++) {
+	snprintf(name, sizeof(name), "%s net %u", port->name, i);
+	rv = pcapng_write_idb(t->fd, name, &t->clk);
+    }
+    if (rv == -1)
+	trace_write_failed(port, t, errno);
+}
+
 static void
 open_trace_file(port_info_t *port,
                 trace_info_t *t,
@@ -2166,9 +3283,12 @@ open_trace_file(port_info_t *port,
 		   trfile, errbuf);
     }
 
-    free(trfile);
+    pool_free(trfile);
     t->fd = rv;
     *out = t;
+
+    if (rv != -1 && t->pcapng)
+	trace_pcapng_header(port, t);
 }
 
 static void
@@ -2285,6 +3405,131 @@ extract_bps_bpc(port_info_t *port)
     port->bpc = 8;
 }
 
+/* Is the device left open when nobody is connected? */
+static bool
+port_dev_stays_open(port_info_t *port)
+{
+    return port->has_connect_back || port->keep_dev_open;
+}
+
+/*
+ * The last user has gone away from a port with keep-device-open set.
+ * Leave the device open, but throw away anything that was going to
+ * the network and start draining the device.
+ */
+static void
+port_dev_set_idle(port_info_t *port)
+{
+    if (port->send_timer_running) {
+	so->stop_timer(port->send_timer);
+	port->send_timer_running = false;
+    }
+    gbuf_reset(&port->dev_to_net);
+    port->closeon_pos = 0;
+    port->dev_idle = true;
+    port_set_state(port, dev_to_net_state, PORT_UNCONNECTED);
+    port_set_state(port, net_to_dev_state, PORT_UNCONNECTED);
+    gensio_set_read_callback_enable(port->io, true);
+}
+
+/*
+ * Hand anything saved while the device was idle to a new user.  It is
+ * tacked onto the end of the banner so it goes out before any new data
+ * from the device.
+ */
+static void
+port_send_backlog(port_info_t *port, net_info_t *netcon)
+{
+    struct gbuf *buf = netcon->banner;
+    gensiods len = gbuf_cursize(&port->dev_backlog);
+    unsigned char *data;
+
+    if (len == 0)
+	return;
+
+    if (!buf) {
+	buf = pool_zalloc(sizeof(*buf));
+	if (!buf)
+	    goto out_nomem;
+    }
+
+    data = pool_alloc(buf->cursize + len);
+    if (!data) {
+	if (!netcon->banner)
+	    pool_free(buf);
+	goto out_nomem;
+    }
+    if (buf->cursize)
+	memcpy(data, buf->buf, buf->cursize);
+    memcpy(data + buf->cursize, port->dev_backlog.buf, len);
+    pool_free(buf->buf);
+    buf->buf = data;
+    buf->cursize += len;
+    buf->maxsize = buf->cursize;
+    netcon->banner = buf;
+    gbuf_reset(&port->dev_backlog);
+    return;
+
+ out_nomem:
+    syslog(LOG_ERR, "Out of memory sending device backlog on port %s",
+	   port->name);
+}
+
+/*
+ * A user came in on an idle device that was kept open.  The device is
+ * already set up, just get data flowing again.
+ */
+static void
+port_dev_reuse(port_info_t *port, net_info_t *netcon)
+{
+    port->dev_idle = false;
+    port_send_backlog(port, netcon);
+    port_set_state(port, dev_to_net_state, PORT_WAITING_INPUT);
+    port_set_state(port, net_to_dev_state, PORT_WAITING_INPUT);
+    gensio_set_read_callback_enable(port->io, true);
+}
+
+/* Post a connect or disconnect event with the remote address. */
+static void
+netcon_event(net_info_t *netcon, enum event_type type, const char *reason)
+{
+    char raddr[256];
+
+    if (gensio_raddr_to_str(netcon->net, NULL, raddr, sizeof(raddr)))
+	strcpy(raddr, "unknown");
+    event_post(type, netcon->port->name, "remote", raddr,
+	       "reason", reason, NULL);
+}
+
+/*
+ * A connection, accepted or a connect back, is set up on the port.
+ * Each netcon_up() is matched by one netcon_down(), when the
+ * connection starts closing or is dropped because the device could
+ * not be opened.  A connect back that is still dialing is not up.
+ * The events and the connections statistics are kept here so they
+ * always match.
+ */
+static void
+netcon_up(net_info_t *netcon)
+{
+    netcon->up = true;
+    netcon_event(netcon, EVENT_CONNECT, NULL);
+    STATS_ADD(netcon->port->stats, connections, 1);
+    STATS_ADD(netcon->port->stats, total_connections, 1);
+    port_publish_state(netcon->port);
+}
+
+static void
+netcon_down(net_info_t *netcon, const char *reason)
+{
+    if (!netcon->up)
+	return;
+    netcon->up = false;
+    netcon_event(netcon, EVENT_DISCONNECT, reason);
+    STATS_SUB(netcon->port->stats, connections, 1);
+    port_publish_state(netcon->port);
+}
+
 static void
 port_dev_open_done(struct gensio *io, int err, void *cb_data)
 {
@@ -2302,10 +3547,12 @@ port_dev_open_done(struct gensio *io, int err, void *cb_data)
 	    if (!netcon->net)
 		continue;
 	    gensio_write(netcon->net, NULL, errstr, strlen(errstr), NULL);
+	    netcon_down(netcon, "device open failure");
 	    gensio_free(netcon->net);
 	    netcon->net = NULL;
 	}
-	port->dev_to_net_state = PORT_UNCONNECTED;
+	port_set_state(port, dev_to_net_state, PORT_UNCONNECTED);
+	port->io_open = false;
 	goto out_unlock;
     }
 
@@ -2313,10 +3560,9 @@ port_dev_open_done(struct gensio *io, int err, void *cb_data)
     recalc_port_chardelay(port);
 
     if (port->devstr) {
-	free(port->devstr->buf);
-	free(port->devstr);
+	gbuf_free_alloced(port->devstr);
     }
-    port->devstr = process_str_to_buf(port, NULL, port->openstr);
+    port->devstr = process_str_to_buf(port, NULL, port->sh->openstr);
     if (port->devstr)
 	port->dev_write_handler = handle_dev_fd_devstr_write;
     else
@@ -2325,9 +3571,10 @@ port_dev_open_done(struct gensio *io, int err, void *cb_data)
     if (port->devstr)
 	gensio_set_write_callback_enable(port->io, true);
     gensio_set_read_callback_enable(port->io, true);
-    port->dev_to_net_state = PORT_WAITING_INPUT;
+    port_set_state(port, dev_to_net_state, PORT_WAITING_INPUT);
 
     setup_trace(port);
+    port_select_data_path(port);
 
     timeout.tv_sec = 1;
     timeout.tv_usec = 0;
@@ -2338,17 +3585,92 @@ port_dev_open_done(struct gensio *io, int err, void *cb_data)
 	    continue;
 	finish_setup_net(port, netcon);
     }
-    port->net_to_dev_state = PORT_WAITING_INPUT;
+    port_set_state(port, net_to_dev_state, PORT_WAITING_INPUT);
+
+    if (port->connback_persist)
+	/* Don't wait for data to connect. */
+	port_check_connect_backs(port);
+
+    if (port->keep_dev_open && num_connected_net(port) == 0)
+	/* Opened at startup with nobody here yet. */
+	port_dev_set_idle(port);
  out_unlock:
     so->unlock(port->lock);
 }
 
+/*
+ * The connection array and the data buffers are not allocated until
+ * they are needed, most ports sit around unused.  These are called
+ * with the port lock held.
+ */
+static int
+port_alloc_netcons(port_info_t *port)
+{
+    net_info_t *netcon;
+
+    if (port->netcons)
+	return 0;
+
+    port->netcons = pool_zalloc(sizeof(net_info_t) * port->max_connections);
+    if (!port->netcons)
+	return GE_NOMEM;
+    for_each_connection(port, netcon)
+	netcon->port = port;
+    return 0;
+}
+
+static int
+port_alloc_bufs(port_info_t *port)
+{
+    if (!port->dev_to_net.buf &&
+		gbuf_init(&port->dev_to_net, port->dev_to_net.maxsize))
+	return GE_NOMEM;
+    if (!port->net_to_dev.buf &&
+		gbuf_init(&port->net_to_dev, port->net_to_dev.maxsize))
+	return GE_NOMEM;
+    return 0;
+}
+
+/*
+ * Called from the port timer when the port has been idle for
+ * idle_release_time, free the buffers and connections.  Connect back
+ * ports keep their connections, they hold the fixed remote
+ * addresses.
+ */
+static void
+port_release_data(port_info_t *port)
+{
+    net_info_t *netcon;
+
+    if (port->io_open || port_in_use(port))
+	return;
+
+    for_each_connection(port, netcon) {
+	if (netcon->net || netcon->new_net)
+	    return;
+    }
+
+    gbuf_free(&port->dev_to_net);
+    gbuf_free(&port->net_to_dev);
+    if (port->netcons && !port->has_connect_back) {
+	pool_free(port->netcons);
+	port->netcons = NULL;
+    }
+}
+
 static int
 port_dev_enable(port_info_t *port)
 {
     int err;
     char auxdata[2] = "1";
 
+    err = port_alloc_bufs(port);
+    if (err)
+	return err;
+
+    /* Stop any idle release, the timer is used for the open port. */
+    so->stop_timer(port->timer);
+
     err = gensio_open(port->io, port_dev_open_done, port);
     if (err)
 	return err;
@@ -2365,167 +3687,603 @@ port_dev_enable(port_info_t *port)
 
 /* Called when a new user is added to the port. */
 static void
-setup_port(port_info_t *port, net_info_t *netcon)
+setup_port(port_info_t *port, net_info_t *netcon)
+{
+    int err;
+    char auxdata[2] = "1";
+
+    netcon_up(netcon);
+    err = gensio_control(netcon->net, GENSIO_CONTROL_DEPTH_ALL, false,
+			 GENSIO_CONTROL_NODELAY, auxdata, NULL);
+    if (err)
+	syslog(LOG_ERR, "Could not enable NODELAY on socket %s: %m",
+	       port->name);
+
+    if (netcon->banner) {
+	gbuf_free_alloced(netcon->banner);
+    }
+    netcon->banner = process_str_to_buf(port, netcon, port->sh->bannerstr);
+
+    if (num_connected_net(port) == 1 && port->dev_idle) {
+	/* The device was kept open, no need to set it up again. */
+	port_dev_reuse(port, netcon);
+    } else if (num_connected_net(port) == 1 && port->keep_dev_open &&
+	       port->io_open) {
+	/* The startup open is still going, port_dev_open_done() will
+	   finish this up. */
+	return;
+    } else if (num_connected_net(port) == 1 && !port->has_connect_back) {
+	/* We are first, set things up on the device. */
+	err = port_dev_enable(port);
+	if (err) {
+	    char errstr[200];
+
+	    snprintf(errstr, sizeof(errstr), "Device open failure: %s\r\n",
+		     gensio_err_to_str(err));
+	    gensio_write(netcon->net, NULL, errstr, strlen(errstr), NULL);
+	    netcon_down(netcon, "device open failure");
+	    gensio_free(netcon->net);
+	    netcon->net = NULL;
+	}
+	return;
+    }
+
+    if (port->has_connect_back)
+	/* Data saved while the connect backs were down. */
+	port_send_backlog(port, netcon);
+    finish_setup_net(port, netcon);
+}
+
+/*
+ * Can the port take a new connection from the given remote address?
+ * Called with the port locked.
+ */
+static bool
+rot_port_usable(port_info_t *port, struct sockaddr *addr, gensiods socklen,
+		unsigned int *netconnum)
+{
+    unsigned int i;
+
+    if (!port->enabled)
+	return false;
+    if (port->dev_to_net_state == PORT_CLOSING)
+	return false;
+    if (!remaddr_check(port->sh, addr, socklen))
+	return false;
+    if (port->net_to_dev_state == PORT_UNCONNECTED &&
+		is_device_already_inuse(port))
+	return false;
+    if (port_alloc_netcons(port))
+	return false;
+
+    for (i = 0; i < port->max_connections; i++) {
+	if (!port->netcons[i].net) {
+	    *netconnum = i;
+	    return true;
+	}
+    }
+    return false;
+}
+
+static void
+handle_new_net(port_info_t *port, struct gensio *net, net_info_t *netcon)
+{
+    netcon->net = net;
+
+    S2N_PROBE2(net_accept, port->name, netcon_index(netcon));
+    setup_port(port, netcon);
+    port_publish_state(port);
+}
+
+int gensio_log_level_to_syslog(int gloglevel)
+{
+    switch (gloglevel) {
+    case GENSIO_LOG_FATAL:
+	return LOG_EMERG;
+    case GENSIO_LOG_ERR:
+	return LOG_ERR;
+    case GENSIO_LOG_WARNING:
+	return LOG_WARNING;
+    case GENSIO_LOG_INFO:
+	return LOG_INFO;
+    }
+    return LOG_ERR;
+}
+
+static void
+do_gensio_log(const char *name, struct gensio_loginfo *i)
+{
+    char buf[256];
+
+    vsnprintf(buf, sizeof(buf), i->str, i->args);
+    syslog(gensio_log_level_to_syslog(i->level), "%s: %s", name, buf);
+}
+
+enum rot_policy {
+    ROT_ROUND_ROBIN,
+    ROT_LRU,
+    ROT_LEAST_BYTES
+};
+
+/*
+ * A port's place in a rotator.  A member is "free" if its port had
+ * room for another connection the last time the port changed state.
+ * The free members are kept in a bitmap for round-robin, in a list
+ * ordered by when they were last handed out for LRU, and in a
+ * min-heap on device bytes for least-bytes.  Everything here is
+ * protected by rot_lock.
+ */
+struct rot_member {
+    struct rotator *rot;
+    unsigned int idx;		/* Index into the rotator's port list. */
+    port_info_t *port;		/* NULL if no port has the name. */
+    struct rot_member *pnext;	/* Next member for the same port. */
+
+    bool free;
+    struct rot_member *lru_prev;
+    struct rot_member *lru_next;
+    unsigned int heap_pos;
+    uint64_t bytes;
+};
+
+typedef struct rotator
+{
+    /* Rotators use the ports_lock for mutex. */
+    int curr_port;
+    const char **portv;
+    int portc;
+
+    char *name;
+    char *accstr;
+
+    struct gensio_accepter *accepter;
+
+    char *authdir;
+
+    enum rot_policy policy;
+    struct rot_member *members;
+
+    /* Members are matched to ports again when ports_gen changes. */
+    bool resolved;
+    unsigned int gen;
+
+    /* The free set, see struct rot_member. */
+    uint64_t *free_bits;
+    struct rot_member *lru_head;
+    struct rot_member *lru_tail;
+    struct rot_member **heap;
+    unsigned int heap_len;
+
+    struct rotator *next;
+} rotator_t;
+
+static rotator_t *rotators = NULL;
+
+/* Lock for the rotator free sets, nests inside the port lock. */
+static struct gensio_lock *rot_lock;
+
+static struct rot_policy_name {
+    const char *name;
+    enum rot_policy policy;
+} rot_policy_names[] = {
+    { "round-robin",	ROT_ROUND_ROBIN },
+    { "lru",		ROT_LRU },
+    { "least-bytes",	ROT_LEAST_BYTES },
+    { NULL }
+};
+
+static int
+rot_parse_policy(const char *str, enum rot_policy *policy)
+{
+    unsigned int i;
+
+    for (i = 0; rot_policy_names[i].name; i++) {
+	if (strcmp(str, rot_policy_names[i].name) == 0) {
+	    *policy = rot_policy_names[i].policy;
+	    return 0;
+	}
+    }
+    return EINVAL;
+}
+
+static bool
+rot_heap_less(struct rot_member *a, struct rot_member *b)
+{
+    if (a->bytes != b->bytes)
+	return a->bytes < b->bytes;
+    return a->idx < b->idx;
+}
+
+static void
+rot_heap_set(rotator_t *rot, unsigned int pos, struct rot_member *m)
+{
+    rot->heap[pos] = m;
+    m->heap_pos = pos;
+}
+
+static void
+rot_heap_up(rotator_t *rot, unsigned int pos)
+{
+    struct rot_member *m = rot->heap[pos];
+
+    while (pos > 0) {
+	unsigned int parent = (pos - 1) / 2;
+
+	if (!rot_heap_less(m, rot->heap[parent]))
+	    break;
+	rot_heap_set(rot, pos, rot->heap[parent]);
+	pos = parent;
+    }
+    rot_heap_set(rot, pos, m);
+}
+
+static void
+rot_heap_down(rotator_t *rot, unsigned int pos)
+{
+    struct rot_member *m = rot->heap[pos];
+
+    for (;;) {
+	unsigned int child = pos * 2 + 1;
+
+	if (child >= rot->heap_len)
+	    break;
+	if (child + 1 < rot->heap_len &&
+		rot_heap_less(rot->heap[child + 1], rot->heap[child]))
+	    child++;
+	if (!rot_heap_less(rot->heap[child], m))
+	    break;
+	rot_heap_set(rot, pos, rot->heap[child]);
+	pos = child;
+    }
+    rot_heap_set(rot, pos, m);
+}
+
+/* All the bytes the port's device has moved.  Port lock held. */
+static uint64_t
+port_dev_bytes(port_info_t *port)
+{
+    return (port->total_dev_bytes + port->dev_bytes_received +
+	    port->dev_bytes_sent);
+}
+
+/* Called with rot_lock and the member's port lock held. */
+static void
+rot_free_add(struct rot_member *m)
+{
+    rotator_t *rot = m->rot;
+    port_info_t *port = m->port;
+
+    if (m->free)
+	return;
+    m->free = true;
+
+    switch (rot->policy) {
+    case ROT_ROUND_ROBIN:
+	rot->free_bits[m->idx / 64] |= (uint64_t) 1 << (m->idx % 64);
+	break;
+
+    case ROT_LRU:
+	m->lru_next = NULL;
+	m->lru_prev = rot->lru_tail;
+	if (rot->lru_tail)
+	    rot->lru_tail->lru_next = m;
+	else
+	    rot->lru_head = m;
+	rot->lru_tail = m;
+	break;
+
+    case ROT_LEAST_BYTES:
+	m->bytes = port_dev_bytes(port);
+	rot_heap_set(rot, rot->heap_len++, m);
+	rot_heap_up(rot, m->heap_pos);
+	break;
+    }
+}
+
+/* Called with rot_lock held. */
+static void
+rot_free_remove(struct rot_member *m)
+{
+    rotator_t *rot = m->rot;
+    struct rot_member *last;
+
+    if (!m->free)
+	return;
+    m->free = false;
+
+    switch (rot->policy) {
+    case ROT_ROUND_ROBIN:
+	rot->free_bits[m->idx / 64] &= ~((uint64_t) 1 << (m->idx % 64));
+	break;
+
+    case ROT_LRU:
+	if (m->lru_prev)
+	    m->lru_prev->lru_next = m->lru_next;
+	else
+	    rot->lru_head = m->lru_next;
+	if (m->lru_next)
+	    m->lru_next->lru_prev = m->lru_prev;
+	else
+	    rot->lru_tail = m->lru_prev;
+	m->lru_prev = NULL;
+	m->lru_next = NULL;
+	break;
+
+    case ROT_LEAST_BYTES:
+	last = rot->heap[--rot->heap_len];
+	if (last != m) {
+	    rot_heap_set(rot, m->heap_pos, last);
+	    rot_heap_up(rot, last->heap_pos);
+	    rot_heap_down(rot, last->heap_pos);
+	}
+	break;
+    }
+}
+
+/* Does the port have room for another connection?  Port lock held. */
+static bool
+port_has_room(port_info_t *port)
+{
+    net_info_t *netcon;
+    unsigned int count = 0;
+
+    if (!port->enabled || port->dev_to_net_state == PORT_CLOSING)
+	return false;
+    for_each_connection(port, netcon) {
+	if (netcon->net)
+	    count++;
+    }
+    return count < port->max_connections;
+}
+
+/* Called with rot_lock and the port lock held. */
+static void
+port_rot_sync(port_info_t *port, bool room)
 {
-    int err;
-    char auxdata[2] = "1";
-
-    err = gensio_control(netcon->net, GENSIO_CONTROL_DEPTH_ALL, false,
-			 GENSIO_CONTROL_NODELAY, auxdata, NULL);
-    if (err)
-	syslog(LOG_ERR, "Could not enable NODELAY on socket %s: %m",
-	       port->name);
+    struct rot_member *m;
 
-    if (netcon->banner) {
-	free(netcon->banner->buf);
-	free(netcon->banner);
+    port->rot_free = room;
+    for (m = port->rot_members; m; m = m->pnext) {
+	if (room)
+	    rot_free_add(m);
+	else
+	    rot_free_remove(m);
     }
-    netcon->banner = process_str_to_buf(port, netcon, port->bannerstr);
+}
 
-    if (num_connected_net(port) == 1 && !port->has_connect_back) {
-	/* We are first, set things up on the device. */
-	err = port_dev_enable(port);
-	if (err) {
-	    char errstr[200];
+/*
+ * A port with room for more than one connection stays free while it
+ * moves data, so bring its least-bytes heap keys up to date.  Called
+ * with rot_lock and the port lock held.
+ */
+static void
+port_rot_refresh(port_info_t *port)
+{
+    struct rot_member *m;
+    uint64_t bytes = port_dev_bytes(port);
 
-	    snprintf(errstr, sizeof(errstr), "Device open failure: %s\r\n",
-		     gensio_err_to_str(err));
-	    gensio_write(netcon->net, NULL, errstr, strlen(errstr), NULL);
-	    gensio_free(netcon->net);
-	    netcon->net = NULL;
-	}
-	return;
+    for (m = port->rot_members; m; m = m->pnext) {
+	if (!m->free || m->rot->policy != ROT_LEAST_BYTES ||
+		m->bytes == bytes)
+	    continue;
+	m->bytes = bytes;
+	rot_heap_up(m->rot, m->heap_pos);
+	rot_heap_down(m->rot, m->heap_pos);
     }
-
-    finish_setup_net(port, netcon);
 }
 
-/* Returns with the port locked, if non-NULL. */
-static port_info_t *
-find_rotator_port(const char *portname, struct gensio *net,
-		  unsigned int *netconnum)
+/*
+ * Tell the rotators the port is in whether it can take another
+ * connection.  Called with the port lock held.
+ */
+static void
+port_rot_update(port_info_t *port)
 {
-    port_info_t *port = ports;
+    bool room = port_has_room(port);
 
-    while (port) {
-	if (strcmp(port->name, portname) == 0) {
-	    unsigned int i;
-	    struct sockaddr_storage addr;
-	    gensiods socklen;
-	    int err;
+    so->lock(rot_lock);
+    if (room != port->rot_free)
+	port_rot_sync(port, room);
+    else if (room)
+	port_rot_refresh(port);
+    so->unlock(rot_lock);
+}
 
-	    so->lock(port->lock);
-	    if (!port->enabled)
-		goto next;
-	    if (port->dev_to_net_state == PORT_CLOSING)
-		goto next;
-	    socklen = sizeof(addr);
-	    err = gensio_get_raddr(net, &addr, &socklen);
-	    if (err)
-		goto next;
-	    if (!remaddr_check(port->remaddrs,
-			       (struct sockaddr *) &addr, socklen))
-		goto next;
-	    if (port->net_to_dev_state == PORT_UNCONNECTED &&
-		is_device_already_inuse(port))
-		goto next;
+/* Called with rot_lock and the member's port lock held. */
+static void
+rot_member_unlink(struct rot_member *m)
+{
+    struct rot_member **p;
 
-	    for (i = 0; i < port->max_connections; i++) {
-		if (!port->netcons[i].net) {
-		    *netconnum = i;
-		    return port;
-		}
-	    }
-	next:
-	    so->unlock(port->lock);
+    rot_free_remove(m);
+    for (p = &m->port->rot_members; *p; p = &(*p)->pnext) {
+	if (*p == m) {
+	    *p = m->pnext;
+	    break;
 	}
-	port = port->next;
     }
-
-    return NULL;
+    m->pnext = NULL;
+    m->port = NULL;
 }
 
+/* Called with ports_lock held. */
 static void
-handle_new_net(port_info_t *port, struct gensio *net, net_info_t *netcon)
+rot_member_set_port(struct rot_member *m, port_info_t *port)
 {
-    netcon->net = net;
+    port_info_t *old = m->port;
 
-    /* XXX log netcon->remote */
-    setup_port(port, netcon);
+    if (old) {
+	so->lock(old->lock);
+	so->lock(rot_lock);
+	rot_member_unlink(m);
+	so->unlock(rot_lock);
+	so->unlock(old->lock);
+    }
+    if (port) {
+	so->lock(port->lock);
+	so->lock(rot_lock);
+	m->port = port;
+	m->pnext = port->rot_members;
+	port->rot_members = m;
+	port_rot_sync(port, port_has_room(port));
+	so->unlock(rot_lock);
+	so->unlock(port->lock);
+    }
 }
 
-int gensio_log_level_to_syslog(int gloglevel)
+/*
+ * Match the rotator's port names to the ports in the list.  A port
+ * that is being replaced by a reconfig is only used if it is the
+ * only one with the name.  Called with ports_lock held.
+ */
+static void
+rot_resolve(rotator_t *rot)
 {
-    switch (gloglevel) {
-    case GENSIO_LOG_FATAL:
-	return LOG_EMERG;
-    case GENSIO_LOG_ERR:
-	return LOG_ERR;
-    case GENSIO_LOG_WARNING:
-	return LOG_WARNING;
-    case GENSIO_LOG_INFO:
-	return LOG_INFO;
+    port_info_t *port, *found;
+    int i;
+
+    for (i = 0; i < rot->portc; i++) {
+	found = NULL;
+	for (port = ports; port; port = port->next) {
+	    if (strcmp(port->name, rot->portv[i]) != 0)
+		continue;
+	    if (!found || found->deleted)
+		found = port;
+	}
+	if (found != rot->members[i].port)
+	    rot_member_set_port(&rot->members[i], found);
     }
-    return LOG_ERR;
+    rot->gen = ports_gen;
+    rot->resolved = true;
 }
 
-static void
-do_gensio_log(const char *name, struct gensio_loginfo *i)
+/* Find the first free round-robin member in [from, to). */
+static struct rot_member *
+rot_rr_scan(rotator_t *rot, unsigned int from, unsigned int to)
 {
-    char buf[256];
+    while (from < to) {
+	uint64_t w = rot->free_bits[from / 64] >> (from % 64);
 
-    vsnprintf(buf, sizeof(buf), i->str, i->args);
-    syslog(gensio_log_level_to_syslog(i->level), "%s: %s", name, buf);
+	if (w) {
+	    from += __builtin_ctzll(w);
+	    if (from < to)
+		return &rot->members[from];
+	    break;
+	}
+	from = (from / 64 + 1) * 64;
+    }
+    return NULL;
 }
 
-typedef struct rotator
+/*
+ * Return the free member to try after prev (or the first one if prev
+ * is NULL) in policy order.  If prev has left the free set, give up
+ * on the free set.  Called with rot_lock held.
+ */
+static struct rot_member *
+rot_next_free(rotator_t *rot, struct rot_member *prev)
 {
-    /* Rotators use the ports_lock for mutex. */
-    int curr_port;
-    const char **portv;
-    int portc;
-
-    char *name;
-    char *accstr;
+    unsigned int curr = rot->curr_port, pos;
+    struct rot_member *m;
 
-    struct gensio_accepter *accepter;
+    if (prev && !prev->free)
+	return NULL;
 
-    char *authdir;
+    switch (rot->policy) {
+    case ROT_ROUND_ROBIN:
+	if (!prev || prev->idx >= curr) {
+	    m = rot_rr_scan(rot, prev ? prev->idx + 1 : curr, rot->portc);
+	    if (!m)
+		m = rot_rr_scan(rot, 0, curr);
+	} else {
+	    m = rot_rr_scan(rot, prev->idx + 1, curr);
+	}
+	return m;
 
-    struct rotator *next;
-} rotator_t;
+    case ROT_LRU:
+	return prev ? prev->lru_next : rot->lru_head;
 
-static rotator_t *rotators = NULL;
+    case ROT_LEAST_BYTES:
+	/* After the top, the heap's array order is close enough. */
+	pos = prev ? prev->heap_pos + 1 : 0;
+	return pos < rot->heap_len ? rot->heap[pos] : NULL;
+    }
+    return NULL;
+}
 
 /* A connection request has come in on a port. */
 static int
 rot_new_con(rotator_t *rot, struct gensio *net)
 {
+    struct sockaddr_storage addr;
+    gensiods socklen = sizeof(addr);
+    struct rot_member *m = NULL;
+    port_info_t *port = NULL;
+    unsigned int netconnum = 0;
     int i;
     const char *err;
 
+    if (gensio_get_raddr(net, &addr, &socklen))
+	goto out_err;
+
     so->lock(ports_lock);
-    i = rot->curr_port;
-    do {
-	unsigned int netconnum = 0;
-	port_info_t *port = find_rotator_port(rot->portv[i], net, &netconnum);
-
-	if (++i >= rot->portc)
-	    i = 0;
-	if (port) {
-	    rot->curr_port = i;
-	    so->unlock(ports_lock);
-	    handle_new_net(port, net, &port->netcons[netconnum]);
-	    so->unlock(port->lock);
-	    return 0;
-	}
-    } while (i != rot->curr_port);
+    if (!rot->resolved || rot->gen != ports_gen)
+	rot_resolve(rot);
+
+    for (i = 0; i < rot->portc; i++) {
+	so->lock(rot_lock);
+	m = rot_next_free(rot, m);
+	if (m)
+	    port = m->port;
+	so->unlock(rot_lock);
+	if (!m)
+	    break;
+
+	so->lock(port->lock);
+	if (rot_port_usable(port, (struct sockaddr *) &addr, socklen,
+			    &netconnum))
+	    goto found;
+	so->unlock(port->lock);
+    }
+
+    /*
+     * The free set is only a hint, the remote address or the device
+     * may keep a free port from being used, and a port that was busy
+     * may have been missed.  Try everything, in the old order.
+     */
+    for (i = 0; i < rot->portc; i++) {
+	m = &rot->members[(rot->curr_port + i) % rot->portc];
+	port = m->port;
+	if (!port)
+	    continue;
+	so->lock(port->lock);
+	if (rot_port_usable(port, (struct sockaddr *) &addr, socklen,
+			    &netconnum))
+	    goto found;
+	so->unlock(port->lock);
+    }
     so->unlock(ports_lock);
 
+ out_err:
     err = "No free port found\r\n";
     gensio_write(net, NULL, err, strlen(err), NULL);
     gensio_free(net);
     return 0;
+
+ found:
+    rot->curr_port = (m->idx + 1) % rot->portc;
+    so->unlock(ports_lock);
+    handle_new_net(port, net, &port->netcons[netconnum]);
+
+    /* If the port still has room, it is now the most recently used. */
+    so->lock(rot_lock);
+    if (m->free) {
+	rot_free_remove(m);
+	rot_free_add(m);
+    }
+    so->unlock(rot_lock);
+    so->unlock(port->lock);
+    return 0;
 }
 
 static int
@@ -2564,6 +4322,19 @@ free_rotator(rotator_t *rot)
 	so->wait(rotator_shutdown_wait, 1, NULL);
 	gensio_acc_free(rot->accepter);
     }
+    if (rot->members) {
+	int i;
+
+	so->lock(ports_lock);
+	for (i = 0; i < rot->portc; i++)
+	    rot_member_set_port(&rot->members[i], NULL);
+	so->unlock(ports_lock);
+	free(rot->members);
+    }
+    if (rot->free_bits)
+	free(rot->free_bits);
+    if (rot->heap)
+	free(rot->heap);
     if (rot->authdir)
 	free(rot->authdir);
     if (rot->name)
@@ -2594,7 +4365,7 @@ add_rotator(const char *name, const char *accstr, int portc, const char **ports,
 	    const char **options, int lineno)
 {
     rotator_t *rot;
-    int rv;
+    int rv, i;
 
     rot = malloc(sizeof(*rot));
     if (!rot)
@@ -2619,7 +4390,6 @@ add_rotator(const char *name, const char *accstr, int portc, const char **ports,
     }
 
     if (options) {
-	unsigned int i;
 	const char *str;
 
 	for (i = 0; options[i]; i++) {
@@ -2635,6 +4405,15 @@ add_rotator(const char *name, const char *accstr, int portc, const char **ports,
 		}
 		continue;
 	    }
+	    if (gensio_check_keyvalue(options[i], "policy", &str) > 0) {
+		if (rot_parse_policy(str, &rot->policy)) {
+		    free_rotator(rot);
+		    syslog(LOG_ERR, "Invalid rotator policy %s on line %d\n",
+			   str, lineno);
+		    return EINVAL;
+		}
+		continue;
+	    }
 	    free_rotator(rot);
 	    syslog(LOG_ERR, "Invalid option %s for rotator on line %d\n",
 		   options[i], lineno);
@@ -2642,6 +4421,20 @@ add_rotator(const char *name, const char *accstr, int portc, const char **ports,
 	}
     }
 
+    rot->members = calloc(portc, sizeof(*rot->members));
+    rot->free_bits = calloc((portc + 63) / 64, sizeof(*rot->free_bits));
+    rot->heap = calloc(portc, sizeof(*rot->heap));
+    if (!rot->members || !rot->free_bits || !rot->heap) {
+	free_rotator(rot);
+	syslog(LOG_ERR, "Out of memory allocating rotator on line %d\n",
+	       lineno);
+	return ENOMEM;
+    }
+    for (i = 0; i < portc; i++) {
+	rot->members[i].rot = rot;
+	rot->members[i].idx = i;
+    }
+
     rot->portc = portc;
     rot->portv = ports;
 
@@ -2740,13 +4533,17 @@ port_new_con(port_info_t *port, struct gensio *net)
 
     socklen = sizeof(addr);
     if (!gensio_get_raddr(net, &addr, &socklen)) {
-	if (!remaddr_check(port->remaddrs,
-			   (struct sockaddr *) &addr, socklen)) {
+	if (!remaddr_check(port->sh, (struct sockaddr *) &addr, socklen)) {
 	    err = "Accessed denied due to your net address\r\n";
 	    goto out_err;
 	}
     }
 
+    if (port_alloc_netcons(port)) {
+	err = "Out of memory\r\n";
+	goto out_err;
+    }
+
     for (j = port->max_connections, i = 0; i < port->max_connections; i++) {
 	if (!port->netcons[i].net && !port->netcons[i].remote_fixed)
 	    break;
@@ -2769,6 +4566,8 @@ port_new_con(port_info_t *port, struct gensio *net)
 
     if (err) {
     out_err:
+	S2N_PROBE2(net_reject, port->name, err);
+	STATS_ADD(port->stats, rejected_connections, 1);
 	so->unlock(port->lock);
 	so->unlock(ports_lock);
 	gensio_write(net, NULL, err, strlen(err), NULL);
@@ -2802,7 +4601,7 @@ handle_port_child_event(struct gensio_accepter *accepter, void *user_data,
 	return port_new_con(port, data);
 
     default:
-	return handle_acc_auth_event(port->authdir, event, data);
+	return handle_acc_auth_event(port->sh->authdir, event, data);
     }
 }
 
@@ -2812,8 +4611,9 @@ finish_startup_port_err(struct gensio_accepter *acc, void *cb_data)
     port_info_t *port = cb_data;
 
     so->lock(port->lock);
-    port->dev_to_net_state = PORT_CLOSED;
-    port->net_to_dev_state = PORT_CLOSED;
+    port_set_state(port, dev_to_net_state, PORT_CLOSED);
+    port_set_state(port, net_to_dev_state, PORT_CLOSED);
+    port_publish_state(port);
     so->unlock(port->lock);
 }
 
@@ -2832,14 +4632,20 @@ startup_port(struct absout *eout, port_info_t *port)
 		      port->name, gensio_err_to_str(err));
 	return err;
     }
-    port->dev_to_net_state = PORT_UNCONNECTED;
-    port->net_to_dev_state = PORT_UNCONNECTED;
+    port_set_state(port, dev_to_net_state, PORT_UNCONNECTED);
+    port_set_state(port, net_to_dev_state, PORT_UNCONNECTED);
 
-    if (port->has_connect_back) {
+    if (port_dev_stays_open(port) && !port->io_open) {
+	/* The device may already be open, moved over by a reconfig. */
 	err = port_dev_enable(port);
-	if (err) {
-	    port->dev_to_net_state = PORT_CLOSING;
-	    port->net_to_dev_state = PORT_CLOSING;
+	if (err && !port->has_connect_back) {
+	    /* The first user that comes in will try the open again. */
+	    syslog(LOG_ERR, "Unable to open device on port %s: %s",
+		   port->name, gensio_err_to_str(err));
+	    err = 0;
+	} else if (err) {
+	    port_set_state(port, dev_to_net_state, PORT_CLOSING);
+	    port_set_state(port, net_to_dev_state, PORT_CLOSING);
 	    if (eout)
 		eout->out(eout, "Unable to enable port device %s: %s",
 			  port->name, gensio_err_to_str(err));
@@ -2849,15 +4655,398 @@ startup_port(struct absout *eout, port_info_t *port)
 		finish_startup_port_err(NULL, port);
 	}
     }
+    port_publish_state(port);
+
+    return err;
+}
+
+static struct port_shared *
+port_shared_alloc(void)
+{
+    struct port_shared *sh;
+
+    sh = malloc(sizeof(*sh));
+    if (!sh)
+	return NULL;
+    memset(sh, 0, sizeof(*sh));
+    sh->refcount = 1;
+    return sh;
+}
+
+static struct port_shared *
+port_shared_get(struct port_shared *sh)
+{
+    so->lock(shared_lock);
+    sh->refcount++;
+    so->unlock(shared_lock);
+    return sh;
+}
+
+static void
+port_shared_put(struct port_shared *sh)
+{
+    struct port_shared **p;
+    struct port_remaddr *r;
+    unsigned int refcount;
+
+    so->lock(shared_lock);
+    refcount = --sh->refcount;
+    if (refcount == 0 && sh->interned) {
+	p = &shared_hash[sh->hash % SHARED_HASH_SIZE];
+	while (*p != sh)
+	    p = &(*p)->hnext;
+	*p = sh->hnext;
+	num_shared--;
+    }
+    so->unlock(shared_lock);
+    if (refcount > 0)
+	return;
+
+    while (sh->remaddrs) {
+	r = sh->remaddrs;
+	sh->remaddrs = r->next;
+	free(r->str);
+	free(r);
+    }
+    addrtrie_free(sh->remtrie);
+    if (sh->bannerstr)
+	free(sh->bannerstr);
+    if (sh->signaturestr)
+	free(sh->signaturestr);
+    if (sh->authdir)
+	free(sh->authdir);
+    if (sh->openstr)
+	free(sh->openstr);
+    if (sh->closestr)
+	free(sh->closestr);
+    if (sh->closeon)
+	free(sh->closeon);
+    if (sh->rs485)
+	free(sh->rs485);
+    if (sh->trace_read_file)
+	free(sh->trace_read_file);
+    if (sh->trace_write_file)
+	free(sh->trace_write_file);
+    if (sh->trace_both_file)
+	free(sh->trace_both_file);
+    if (sh->tap_file)
+	free(sh->tap_file);
+    if (sh->tap_filter)
+	free(sh->tap_filter);
+    free(sh);
+}
+
+static uint32_t
+shared_hash_data(uint32_t h, const void *data, size_t len)
+{
+    const unsigned char *d = data;
+
+    while (len--) {
+	h ^= *d++;
+	h *= 16777619;
+    }
+    return h;
+}
+
+static uint32_t
+shared_hash_str(uint32_t h, const char *str)
+{
+    /* Include the nil so NULL and "" and adjacent strings differ. */
+    if (!str)
+	return shared_hash_data(h, "", 1);
+    return shared_hash_data(h, str, strlen(str) + 1);
+}
+
+static uint32_t
+port_shared_hash(struct port_shared *sh)
+{
+    uint32_t h = 2166136261U;
+    struct port_remaddr *r;
+
+    h = shared_hash_str(h, sh->bannerstr);
+    h = shared_hash_str(h, sh->signaturestr);
+    h = shared_hash_str(h, sh->openstr);
+    h = shared_hash_str(h, sh->closestr);
+    if (sh->closeon)
+	h = shared_hash_data(h, sh->closeon, sh->closeon_len);
+    h = shared_hash_str(h, sh->authdir);
+    h = shared_hash_str(h, sh->rs485);
+    for (r = sh->remaddrs; r; r = r->next)
+	h = shared_hash_str(h, r->str);
+    h = shared_hash_str(h, sh->trace_read_file);
+    h = shared_hash_str(h, sh->trace_write_file);
+    h = shared_hash_str(h, sh->trace_both_file);
+    h = shared_hash_str(h, sh->tap_file);
+    h = shared_hash_str(h, sh->tap_filter);
+    h = shared_hash_data(h, &sh->led_tx, sizeof(sh->led_tx));
+    h = shared_hash_data(h, &sh->led_rx, sizeof(sh->led_rx));
+    return h;
+}
+
+static bool
+shared_str_eq(const char *a, const char *b)
+{
+    if (!a || !b)
+	return a == b;
+    return strcmp(a, b) == 0;
+}
+
+static bool
+port_shared_eq(struct port_shared *a, struct port_shared *b)
+{
+    struct port_remaddr *ra, *rb;
+
+    if (a->gen != b->gen)
+	return false;
+    if (a->closeon_len != b->closeon_len ||
+		(a->closeon == NULL) != (b->closeon == NULL) ||
+		(a->closeon && memcmp(a->closeon, b->closeon, a->closeon_len)))
+	return false;
+    if (!shared_str_eq(a->bannerstr, b->bannerstr) ||
+		!shared_str_eq(a->signaturestr, b->signaturestr) ||
+		!shared_str_eq(a->openstr, b->openstr) ||
+		!shared_str_eq(a->closestr, b->closestr) ||
+		!shared_str_eq(a->authdir, b->authdir) ||
+		!shared_str_eq(a->rs485, b->rs485) ||
+		!shared_str_eq(a->trace_read_file, b->trace_read_file) ||
+		!shared_str_eq(a->trace_write_file, b->trace_write_file) ||
+		!shared_str_eq(a->trace_both_file, b->trace_both_file) ||
+		!shared_str_eq(a->tap_file, b->tap_file) ||
+		!shared_str_eq(a->tap_filter, b->tap_filter) ||
+		a->led_tx != b->led_tx || a->led_rx != b->led_rx)
+	return false;
+    for (ra = a->remaddrs, rb = b->remaddrs; ra && rb;
+		ra = ra->next, rb = rb->next) {
+	if (strcmp(ra->str, rb->str) != 0)
+	    return false;
+    }
+    return ra == rb;
+}
+
+/*
+ * Called when a port's configuration has been parsed.  If another
+ * port already has the same configuration, use that one and free
+ * the port's copy, otherwise add the port's to the hash table.
+ */
+static void
+port_intern_shared(port_info_t *port)
+{
+    struct port_shared *sh = port->sh, *curr;
+    uint32_t hash = port_shared_hash(sh);
+
+    so->lock(shared_lock);
+    sh->gen = shared_gen;
+    for (curr = shared_hash[hash % SHARED_HASH_SIZE]; curr;
+		curr = curr->hnext) {
+	if (curr->hash == hash && port_shared_eq(curr, sh))
+	    break;
+    }
+    if (curr) {
+	curr->refcount++;
+    } else {
+	sh->hash = hash;
+	sh->interned = true;
+	sh->hnext = shared_hash[hash % SHARED_HASH_SIZE];
+	shared_hash[hash % SHARED_HASH_SIZE] = sh;
+	num_shared++;
+    }
+    so->unlock(shared_lock);
+
+    if (curr) {
+	port_shared_put(sh);
+	port->sh = curr;
+    }
+
+    port->trace_read.filename = port->sh->trace_read_file;
+    port->trace_write.filename = port->sh->trace_write_file;
+    port->trace_both.filename = port->sh->trace_both_file;
+}
+
+/*
+ * A file subscribed to a port's data with the tap-file option.  The
+ * data is written from a runner so a slow file never holds up the
+ * port, if the runner can't keep up the tap queue drops the data.
+ */
+struct tap_file {
+    struct gensio_lock *lock;
+    int fd;
+    struct tap_sub *sub;
+    struct gensio_runner *runner;
+    bool running;	/* The runner is scheduled or running. */
+    bool pending;	/* Data was queued since the runner looked. */
+    bool closing;	/* Free it when the runner finishes. */
+};
+
+static void
+tap_file_free(struct tap_file *tf)
+{
+    if (tf->sub)
+	tap_sub_free(tf->sub);
+    if (tf->runner)
+	so->free_runner(tf->runner);
+    if (tf->lock)
+	so->free_lock(tf->lock);
+    if (tf->fd != -1)
+	close(tf->fd);
+    free(tf);
+}
+
+static void
+tap_file_run(struct gensio_runner *runner, void *cb_data)
+{
+    struct tap_file *tf = cb_data;
+    struct tap_chunk *chunk;
+    gensiods pos;
+    ssize_t rv;
+    bool closing;
+
+    so->lock(tf->lock);
+    while (tf->pending && !tf->closing) {
+	tf->pending = false;
+	so->unlock(tf->lock);
+	while ((chunk = tap_sub_next(tf->sub))) {
+	    for (pos = 0; pos < chunk->len; pos += rv) {
+		rv = write(tf->fd, chunk->data + pos, chunk->len - pos);
+		if (rv == -1 && errno == EINTR) {
+		    rv = 0;
+		} else if (rv <= 0) {
+		    break;
+		}
+	    }
+	    tap_sub_done(tf->sub, chunk,
+			 pos < chunk->len ? chunk->len - pos : 0);
+	}
+	so->lock(tf->lock);
+    }
+    tf->running = false;
+    closing = tf->closing;
+    so->unlock(tf->lock);
+
+    if (closing)
+	tap_file_free(tf);
+}
+
+/* Called with the port lock held when data is queued to the file. */
+static void
+tap_file_ready(struct tap_sub *sub, void *cb_data)
+{
+    struct tap_file *tf = cb_data;
+
+    so->lock(tf->lock);
+    tf->pending = true;
+    if (!tf->running) {
+	tf->running = true;
+	so->run(tf->runner);
+    }
+    so->unlock(tf->lock);
+}
+
+static int
+tap_file_open(struct absout *eout, port_info_t *port)
+{
+    struct tap_filter f = { .dirs = TAP_DIR_BOTH };
+    struct tap_file *tf;
+    const char *errstr;
+    char desc[64];
+
+    if (port->sh->tap_filter) {
+	errstr = tap_filter_parse(&f, port->sh->tap_filter);
+	if (errstr) {
+	    tap_filter_free(&f);
+	    eout->out(eout, "%s: %s", errstr, port->sh->tap_filter);
+	    return -1;
+	}
+    }
+
+    tf = malloc(sizeof(*tf));
+    if (!tf) {
+	tap_filter_free(&f);
+	eout->out(eout, "Out of memory allocating tap file");
+	return -1;
+    }
+    memset(tf, 0, sizeof(*tf));
+    tf->fd = -1;
+
+    snprintf(desc, sizeof(desc), "file %s", port->sh->tap_file);
+    tf->lock = so->alloc_lock(so);
+    if (tf->lock)
+	tf->runner = so->alloc_runner(so, tap_file_run, tf);
+    if (tf->runner)
+	tf->sub = tap_sub_alloc(&f, desc, tap_file_ready, NULL, tf);
+    tap_filter_free(&f);
+    if (!tf->sub) {
+	tap_file_free(tf);
+	eout->out(eout, "Out of memory allocating tap file");
+	return -1;
+    }
+
+    tf->fd = open(port->sh->tap_file, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (tf->fd == -1) {
+	eout->out(eout, "Unable to open tap file %s: %s",
+		  port->sh->tap_file, strerror(errno));
+	tap_file_free(tf);
+	return -1;
+    }
+
+    port->tapfile = tf;
+    tap_add(&port->taps, tf->sub);
+    return 0;
+}
+
+/* The file's sub must be off the port's list, so no more data comes. */
+static void
+tap_file_close(struct tap_file *tf)
+{
+    so->lock(tf->lock);
+    if (tf->running) {
+	tf->closing = true;
+	so->unlock(tf->lock);
+	return;
+    }
+    so->unlock(tf->lock);
+    tap_file_free(tf);
+}
+
+/*
+ * Move the subscribers other than the tap file from a port being
+ * deleted to the port replacing it, so monitors survive a reload.
+ */
+static void
+port_move_taps(port_info_t *from, port_info_t *to)
+{
+    struct tap_sub *sub, *next;
+
+    for (sub = from->taps; sub; sub = next) {
+	next = tap_sub_list_next(sub);
+	if (from->tapfile && sub == from->tapfile->sub)
+	    continue;
+	tap_remove(&from->taps, sub);
+	tap_add(&to->taps, sub);
+    }
+    port_select_data_path(from);
+    port_select_data_path(to);
+}
 
-    return err;
+static void
+port_free_taps(port_info_t *port)
+{
+    struct tap_sub *sub;
+
+    if (port->tapfile) {
+	tap_remove(&port->taps, port->tapfile->sub);
+	tap_file_close(port->tapfile);
+	port->tapfile = NULL;
+    }
+    while ((sub = port->taps)) {
+	tap_remove(&port->taps, sub);
+	tap_sub_free(sub);
+    }
 }
 
 static void
 free_port(port_info_t *port)
 {
     net_info_t *netcon;
-    struct port_remaddr *r;
 
     if (port->netcons) {
 	for_each_connection(port, netcon) {
@@ -2869,34 +5058,35 @@ free_port(port_info_t *port)
 	}
     }
 
-    so->free_lock(port->lock);
-    while (port->remaddrs) {
-	r = port->remaddrs;
-	port->remaddrs = r->next;
-	gensio_free_addrinfo(so, r->ai);
-	free(r->str);
-	free(r);
+    if (port->rot_members) {
+	so->lock(rot_lock);
+	while (port->rot_members)
+	    rot_member_unlink(port->rot_members);
+	so->unlock(rot_lock);
     }
+    port_free_taps(port);
+    stats_slot_put(port->stats);
+    if (port->lock)
+	so->free_lock(port->lock);
+    if (port->sh)
+	port_shared_put(port->sh);
     if (port->accepter)
 	gensio_acc_free(port->accepter);
-    if (port->dev_to_net.buf)
-	free(port->dev_to_net.buf);
-    if (port->net_to_dev.buf)
-	free(port->net_to_dev.buf);
+    gbuf_free(&port->dev_to_net);
+    gbuf_free(&port->net_to_dev);
+    gbuf_free(&port->dev_backlog);
     if (port->timer)
 	so->free_timer(port->timer);
     if (port->send_timer)
 	so->free_timer(port->send_timer);
+    if (port->state_timer)
+	so->free_timer(port->state_timer);
+    if (port->batch_timer)
+	so->free_timer(port->batch_timer);
     if (port->runshutdown)
 	so->free_runner(port->runshutdown);
     if (port->io)
 	gensio_free(port->io);
-    if (port->trace_read.filename)
-	free(port->trace_read.filename);
-    if (port->trace_write.filename)
-	free(port->trace_write.filename);
-    if (port->trace_both.filename)
-	free(port->trace_both.filename);
     if (port->devname)
 	free(port->devname);
     if (port->name)
@@ -2905,20 +5095,7 @@ free_port(port_info_t *port)
 	free(port->accstr);
     if (port->new_config)
 	free_port(port->new_config);
-    if (port->bannerstr)
-	free(port->bannerstr);
-    if (port->signaturestr)
-	free(port->signaturestr);
-    if (port->authdir)
-	free(port->authdir);
-    if (port->openstr)
-	free(port->openstr);
-    if (port->closestr)
-	free(port->closestr);
-    if (port->closeon)
-	free(port->closeon);
-    if (port->netcons)
-	free(port->netcons);
+    pool_free(port->netcons);
     if (port->orig_devname)
 	free(port->orig_devname);
     free(port);
@@ -2933,21 +5110,26 @@ finish_shutdown_port(struct gensio_runner *runner, void *cb_data)
     so->lock(port->lock);
 
     if (port->enabled) {
-	port->net_to_dev_state = PORT_UNCONNECTED;
-	port->dev_to_net_state = PORT_UNCONNECTED;
+	port_set_state(port, net_to_dev_state, PORT_UNCONNECTED);
+	port_set_state(port, dev_to_net_state, PORT_UNCONNECTED);
     } else {
-	port->net_to_dev_state = PORT_CLOSED;
-	port->dev_to_net_state = PORT_CLOSED;
+	port_set_state(port, net_to_dev_state, PORT_CLOSED);
+	port_set_state(port, dev_to_net_state, PORT_CLOSED);
     }
     gbuf_reset(&port->net_to_dev);
     if (port->devstr) {
-	free(port->devstr->buf);
-	free(port->devstr);
+	gbuf_free_alloced(port->devstr);
 	port->devstr = NULL;
     }
     gbuf_reset(&port->dev_to_net);
+    port_stop_state_timer(port);
+    port_stop_batch_timer(port);
+    port->total_dev_bytes += port->dev_bytes_received + port->dev_bytes_sent;
     port->dev_bytes_received = 0;
     port->dev_bytes_sent = 0;
+    STATS_SET(port->stats, dev_to_net_queue, 0);
+    STATS_SET(port->stats, net_to_dev_queue, 0);
+    port_publish_state(port);
 
     if (gensio_acc_exit_on_close(port->accepter))
 	/* This was a zero port (for stdin/stdout), this is only
@@ -2961,6 +5143,8 @@ finish_shutdown_port(struct gensio_runner *runner, void *cb_data)
 
 	new = port->new_config;
 	port->new_config = NULL;
+	if (new)
+	    port_move_taps(port, new);
 
 	prev = NULL;
 	for (curr = ports; curr && curr != port; curr = curr->next)
@@ -2971,6 +5155,7 @@ finish_shutdown_port(struct gensio_runner *runner, void *cb_data)
 	    else
 		prev->next = curr->next;
 	}
+	ports_gen++;
 	so->unlock(port->lock);
 
 	free_port(port);
@@ -3002,6 +5187,14 @@ finish_shutdown_port(struct gensio_runner *runner, void *cb_data)
 	gensio_acc_set_accept_callback_enable(port->accepter, true);
 	for_each_connection(port, netcon)
 	    check_port_new_net(port, netcon);
+
+	if (port->idle_release_time && !port->io_open) {
+	    struct timeval timeout;
+
+	    timeout.tv_sec = port->idle_release_time;
+	    timeout.tv_usec = 0;
+	    so->start_timer(port->timer, &timeout);
+	}
     }
     so->unlock(port->lock);
     so->unlock(ports_lock);
@@ -3017,10 +5210,8 @@ io_shutdown_done(struct gensio *io, void *cb_data)
 }
 
 static void
-shutdown_port_io(port_info_t *port)
+port_close_traces(port_info_t *port)
 {
-    int err = 1;
-
     if (port->trace_write.fd != -1) {
 	close(port->trace_write.fd);
 	port->trace_write.fd = -1;
@@ -3035,6 +5226,15 @@ shutdown_port_io(port_info_t *port)
     }
 
     port->tw = port->tr = port->tb = NULL;
+    port_select_data_path(port);
+}
+
+static void
+shutdown_port_io(port_info_t *port)
+{
+    int err = 1;
+
+    port_close_traces(port);
 
     if (port->io)
 	err = gensio_close(port->io, io_shutdown_done, port);
@@ -3072,6 +5272,7 @@ handle_dev_fd_close_write(port_info_t *port)
     if (err) {
 	syslog(LOG_ERR, "The dev write for port %s had error: %s",
 	       port->name, gensio_err_to_str(err));
+	port_dev_error(port, "write", err);
 	goto closeit;
     }
 
@@ -3097,10 +5298,9 @@ start_shutdown_port_io(port_info_t *port)
     }
 
     if (port->devstr) {
-	free(port->devstr->buf);
-	free(port->devstr);
+	gbuf_free_alloced(port->devstr);
     }
-    port->devstr = process_str_to_buf(port, NULL, port->closestr);
+    port->devstr = process_str_to_buf(port, NULL, port->sh->closestr);
     port->dev_write_handler = handle_dev_fd_close_write;
     gensio_set_write_callback_enable(port->io, true);
 }
@@ -3110,9 +5310,13 @@ netcon_finish_shutdown(net_info_t *netcon)
 {
     port_info_t *port = netcon->port;
 
+    S2N_PROBE4(net_closed, port->name, netcon_index(netcon),
+	       netcon->bytes_received, netcon->bytes_sent);
     if (netcon->net) {
+	netcon_down(netcon, NULL);
 	gensio_free(netcon->net);
 	netcon->net = NULL;
+	port_publish_state(port);
     }
 
     netcon->closing = false;
@@ -3120,8 +5324,7 @@ netcon_finish_shutdown(net_info_t *netcon)
     netcon->bytes_sent = 0;
     netcon->write_pos = 0;
     if (netcon->banner) {
-	free(netcon->banner->buf);
-	free(netcon->banner);
+	gbuf_free_alloced(netcon->banner);
 	netcon->banner = NULL;
     }
 
@@ -3130,8 +5333,13 @@ netcon_finish_shutdown(net_info_t *netcon)
 	    start_shutdown_port_io(port);
 	} else if (port->has_connect_back && port->enabled) {
 	    /* Leave the device open for connect backs. */
-	    port->dev_to_net_state = PORT_UNCONNECTED;
-	    port->net_to_dev_state = PORT_UNCONNECTED;
+	    port_set_state(port, dev_to_net_state, PORT_UNCONNECTED);
+	    port_set_state(port, net_to_dev_state, PORT_UNCONNECTED);
+	    check_port_new_net(port, netcon);
+	} else if (port->keep_dev_open && port->enabled && port->io_open) {
+	    /* Leave the device open for the next user. */
+	    footer_trace(port, NULL, "port", "All users disconnected");
+	    port_dev_set_idle(port);
 	    check_port_new_net(port, netcon);
 	} else {
 	    shutdown_port(port, NULL);
@@ -3161,7 +5369,9 @@ shutdown_one_netcon(net_info_t *netcon, const char *reason)
 	return;
 
     netcon->write_pos = 0;
-    footer_trace(netcon->port, "netcon", reason);
+    S2N_PROBE3(net_close, netcon->port->name, netcon_index(netcon), reason);
+    footer_trace(netcon->port, netcon, "netcon", reason);
+    netcon_down(netcon, reason);
 
     netcon->closing = true;
     err = gensio_close(netcon->net, handle_net_fd_closed, netcon);
@@ -3235,9 +5445,9 @@ accept_read_disabled(struct gensio_accepter *acc, void *cb_data)
     port->shutdown_timeout_count = 4;
 
     if (port->shutdown_reason)
-	footer_trace(port, "port", port->shutdown_reason);
+	footer_trace(port, NULL, "port", port->shutdown_reason);
     else
-	footer_trace(port, "port", "All users disconnected");
+	footer_trace(port, NULL, "port", "All users disconnected");
 
     /*
      * If close_on_output_done is already set, the netcons are all set to
@@ -3267,16 +5477,22 @@ accept_read_disabled(struct gensio_accepter *acc, void *cb_data)
     if (!some_to_close) {
 	if (port->has_connect_back && port->enabled) {
 	    /* Leave the device open for connect backs. */
-	    port->dev_to_net_state = PORT_UNCONNECTED;
-	    port->net_to_dev_state = PORT_UNCONNECTED;
+	    port_set_state(port, dev_to_net_state, PORT_UNCONNECTED);
+	    port_set_state(port, net_to_dev_state, PORT_UNCONNECTED);
+	    goto out_unlock;
+	} else if (port->keep_dev_open && port->enabled && port->io_open &&
+		   port->net_to_dev_state != PORT_CLOSING) {
+	    /* Leave the device open for the next user. */
+	    port_dev_set_idle(port);
+	    gensio_acc_set_accept_callback_enable(port->accepter, true);
 	    goto out_unlock;
 	} else {
 	    start_shutdown_port_io(port);
 	}
     }
 
-    port->dev_to_net_state = PORT_CLOSING;
-    port->net_to_dev_state = PORT_CLOSING;
+    port_set_state(port, dev_to_net_state, PORT_CLOSING);
+    port_set_state(port, net_to_dev_state, PORT_CLOSING);
 
  out_unlock:
     so->unlock(port->lock);
@@ -3292,7 +5508,7 @@ shutdown_port(port_info_t *port, const char *errreason)
 		&& errreason) {
 	/* An error occurred and we are in a non-err shutdown.  Convert it. */
 	port->shutdown_reason = errreason;
-	port->net_to_dev_state = PORT_CLOSING;
+	port_set_state(port, net_to_dev_state, PORT_CLOSING);
 	return 0;
     }
 
@@ -3305,9 +5521,13 @@ shutdown_port(port_info_t *port, const char *errreason)
     port->shutdown_reason = errreason;
     if (errreason)
 	/* It's an error, force a shutdown.  Don't set dev_to_net_state yet. */
-	port->net_to_dev_state = PORT_CLOSING;
+	port_set_state(port, net_to_dev_state, PORT_CLOSING);
 
     port->shutdown_started = true;
+    port->dev_idle = false;
+    event_post(EVENT_SHUTDOWN, port->name,
+	       "reason", errreason ? errreason : "normal", NULL);
+    port_publish_state(port);
 
     err = gensio_acc_set_accept_callback_enable_cb(port->accepter, false,
 						   accept_read_disabled, port);
@@ -3331,6 +5551,14 @@ got_timeout(struct gensio_timer *timer, void *data)
 
     so->lock(port->lock);
 
+    if (!port->io_open && (port->dev_to_net_state == PORT_UNCONNECTED ||
+			   port->dev_to_net_state == PORT_CLOSED)) {
+	/* Idle release timer, started from finish_shutdown_port(). */
+	port_release_data(port);
+	so->unlock(port->lock);
+	return;
+    }
+
     if (port->dev_to_net_state == PORT_CLOSING) {
 	if (port->shutdown_timeout_count <= 1) {
 	    int count = port->shutdown_timeout_count;
@@ -3349,6 +5577,11 @@ got_timeout(struct gensio_timer *timer, void *data)
 	}
     }
 
+    if (port->connback_persist && port->io_open && port->enabled &&
+		port->dev_to_net_state != PORT_CLOSING)
+	/* Redial any connect backs whose backoff is over. */
+	port_check_connect_backs(port);
+
     if (port->nocon_read_enable_time_left) {
 	port->nocon_read_enable_time_left--;
 	if (port->nocon_read_enable_time_left == 0)
@@ -3390,7 +5623,7 @@ port_add_remaddr(struct absout *eout, port_info_t *port, const char *istr)
     remstr = strtok_r(str, ";", &strtok_data);
     /* Note that we ignore an empty remaddr. */
     while (remstr && *remstr) {
-	err = remaddr_append(&port->remaddrs, remstr);
+	err = remaddr_append(&port->sh->remaddrs, remstr);
 	if (err) {
 	    eout->out(eout, "Error adding remote address '%s': %s\n", remstr,
 		      gensio_err_to_str(err));
@@ -3506,26 +5739,67 @@ myconfig(port_info_t *port, struct absout *eout, const char *pos)
 				    &port->trace_both.hexdump) > 0) {
     } else if (gensio_check_keybool(pos, "tb-timestamp",
 				    &port->trace_both.timestamp) > 0) {
+    } else if (gensio_check_keyvalue(pos, "trace-format", &val) > 0) {
+	if (strcmp(val, "pcapng") == 0) {
+	    port->trace_read.pcapng = true;
+	} else if (strcmp(val, "text") == 0) {
+	    port->trace_read.pcapng = false;
+	} else {
+	    eout->out(eout, "Invalid trace-format: %s", val);
+	    return -1;
+	}
+	port->trace_write.pcapng = port->trace_read.pcapng;
+	port->trace_both.pcapng = port->trace_read.pcapng;
     } else if (gensio_check_keyvalue(pos, "tr", &val) > 0) {
 	/* trace read, data from the port to the socket */
-	port->trace_read.filename = find_tracefile(val);
+	if (port->sh->trace_read_file)
+	    free(port->sh->trace_read_file);
+	port->sh->trace_read_file = find_tracefile(val);
     } else if (gensio_check_keyvalue(pos, "tw", &val) > 0) {
 	/* trace write, data from the socket to the port */
-	port->trace_write.filename = find_tracefile(val);
+	if (port->sh->trace_write_file)
+	    free(port->sh->trace_write_file);
+	port->sh->trace_write_file = find_tracefile(val);
     } else if (gensio_check_keyvalue(pos, "tb", &val) > 0) {
 	/* trace both directions. */
-	port->trace_both.filename = find_tracefile(val);
+	if (port->sh->trace_both_file)
+	    free(port->sh->trace_both_file);
+	port->sh->trace_both_file = find_tracefile(val);
+    } else if (gensio_check_keyvalue(pos, "tap-file", &val) > 0) {
+	if (port->sh->tap_file)
+	    free(port->sh->tap_file);
+	port->sh->tap_file = strdup(val);
+	if (!port->sh->tap_file) {
+	    eout->out(eout, "Out of memory allocating tap-file");
+	    return -1;
+	}
+    } else if (gensio_check_keyvalue(pos, "tap-filter", &val) > 0) {
+	struct tap_filter f = { .dirs = TAP_DIR_BOTH };
+	const char *errstr = tap_filter_parse(&f, val);
+
+	tap_filter_free(&f);
+	if (errstr) {
+	    eout->out(eout, "%s: %s", errstr, val);
+	    return -1;
+	}
+	if (port->sh->tap_filter)
+	    free(port->sh->tap_filter);
+	port->sh->tap_filter = strdup(val);
+	if (!port->sh->tap_filter) {
+	    eout->out(eout, "Out of memory allocating tap-filter");
+	    return -1;
+	}
     } else if (gensio_check_keyvalue(pos, "led-rx", &val) > 0) {
 	/* LED for UART RX traffic */
-	port->led_rx = find_led(val);
-	if (!port->led_rx) {
+	port->sh->led_rx = find_led(val);
+	if (!port->sh->led_rx) {
 	    eout->out(eout, "Could not find led-rx LED: %s", val);
 	    return -1;
 	}
     } else if (gensio_check_keyvalue(pos, "led-tx", &val) > 0) {
 	/* LED for UART TX traffic */
-	port->led_tx = find_led(val);
-	if (!port->led_tx) {
+	port->sh->led_tx = find_led(val);
+	if (!port->sh->led_tx) {
 	    eout->out(eout, "Could not find led-tx LED: %s", val);
 	    return -1;
 	}
@@ -3551,67 +5825,87 @@ myconfig(port_info_t *port, struct absout *eout, const char *pos)
 				   &port->max_connections) > 0) {
 	if (port->max_connections < 1)
 	    port->max_connections = 1;
+    } else if (gensio_check_keybool(pos, "keep-device-open",
+				    &port->keep_dev_open) > 0) {
+    } else if (gensio_check_keyds(pos, "keep-open-backlog",
+				  &port->dev_backlog.maxsize) > 0) {
+    } else if (gensio_check_keybool(pos, "connback-persist",
+				    &port->connback_persist) > 0) {
+    } else if (gensio_check_keyuint(pos, "connback-retry-max",
+				    &port->connback_retry_max) > 0) {
+	if (port->connback_retry_max < 1)
+	    port->connback_retry_max = 1;
+	else if (port->connback_retry_max > 3600)
+	    port->connback_retry_max = 3600;
+    } else if (gensio_check_keyuint(pos, "state-coalesce",
+				    &port->state_coalesce) > 0) {
+    } else if (gensio_check_keyuint(pos, "udp-batch",
+				    &port->udp_batch) > 0) {
+    } else if (gensio_check_keybool(pos, "relay", &port->relay) > 0) {
+    } else if (gensio_check_keyuint(pos, "idle-release-time",
+				    &port->idle_release_time) > 0) {
     } else if (gensio_check_keyvalue(pos, "authdir", &val) > 0) {
 	fval = strdup(val);
 	if (!fval) {
 	    eout->out(eout, "Out of memory allocating authdir");
 	    return -1;
 	}
-	if (port->authdir)
-	    free(port->authdir);
-	port->authdir = fval;
+	if (port->sh->authdir)
+	    free(port->sh->authdir);
+	port->sh->authdir = fval;
     } else if (gensio_check_keyvalue(pos, "remaddr", &val) > 0) {
 	rv = port_add_remaddr(eout, port, val);
 	if (rv)
 	    return -1;
 	port->remaddr_set = true;
     } else if (gensio_check_keyvalue(pos, "rs485", &val) > 0) {
-	port->rs485 = find_rs485conf(val);
+	port->sh->rs485 = find_rs485conf(val);
     } else if (check_keyvalue_default(pos, "banner", &val, "") > 0) {
 	fval = strdup(val);
 	if (!fval) {
 	    eout->out(eout, "Out of memory allocating banner");
 	    return -1;
 	}
-	if (port->bannerstr)
-	    free(port->bannerstr);
-	port->bannerstr = fval;
+	if (port->sh->bannerstr)
+	    free(port->sh->bannerstr);
+	port->sh->bannerstr = fval;
     } else if (check_keyvalue_default(pos, "openstr", &val, "") > 0) {
 	fval = strdup(val);
 	if (!fval) {
 	    eout->out(eout, "Out of memory allocating openstr");
 	    return -1;
 	}
-	if (port->openstr)
-	    free(port->openstr);
-	port->openstr = fval;
+	if (port->sh->openstr)
+	    free(port->sh->openstr);
+	port->sh->openstr = fval;
     } else if (check_keyvalue_default(pos, "closestr", &val, "") > 0) {
 	fval = strdup(val);
 	if (!fval) {
 	    eout->out(eout, "Out of memory allocating closestr");
 	    return -1;
 	}
-	if (port->closestr)
-	    free(port->closestr);
-	port->closestr = fval;
+	if (port->sh->closestr)
+	    free(port->sh->closestr);
+	port->sh->closestr = fval;
     } else if (gensio_check_keyvalue(pos, "closeon", &val) > 0) {
 	fval = strdup(val);
 	if (!fval) {
 	    eout->out(eout, "Out of memory allocating closeon");
 	    return -1;
 	}
-	if (port->closeon)
-	    free(port->closeon);
-	port->closeon = fval;
+	if (port->sh->closeon)
+	    free(port->sh->closeon);
+	port->sh->closeon = fval;
+	port->sh->closeon_len = strlen(fval);
     } else if (check_keyvalue_default(pos, "signature", &val, "") > 0) {
 	fval = strdup(val);
 	if (!fval) {
 	    eout->out(eout, "Out of memory banner");
 	    return -1;
 	}
-	if (port->signaturestr)
-	    free(port->signaturestr);
-	port->signaturestr = fval;
+	if (port->sh->signaturestr)
+	    free(port->sh->signaturestr);
+	port->sh->signaturestr = fval;
 
     /* Everything from here down to the banner, etc is deprecated. */
     } else if (strcmp(pos, "remctl") == 0) {
@@ -3652,11 +5946,16 @@ myconfig(port_info_t *port, struct absout *eout, const char *pos)
 	/* It's a startup banner, signature or open/close string, it's
 	   already set. */
 	switch (stype) {
-	case BANNER: port->bannerstr = s; break;
-	case SIGNATURE: port->signaturestr = s; break;
-	case OPENSTR: port->openstr = s; break;
-	case CLOSESTR: port->closestr = s; break;
-	case CLOSEON: port->closeon = s; port->closeon_len = len; break;
+	case BANNER: port->sh->bannerstr = s; break;
+	case SIGNATURE: port->sh->signaturestr = s; break;
+	case OPENSTR: port->sh->openstr = s; break;
+	case CLOSESTR: port->sh->closestr = s; break;
+	case CLOSEON:
+	    if (port->sh->closeon)
+		free(port->sh->closeon);
+	    port->sh->closeon = s;
+	    port->sh->closeon_len = len;
+	    break;
 	default: free(s); goto unknown;
 	}
     } else {
@@ -3692,42 +5991,30 @@ process_remaddr(struct absout *eout, port_info_t *port, struct port_remaddr *r)
 		  " for the max-connections given");
 }
 
-/* Create a port based on a set of parameters passed in. */
-int
-portconfig(struct absout *eout,
-	   const char *name,
-	   const char *accstr,
-	   const char *state,
-	   unsigned int timeout,
-	   const char *devname,
-	   const char * const *devcfg)
+static bool
+port_name_in_use(const char *name)
 {
-    port_info_t *new_port, *curr;
-    net_info_t *netcon;
-    enum str_type str_type;
-    int err;
-    bool do_telnet = false;
-    bool write_only = false;
-    unsigned int i;
-    struct port_remaddr *r;
+    port_info_t *curr;
 
     so->lock(ports_lock);
-    curr = new_ports;
-    while (curr) {
-	if (strcmp(curr->name, name) == 0) {
-	    /* We don't allow duplicate names. */
-	    so->unlock(ports_lock);
-	    eout->out(eout, "Duplicate connection name: %s", name);
-	    return -1;
-	}
-	curr = curr->next;
+    for (curr = new_ports; curr; curr = curr->next) {
+	if (strcmp(curr->name, name) == 0)
+	    break;
     }
     so->unlock(ports_lock);
+    return curr != NULL;
+}
 
-    new_port = malloc(sizeof(port_info_t));
-    if (new_port == NULL) {
+/* Allocate a port with its lock, timers and runner, but no config. */
+static port_info_t *
+port_alloc(struct absout *eout)
+{
+    port_info_t *new_port;
+
+    if (posix_memalign((void **) &new_port, PORT_CACHE_LINE,
+		       sizeof(port_info_t))) {
 	eout->out(eout, "Could not allocate a port data structure");
-	return -1;
+	return NULL;
     }
     memset(new_port, 0, sizeof(*new_port));
 
@@ -3749,48 +6036,53 @@ portconfig(struct absout *eout,
 	goto errout;
     }
 
+    new_port->state_timer = so->alloc_timer(so, state_timeout, new_port);
+    if (!new_port->state_timer) {
+	eout->out(eout, "Could not allocate timer data");
+	goto errout;
+    }
+
+    new_port->batch_timer = so->alloc_timer(so, batch_timeout, new_port);
+    if (!new_port->batch_timer) {
+	eout->out(eout, "Could not allocate timer data");
+	goto errout;
+    }
+
     new_port->runshutdown = so->alloc_runner(so, finish_shutdown_port,
 					     new_port);
     if (!new_port->runshutdown)
 	goto errout;
 
-    new_port->devname = find_str(devname, &str_type, NULL);
-    if (new_port->devname) {
-	if (str_type != DEVNAME) {
-	    free(new_port->devname);
-	    new_port->devname = NULL;
-	} else {
-	    new_port->orig_devname = strdup(devname);
-	    if (!new_port->orig_devname) {
-		eout->out(eout, "unable to allocate original device name");
-		goto errout;
-	    }
-	}
-    }
-    if (!new_port->devname)
-	new_port->devname = strdup(devname);
-    if (!new_port->devname) {
-	eout->out(eout, "unable to allocate device name");
-	goto errout;
-    }
+    return new_port;
 
-    /* Errors from here on out must goto errout. */
-    init_port_data(new_port);
+errout:
+    free_port(new_port);
+    return NULL;
+}
 
-    if (!new_port->name) {
-	new_port->name = strdup(name);
-	if (!new_port->name) {
-	    eout->out(eout, "unable to allocate port name");
-	    goto errout;
-	}
+/*
+ * Handle the state and options for a port.  Options meant for the
+ * device are appended to the port's devname, which must be set to
+ * something before this is called.
+ */
+static int
+port_parse_config(struct absout *eout, port_info_t *new_port,
+		  const char *state, unsigned int timeout,
+		  const char * const *devcfg,
+		  bool *do_telnet, bool *write_only)
+{
+    unsigned int i;
+    int err;
+
+    new_port->sh = port_shared_alloc();
+    if (!new_port->sh) {
+	eout->out(eout, "Could not allocate port configuration");
+	return -1;
     }
 
-    if (!new_port->accstr) {
-	new_port->accstr = strdup(accstr);
-	if (!new_port->accstr) {
-	    eout->out(eout, "unable to allocate port accepter string");
-	    goto errout;
-	}
+    if (init_port_data(new_port)) {
+	eout->out(eout, "Out of memory getting port defaults");
+	return -1;
     }
 
     if (strcmp(state, "on") == 0) {
@@ -3800,16 +6092,16 @@ portconfig(struct absout *eout,
     } else if (strcmp(state, "rawlp") == 0) {
 	/* FIXME - remove this someday. */
 	new_port->enabled = true;
-	write_only = true;
+	*write_only = true;
     } else if (strcmp(state, "telnet") == 0) {
 	/* FIXME - remove this someday. */
 	new_port->enabled = true;
-	do_telnet = true;
+	*do_telnet = true;
     } else if (strcmp(state, "off") == 0) {
 	new_port->enabled = false;
     } else {
 	eout->out(eout, "state was invalid");
-	goto errout;
+	return -1;
     }
 
     new_port->timeout = timeout;
@@ -3817,24 +6109,149 @@ portconfig(struct absout *eout,
     for (i = 0; devcfg[i]; i++) {
 	err = myconfig(new_port, eout, devcfg[i]);
 	if (err)
-	    goto errout;
+	    return -1;
+    }
+
+    /*
+     * Don't handle the remaddr default until here, we don't want to
+     * mess with it if the user has set it, because the user may set
+     * it to an empty string.
+     */
+    if (!new_port->remaddr_set) {
+	char *remaddr;
+	if (find_default_str("remaddr", &remaddr)) {
+	    eout->out(eout, "Out of memory processing default remote address");
+	} else if (remaddr) {
+	    err = port_add_remaddr(eout, new_port, remaddr);
+	    free(remaddr);
+	    if (err)
+		return -1;
+	}
+    }
+
+    port_intern_shared(new_port);
+
+    return 0;
+}
+
+static void
+copy_trace_info(trace_info_t *t, const trace_info_t *from)
+{
+    *t = *from;
+    t->fd = -1;
+}
+
+/* Set up a port's configuration from a template's parsed port. */
+static int
+port_copy_config(struct absout *eout, port_info_t *new_port,
+		 const port_info_t *proto)
+{
+    new_port->sh = port_shared_get(proto->sh);
+
+    new_port->enabled = proto->enabled;
+    new_port->timeout = proto->timeout;
+    new_port->net_to_dev_state = PORT_CLOSED;
+    new_port->dev_to_net_state = PORT_CLOSED;
+    new_port->telnet_brk_on_sync = proto->telnet_brk_on_sync;
+    new_port->kickolduser_mode = proto->kickolduser_mode;
+    new_port->allow_2217 = proto->allow_2217;
+    new_port->enable_chardelay = proto->enable_chardelay;
+    new_port->chardelay_scale = proto->chardelay_scale;
+    new_port->chardelay_min = proto->chardelay_min;
+    new_port->chardelay_max = proto->chardelay_max;
+    new_port->dev_to_net.maxsize = proto->dev_to_net.maxsize;
+    new_port->net_to_dev.maxsize = proto->net_to_dev.maxsize;
+    new_port->max_connections = proto->max_connections;
+    new_port->keep_dev_open = proto->keep_dev_open;
+    new_port->dev_backlog.maxsize = proto->dev_backlog.maxsize;
+    new_port->connback_persist = proto->connback_persist;
+    new_port->connback_retry_max = proto->connback_retry_max;
+    new_port->state_coalesce = proto->state_coalesce;
+    new_port->udp_batch = proto->udp_batch;
+    new_port->relay = proto->relay;
+    new_port->idle_release_time = proto->idle_release_time;
+    new_port->remaddr_set = proto->remaddr_set;
+    copy_trace_info(&new_port->trace_read, &proto->trace_read);
+    copy_trace_info(&new_port->trace_write, &proto->trace_write);
+    copy_trace_info(&new_port->trace_both, &proto->trace_both);
+
+    return 0;
+}
+
+/*
+ * Finish a port whose configuration has been parsed or copied: set
+ * the name, accepter and device, allocate the gensios and buffers,
+ * and add it to the new ports.  devopts holds the options for the
+ * device from the config, each starting with a ','.
+ */
+static int
+port_finish_config(struct absout *eout, port_info_t *new_port,
+		   const char *name, const char *accstr,
+		   const char *devname, const char *devopts,
+		   bool do_telnet, bool write_only)
+{
+    enum str_type str_type;
+    struct port_remaddr *r;
+    char *s;
+    int err;
+
+    new_port->name = strdup(name);
+    if (!new_port->name) {
+	eout->out(eout, "unable to allocate port name");
+	return -1;
+    }
+
+    new_port->accstr = strdup(accstr);
+    if (!new_port->accstr) {
+	eout->out(eout, "unable to allocate port accepter string");
+	return -1;
+    }
+
+    s = find_str(devname, &str_type, NULL);
+    if (s) {
+	if (str_type != DEVNAME) {
+	    free(s);
+	    s = NULL;
+	} else {
+	    new_port->orig_devname = strdup(devname);
+	    if (!new_port->orig_devname) {
+		free(s);
+		eout->out(eout, "unable to allocate original device name");
+		return -1;
+	    }
+	}
+    }
+    if (!s)
+	s = strdup(devname);
+    if (!s) {
+	eout->out(eout, "unable to allocate device name");
+	return -1;
     }
+    new_port->devname = malloc(strlen(s) + strlen(devopts) + 1);
+    if (!new_port->devname) {
+	free(s);
+	eout->out(eout, "unable to allocate device name");
+	return -1;
+    }
+    strcpy(new_port->devname, s);
+    strcat(new_port->devname, devopts);
+    free(s);
 
     if (write_only) {
 	err = strdupcat(&new_port->devname, "WRONLY");
 	if (err) {
 	    eout->out(eout, "Out of memory appending to devname");
-	    goto errout;
+	    return -1;
 	}
     }
 
-    if (new_port->rs485) {
+    if (new_port->sh->rs485) {
 	err = strdupcat(&new_port->devname, "rs485=");
 	if (!err)
-	    err = strdupcat(&new_port->devname, new_port->rs485);
+	    err = strdupcat(&new_port->devname, new_port->sh->rs485);
 	if (err) {
 	    eout->out(eout, "Out of memory appending to devname");
-	    goto errout;
+	    return -1;
 	}
     }
 
@@ -3843,7 +6260,7 @@ portconfig(struct absout *eout,
     if (err) {
 	eout->out(eout, "device configuration %s invalid: %s",
 		  new_port->devname, gensio_err_to_str(err));
-	goto errout;
+	return -1;
     }
 
     err = str_to_gensio_accepter(new_port->accstr, so,
@@ -3851,7 +6268,7 @@ portconfig(struct absout *eout,
 				&new_port->accepter);
     if (err) {
 	eout->out(eout, "Invalid port name/number: %s", gensio_err_to_str(err));
-	goto errout;
+	return -1;
     }
 
     if (new_port->enabled && do_telnet) {
@@ -3865,58 +6282,189 @@ portconfig(struct absout *eout,
 					   handle_port_child_event,
 					   new_port, &parent);
 	if (err)
-	    goto errout;
+	    return -1;
 	new_port->accepter = parent;
     }
 
-    if (gbuf_init(&new_port->dev_to_net, new_port->dev_to_net.maxsize))
-    {
-	eout->out(eout, "Could not allocate dev to net buffer");
-	goto errout;
+    /*
+     * Connect back addresses are assigned to connections now, so
+     * those ports need their connections from the start.
+     */
+    for (r = new_port->sh->remaddrs; r; r = r->next) {
+	if (r->is_connect_back)
+	    break;
+    }
+    if (r && port_alloc_netcons(new_port)) {
+	eout->out(eout, "Could not allocate a port data structure");
+	return -1;
+    }
+
+    for (r = new_port->sh->remaddrs; r; r = r->next)
+	process_remaddr(eout, new_port, r);
+
+    if (!new_port->keep_dev_open && !new_port->has_connect_back)
+	new_port->dev_backlog.maxsize = 0;
+    if (new_port->dev_backlog.maxsize &&
+		gbuf_init(&new_port->dev_backlog, new_port->dev_backlog.maxsize))
+    {
+	eout->out(eout, "Could not allocate device backlog buffer");
+	return -1;
+    }
+
+    if (new_port->sh->tap_file && tap_file_open(eout, new_port))
+	return -1;
+
+    /* The state is published when the port is started. */
+    new_port->stats = stats_slot_get(new_port->name);
+
+    /* Connect backs already keep the device open and use the data. */
+    if (new_port->has_connect_back)
+	new_port->keep_dev_open = false;
+
+    port_select_data_path(new_port);
+
+    /* Link it on the end of new_ports for now. */
+    so->lock(ports_lock);
+    if (new_ports_end)
+	new_ports_end->next = new_port;
+    else
+	new_ports = new_port;
+    new_ports_end = new_port;
+    so->unlock(ports_lock);
+
+    return 0;
+}
+
+/* Create a port based on a set of parameters passed in. */
+int
+portconfig(struct absout *eout,
+	   const char *name,
+	   const char *accstr,
+	   const char *state,
+	   unsigned int timeout,
+	   const char *devname,
+	   const char * const *devcfg)
+{
+    port_info_t *new_port;
+    bool do_telnet = false;
+    bool write_only = false;
+    char *devopts = NULL;
+    int rv = -1;
+
+    if (port_name_in_use(name)) {
+	/* We don't allow duplicate names. */
+	eout->out(eout, "Duplicate connection name: %s", name);
+	return -1;
+    }
+
+    new_port = port_alloc(eout);
+    if (!new_port)
+	return -1;
+
+    /* Errors from here on out must goto errout. */
+
+    /* Device options from the config get added on to this. */
+    new_port->devname = strdup("");
+    if (!new_port->devname) {
+	eout->out(eout, "unable to allocate device name");
+	goto errout;
+    }
+
+    if (port_parse_config(eout, new_port, state, timeout, devcfg,
+			  &do_telnet, &write_only))
+	goto errout;
+
+    devopts = new_port->devname;
+    new_port->devname = NULL;
+    rv = port_finish_config(eout, new_port, name, accstr, devname, devopts,
+			    do_telnet, write_only);
+    free(devopts);
+    if (rv)
+	goto errout;
+
+    return 0;
+
+errout:
+    free_port(new_port);
+    return -1;
+}
+
+/*
+ * A template is a port that has been through the option parsing but
+ * has no name, accepter, device, or gensios.  Each instance copies
+ * the parsed configuration and shares the configuration strings, so
+ * the options are only handled once however many ports are made.
+ */
+struct port_template
+{
+    port_info_t *proto;
+    bool do_telnet;
+    bool write_only;
+};
+
+struct port_template *
+port_template_alloc(struct absout *eout,
+		    const char *state,
+		    unsigned int timeout,
+		    const char * const *devcfg)
+{
+    struct port_template *t;
+
+    t = malloc(sizeof(*t));
+    if (!t) {
+	eout->out(eout, "Could not allocate template");
+	return NULL;
     }
+    memset(t, 0, sizeof(*t));
 
-    if (gbuf_init(&new_port->net_to_dev, new_port->net_to_dev.maxsize))
-    {
-	eout->out(eout, "Could not allocate net to dev buffer");
+    t->proto = malloc(sizeof(port_info_t));
+    if (!t->proto) {
+	eout->out(eout, "Could not allocate template");
 	goto errout;
     }
+    memset(t->proto, 0, sizeof(port_info_t));
 
-    /*
-     * Don't handle the remaddr default until here, we don't want to
-     * mess with it if the user has set it, because the user may set
-     * it to an empty string.
-     */
-    if (!new_port->remaddr_set) {
-	char *remaddr;
-	if (find_default_str("remaddr", &remaddr)) {
-	    eout->out(eout, "Out of memory processing default remote address");
-	} else if (remaddr) {
-	    err = port_add_remaddr(eout, new_port, remaddr);
-	    free(remaddr);
-	    if (err)
-		goto errout;
-	}
+    t->proto->devname = strdup("");
+    if (!t->proto->devname) {
+	eout->out(eout, "unable to allocate device name");
+	goto errout;
     }
 
-    new_port->netcons = malloc(sizeof(net_info_t) * new_port->max_connections);
-    if (new_port->netcons == NULL) {
-	eout->out(eout, "Could not allocate a port data structure");
+    if (port_parse_config(eout, t->proto, state, timeout, devcfg,
+			  &t->do_telnet, &t->write_only))
 	goto errout;
+
+    return t;
+
+errout:
+    port_template_free(t);
+    return NULL;
+}
+
+int
+port_template_instantiate(struct absout *eout,
+			  struct port_template *t,
+			  const char *name,
+			  const char *accstr,
+			  const char *devname)
+{
+    port_info_t *new_port;
+
+    if (port_name_in_use(name)) {
+	eout->out(eout, "Duplicate connection name: %s", name);
+	return -1;
     }
-    memset(new_port->netcons, 0,
-	   sizeof(net_info_t) * new_port->max_connections);
-    for_each_connection(new_port, netcon)
-	netcon->port = new_port;
 
-    for (r = new_port->remaddrs; r; r = r->next)
-	process_remaddr(eout, new_port, r);
+    new_port = port_alloc(eout);
+    if (!new_port)
+	return -1;
 
-    /* Link it on the end of new_ports for now. */
-    if (new_ports_end)
-	new_ports_end->next = new_port;
-    else
-	new_ports = new_port;
-    new_ports_end = new_port;
+    if (port_copy_config(eout, new_port, t->proto))
+	goto errout;
+
+    if (port_finish_config(eout, new_port, name, accstr, devname,
+			   t->proto->devname, t->do_telnet, t->write_only))
+	goto errout;
 
     return 0;
 
@@ -3925,12 +6473,111 @@ errout:
     return -1;
 }
 
+void
+port_template_free(struct port_template *t)
+{
+    if (t->proto)
+	free_port(t->proto);
+    free(t);
+}
+
+/*
+ * Can a reconfig give the device of an idle keep-device-open port to
+ * its new config?  Only if the device string is the same and the new
+ * config keeps the device open the same way.
+ */
+static bool
+port_dev_can_move(port_info_t *curr, port_info_t *new)
+{
+    return (curr->dev_idle && new->enabled && new->keep_dev_open &&
+	    !curr->has_connect_back && !new->has_connect_back &&
+	    strcmp(curr->devname, new->devname) == 0);
+}
+
+/*
+ * Give the open device of an idle port to its new config, like the
+ * accepter is moved, so the device is not closed and opened again.
+ * The openstr is not sent again, the device is already set up.
+ * Both ports are locked.
+ */
+static int
+port_dev_move(port_info_t *curr, port_info_t *new)
+{
+    struct gensio *tmp;
+    struct timeval timeout;
+    int err;
+
+    err = port_alloc_bufs(new);
+    if (err)
+	return err;
+
+    so->stop_timer(curr->timer);
+    tmp = new->io;
+    new->io = curr->io;
+    curr->io = tmp;
+    gensio_set_callback(new->io, handle_dev_event, new);
+    gensio_set_callback(curr->io, handle_dev_event, curr);
+    new->io_open = true;
+    curr->io_open = false;
+
+    if (new->dev_backlog.maxsize && gbuf_cursize(&curr->dev_backlog))
+	gbuf_append_keep_newest(&new->dev_backlog, curr->dev_backlog.buf,
+				gbuf_cursize(&curr->dev_backlog));
+    curr->dev_idle = false;
+    new->dev_idle = true;
+    port_close_traces(curr);
+
+    extract_bps_bpc(new);
+    recalc_port_chardelay(new);
+    new->dev_write_handler = handle_dev_fd_normal_write;
+    setup_trace(new);
+    port_select_data_path(new);
+
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    so->start_timer(new->timer, &timeout);
+    return 0;
+}
+
+/*
+ * A reconfig removed or changed an idle keep-device-open port in a
+ * way that can't keep the device.  Nobody is connected, so go right
+ * to closing the device, finish_shutdown_port() frees the port and
+ * starts any new config after the device is closed.  The port is
+ * locked.
+ */
+static void
+port_dev_idle_shutdown(port_info_t *port)
+{
+    port->dev_idle = false;
+    event_post(EVENT_SHUTDOWN, port->name, "reason", "reconfig", NULL);
+    gensio_set_read_callback_enable(port->io, false);
+    port->shutdown_timeout_count = 4;
+    port_set_state(port, dev_to_net_state, PORT_CLOSING);
+    port_set_state(port, net_to_dev_state, PORT_CLOSING);
+    start_shutdown_port_io(port);
+    port_publish_state(port);
+}
+
 void
 apply_new_ports(void)
 {
     port_info_t *new, *curr, *next, *prev, *new_prev;
     int err;
 
+    /*
+     * Look up all the new remote addresses at once, then compile
+     * them, before anything is switched.  Only the configuration
+     * reader changes new_ports, and this is it, so no lock is needed
+     * to go through it.  The lookups may block.
+     */
+    resolve_pending(find_default_int("resolver-ttl"));
+    for (curr = new_ports; curr; curr = curr->next)
+	port_compile_remaddrs(curr);
+    so->lock(shared_lock);
+    shared_gen++;
+    so->unlock(shared_lock);
+
     so->lock(ports_lock);
     /* First turn off all the accepters. */
     for (curr = ports; curr; curr = curr->next) {
@@ -3970,10 +6617,16 @@ apply_new_ports(void)
 	for (prev = NULL, curr = ports; curr; prev = curr, curr = curr->next) {
 	    so->lock(curr->lock);
 	    if (strcmp(curr->name, new->name) == 0) {
+		if (port_dev_can_move(curr, new) && port_dev_move(curr, new))
+		    syslog(LOG_ERR, "Out of memory keeping device open on"
+			   " port %s, reopening it", curr->name);
 		if (port_in_use(curr)) {
 		    /* If we are disabling, kick off old users. */
 		    if (!new->enabled && curr->enabled)
 			shutdown_all_netcons(curr);
+		} else if (curr->dev_idle) {
+		    /* The device can't be kept, close it first. */
+		    port_dev_idle_shutdown(curr);
 		} else {
 		    if (strcmp(curr->accstr, new->accstr) == 0 &&
 					curr->enabled) {
@@ -3991,7 +6644,8 @@ apply_new_ports(void)
 			gensio_acc_set_user_data(curr->accepter, curr);
 			gensio_acc_set_user_data(new->accepter, new);
 		    }
-		    /* Just let the old one get deleted. */
+		    /* Keep any monitors, let the old one get deleted. */
+		    port_move_taps(curr, new);
 		    so->unlock(curr->lock);
 		    break;
 		}
@@ -4041,6 +6695,9 @@ apply_new_ports(void)
 	    gensio_acc_disable(curr->accepter);
 	curr->deleted = true;
 	curr->enabled = false;
+	if (curr->dev_idle)
+	    /* Close the kept open device, then it gets freed. */
+	    port_dev_idle_shutdown(curr);
 	if (!port_in_use(curr)) {
 	    so->unlock(curr->lock);
 	    free_port(curr);
@@ -4056,20 +6713,21 @@ apply_new_ports(void)
 
     /* Now start up the new ports. */
     ports = new_ports;
+    ports_gen++;
     new_ports = NULL;
     new_ports_end = NULL;
 
     for (curr = ports; curr; curr = curr->next) {
 	so->lock(curr->lock);
 	if (!curr->deleted) {
-	    curr->dev_to_net_state = PORT_CLOSED;
-	    curr->net_to_dev_state = PORT_CLOSED;
+	    port_set_state(curr, dev_to_net_state, PORT_CLOSED);
+	    port_set_state(curr, net_to_dev_state, PORT_CLOSED);
 	    if (curr->accepter_stopped) {
 		curr->accepter_stopped = false;
 		if (curr->enabled) {
 		    gensio_acc_set_accept_callback_enable(curr->accepter, true);
-		    curr->dev_to_net_state = PORT_UNCONNECTED;
-		    curr->net_to_dev_state = PORT_UNCONNECTED;
+		    port_set_state(curr, dev_to_net_state, PORT_UNCONNECTED);
+		    port_set_state(curr, net_to_dev_state, PORT_UNCONNECTED);
 		} else {
 		    gensio_acc_disable(curr->accepter);
 		}
@@ -4107,7 +6765,7 @@ showshortport(struct controller_info *cntlr, port_info_t *port)
 
     netcon = first_live_net_con(port);
     if (!netcon)
-	netcon = &(port->netcons[0]);
+	netcon = port->netcons;
 
     if (port_in_use(port)) {
 	gensio_raddr_to_str(netcon->net, NULL, buffer, sizeof(buffer));
@@ -4125,8 +6783,13 @@ showshortport(struct controller_info *cntlr, port_info_t *port)
     controller_outputf(cntlr, "%-22s ", port->devname);
     controller_outputf(cntlr, "%-14s ", state_str[port->net_to_dev_state]);
     controller_outputf(cntlr, "%-14s ", state_str[port->dev_to_net_state]);
-    controller_outputf(cntlr, "%9lu ", (unsigned long) netcon->bytes_received);
-    controller_outputf(cntlr, "%9lu ", (unsigned long) netcon->bytes_sent);
+    if (netcon) {
+	controller_outputf(cntlr, "%9lu ",
+			   (unsigned long) netcon->bytes_received);
+	controller_outputf(cntlr, "%9lu ", (unsigned long) netcon->bytes_sent);
+    } else {
+	controller_outputf(cntlr, "%9lu %9lu ", 0UL, 0UL);
+    }
     controller_outputf(cntlr, "%9lu ", (unsigned long)port->dev_bytes_received);
     controller_outputf(cntlr, "%9lu ", (unsigned long) port->dev_bytes_sent);
 
@@ -4143,6 +6806,8 @@ showport(struct controller_info *cntlr, port_info_t *port)
 {
     char buffer[NI_MAXHOST + NI_MAXSERV + 2], *cfg, *oth = NULL;
     net_info_t *netcon;
+    struct tap_sub *sub;
+    char dstr[64], nstr[64];
     int err;
 
     controller_outputf(cntlr, "Port %s\r\n", port->name);
@@ -4205,6 +6870,60 @@ showport(struct controller_info *cntlr, port_info_t *port)
 
     controller_outputf(cntlr, "  bytes written to device: %lu\r\n",
 		       (unsigned long) port->dev_bytes_sent);
+    if (port->state_coalesce)
+	controller_outputf(cntlr, "  state reports merged: modemstate %llu,"
+			   " linestate %llu\r\n",
+			   (unsigned long long) port->modemstate_suppressed,
+			   (unsigned long long) port->linestate_suppressed);
+    if (port->udp_batch)
+	controller_outputf(cntlr, "  udp batch: %llu datagrams in %llu device"
+			   " writes\r\n",
+			   (unsigned long long) port->batch_datagrams,
+			   (unsigned long long) port->batch_writes);
+    if (port->relay)
+	controller_outputf(cntlr, "  relay: %llu bytes passed directly\r\n",
+			   (unsigned long long) port->relay_bytes);
+    data_stages_str(dstr, sizeof(dstr), port->dev_stages,
+		    port->num_dev_stages,
+		    port->dev_read_handler == handle_dev_read_minimal);
+    data_stages_str(nstr, sizeof(nstr), port->net_stages,
+		    port->num_net_stages,
+		    port->net_read_handler == handle_net_fd_read_minimal);
+    controller_outputf(cntlr, "  data path: from device %s, from network %s"
+		       "\r\n", dstr, nstr);
+
+    for_each_tap(port->taps, sub) {
+	gensiods sent, dropped;
+	char filter[128];
+
+	tap_sub_stats(sub, &sent, &dropped);
+	tap_filter_str(tap_sub_filter(sub), filter, sizeof(filter));
+	controller_outputf(cntlr, "  tap: %s %s, sent %lu, dropped %lu"
+			   " bytes\r\n", tap_sub_desc(sub), filter,
+			   (unsigned long) sent, (unsigned long) dropped);
+    }
+
+    if (port->keep_dev_open)
+	controller_outputf(cntlr, "  device kept open: %s, backlog %lu of"
+			   " %lu bytes\r\n",
+			   port->dev_idle ? "idle" : "active",
+			   (unsigned long) gbuf_cursize(&port->dev_backlog),
+			   (unsigned long) port->dev_backlog.maxsize);
+    else if (port->dev_backlog.maxsize)
+	controller_outputf(cntlr, "  connect back backlog %lu of %lu bytes\r\n",
+			   (unsigned long) gbuf_cursize(&port->dev_backlog),
+			   (unsigned long) port->dev_backlog.maxsize);
+
+    for_each_connection(port, netcon) {
+	if (!netcon->connect_back)
+	    continue;
+	controller_outputf(cntlr, "  connect back %s: %s", netcon->remote_str,
+			   netcon->cb_dialing ? "dialing" :
+			   netcon->net ? "connected" : "down");
+	if (!netcon->net && netcon->cb_backoff)
+	    controller_outputf(cntlr, ", backoff %u secs", netcon->cb_backoff);
+	controller_outputf(cntlr, "\r\n");
+    }
 
     if (port->new_config != NULL) {
 	controller_outputf(cntlr, "  Port will be reconfigured when current"
@@ -4271,6 +6990,141 @@ showports(struct controller_info *cntlr, char *portspec)
     }
 }
 
+/* The fields of showport as a JSON record. */
+static void
+showport_json_port(struct controller_info *cntlr, port_info_t *port)
+{
+    char buffer[NI_MAXHOST + NI_MAXSERV + 2], *cfg = NULL, *oth = NULL;
+    net_info_t *netcon;
+    struct tap_sub *sub;
+    char dstr[64], nstr[64];
+
+    controller_json_begin(cntlr);
+    controller_json_open(cntlr, "port", '{');
+    controller_json_str(cntlr, "name", port->name);
+    controller_json_str(cntlr, "accepter", port->accstr);
+    controller_json_str(cntlr, "enable", enabled_str[port->enabled]);
+    controller_json_num(cntlr, "timeout", port->timeout);
+
+    controller_json_open(cntlr, "connections", '[');
+    for_each_connection(port, netcon) {
+	if (!netcon->net)
+	    continue;
+	gensio_raddr_to_str(netcon->net, NULL, buffer, sizeof(buffer));
+	controller_json_open(cntlr, NULL, '{');
+	controller_json_str(cntlr, "remote", buffer);
+	controller_json_num(cntlr, "bytes_read", netcon->bytes_received);
+	controller_json_num(cntlr, "bytes_written", netcon->bytes_sent);
+	controller_json_close(cntlr, '}');
+    }
+    controller_json_close(cntlr, ']');
+
+    controller_json_str(cntlr, "device", port->devname);
+    if (port->orig_devname)
+	controller_json_str(cntlr, "orig_device", port->orig_devname);
+    if (!gensio_raddr_to_str(port->io, NULL, buffer, sizeof(buffer))) {
+	cfg = strchr(buffer, ',');
+	if (cfg) {
+	    cfg++;
+	    oth = strchr(cfg, ' ');
+	} else {
+	    cfg = "";
+	    oth = strchr(buffer, ' ');
+	}
+	if (oth) {
+	    *oth = '\0';
+	    oth++;
+	} else {
+	    oth = "";
+	}
+    }
+    controller_json_str(cntlr, "device_config", cfg);
+    controller_json_str(cntlr, "device_controls", oth);
+
+    controller_json_str(cntlr, "tcp_to_device_state",
+			state_str[port->net_to_dev_state]);
+    controller_json_str(cntlr, "device_to_tcp_state",
+			state_str[port->dev_to_net_state]);
+    controller_json_num(cntlr, "device_bytes_read", port->dev_bytes_received);
+    controller_json_num(cntlr, "device_bytes_written", port->dev_bytes_sent);
+    controller_json_num(cntlr, "modemstate_suppressed",
+			port->modemstate_suppressed);
+    controller_json_num(cntlr, "linestate_suppressed",
+			port->linestate_suppressed);
+    controller_json_num(cntlr, "udp_batch_datagrams", port->batch_datagrams);
+    controller_json_num(cntlr, "udp_batch_writes", port->batch_writes);
+    controller_json_num(cntlr, "relay_bytes", port->relay_bytes);
+    data_stages_str(dstr, sizeof(dstr), port->dev_stages,
+		    port->num_dev_stages,
+		    port->dev_read_handler == handle_dev_read_minimal);
+    controller_json_str(cntlr, "device_data_path", dstr);
+    data_stages_str(nstr, sizeof(nstr), port->net_stages,
+		    port->num_net_stages,
+		    port->net_read_handler == handle_net_fd_read_minimal);
+    controller_json_str(cntlr, "network_data_path", nstr);
+
+    controller_json_open(cntlr, "taps", '[');
+    for_each_tap(port->taps, sub) {
+	gensiods sent, dropped;
+	char filter[128];
+
+	tap_sub_stats(sub, &sent, &dropped);
+	tap_filter_str(tap_sub_filter(sub), filter, sizeof(filter));
+	controller_json_open(cntlr, NULL, '{');
+	controller_json_str(cntlr, "type", tap_sub_desc(sub));
+	controller_json_str(cntlr, "filter", filter);
+	controller_json_num(cntlr, "sent", sent);
+	controller_json_num(cntlr, "dropped", dropped);
+	controller_json_close(cntlr, '}');
+    }
+    controller_json_close(cntlr, ']');
+
+    controller_json_bool(cntlr, "reconfig_pending", port->new_config != NULL);
+    controller_json_bool(cntlr, "deleted", port->deleted);
+    controller_json_close(cntlr, '}');
+    controller_json_end(cntlr);
+}
+
+int
+showport_json(struct controller_info *cntlr, const char *portspec,
+	      unsigned int idx)
+{
+    port_info_t *port;
+
+    if (portspec) {
+	port = find_port_by_name((char *) portspec, true);
+    } else {
+	/*
+	 * Walk to the port by index each time, that way nothing is
+	 * held between ports.  Ports added or removed during a walk
+	 * show up as a new generation.
+	 */
+	so->lock(ports_lock);
+	for (port = ports; port && idx > 0; port = port->next)
+	    idx--;
+	if (port)
+	    so->lock(port->lock);
+	so->unlock(ports_lock);
+    }
+    if (!port)
+	return -1;
+
+    showport_json_port(cntlr, port);
+    so->unlock(port->lock);
+    return 0;
+}
+
+unsigned int
+ports_generation(void)
+{
+    unsigned int gen;
+
+    so->lock(ports_lock);
+    gen = ports_gen;
+    so->unlock(ports_lock);
+    return gen;
+}
+
 /* Handle a showport command from the control port. */
 void
 showshortports(struct controller_info *cntlr, char *portspec)
@@ -4315,6 +7169,110 @@ showshortports(struct controller_info *cntlr, char *portspec)
     }
 }
 
+static size_t
+strsize(const char *str)
+{
+    if (!str)
+	return 0;
+    return strlen(str) + 1;
+}
+
+/* Memory used by a port's shared configuration. */
+static size_t
+port_shared_size(struct port_shared *sh)
+{
+    struct port_remaddr *r;
+    size_t size = sizeof(*sh);
+
+    size += strsize(sh->bannerstr);
+    size += strsize(sh->signaturestr);
+    size += strsize(sh->openstr);
+    size += strsize(sh->closestr);
+    if (sh->closeon)
+	size += sh->closeon_len + 1;
+    size += strsize(sh->authdir);
+    size += strsize(sh->rs485);
+    size += strsize(sh->trace_read_file);
+    size += strsize(sh->trace_write_file);
+    size += strsize(sh->trace_both_file);
+    size += strsize(sh->tap_file);
+    size += strsize(sh->tap_filter);
+    for (r = sh->remaddrs; r; r = r->next)
+	size += sizeof(*r) + strsize(r->str);
+    if (sh->remtrie)
+	size += addrtrie_size(sh->remtrie);
+    return size;
+}
+
+/* Memory used by a port that is not shared with other ports. */
+static size_t
+port_own_size(port_info_t *port)
+{
+    size_t size = sizeof(*port);
+
+    if (port->netcons)
+	size += sizeof(net_info_t) * port->max_connections;
+    if (port->dev_to_net.buf)
+	size += port->dev_to_net.maxsize;
+    if (port->net_to_dev.buf)
+	size += port->net_to_dev.maxsize;
+    if (port->dev_backlog.buf)
+	size += port->dev_backlog.maxsize;
+    size += strsize(port->name);
+    size += strsize(port->accstr);
+    size += strsize(port->devname);
+    size += strsize(port->orig_devname);
+    return size;
+}
+
+/*
+ * Handle a showmem command from the control port.  This shows the
+ * memory used per port, and what it would be if the configuration
+ * was not shared between ports.
+ */
+void
+showmem(struct controller_info *cntlr)
+{
+    port_info_t *port;
+    struct port_shared *sh;
+    unsigned int i, nports = 0, nshared;
+    size_t own = 0, unshared = 0, shared = 0;
+
+    so->lock(ports_lock);
+    for (port = ports; port; port = port->next) {
+	nports++;
+	own += port_own_size(port);
+	unshared += port_shared_size(port->sh);
+    }
+    so->unlock(ports_lock);
+
+    so->lock(shared_lock);
+    nshared = num_shared;
+    for (i = 0; i < SHARED_HASH_SIZE; i++) {
+	for (sh = shared_hash[i]; sh; sh = sh->hnext)
+	    shared += port_shared_size(sh);
+    }
+    so->unlock(shared_lock);
+
+    controller_outputf(cntlr, "ports: %u\r\n", nports);
+    controller_outputf(cntlr, "port structure: %lu bytes\r\n",
+		       (unsigned long) sizeof(port_info_t));
+    controller_outputf(cntlr, "connection structure: %lu bytes\r\n",
+		       (unsigned long) sizeof(net_info_t));
+    controller_outputf(cntlr, "shared configs: %u\r\n", nshared);
+    controller_outputf(cntlr, "port bytes: %lu\r\n", (unsigned long) own);
+    controller_outputf(cntlr, "config bytes unshared: %lu\r\n",
+		       (unsigned long) unshared);
+    controller_outputf(cntlr, "config bytes shared: %lu\r\n",
+		       (unsigned long) shared);
+    if (nports) {
+	controller_outputf(cntlr, "bytes per port unshared: %lu\r\n",
+			   (unsigned long) ((own + unshared) / nports));
+	controller_outputf(cntlr, "bytes per port shared: %lu\r\n",
+			   (unsigned long) ((own + shared) / nports));
+    }
+}
+
 /* Set the timeout on a port.  The port number and timeout are passed
    in as strings, this code will convert them, return any errors, and
    perform the operation. */
@@ -4430,75 +7388,159 @@ setportenable(struct controller_info *cntlr, char *portspec, char *enable)
     }
     if (rv)
 	port->enabled = !new_enable;
+    port_publish_state(port);
 
  out_unlock:
     so->unlock(port->lock);
 }
 
-/* Start data monitoring on the given port, type may be either "tcp" or
-   "term" and only one direction may be monitored.  This return NULL if
-   the monitor fails.  The monitor output will go to "fd". */
-void *
+/* A controller's monitor of a port, the tap's callback data. */
+struct port_monitor {
+    struct controller_info *cntlr;
+    char portname[];
+};
+
+/* Monitor data is copied into the controller's output ring. */
+static void
+monitor_tap_ready(struct tap_sub *sub, void *cb_data)
+{
+    struct port_monitor *mon = cb_data;
+    struct tap_chunk *chunk;
+    gensiods dropped;
+
+    while ((chunk = tap_sub_next(sub))) {
+	dropped = controller_write(mon->cntlr, mon->portname,
+				   chunk->dir == TAP_DIR_NET ? "tcp" : "term",
+				   (char *) chunk->data, chunk->len);
+	tap_sub_done(sub, chunk, dropped);
+    }
+}
+
+/*
+ * Start data monitoring on the given port, type may be "tcp", "term"
+ * or "both".  filterstr may be NULL, or a tap filter.  Any number of
+ * monitors may be on a port or on a controller.  Returns 0 on
+ * success, -1 if the monitor fails.
+ */
+int
 data_monitor_start(struct controller_info *cntlr,
 		   char                   *type,
-		   char                   *portspec)
+		   char                   *portspec,
+		   char                   *filterstr)
 {
+    struct tap_filter f = { 0 };
+    struct port_monitor *mon;
+    struct tap_sub *sub;
     port_info_t *port;
+    const char *errstr;
 
-    port = find_port_by_name(portspec, true);
-    if (port == NULL) {
-	char *err = "Invalid port number: ";
+    if (strcmp(type, "tcp") == 0) {
+	f.dirs = TAP_DIR_NET;
+    } else if (strcmp(type, "term") == 0) {
+	f.dirs = TAP_DIR_DEV;
+    } else if (strcmp(type, "both") == 0) {
+	f.dirs = TAP_DIR_BOTH;
+    } else {
+	char *err = "invalid monitor type: ";
 	controller_outs(cntlr, err);
-	controller_outs(cntlr, portspec);
+	controller_outs(cntlr, type);
 	controller_outs(cntlr, "\r\n");
-	goto out;
+	return -1;
     }
 
-    if ((port->net_monitor != NULL) || (port->dev_monitor != NULL)) {
-	char *err = "Port is already being monitored";
-	controller_outs(cntlr, err);
-	controller_outs(cntlr, "\r\n");
-	goto out_unlock;
+    if (filterstr) {
+	errstr = tap_filter_parse(&f, filterstr);
+	if (errstr) {
+	    tap_filter_free(&f);
+	    controller_outputf(cntlr, "%s: %s\r\n", errstr, filterstr);
+	    return -1;
+	}
     }
 
-    if (strcmp(type, "tcp") == 0) {
-	port->net_monitor = cntlr;
-    } else if (strcmp(type, "term") == 0) {
-	port->dev_monitor = cntlr;
-    } else {
-	char *err = "invalid monitor type: ";
+    mon = malloc(sizeof(*mon) + strlen(portspec) + 1);
+    if (!mon) {
+	tap_filter_free(&f);
+	controller_outs(cntlr, "Out of memory allocating monitor\r\n");
+	return -1;
+    }
+    mon->cntlr = cntlr;
+    strcpy(mon->portname, portspec);
+
+    sub = tap_sub_alloc(&f, "monitor", monitor_tap_ready, free, mon);
+    tap_filter_free(&f);
+    if (!sub) {
+	free(mon);
+	controller_outs(cntlr, "Out of memory allocating monitor\r\n");
+	return -1;
+    }
+
+    port = find_port_by_name(portspec, true);
+    if (port == NULL) {
+	char *err = "Invalid port number: ";
 	controller_outs(cntlr, err);
-	controller_outs(cntlr, type);
+	controller_outs(cntlr, portspec);
 	controller_outs(cntlr, "\r\n");
-	so->unlock(port->lock);
-	port = NULL;
-	goto out;
+	tap_sub_free(sub);
+	return -1;
     }
- out_unlock:
+    tap_add(&port->taps, sub);
+    port_select_data_path(port);
     so->unlock(port->lock);
- out:
-    return port;
+
+    return 0;
+}
+
+/* Remove the controller's monitors from a locked port. */
+static void
+port_monitor_stop(port_info_t *port, struct controller_info *cntlr)
+{
+    struct tap_sub *sub, *next;
+    struct port_monitor *mon;
+
+    for (sub = port->taps; sub; sub = next) {
+	next = tap_sub_list_next(sub);
+	if (port->tapfile && sub == port->tapfile->sub)
+	    continue;
+	mon = tap_sub_cb_data(sub);
+	if (mon->cntlr == cntlr) {
+	    tap_remove(&port->taps, sub);
+	    tap_sub_free(sub);
+	}
+    }
+    port_select_data_path(port);
 }
 
-/* Stop monitoring the given id. */
+/*
+ * Stop the controller's monitors on the given port, or on all ports
+ * if portspec is NULL.
+ */
 void
 data_monitor_stop(struct controller_info *cntlr,
-		  void                   *monitor_id)
+		  char                   *portspec)
 {
-    port_info_t *port = (port_info_t *) monitor_id;
-    port_info_t *curr;
+    port_info_t *port;
 
-    so->lock(ports_lock);
-    curr = ports;
-    while (curr) {
-	if (curr == port) {
-	    so->lock(port->lock);
-	    port->net_monitor = NULL;
-	    port->dev_monitor = NULL;
-	    so->unlock(port->lock);
-	    break;
+    if (portspec) {
+	port = find_port_by_name(portspec, true);
+	if (port == NULL) {
+	    char *err = "Invalid port number: ";
+	    controller_outs(cntlr, err);
+	    controller_outs(cntlr, portspec);
+	    controller_outs(cntlr, "\r\n");
+	    return;
 	}
-	curr = curr->next;
+	port_monitor_stop(port, cntlr);
+	so->unlock(port->lock);
+	return;
+    }
+
+    so->lock(ports_lock);
+    for (port = ports; port; port = port->next) {
+	so->lock(port->lock);
+	port_monitor_stop(port, cntlr);
+	if (port->new_config)
+	    port_monitor_stop(port->new_config, cntlr);
+	so->unlock(port->lock);
     }
     so->unlock(ports_lock);
 }
@@ -4556,6 +7598,7 @@ shutdown_ports(void)
 		prev->next = port->next;
 	    else
 		ports = port->next;
+	    ports_gen++;
 	    free_port(port);
 	}
     }
@@ -4573,21 +7616,43 @@ shutdown_dataxfer(void)
 {
     if (rotator_shutdown_wait)
 	so->free_waiter(rotator_shutdown_wait);
+    if (rot_lock)
+	so->free_lock(rot_lock);
     if (ports_lock)
 	so->free_lock(ports_lock);
+    if (shared_lock)
+	so->free_lock(shared_lock);
 }
 
 int
 init_dataxfer(void)
 {
+    struct timeval tv;
+
+    /*
+     * Seed the connect back jitter.  Hosts restarted together get the
+     * same seconds and maybe the same pid, but not the same
+     * microseconds.
+     */
+    gettimeofday(&tv, NULL);
+    srand(tv.tv_sec ^ tv.tv_usec ^ ((unsigned int) getpid() << 16));
+
     ports_lock = so->alloc_lock(so);
     if (!ports_lock)
 	goto out_nomem;
 
+    shared_lock = so->alloc_lock(so);
+    if (!shared_lock)
+	goto out_nomem;
+
     rotator_shutdown_wait = so->alloc_waiter(so);
     if (!rotator_shutdown_wait)
 	goto out_nomem;
 
+    rot_lock = so->alloc_lock(so);
+    if (!rot_lock)
+	goto out_nomem;
+
     return 0;
 
  out_nomem:
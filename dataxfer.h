@@ -44,6 +44,24 @@ int portconfig(struct absout *eout,
 	       unsigned int timeout,
 	       const char *devname,
 	       const char * const *devcfg);
+
+/*
+ * Templates handle the state and options once, then create ports
+ * with the given name, accepter and device that share the parsed
+ * configuration.
+ */
+struct port_template;
+struct port_template *port_template_alloc(struct absout *eout,
+					  const char *state,
+					  unsigned int timeout,
+					  const char * const *devcfg);
+int port_template_instantiate(struct absout *eout,
+			      struct port_template *t,
+			      const char *name,
+			      const char *accstr,
+			      const char *devname);
+void port_template_free(struct port_template *t);
+
 void apply_new_ports(void);
 
 /* Shut down all the ports, and provide a way to check when done. */
@@ -61,6 +79,18 @@ void showports(struct controller_info *cntlr, char *portspec);
 /* Show information about a port (as above) but in a one-line format. */
 void showshortports(struct controller_info *cntlr, char *portspec);
 
+/* Send a JSON record for the named port, or the idx'th port if
+   portspec is NULL.  The port lock is only held while it is
+   formatted.  Returns -1 if there is no such port. */
+int showport_json(struct controller_info *cntlr, const char *portspec,
+		  unsigned int idx);
+
+/* This changes whenever ports are added or removed. */
+unsigned int ports_generation(void);
+
+/* Show the memory used by the ports. */
+void showmem(struct controller_info *cntlr);
+
 /* Set the port's timeout.  The parameters are all strings that the
    routine will convert to integers.  Error output will be generated
    on invalid data. */
@@ -80,17 +110,20 @@ void setportenable(struct controller_info *cntlr,
 		   char *portspec,
 		   char *enable);
 
-/* Start data monitoring on the given port, type may be either "tcp" or
-   "term" and only one direction may be monitored.  This return NULL if
-   the monitor fails.  The monitor output will go to the controller
-   via the controller_write() call. */
-void *data_monitor_start(struct controller_info *cntlr,
-			 char *type,
-			 char *portspec);
-
-/* Stop monitoring the given id. */
+/* Start data monitoring on the given port, type may be "tcp", "term"
+   or "both", filter is NULL or a tap filter (see tap.h).  A port may
+   have any number of monitors.  This returns -1 if the monitor fails.
+   The monitor output will go to the controller via the
+   controller_write() call. */
+int data_monitor_start(struct controller_info *cntlr,
+		       char *type,
+		       char *portspec,
+		       char *filter);
+
+/* Stop the controller's monitors on the port, or all of them if
+   portspec is NULL. */
 void data_monitor_stop(struct controller_info *cntlr,
-		       void   *monitor_id);
+		       char   *portspec);
 
 /* Shut down the port, if it is connected. */
 void disconnect_port(struct controller_info *cntlr,
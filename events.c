@@ -0,0 +1,240 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <gensio/gensio.h>
+
+#include "ser2net.h"
+#include "controller.h"
+#include "events.h"
+
+/* Most key/value pairs an event may carry. */
+#define EVENT_MAX_KV	4
+
+struct event_sub {
+    struct event_sub *next;
+    struct controller_info *cntlr;
+    unsigned int mask;
+    unsigned long seq;
+    unsigned long dropped;
+};
+
+static const char *event_names[EVENT_NUM_TYPES] = {
+    [EVENT_CONNECT] = "connect",
+    [EVENT_DISCONNECT] = "disconnect",
+    [EVENT_SHUTDOWN] = "shutdown",
+    [EVENT_DEVERROR] = "deverror",
+    [EVENT_MODEMSTATE] = "modemstate",
+    [EVENT_LINESTATE] = "linestate",
+};
+
+/*
+ * Protects the subscriber list.  Events are posted with port locks
+ * held and the controller output lock is taken under this, so the
+ * only lock that may be taken while holding it is the output lock.
+ */
+static struct gensio_lock *events_lock;
+static struct event_sub *event_subs;
+
+/* Types anyone is subscribed to, checked without the lock. */
+static unsigned int events_wanted;
+
+int
+events_init(void)
+{
+    events_lock = so->alloc_lock(so);
+    if (!events_lock)
+	return GE_NOMEM;
+    return 0;
+}
+
+void
+events_shutdown(void)
+{
+    struct event_sub *sub;
+
+    while (event_subs) {
+	sub = event_subs;
+	event_subs = sub->next;
+	free(sub);
+    }
+    events_wanted = 0;
+    if (events_lock)
+	so->free_lock(events_lock);
+    events_lock = NULL;
+}
+
+const char *
+event_type_name(enum event_type type)
+{
+    if (type >= EVENT_NUM_TYPES)
+	return "unknown";
+    return event_names[type];
+}
+
+const char *
+event_parse_types(const char *str, unsigned int *mask)
+{
+    const char *end;
+    unsigned int i, m = 0;
+    size_t len;
+
+    while (*str) {
+	end = strchr(str, ',');
+	if (!end)
+	    end = str + strlen(str);
+	len = end - str;
+
+	if (len == 3 && strncmp(str, "all", 3) == 0) {
+	    m |= EVENT_ALL;
+	} else {
+	    for (i = 0; i < EVENT_NUM_TYPES; i++) {
+		if (strlen(event_names[i]) == len &&
+			strncmp(str, event_names[i], len) == 0)
+		    break;
+	    }
+	    if (i == EVENT_NUM_TYPES)
+		return "Invalid event type, must be connect, disconnect,"
+		    " shutdown, deverror, modemstate, linestate, or all";
+	    m |= 1 << i;
+	}
+
+	str = end;
+	if (*str == ',')
+	    str++;
+    }
+
+    if (!m)
+	return "No event types given";
+    *mask = m;
+    return NULL;
+}
+
+/* Recalculate the types anyone wants, events_lock must be held. */
+static void
+events_update_wanted(void)
+{
+    struct event_sub *sub;
+    unsigned int wanted = 0;
+
+    for (sub = event_subs; sub; sub = sub->next)
+	wanted |= sub->mask;
+    events_wanted = wanted;
+}
+
+int
+events_subscribe(struct controller_info *cntlr, unsigned int mask)
+{
+    struct event_sub *sub, **prev;
+    int rv = 0;
+
+    so->lock(events_lock);
+    for (prev = &event_subs; *prev; prev = &(*prev)->next) {
+	if ((*prev)->cntlr == cntlr)
+	    break;
+    }
+    sub = *prev;
+
+    if (!mask) {
+	if (sub) {
+	    *prev = sub->next;
+	    free(sub);
+	}
+    } else if (sub) {
+	sub->mask = mask;
+    } else {
+	sub = malloc(sizeof(*sub));
+	if (!sub) {
+	    rv = GE_NOMEM;
+	} else {
+	    memset(sub, 0, sizeof(*sub));
+	    sub->cntlr = cntlr;
+	    sub->mask = mask;
+	    sub->next = event_subs;
+	    event_subs = sub;
+	}
+    }
+    events_update_wanted();
+    so->unlock(events_lock);
+
+    return rv;
+}
+
+bool
+events_subscription(struct controller_info *cntlr, unsigned int *mask,
+		    unsigned long *seq, unsigned long *dropped)
+{
+    struct event_sub *sub;
+
+    so->lock(events_lock);
+    for (sub = event_subs; sub; sub = sub->next) {
+	if (sub->cntlr == cntlr) {
+	    *mask = sub->mask;
+	    *seq = sub->seq;
+	    *dropped = sub->dropped;
+	    break;
+	}
+    }
+    so->unlock(events_lock);
+
+    return sub != NULL;
+}
+
+void
+event_post(enum event_type type, const char *port, ...)
+{
+    const char *kv[EVENT_MAX_KV * 2];
+    unsigned int nkv = 0;
+    struct event_sub *sub;
+    struct timespec now;
+    const char *key, *val;
+    va_list ap;
+
+    /* Nobody is listening most of the time, don't bother. */
+    if (!(events_wanted & (1 << type)))
+	return;
+
+    va_start(ap, port);
+    while ((key = va_arg(ap, const char *))) {
+	val = va_arg(ap, const char *);
+	if (!val || nkv >= EVENT_MAX_KV)
+	    continue;
+	kv[nkv * 2] = key;
+	kv[nkv * 2 + 1] = val;
+	nkv++;
+    }
+    va_end(ap);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    so->lock(events_lock);
+    for (sub = event_subs; sub; sub = sub->next) {
+	if (!(sub->mask & (1 << type)))
+	    continue;
+	sub->seq++;
+	if (!controller_event(sub->cntlr, sub->seq, &now,
+			      event_names[type], port, kv, nkv))
+	    sub->dropped++;
+    }
+    so->unlock(events_lock);
+}
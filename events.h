@@ -0,0 +1,78 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+
+/*
+ * Port events pushed to subscribed controllers.  Events are posted
+ * from the data path, usually with the port lock held, and go
+ * straight into the output of every controller subscribed to that
+ * type.  Every subscriber has its own sequence number that is bumped
+ * for each event it wants, even ones it has to drop because its
+ * output is backed up, so a gap in the sequence means lost events.
+ */
+
+enum event_type {
+    EVENT_CONNECT,
+    EVENT_DISCONNECT,
+    EVENT_SHUTDOWN,
+    EVENT_DEVERROR,
+    EVENT_MODEMSTATE,
+    EVENT_LINESTATE,
+    EVENT_NUM_TYPES
+};
+
+#define EVENT_ALL	((1 << EVENT_NUM_TYPES) - 1)
+
+struct controller_info;
+
+/* Allocate the event lock, call before any events are posted. */
+int events_init(void);
+void events_shutdown(void);
+
+const char *event_type_name(enum event_type type);
+
+/*
+ * Parse a comma separated list of event type names, or "all", into
+ * a mask.  Returns NULL on success or an error string.
+ */
+const char *event_parse_types(const char *str, unsigned int *mask);
+
+/*
+ * Subscribe the controller to the events in the mask, replacing any
+ * subscription it already has.  A mask of 0 unsubscribes.  After
+ * unsubscribing no more events will be delivered to the controller.
+ */
+int events_subscribe(struct controller_info *cntlr, unsigned int mask);
+
+/* Get the subscription of a controller, false if it has none. */
+bool events_subscription(struct controller_info *cntlr, unsigned int *mask,
+			 unsigned long *seq, unsigned long *dropped);
+
+/*
+ * Post an event for the given port.  The arguments after the port
+ * are key and value strings, ending with a NULL key.  A NULL value
+ * leaves the key out.
+ */
+void event_post(enum event_type type, const char *port, ...);
+
+#endif /* EVENTS_H */
@@ -0,0 +1,244 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Write trace data in pcapng format, so it can be read by wireshark. */
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "pcapng.h"
+
+#define PCAPNG_BT_SHB		0x0a0d0d0a
+#define PCAPNG_BT_IDB		0x00000001
+#define PCAPNG_BT_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1a2b3c4d
+#define PCAPNG_LINKTYPE_USER0	147
+
+#define PCAPNG_OPT_ENDOFOPT	0
+#define PCAPNG_OPT_COMMENT	1
+#define PCAPNG_SHB_USERAPPL	4
+#define PCAPNG_IF_NAME		2
+#define PCAPNG_IF_TSRESOL	9
+#define PCAPNG_IF_TSOFFSET	14
+#define PCAPNG_EPB_FLAGS	2
+
+#define PAD4(n) (((n) + 3) & ~3)
+
+/* Longest string option we write, the rest is cut off. */
+#define PCAPNG_MAX_STROPT	256
+
+struct pcapng_buf {
+    unsigned char data[PCAPNG_MAX_STROPT + 64];
+    size_t len;
+};
+
+static void
+put_u16(struct pcapng_buf *b, uint16_t v)
+{
+    memcpy(b->data + b->len, &v, sizeof(v));
+    b->len += sizeof(v);
+}
+
+static void
+put_u32(struct pcapng_buf *b, uint32_t v)
+{
+    memcpy(b->data + b->len, &v, sizeof(v));
+    b->len += sizeof(v);
+}
+
+static void
+put_opt(struct pcapng_buf *b, uint16_t code, const void *val, size_t len)
+{
+    put_u16(b, code);
+    put_u16(b, len);
+    if (len)
+	memcpy(b->data + b->len, val, len);
+    memset(b->data + b->len + len, 0, PAD4(len) - len);
+    b->len += PAD4(len);
+}
+
+static void
+put_stropt(struct pcapng_buf *b, uint16_t code, const char *str)
+{
+    size_t len = strlen(str);
+
+    if (len > PCAPNG_MAX_STROPT)
+	len = PCAPNG_MAX_STROPT;
+    put_opt(b, code, str, len);
+}
+
+static int
+pcapng_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t rv;
+
+    while (iovcnt > 0) {
+	rv = writev(fd, iov, iovcnt);
+	if (rv == -1) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	while (iovcnt > 0 && (size_t) rv >= iov->iov_len) {
+	    rv -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = ((char *) iov->iov_base) + rv;
+	    iov->iov_len -= rv;
+	}
+    }
+    return 0;
+}
+
+/* Fill in the block length at the front and end and write it. */
+static int
+finish_block(int fd, struct pcapng_buf *b)
+{
+    uint32_t len = b->len + 4;
+    struct iovec iov = { b->data, len };
+
+    memcpy(b->data + 4, &len, sizeof(len));
+    put_u32(b, len);
+    return pcapng_writev(fd, &iov, 1);
+}
+
+void
+pcapng_clock_init(struct pcapng_clock *clk)
+{
+    struct timespec real, mono;
+    int64_t off;
+
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    off = ((int64_t) real.tv_sec - mono.tv_sec) * 1000000000LL
+	+ real.tv_nsec - mono.tv_nsec;
+    clk->tsoffset = off / 1000000000LL;
+    clk->tsadj = off % 1000000000LL;
+}
+
+uint64_t
+pcapng_now(struct pcapng_clock *clk)
+{
+    struct timespec mono;
+
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return (uint64_t) mono.tv_sec * 1000000000ULL + mono.tv_nsec + clk->tsadj;
+}
+
+int
+pcapng_write_shb(int fd, const char *appl)
+{
+    struct pcapng_buf b;
+    int64_t section_len = -1;
+
+    b.len = 0;
+    put_u32(&b, PCAPNG_BT_SHB);
+    put_u32(&b, 0); /* Length, filled in later. */
+    put_u32(&b, PCAPNG_BYTE_ORDER_MAGIC);
+    put_u16(&b, 1); /* Version 1.0 */
+    put_u16(&b, 0);
+    memcpy(b.data + b.len, &section_len, sizeof(section_len));
+    b.len += sizeof(section_len);
+    put_stropt(&b, PCAPNG_SHB_USERAPPL, appl);
+    put_opt(&b, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    return finish_block(fd, &b);
+}
+
+int
+pcapng_write_idb(int fd, const char *name, struct pcapng_clock *clk)
+{
+    struct pcapng_buf b;
+    uint8_t tsresol = 9;
+
+    b.len = 0;
+    put_u32(&b, PCAPNG_BT_IDB);
+    put_u32(&b, 0);
+    put_u16(&b, PCAPNG_LINKTYPE_USER0);
+    put_u16(&b, 0);
+    put_u32(&b, 0); /* No snaplen */
+    put_stropt(&b, PCAPNG_IF_NAME, name);
+    put_opt(&b, PCAPNG_IF_TSRESOL, &tsresol, sizeof(tsresol));
+    put_opt(&b, PCAPNG_IF_TSOFFSET, &clk->tsoffset, sizeof(clk->tsoffset));
+    put_opt(&b, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    return finish_block(fd, &b);
+}
+
+int
+pcapng_write_epb(int fd, uint32_t ifidx, uint64_t ts, unsigned int dir,
+		 const unsigned char *data, size_t len,
+		 const char *comment, size_t commentlen)
+{
+    struct pcapng_buf hdr, mid, trl;
+    uint32_t flags = dir, blen;
+    struct iovec iov[5];
+
+    if (!comment)
+	commentlen = 0;
+    else if (commentlen > PCAPNG_MAX_STROPT)
+	commentlen = PCAPNG_MAX_STROPT;
+    hdr.len = 0;
+    mid.len = 0;
+    trl.len = 0;
+
+    /*
+     * The data goes out of the caller's buffer and the comment out of
+     * the caller's string, the padding and options around them are
+     * built here.  The whole thing is a single writev.
+     */
+    put_u32(&hdr, PCAPNG_BT_EPB);
+    put_u32(&hdr, 0);
+    put_u32(&hdr, ifidx);
+    put_u32(&hdr, ts >> 32);
+    put_u32(&hdr, ts);
+    put_u32(&hdr, len);
+    put_u32(&hdr, len);
+
+    memset(mid.data, 0, PAD4(len) - len);
+    mid.len = PAD4(len) - len;
+    if (comment) {
+	put_u16(&mid, PCAPNG_OPT_COMMENT);
+	put_u16(&mid, commentlen);
+	memset(trl.data, 0, PAD4(commentlen) - commentlen);
+	trl.len = PAD4(commentlen) - commentlen;
+    }
+    if (dir != PCAPNG_DIR_NONE)
+	put_opt(&trl, PCAPNG_EPB_FLAGS, &flags, sizeof(flags));
+    put_opt(&trl, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+
+    blen = hdr.len + len + mid.len + commentlen + trl.len + 4;
+    memcpy(hdr.data + 4, &blen, sizeof(blen));
+    put_u32(&trl, blen);
+
+    iov[0].iov_base = hdr.data;
+    iov[0].iov_len = hdr.len;
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len = len;
+    iov[2].iov_base = mid.data;
+    iov[2].iov_len = mid.len;
+    iov[3].iov_base = (void *) comment;
+    iov[3].iov_len = commentlen;
+    iov[4].iov_base = trl.data;
+    iov[4].iov_len = trl.len;
+    return pcapng_writev(fd, iov, 5);
+}
@@ -0,0 +1,72 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef PCAPNG_H
+#define PCAPNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Minimal pcapng writer for trace files.  A file is a section header
+ * followed by one interface description per interface, then enhanced
+ * packet blocks.  All blocks are written in host byte order, readers
+ * use the section header to tell.
+ *
+ * Timestamps are in nanoseconds (if_tsresol = 9).  The packets carry
+ * monotonic time plus a sub-second adjustment, the interfaces carry
+ * the whole seconds between the monotonic and real time clocks in
+ * if_tsoffset, so readers show wall clock times.
+ */
+
+/* Direction of a packet, for the epb_flags option. */
+#define PCAPNG_DIR_NONE		0
+#define PCAPNG_DIR_INBOUND	1
+#define PCAPNG_DIR_OUTBOUND	2
+
+struct pcapng_clock {
+    int64_t tsoffset;	/* Seconds, written into each interface. */
+    int64_t tsadj;	/* Nanoseconds, added to each monotonic time. */
+};
+
+/* Fetch the monotonic to real time offset for a new file. */
+void pcapng_clock_init(struct pcapng_clock *clk);
+
+/* Current timestamp to put into a packet. */
+uint64_t pcapng_now(struct pcapng_clock *clk);
+
+/*
+ * Write the section header.  The interfaces must be written next,
+ * numbered from zero in the order they are written.
+ */
+int pcapng_write_shb(int fd, const char *appl);
+
+/* Write an interface description, using LINKTYPE_USER0. */
+int pcapng_write_idb(int fd, const char *name, struct pcapng_clock *clk);
+
+/*
+ * Write a packet.  If comment is not NULL it is added as an
+ * opt_comment, a zero length packet with a comment is used for
+ * events.  Returns 0 on success or -1 with errno set.
+ */
+int pcapng_write_epb(int fd, uint32_t ifidx, uint64_t ts, unsigned int dir,
+		     const unsigned char *data, size_t len,
+		     const char *comment, size_t commentlen);
+
+#endif /* PCAPNG_H */
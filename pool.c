@@ -0,0 +1,214 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <gensio/gensio.h>
+
+#include "ser2net.h"
+#include "controller.h"
+#include "pool.h"
+
+/* Size classes are powers of two from 32 bytes to 64K. */
+#define POOL_MIN_SHIFT		5
+#define POOL_NUM_CLASSES	12
+#define POOL_LARGE		POOL_NUM_CLASSES
+
+/* Don't keep more than this many bytes on a class's free list. */
+#define POOL_MAX_FREE_BYTES	(256 * 1024)
+
+/*
+ * In front of each object.  It is 16 bytes so what is returned is as
+ * aligned as what malloc returns.
+ */
+struct pool_hdr {
+    struct pool_hdr *next;	/* When on the free list. */
+    unsigned int cls;		/* Size class, or POOL_LARGE. */
+};
+#define POOL_HDR_SIZE 16
+
+struct pool_class {
+    struct gensio_lock *lock;
+    struct pool_hdr *free_list;
+    unsigned int num_free;
+    unsigned int max_free;
+
+    /* Statistics */
+    unsigned long hits;		/* Allocations from the free list. */
+    unsigned long misses;	/* Allocations from malloc. */
+    unsigned long trims;	/* Frees that went back to the heap. */
+    unsigned int in_use;
+    unsigned int high_water;	/* Most ever in use at one time. */
+};
+
+/* The last one is for large allocations, it has no free list. */
+static struct pool_class classes[POOL_NUM_CLASSES + 1];
+
+static size_t
+class_size(unsigned int cls)
+{
+    return (size_t) 1 << (cls + POOL_MIN_SHIFT);
+}
+
+static unsigned int
+size_to_class(size_t size)
+{
+    unsigned int cls = 0;
+
+    while (cls < POOL_NUM_CLASSES && class_size(cls) < size)
+	cls++;
+    return cls;
+}
+
+int
+pool_init(void)
+{
+    unsigned int i;
+
+    for (i = 0; i <= POOL_NUM_CLASSES; i++) {
+	classes[i].lock = so->alloc_lock(so);
+	if (!classes[i].lock) {
+	    pool_shutdown();
+	    return ENOMEM;
+	}
+	if (i < POOL_NUM_CLASSES)
+	    classes[i].max_free = POOL_MAX_FREE_BYTES / class_size(i);
+    }
+    return 0;
+}
+
+void
+pool_shutdown(void)
+{
+    struct pool_hdr *h;
+    unsigned int i;
+
+    for (i = 0; i <= POOL_NUM_CLASSES; i++) {
+	while (classes[i].free_list) {
+	    h = classes[i].free_list;
+	    classes[i].free_list = h->next;
+	    free(h);
+	}
+	classes[i].num_free = 0;
+	if (classes[i].lock)
+	    so->free_lock(classes[i].lock);
+	classes[i].lock = NULL;
+    }
+}
+
+void *
+pool_alloc(size_t size)
+{
+    unsigned int cls = size_to_class(size);
+    struct pool_class *c = &classes[cls];
+    struct pool_hdr *h;
+
+    so->lock(c->lock);
+    h = c->free_list;
+    if (h) {
+	c->free_list = h->next;
+	c->num_free--;
+	c->hits++;
+    } else {
+	c->misses++;
+    }
+    c->in_use++;
+    if (c->in_use > c->high_water)
+	c->high_water = c->in_use;
+    so->unlock(c->lock);
+
+    if (!h) {
+	if (cls == POOL_LARGE)
+	    h = malloc(POOL_HDR_SIZE + size);
+	else
+	    h = malloc(POOL_HDR_SIZE + class_size(cls));
+	if (!h) {
+	    so->lock(c->lock);
+	    c->misses--;
+	    c->in_use--;
+	    so->unlock(c->lock);
+	    return NULL;
+	}
+	h->cls = cls;
+    }
+    return ((unsigned char *) h) + POOL_HDR_SIZE;
+}
+
+void *
+pool_zalloc(size_t size)
+{
+    void *data = pool_alloc(size);
+
+    if (data)
+	memset(data, 0, size);
+    return data;
+}
+
+void
+pool_free(void *data)
+{
+    struct pool_hdr *h;
+    struct pool_class *c;
+
+    if (!data)
+	return;
+
+    h = (struct pool_hdr *) (((unsigned char *) data) - POOL_HDR_SIZE);
+    c = &classes[h->cls];
+    so->lock(c->lock);
+    c->in_use--;
+    if (c->num_free < c->max_free) {
+	h->next = c->free_list;
+	c->free_list = h;
+	c->num_free++;
+	h = NULL;
+    } else if (h->cls != POOL_LARGE) {
+	c->trims++;
+    }
+    so->unlock(c->lock);
+    if (h)
+	free(h);
+}
+
+void
+showpools(struct controller_info *cntlr)
+{
+    struct pool_class c;
+    unsigned int i;
+
+    controller_outputf(cntlr, "%8s %10s %10s %10s %8s %8s %8s\r\n",
+		       "size", "hits", "misses", "trims", "inuse", "highwat",
+		       "free");
+    for (i = 0; i <= POOL_NUM_CLASSES; i++) {
+	so->lock(classes[i].lock);
+	c = classes[i];
+	so->unlock(classes[i].lock);
+
+	if (i == POOL_LARGE)
+	    controller_outputf(cntlr, "%8s ", "large");
+	else
+	    controller_outputf(cntlr, "%8lu ", (unsigned long) class_size(i));
+	controller_outputf(cntlr, "%10lu %10lu %10lu %8u %8u %8u\r\n",
+			   c.hits, c.misses, c.trims, c.in_use, c.high_water,
+			   c.num_free);
+    }
+}
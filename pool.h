@@ -0,0 +1,57 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+struct controller_info;
+
+/*
+ * Size classed memory pools for objects that come and go with
+ * connections: buffers, banners, connection arrays and controller
+ * output.  Freed objects are kept on a per size class free list and
+ * reused, up to a limit per class, so connect/disconnect churn does
+ * not fragment the heap.  Anything bigger than the largest class
+ * goes straight to malloc.
+ *
+ * Memory from pool_alloc() must be freed with pool_free(), never with
+ * free(), and vice versa.
+ */
+
+/* Allocate the locks, call before anything uses the pools. */
+int pool_init(void);
+
+/* Free everything on the free lists. */
+void pool_shutdown(void);
+
+void *pool_alloc(size_t size);
+
+/* Like pool_alloc(), but the memory is zeroed. */
+void *pool_zalloc(size_t size);
+
+/* NULL is ignored. */
+void pool_free(void *data);
+
+/* Show the pool statistics on a control port. */
+void showpools(struct controller_info *cntlr);
+
+#endif /* POOL_H */
@@ -0,0 +1,50 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * Static tracepoints (USDT) in the "ser2net" provider, for bpftrace,
+ * perf, or systemtap on a running daemon.  With --with-probes and
+ * sys/sdt.h, each probe is a single nop in the code plus a note in
+ * the ELF file, it costs nothing until something attaches to it.
+ * Otherwise the probes are empty and their arguments are not
+ * evaluated, so the arguments must not have side effects.
+ *
+ * The data path probes take the port name first.  The probes are
+ * listed in ser2net(8), example scripts are in the probes directory.
+ */
+
+#if defined(USE_PROBES)
+#include <sys/sdt.h>
+
+#define S2N_PROBE1(name, a1) DTRACE_PROBE1(ser2net, name, a1)
+#define S2N_PROBE2(name, a1, a2) DTRACE_PROBE2(ser2net, name, a1, a2)
+#define S2N_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(ser2net, name, a1, a2, a3)
+#define S2N_PROBE4(name, a1, a2, a3, a4) \
+    DTRACE_PROBE4(ser2net, name, a1, a2, a3, a4)
+#else
+#define S2N_PROBE1(name, a1) do { } while (0)
+#define S2N_PROBE2(name, a1, a2) do { } while (0)
+#define S2N_PROBE3(name, a1, a2, a3) do { } while (0)
+#define S2N_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+#endif
+
+#endif /* PROBES_H */
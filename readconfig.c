@@ -40,6 +40,7 @@
 #define PORT_BUFSIZE	64	/* Default data transfer buffer size */
 
 static int lineno = 0;
+unsigned int config_errors;
 
 struct longstr_s
 {
@@ -399,6 +400,7 @@ syslog_eprint(struct absout *e, const char *str, ...)
     vsnprintf(buf, sizeof(buf), str, ap);
     va_end(ap);
     syslog(LOG_ERR, "%s on line %d", buf, *((int *) e->data));
+    config_errors++;
     return 0;
 }
 
@@ -437,7 +439,22 @@ struct default_data defaults[] = {
 					.def.intval = PORT_BUFSIZE },
     { "max-connections", GENSIO_DEFAULT_INT,	.min=1, .max=65536,
 					.def.intval = 1 },
+    { "keep-device-open", GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "keep-open-backlog", GENSIO_DEFAULT_INT,	.min=0, .max=1048576,
+					.def.intval = 0 },
+    { "connback-persist", GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "connback-retry-max", GENSIO_DEFAULT_INT,	.min=1, .max=3600,
+					.def.intval = 10 },
+    { "state-coalesce",	GENSIO_DEFAULT_INT,	.min=0, .max=60000,
+					.def.intval = 0 },
+    { "udp-batch",	GENSIO_DEFAULT_INT,	.min=0, .max=1000000,
+					.def.intval = 0 },
+    { "relay",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "idle-release-time", GENSIO_DEFAULT_INT,	.min=0, .max=INT_MAX,
+					.def.intval = 60 },
     { "remaddr",	GENSIO_DEFAULT_STR,	.def.strval = NULL },
+    { "resolver-ttl",	GENSIO_DEFAULT_INT,	.min=0, .max=INT_MAX,
+					.def.intval = 300 },
     { "authdir",	GENSIO_DEFAULT_STR,	.def.strval =
 						DATAROOT "/ser2net/auth" },
     { "authdir-admin",	GENSIO_DEFAULT_STR,	.def.strval =
@@ -893,6 +910,7 @@ readconfig_init(void)
 
     if (err)
 	return err;
+    config_errors = 0;
     free_longstrs();
     free_tracefiles();
     free_rs485confs();
@@ -34,6 +34,13 @@ int yaml_readconfig(FILE *f);
 
 int readconfig_finalize(void);
 
+/*
+ * Number of errors reported while reading the configuration since
+ * readconfig_init(), including errors in single connections that
+ * don't stop the read.
+ */
+extern unsigned int config_errors;
+
 /*
  * Search for a banner/open/close string by name.  Note that the
  * returned value needs to be free-ed when done.
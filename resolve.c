@@ -0,0 +1,432 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <netdb.h>
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include <gensio/gensio.h>
+
+#include "ser2net.h"
+#include "controller.h"
+#include "resolve.h"
+
+#define RESOLVE_HASH_SIZE	256
+#define RESOLVE_THREADS		8	/* Most lookups at once. */
+#define RESOLVE_NEG_TTL		5	/* Seconds to keep a failure. */
+
+struct resolve_entry {
+    struct resolve_entry *next;
+    char *str;
+    bool pending;		/* Queued for resolve_pending(). */
+    int err;			/* If the lookup failed, res is NULL. */
+    struct resolve_result *res;
+    time_t expires;		/* Monotonic seconds. */
+};
+
+struct resolve_batch {
+    struct resolve_entry **work;
+    unsigned int count;
+    unsigned int next;
+    unsigned int ttl;
+};
+
+static struct gensio_lock *resolve_lock;
+static struct resolve_entry *resolve_hash[RESOLVE_HASH_SIZE];
+static unsigned int resolve_entries;
+
+static unsigned long resolve_hits;
+static unsigned long resolve_lookups;
+static unsigned long resolve_failures;
+static unsigned long long resolve_total_usec;
+static unsigned long resolve_max_usec;
+static unsigned int resolve_batch_count;
+static unsigned long resolve_batch_usec;
+
+static time_t
+resolve_now(void)
+{
+    struct timeval now;
+
+    so->get_monotonic_time(so, &now);
+    return now.tv_sec;
+}
+
+static unsigned int
+resolve_hash_str(const char *str)
+{
+    unsigned int h = 5381;
+
+    while (*str)
+	h = h * 33 + (unsigned char) *str++;
+    return h % RESOLVE_HASH_SIZE;
+}
+
+static struct resolve_entry *
+resolve_find(const char *str)
+{
+    struct resolve_entry *e;
+
+    for (e = resolve_hash[resolve_hash_str(str)]; e; e = e->next) {
+	if (strcmp(e->str, str) == 0)
+	    return e;
+    }
+    return NULL;
+}
+
+static struct resolve_entry *
+resolve_new(const char *str)
+{
+    unsigned int h = resolve_hash_str(str);
+    struct resolve_entry *e;
+
+    e = malloc(sizeof(*e));
+    if (!e)
+	return NULL;
+    memset(e, 0, sizeof(*e));
+    e->str = strdup(str);
+    if (!e->str) {
+	free(e);
+	return NULL;
+    }
+    e->next = resolve_hash[h];
+    resolve_hash[h] = e;
+    resolve_entries++;
+    return e;
+}
+
+/* Called with resolve_lock held. */
+static void
+resolve_put_locked(struct resolve_result *res)
+{
+    if (--res->refcount > 0)
+	return;
+    free(res->addrs);
+    free(res);
+}
+
+void
+resolve_put(struct resolve_result *res)
+{
+    so->lock(resolve_lock);
+    resolve_put_locked(res);
+    so->unlock(resolve_lock);
+}
+
+/* Give the cache entry a new result.  Called with resolve_lock held. */
+static void
+resolve_set(struct resolve_entry *e, int err, struct resolve_result *res,
+	    unsigned int ttl)
+{
+    if (e->res)
+	resolve_put_locked(e->res);
+    e->res = res;
+    e->err = err;
+    e->pending = false;
+    e->expires = resolve_now() + (err ? RESOLVE_NEG_TTL : ttl);
+}
+
+/* Is the entry usable?  A ttl of 0 keeps it for the current second. */
+static bool
+resolve_fresh(struct resolve_entry *e, time_t now)
+{
+    return !e->pending && e->expires >= now;
+}
+
+/* Free expired entries.  Called with resolve_lock held. */
+static void
+resolve_prune(bool all)
+{
+    struct resolve_entry **p, *e;
+    time_t now = resolve_now();
+    unsigned int i;
+
+    for (i = 0; i < RESOLVE_HASH_SIZE; i++) {
+	p = &resolve_hash[i];
+	while ((e = *p)) {
+	    if (!all && (e->pending || e->expires >= now)) {
+		p = &e->next;
+		continue;
+	    }
+	    *p = e->next;
+	    if (e->res)
+		resolve_put_locked(e->res);
+	    free(e->str);
+	    free(e);
+	    resolve_entries--;
+	}
+    }
+}
+
+/* Do the actual lookup and time it, this blocks. */
+static int
+resolve_lookup(const char *str, struct resolve_result **rres)
+{
+    struct addrinfo *ai = NULL, *a;
+    struct resolve_result *res = NULL;
+    int socktype, protocol, err;
+    bool is_port_set = false;
+    struct timeval start, end;
+    unsigned long usec;
+    unsigned int n = 0;
+
+    so->get_monotonic_time(so, &start);
+    err = gensio_scan_network_port(so, str, false, &ai, &socktype, &protocol,
+				   &is_port_set, NULL, NULL);
+    so->get_monotonic_time(so, &end);
+    usec = ((end.tv_sec - start.tv_sec) * 1000000 +
+	    (end.tv_usec - start.tv_usec));
+
+    so->lock(resolve_lock);
+    resolve_lookups++;
+    if (err)
+	resolve_failures++;
+    resolve_total_usec += usec;
+    if (usec > resolve_max_usec)
+	resolve_max_usec = usec;
+    so->unlock(resolve_lock);
+    if (err)
+	return err;
+
+    for (a = ai; a; a = a->ai_next)
+	n++;
+    res = malloc(sizeof(*res));
+    if (!res)
+	goto out_nomem;
+    res->addrs = calloc(n ? n : 1, sizeof(*res->addrs));
+    if (!res->addrs)
+	goto out_nomem;
+    res->refcount = 1;
+    res->is_port_set = is_port_set;
+    res->naddrs = 0;
+    for (a = ai; a; a = a->ai_next) {
+	struct resolve_addr *r = &res->addrs[res->naddrs];
+
+	if (a->ai_addrlen > sizeof(r->addr))
+	    continue;
+	memcpy(&r->addr, a->ai_addr, a->ai_addrlen);
+	r->len = a->ai_addrlen;
+	res->naddrs++;
+    }
+    gensio_free_addrinfo(so, ai);
+    *rres = res;
+    return 0;
+
+ out_nomem:
+    if (res)
+	free(res);
+    gensio_free_addrinfo(so, ai);
+    return GE_NOMEM;
+}
+
+void
+resolve_add_pending(const char *str)
+{
+    struct resolve_entry *e;
+
+    so->lock(resolve_lock);
+    e = resolve_find(str);
+    if (!e)
+	e = resolve_new(str);
+    /* If this fails, resolve_get() will look it up by itself. */
+    if (e && !resolve_fresh(e, resolve_now()))
+	e->pending = true;
+    so->unlock(resolve_lock);
+}
+
+static void *
+resolve_worker(void *data)
+{
+    struct resolve_batch *b = data;
+    struct resolve_result *res;
+    struct resolve_entry *e;
+    int err;
+
+    for (;;) {
+	so->lock(resolve_lock);
+	if (b->next >= b->count) {
+	    so->unlock(resolve_lock);
+	    break;
+	}
+	e = b->work[b->next++];
+	so->unlock(resolve_lock);
+
+	res = NULL;
+	err = resolve_lookup(e->str, &res);
+
+	so->lock(resolve_lock);
+	resolve_set(e, err, res, b->ttl);
+	so->unlock(resolve_lock);
+    }
+    return NULL;
+}
+
+void
+resolve_pending(unsigned int ttl)
+{
+    struct resolve_batch b;
+    struct resolve_entry *e;
+    struct timeval start, end;
+    unsigned int i, n = 0;
+#ifdef USE_PTHREADS
+    pthread_t threads[RESOLVE_THREADS - 1];
+    unsigned int nthreads = 0;
+#endif
+
+    memset(&b, 0, sizeof(b));
+    b.ttl = ttl;
+
+    so->lock(resolve_lock);
+    resolve_prune(false);
+    for (i = 0; i < RESOLVE_HASH_SIZE; i++) {
+	for (e = resolve_hash[i]; e; e = e->next)
+	    if (e->pending)
+		n++;
+    }
+    if (n)
+	b.work = malloc(n * sizeof(*b.work));
+    if (b.work) {
+	for (i = 0; i < RESOLVE_HASH_SIZE; i++) {
+	    for (e = resolve_hash[i]; e; e = e->next)
+		if (e->pending)
+		    b.work[b.count++] = e;
+	}
+    }
+    so->unlock(resolve_lock);
+    /* Without the work array resolve_get() does them one at a time. */
+    if (!b.work)
+	return;
+
+    so->get_monotonic_time(so, &start);
+#ifdef USE_PTHREADS
+    while (nthreads < RESOLVE_THREADS - 1 && nthreads + 1 < b.count) {
+	if (pthread_create(&threads[nthreads], NULL, resolve_worker, &b))
+	    break;
+	nthreads++;
+    }
+#endif
+    resolve_worker(&b);
+#ifdef USE_PTHREADS
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+#endif
+    so->get_monotonic_time(so, &end);
+
+    so->lock(resolve_lock);
+    resolve_batch_count = b.count;
+    resolve_batch_usec = ((end.tv_sec - start.tv_sec) * 1000000 +
+			  (end.tv_usec - start.tv_usec));
+    so->unlock(resolve_lock);
+    free(b.work);
+}
+
+int
+resolve_get(const char *str, unsigned int ttl, struct resolve_result **res)
+{
+    struct resolve_result *r = NULL;
+    struct resolve_entry *e;
+    int err;
+
+    so->lock(resolve_lock);
+    e = resolve_find(str);
+    if (e && resolve_fresh(e, resolve_now())) {
+	resolve_hits++;
+	err = e->err;
+	if (!err) {
+	    e->res->refcount++;
+	    *res = e->res;
+	}
+	so->unlock(resolve_lock);
+	return err;
+    }
+    so->unlock(resolve_lock);
+
+    err = resolve_lookup(str, &r);
+
+    so->lock(resolve_lock);
+    e = resolve_find(str);
+    if (!e)
+	e = resolve_new(str);
+    if (e) {
+	if (r)
+	    r->refcount++;
+	resolve_set(e, err, r, ttl);
+    }
+    so->unlock(resolve_lock);
+
+    if (!err)
+	*res = r;
+    return err;
+}
+
+int
+resolve_init(void)
+{
+    resolve_lock = so->alloc_lock(so);
+    if (!resolve_lock)
+	return ENOMEM;
+    return 0;
+}
+
+void
+resolve_shutdown(void)
+{
+    if (!resolve_lock)
+	return;
+    so->lock(resolve_lock);
+    resolve_prune(true);
+    so->unlock(resolve_lock);
+    so->free_lock(resolve_lock);
+    resolve_lock = NULL;
+}
+
+void
+showresolver(struct controller_info *cntlr)
+{
+    unsigned long hits, lookups, failures, max_usec, batch_usec;
+    unsigned long long total_usec;
+    unsigned int entries, batch_count;
+
+    so->lock(resolve_lock);
+    entries = resolve_entries;
+    hits = resolve_hits;
+    lookups = resolve_lookups;
+    failures = resolve_failures;
+    total_usec = resolve_total_usec;
+    max_usec = resolve_max_usec;
+    batch_count = resolve_batch_count;
+    batch_usec = resolve_batch_usec;
+    so->unlock(resolve_lock);
+
+    controller_outputf(cntlr, "resolver cache: %u entries\r\n", entries);
+    controller_outputf(cntlr, "  hits: %lu\r\n", hits);
+    controller_outputf(cntlr, "  lookups: %lu (%lu failed)\r\n",
+		       lookups, failures);
+    controller_outputf(cntlr, "  lookup latency: avg %lu usec, max %lu"
+		       " usec\r\n",
+		       lookups ? (unsigned long) (total_usec / lookups) : 0UL,
+		       max_usec);
+    controller_outputf(cntlr, "  last batch: %u lookups in %lu usec\r\n",
+		       batch_count, batch_usec);
+}
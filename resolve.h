@@ -0,0 +1,72 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+struct controller_info;
+
+/*
+ * A cache of network address lookups, shared by all the ports.  The
+ * addresses a configuration needs are queued while it is read, then
+ * looked up all at once on a few threads before the configuration is
+ * applied.  Lookups are kept for a time to live, so rereading the
+ * configuration doesn't look everything up again.
+ */
+
+struct resolve_addr {
+    struct sockaddr_storage addr;
+    socklen_t len;
+};
+
+struct resolve_result {
+    unsigned int refcount;
+    bool is_port_set;
+    unsigned int naddrs;
+    struct resolve_addr *addrs;
+};
+
+int resolve_init(void);
+void resolve_shutdown(void);
+
+/* Queue an address string for resolve_pending(). */
+void resolve_add_pending(const char *str);
+
+/*
+ * Look up everything queued that isn't already cached, concurrently,
+ * and wait for it to finish.  Results are kept for ttl seconds.
+ */
+void resolve_pending(unsigned int ttl);
+
+/*
+ * Get the addresses for the string, from the cache if they are there,
+ * otherwise they are looked up now.  Returns a gensio error.  The
+ * result must be released with resolve_put().
+ */
+int resolve_get(const char *str, unsigned int ttl,
+		struct resolve_result **res);
+void resolve_put(struct resolve_result *res);
+
+/* Show the cache and latency statistics on a control port. */
+void showresolver(struct controller_info *cntlr);
+
+#endif /* RESOLVE_H */
@@ -0,0 +1,219 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Dump the port statistics ser2net publishes in shared memory, see
+ * stats.h.  This only reads the segment, it never touches the daemon.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+static const char *state_str[] = { "closed", "unconnected", "waiting input",
+				   "waiting output", "closing" };
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+	    "%s: Valid parameters are:\n"
+	    "  -s <shm name> - the name given to ser2net with -S,"
+	    " default /ser2net\n"
+	    "  -i <seconds> - print the stats every interval until killed\n"
+	    "  -p - print name=value lines instead of a table\n",
+	    name);
+    exit(1);
+}
+
+static const char *
+get_arg(int argc, char *argv[], int *i)
+{
+    (*i)++;
+    if (*i == argc) {
+	fprintf(stderr, "No value given for %s\n", argv[*i - 1]);
+	usage(argv[0]);
+    }
+    return argv[*i];
+}
+
+/* Copy a slot, retrying if it changed owners while copying. */
+static void
+read_slot(const struct stats_slot *slot, struct stats_slot *copy)
+{
+    uint64_t seq;
+
+    for (;;) {
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+	    continue;
+	memcpy(copy, slot, sizeof(*copy));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+	    break;
+    }
+    copy->name[STATS_NAME_LEN - 1] = '\0';
+}
+
+static const char *
+slot_state(const struct stats_slot *s)
+{
+    if (!s->enabled)
+	return "off";
+    if (s->state >= sizeof(state_str) / sizeof(state_str[0]))
+	return "unknown";
+    return state_str[s->state];
+}
+
+static void
+print_stats(const struct stats_header *hdr, int parseable)
+{
+    const char *slots = ((const char *) hdr) + hdr->header_size;
+    struct stats_slot s;
+    unsigned int i;
+
+    if (!parseable)
+	printf("%-16s %-14s %5s %12s %12s %12s %12s %6s %6s %8s %8s\n",
+	       "port", "state", "conns", "net in", "net out",
+	       "dev in", "dev out", "deverr", "neterr", "to net",
+	       "to dev");
+    for (i = 0; i < hdr->num_slots; i++) {
+	read_slot((const struct stats_slot *) (slots + i * hdr->slot_size),
+		  &s);
+	if (!s.in_use)
+	    continue;
+	if (parseable) {
+	    printf("port=%s state=%s connections=%u total_connections=%llu"
+		   " rejected_connections=%llu net_bytes_in=%llu"
+		   " net_bytes_out=%llu dev_bytes_in=%llu dev_bytes_out=%llu"
+		   " dev_errors=%llu net_errors=%llu dev_to_net_queue=%llu"
+		   " net_to_dev_queue=%llu modemstate_suppressed=%llu"
+		   " linestate_suppressed=%llu\n",
+		   s.name, slot_state(&s), s.connections,
+		   (unsigned long long) s.total_connections,
+		   (unsigned long long) s.rejected_connections,
+		   (unsigned long long) s.net_bytes_in,
+		   (unsigned long long) s.net_bytes_out,
+		   (unsigned long long) s.dev_bytes_in,
+		   (unsigned long long) s.dev_bytes_out,
+		   (unsigned long long) s.dev_errors,
+		   (unsigned long long) s.net_errors,
+		   (unsigned long long) s.dev_to_net_queue,
+		   (unsigned long long) s.net_to_dev_queue,
+		   (unsigned long long) s.modemstate_suppressed,
+		   (unsigned long long) s.linestate_suppressed);
+	} else {
+	    printf("%-16s %-14s %5u %12llu %12llu %12llu %12llu %6llu %6llu"
+		   " %8llu %8llu\n",
+		   s.name, slot_state(&s), s.connections,
+		   (unsigned long long) s.net_bytes_in,
+		   (unsigned long long) s.net_bytes_out,
+		   (unsigned long long) s.dev_bytes_in,
+		   (unsigned long long) s.dev_bytes_out,
+		   (unsigned long long) s.dev_errors,
+		   (unsigned long long) s.net_errors,
+		   (unsigned long long) s.dev_to_net_queue,
+		   (unsigned long long) s.net_to_dev_queue);
+	}
+    }
+    fflush(stdout);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *name = "/ser2net";
+    unsigned int interval = 0;
+    int parseable = 0;
+    struct stats_header *hdr;
+    struct stat st;
+    int i, fd;
+
+    for (i = 1; i < argc; i++) {
+	if (argv[i][0] != '-' || strlen(argv[i]) != 2)
+	    usage(argv[0]);
+
+	switch (argv[i][1]) {
+	case 's':
+	    name = get_arg(argc, argv, &i);
+	    break;
+
+	case 'i':
+	    interval = strtoul(get_arg(argc, argv, &i), NULL, 0);
+	    break;
+
+	case 'p':
+	    parseable = 1;
+	    break;
+
+	default:
+	    usage(argv[0]);
+	}
+    }
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+	fprintf(stderr, "Unable to open %s: %s\n", name, strerror(errno));
+	exit(1);
+    }
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(*hdr)) {
+	fprintf(stderr, "%s is not a ser2net stats segment\n", name);
+	exit(1);
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+	fprintf(stderr, "Unable to map %s: %s\n", name, strerror(errno));
+	exit(1);
+    }
+
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC) {
+	fprintf(stderr, "%s is not a ser2net stats segment\n", name);
+	exit(1);
+    }
+    if (hdr->version != STATS_VERSION) {
+	fprintf(stderr, "%s is version %u, only version %u is understood\n",
+		name, hdr->version, STATS_VERSION);
+	exit(1);
+    }
+    if (hdr->slot_size < sizeof(struct stats_slot) ||
+		hdr->header_size + (uint64_t) hdr->num_slots * hdr->slot_size
+		> (uint64_t) st.st_size) {
+	fprintf(stderr, "%s has a bad size\n", name);
+	exit(1);
+    }
+
+    for (;;) {
+	print_stats(hdr, parseable);
+	if (!interval)
+	    break;
+	sleep(interval);
+	if (!parseable)
+	    printf("\n");
+    }
+
+    return 0;
+}
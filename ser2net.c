@@ -38,6 +38,13 @@
 #include "controller.h"
 #include "dataxfer.h"
 #include "led.h"
+#include "pool.h"
+#include "tap.h"
+#include "events.h"
+#include "stats.h"
+#include "auth.h"
+#include "resolve.h"
+#include "probes.h"
 
 static char *config_file = SYSCONFDIR "/ser2net/ser2net.yaml";
 static bool config_file_set = false;
@@ -45,6 +52,8 @@ static char *old_config_file = SYSCONFDIR "/ser2net.conf";
 bool admin_port_from_cmdline = false;
 char *admin_port = NULL; /* Can be set from readconfig, too. */
 static char *pid_file = NULL;
+static char *stats_shm = NULL;
+static unsigned int stats_slots = STATS_DEFAULT_SLOTS;
 static int detach = 1;
 int ser2net_debug = 0;
 int ser2net_debug_level = 0;
@@ -82,7 +91,11 @@ static char *help_string =
 #endif
 "  -b - unused (was Do CISCO IOS baud-rate negotiation, instead of RFC2217)\n"
 "  -v - print the program's version and exit\n"
-"  -s - specify a default signature for RFC2217 protocol\n";
+"  -s - specify a default signature for RFC2217 protocol\n"
+"  -S <name>[,<slots>] - publish port statistics in the given POSIX\n"
+"     shared memory segment, for ser2net-stats\n"
+"  --parse-only - read the configuration, report errors, and exit\n"
+"  --time - print the time spent parsing and applying the configuration\n";
 
 static bool
 str_endswith(const char *str, const char *end)
@@ -129,6 +142,7 @@ reread_config_file(void)
 	bool is_yaml;
 
 	syslog(LOG_INFO, "Got SIGHUP, re-reading configuration");
+	S2N_PROBE1(config_reload, config_file);
 	readconfig_init();
 
 	instream = fopen_config_file(&is_yaml);
@@ -144,6 +158,7 @@ reread_config_file(void)
 	fclose(instream);
 
 	readconfig_finalize();
+	S2N_PROBE1(config_reload_done, config_file);
     }
  out:
     return;
@@ -505,6 +520,12 @@ finish_shutdown_cleanly(void)
     if (admin_port)
 	free(admin_port);
 
+    stats_close();
+    auth_cache_shutdown();
+    resolve_shutdown();
+    events_shutdown();
+    tap_shutdown();
+    pool_shutdown();
     so->free_funcs(so);
 
     exit(1);
@@ -605,12 +626,13 @@ main(int argc, char *argv[])
 {
     int i;
     int err;
-#ifdef USE_PTHREADS
     char *end;
-#endif
     char **config_lines;
     int num_config_lines = 0;
     int print_when_ready = 0;
+    bool parse_only = false;
+    bool print_times = false;
+    struct timeval start_time, parsed_time, applied_time;
 
     gensio_set_progname("ser2net");
 
@@ -627,6 +649,16 @@ main(int argc, char *argv[])
     }
 
     for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "--parse-only") == 0) {
+	    parse_only = true;
+	    detach = 0;
+	    continue;
+	}
+	if (strcmp(argv[i], "--time") == 0) {
+	    print_times = true;
+	    continue;
+	}
+
 	if ((argv[i][0] != '-') || (strlen(argv[i]) != 2)) {
 	    fprintf(stderr, "Invalid argument: '%s'\n", argv[i]);
 	    arg_error(argv[0]);
@@ -726,6 +758,25 @@ main(int argc, char *argv[])
             rfc2217_signature = argv[i];
             break;
 
+	case 'S':
+	    i++;
+	    if (i == argc) {
+		fprintf(stderr, "No shared memory name specified with -S\n");
+		arg_error(argv[0]);
+	    }
+	    stats_shm = argv[i];
+	    end = strchr(stats_shm, ',');
+	    if (end) {
+		*end++ = '\0';
+		stats_slots = strtoul(end, &end, 10);
+		if (*end != '\0' || stats_slots == 0) {
+		    fprintf(stderr, "Invalid stats slot count: %s\n",
+			    argv[i]);
+		    exit(1);
+		}
+	    }
+	    break;
+
 #ifdef USE_PTHREADS
 	case 't':
             i++;
@@ -783,6 +834,40 @@ main(int argc, char *argv[])
 	exit(1);
     }
 
+    if (pool_init()) {
+	fprintf(stderr, "Could not alloc ser2net memory pools\n");
+	exit(1);
+    }
+
+    if (tap_init()) {
+	fprintf(stderr, "Could not alloc ser2net tap lock\n");
+	exit(1);
+    }
+
+    if (events_init()) {
+	fprintf(stderr, "Could not alloc ser2net event lock\n");
+	exit(1);
+    }
+
+    if (auth_cache_init()) {
+	fprintf(stderr, "Could not alloc ser2net auth cache lock\n");
+	exit(1);
+    }
+
+    if (resolve_init()) {
+	fprintf(stderr, "Could not alloc ser2net resolver lock\n");
+	exit(1);
+    }
+
+    if (stats_shm && !parse_only) {
+	err = stats_open(stats_shm, stats_slots);
+	if (err) {
+	    fprintf(stderr, "Could not create stats segment %s: %s\n",
+		    stats_shm, strerror(err));
+	    exit(1);
+	}
+    }
+
     setup_signals();
 
     err = init_dataxfer();
@@ -793,7 +878,7 @@ main(int argc, char *argv[])
 	exit(1);
     }
 
-    if (ser2net_debug && !detach)
+    if ((ser2net_debug && !detach) || parse_only)
 	openlog("ser2net", LOG_PID | LOG_CONS | LOG_PERROR, LOG_DAEMON);
 
     err = readconfig_init();
@@ -804,9 +889,10 @@ main(int argc, char *argv[])
 	exit(1);
     }
 
-    if (admin_port)
+    if (admin_port && !parse_only)
 	controller_init(admin_port, NULL, NULL);
 
+    so->get_monotonic_time(so, &start_time);
     for (i = 0; i < num_config_lines; i++)
 	handle_config_line(config_lines[i], strlen(config_lines[i]));
     free(config_lines);
@@ -826,7 +912,22 @@ main(int argc, char *argv[])
 	    exit(1);
 	fclose(instream);
     }
+    so->get_monotonic_time(so, &parsed_time);
+    if (print_times)
+	printf("Configuration parse time: %d.%6.6ds\n",
+	       sub_timeval_us(&parsed_time, &start_time) / 1000000,
+	       sub_timeval_us(&parsed_time, &start_time) % 1000000);
+    if (parse_only)
+	exit(config_errors ? 1 : 0);
+
     readconfig_finalize();
+    so->get_monotonic_time(so, &applied_time);
+    if (print_times) {
+	printf("Configuration apply time: %d.%6.6ds\n",
+	       sub_timeval_us(&applied_time, &parsed_time) / 1000000,
+	       sub_timeval_us(&applied_time, &parsed_time) % 1000000);
+	fflush(stdout);
+    }
 
     if (detach) {
 	int pid;
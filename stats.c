@@ -0,0 +1,187 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gensio/gensio.h>
+
+#include "ser2net.h"
+#include "stats.h"
+
+static struct stats_header *stats_hdr;
+static struct stats_slot *stats_slots;
+static size_t stats_size;
+static char *stats_name;
+
+/*
+ * Number of ports using each slot, a port and its new config share
+ * one while a reconfig is in progress.  Protected by stats_lock,
+ * which is only used at config time.
+ */
+static unsigned int *stats_refcount;
+static struct gensio_lock *stats_lock;
+
+int
+stats_open(const char *name, unsigned int num_slots)
+{
+    int fd, err;
+
+    stats_lock = so->alloc_lock(so);
+    if (!stats_lock)
+	return ENOMEM;
+    stats_name = strdup(name);
+    stats_refcount = calloc(num_slots, sizeof(*stats_refcount));
+    if (!stats_name || !stats_refcount) {
+	err = ENOMEM;
+	goto out_err;
+    }
+
+    stats_size = sizeof(*stats_hdr) + num_slots * sizeof(*stats_slots);
+    /* Start with a fresh one, readers of an old one will see it go. */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+	err = errno;
+	goto out_err;
+    }
+    if (ftruncate(fd, stats_size) == -1) {
+	err = errno;
+	close(fd);
+	shm_unlink(name);
+	goto out_err;
+    }
+    stats_hdr = mmap(NULL, stats_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		     fd, 0);
+    close(fd);
+    if (stats_hdr == MAP_FAILED) {
+	err = errno;
+	stats_hdr = NULL;
+	shm_unlink(name);
+	goto out_err;
+    }
+
+    /* ftruncate() zeroed it. */
+    stats_slots = (struct stats_slot *) (stats_hdr + 1);
+    stats_hdr->version = STATS_VERSION;
+    stats_hdr->header_size = sizeof(*stats_hdr);
+    stats_hdr->slot_size = sizeof(*stats_slots);
+    stats_hdr->num_slots = num_slots;
+    stats_hdr->pid = getpid();
+    stats_hdr->start_time = time(NULL);
+    __atomic_store_n(&stats_hdr->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+
+ out_err:
+    free(stats_refcount);
+    stats_refcount = NULL;
+    free(stats_name);
+    stats_name = NULL;
+    so->free_lock(stats_lock);
+    stats_lock = NULL;
+    return err;
+}
+
+void
+stats_close(void)
+{
+    if (!stats_hdr)
+	return;
+    munmap(stats_hdr, stats_size);
+    shm_unlink(stats_name);
+    stats_hdr = NULL;
+    stats_slots = NULL;
+    free(stats_name);
+    stats_name = NULL;
+    free(stats_refcount);
+    stats_refcount = NULL;
+    so->free_lock(stats_lock);
+    stats_lock = NULL;
+}
+
+/* Mark the slot as changing (odd seq) or done changing (even seq). */
+static void
+stats_slot_seq(struct stats_slot *slot)
+{
+    __atomic_fetch_add(&slot->seq, 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+struct stats_slot *
+stats_slot_get(const char *name)
+{
+    struct stats_slot *slot = NULL;
+    unsigned int i, free_slot;
+
+    if (!stats_hdr)
+	return NULL;
+
+    so->lock(stats_lock);
+    free_slot = stats_hdr->num_slots;
+    for (i = 0; i < stats_hdr->num_slots; i++) {
+	if (!stats_refcount[i]) {
+	    if (free_slot == stats_hdr->num_slots)
+		free_slot = i;
+	} else if (strncmp(stats_slots[i].name, name,
+			   STATS_NAME_LEN - 1) == 0) {
+	    break;
+	}
+    }
+
+    if (i < stats_hdr->num_slots) {
+	stats_refcount[i]++;
+	slot = &stats_slots[i];
+    } else if (free_slot < stats_hdr->num_slots) {
+	slot = &stats_slots[free_slot];
+	stats_refcount[free_slot] = 1;
+	stats_slot_seq(slot);
+	memset(((char *) slot) + sizeof(slot->seq), 0,
+	       sizeof(*slot) - sizeof(slot->seq));
+	strncpy(slot->name, name, STATS_NAME_LEN - 1);
+	slot->in_use = 1;
+	stats_slot_seq(slot);
+    }
+    so->unlock(stats_lock);
+
+    return slot;
+}
+
+void
+stats_slot_put(struct stats_slot *slot)
+{
+    unsigned int i;
+
+    if (!slot)
+	return;
+
+    i = slot - stats_slots;
+    so->lock(stats_lock);
+    if (--stats_refcount[i] == 0) {
+	stats_slot_seq(slot);
+	slot->in_use = 0;
+	stats_slot_seq(slot);
+    }
+    so->unlock(stats_lock);
+}
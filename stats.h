@@ -0,0 +1,115 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * Port statistics published in a POSIX shared memory segment, so
+ * monitoring programs on the same host can read them without going
+ * through the admin port.  The segment is a header followed by an
+ * array of slots, one per port.  This layout is shared with the
+ * ser2net-stats reader, any incompatible change must bump
+ * STATS_VERSION.
+ *
+ * The counters are updated with relaxed atomics from the data path,
+ * nothing in the daemon waits for a reader.  A slot's seq is odd
+ * while the slot is being given to a port or released, a reader
+ * should copy the slot and retry if seq was odd or changed during
+ * the copy.  The counters themselves are not covered by seq, each
+ * one is consistent by itself.
+ */
+
+#define STATS_MAGIC		0x53324e53	/* "S2NS" */
+#define STATS_VERSION		1
+#define STATS_NAME_LEN		64
+#define STATS_DEFAULT_SLOTS	256
+
+struct stats_header {
+    uint32_t magic;		/* Set last, when the segment is ready. */
+    uint32_t version;
+    uint32_t header_size;	/* Offset of the first slot. */
+    uint32_t slot_size;
+    uint32_t num_slots;
+    uint32_t pid;
+    uint64_t start_time;	/* Seconds since the epoch. */
+} __attribute__ ((aligned (64)));
+
+/* Aligned so ports don't share cache lines. */
+struct stats_slot {
+    uint64_t seq;
+    char name[STATS_NAME_LEN];
+    uint32_t in_use;
+    uint32_t enabled;
+    uint32_t state;		/* Index into the port state strings. */
+    uint32_t connections;	/* Current connections. */
+    uint64_t total_connections;
+    uint64_t rejected_connections;
+    uint64_t net_bytes_in;	/* Read from the network. */
+    uint64_t net_bytes_out;	/* Written to the network. */
+    uint64_t dev_bytes_in;	/* Read from the device. */
+    uint64_t dev_bytes_out;	/* Written to the device. */
+    uint64_t dev_errors;
+    uint64_t net_errors;
+    uint64_t dev_to_net_queue;	/* Bytes waiting to go to the network. */
+    uint64_t net_to_dev_queue;	/* Bytes waiting to go to the device. */
+    uint64_t modemstate_suppressed; /* Merged by state-coalesce. */
+    uint64_t linestate_suppressed;
+} __attribute__ ((aligned (64)));
+
+#define STATS_ADD(slot, field, n) \
+    do {								\
+	if (slot)							\
+	    __atomic_fetch_add(&(slot)->field, (n), __ATOMIC_RELAXED); \
+    } while (0)
+
+#define STATS_SUB(slot, field, n) \
+    do {								\
+	if (slot)							\
+	    __atomic_fetch_sub(&(slot)->field, (n), __ATOMIC_RELAXED); \
+    } while (0)
+
+#define STATS_SET(slot, field, v) \
+    do {								\
+	if (slot)							\
+	    __atomic_store_n(&(slot)->field, (v), __ATOMIC_RELAXED);	\
+    } while (0)
+
+/*
+ * Create the segment with the given shm name (like "/ser2net") and
+ * number of slots.  Any old segment with that name is replaced.
+ * Returns 0 or an errno.  Without this, stats_slot_get() returns
+ * NULL and the macros above do nothing.
+ */
+int stats_open(const char *name, unsigned int num_slots);
+
+/* Unmap and remove the segment. */
+void stats_close(void);
+
+/*
+ * Get the slot for a port name.  A port that is reconfigured gets the
+ * same slot as the old one, so the counters carry over.  Returns NULL
+ * if stats are off or all slots are in use.
+ */
+struct stats_slot *stats_slot_get(const char *name);
+void stats_slot_put(struct stats_slot *slot);
+
+#endif /* STATS_H */
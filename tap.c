@@ -0,0 +1,375 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gensio/gensio.h>
+
+#include "ser2net.h"
+#include "pool.h"
+#include "tap.h"
+
+/* Chunks a subscriber may have waiting before data is dropped. */
+#define TAP_QUEUE_LEN	64
+
+struct tap_sub {
+    struct tap_sub *next;
+
+    struct tap_filter filter;
+    unsigned int sample_count;
+
+    /* Protects the queue and the counts. */
+    struct gensio_lock *lock;
+    struct tap_chunk *queue[TAP_QUEUE_LEN];
+    unsigned int qpos;
+    unsigned int qcount;
+    gensiods sent;
+    gensiods dropped;
+
+    char *desc;
+    tap_ready_cb ready;
+    void (*free_cb)(void *cb_data);
+    void *cb_data;
+};
+
+/*
+ * Protects the chunk reference counts.  Subscribers drop their
+ * references from wherever they drain the queue, so this is a
+ * leaf lock.
+ */
+static struct gensio_lock *tap_lock;
+
+int
+tap_init(void)
+{
+    tap_lock = so->alloc_lock(so);
+    if (!tap_lock)
+	return GE_NOMEM;
+    return 0;
+}
+
+void
+tap_shutdown(void)
+{
+    if (tap_lock)
+	so->free_lock(tap_lock);
+    tap_lock = NULL;
+}
+
+static void
+tap_chunk_put(struct tap_chunk *chunk)
+{
+    unsigned int refcount;
+
+    so->lock(tap_lock);
+    refcount = --chunk->refcount;
+    so->unlock(tap_lock);
+    if (refcount == 0)
+	pool_free(chunk);
+}
+
+const char *
+tap_filter_parse(struct tap_filter *f, const char *str)
+{
+    const char *end, *val;
+    gensiods len;
+
+    while (*str) {
+	end = strchr(str, ',');
+	if (!end)
+	    end = str + strlen(str);
+	len = end - str;
+
+	if (strncmp(str, "dir=", 4) == 0) {
+	    val = str + 4;
+	    len -= 4;
+	    if ((len == 3 && strncmp(val, "net", 3) == 0) ||
+			(len == 3 && strncmp(val, "tcp", 3) == 0))
+		f->dirs = TAP_DIR_NET;
+	    else if ((len == 3 && strncmp(val, "dev", 3) == 0) ||
+			(len == 4 && strncmp(val, "term", 4) == 0))
+		f->dirs = TAP_DIR_DEV;
+	    else if (len == 4 && strncmp(val, "both", 4) == 0)
+		f->dirs = TAP_DIR_BOTH;
+	    else
+		return "Invalid tap direction, must be net, dev, or both";
+	} else if (strncmp(str, "pattern=", 8) == 0) {
+	    len -= 8;
+	    if (len == 0)
+		return "Empty tap pattern";
+	    if (f->pattern)
+		free(f->pattern);
+	    f->pattern = malloc(len + 1);
+	    if (!f->pattern)
+		return "Out of memory allocating tap pattern";
+	    memcpy(f->pattern, str + 8, len);
+	    f->pattern[len] = '\0';
+	    f->patternlen = len;
+	} else if (strncmp(str, "sample=", 7) == 0) {
+	    char *e;
+
+	    f->sample = strtoul(str + 7, &e, 0);
+	    if (e != end || e == str + 7)
+		return "Invalid tap sample value";
+	} else {
+	    return "Invalid tap filter item, must be dir, pattern, or sample";
+	}
+
+	str = end;
+	if (*str == ',')
+	    str++;
+    }
+
+    return NULL;
+}
+
+void
+tap_filter_free(struct tap_filter *f)
+{
+    if (f->pattern)
+	free(f->pattern);
+    f->pattern = NULL;
+}
+
+void
+tap_filter_str(const struct tap_filter *f, char *buf, size_t len)
+{
+    const char *dir = "both";
+    int n;
+
+    if (f->dirs == TAP_DIR_NET)
+	dir = "net";
+    else if (f->dirs == TAP_DIR_DEV)
+	dir = "dev";
+    n = snprintf(buf, len, "dir=%s", dir);
+    if (f->pattern && n >= 0 && (size_t) n < len)
+	n += snprintf(buf + n, len - n, ",pattern=%s", f->pattern);
+    if (f->sample > 1 && n >= 0 && (size_t) n < len)
+	snprintf(buf + n, len - n, ",sample=%u", f->sample);
+}
+
+struct tap_sub *
+tap_sub_alloc(struct tap_filter *f, const char *desc,
+	      tap_ready_cb ready, void (*free_cb)(void *), void *cb_data)
+{
+    struct tap_sub *sub;
+
+    sub = malloc(sizeof(*sub));
+    if (!sub)
+	return NULL;
+    memset(sub, 0, sizeof(*sub));
+
+    sub->lock = so->alloc_lock(so);
+    if (!sub->lock)
+	goto out_nomem;
+    sub->desc = strdup(desc);
+    if (!sub->desc)
+	goto out_nomem;
+
+    sub->filter = *f;
+    f->pattern = NULL;
+    sub->ready = ready;
+    sub->free_cb = free_cb;
+    sub->cb_data = cb_data;
+    return sub;
+
+ out_nomem:
+    if (sub->lock)
+	so->free_lock(sub->lock);
+    free(sub);
+    return NULL;
+}
+
+void
+tap_sub_free(struct tap_sub *sub)
+{
+    while (sub->qcount > 0) {
+	tap_chunk_put(sub->queue[sub->qpos]);
+	sub->qpos = (sub->qpos + 1) % TAP_QUEUE_LEN;
+	sub->qcount--;
+    }
+    tap_filter_free(&sub->filter);
+    if (sub->free_cb)
+	sub->free_cb(sub->cb_data);
+    so->free_lock(sub->lock);
+    free(sub->desc);
+    free(sub);
+}
+
+void
+tap_add(struct tap_sub **list, struct tap_sub *sub)
+{
+    sub->next = *list;
+    *list = sub;
+}
+
+void
+tap_remove(struct tap_sub **list, struct tap_sub *sub)
+{
+    for (; *list; list = &(*list)->next) {
+	if (*list == sub) {
+	    *list = sub->next;
+	    sub->next = NULL;
+	    break;
+	}
+    }
+}
+
+struct tap_sub *
+tap_sub_list_next(struct tap_sub *sub)
+{
+    return sub->next;
+}
+
+static bool
+tap_match(const unsigned char *buf, gensiods len,
+	  const char *pattern, gensiods patternlen)
+{
+    gensiods i;
+
+    for (i = 0; i + patternlen <= len; i++) {
+	if (buf[i] == (unsigned char) pattern[0] &&
+		memcmp(buf + i, pattern, patternlen) == 0)
+	    return true;
+    }
+    return false;
+}
+
+static bool
+tap_wants(struct tap_sub *sub, unsigned int dir,
+	  const unsigned char *buf, gensiods len)
+{
+    if (!(sub->filter.dirs & dir))
+	return false;
+    if (sub->filter.pattern &&
+		!tap_match(buf, len, sub->filter.pattern,
+			   sub->filter.patternlen))
+	return false;
+    if (sub->filter.sample > 1) {
+	/* Only touched with the port lock held. */
+	if (sub->sample_count++ % sub->filter.sample != 0)
+	    return false;
+    }
+    return true;
+}
+
+void
+tap_data(struct tap_sub *list, unsigned int dir,
+	 const unsigned char *buf, gensiods len)
+{
+    struct tap_chunk *chunk = NULL;
+    struct tap_sub *sub;
+    bool queued;
+
+    for (sub = list; sub; sub = sub->next) {
+	if (!tap_wants(sub, dir, buf, len))
+	    continue;
+
+	if (!chunk) {
+	    chunk = pool_alloc(sizeof(*chunk) + len);
+	    if (!chunk) {
+		/* Count it against everyone that wanted it. */
+		for (; sub; sub = sub->next) {
+		    so->lock(sub->lock);
+		    sub->dropped += len;
+		    so->unlock(sub->lock);
+		}
+		return;
+	    }
+	    /* Hold a reference while handing it out. */
+	    chunk->refcount = 1;
+	    chunk->dir = dir;
+	    chunk->len = len;
+	    memcpy(chunk->data, buf, len);
+	}
+
+	so->lock(sub->lock);
+	queued = sub->qcount < TAP_QUEUE_LEN;
+	if (queued) {
+	    sub->queue[(sub->qpos + sub->qcount) % TAP_QUEUE_LEN] = chunk;
+	    sub->qcount++;
+	    so->lock(tap_lock);
+	    chunk->refcount++;
+	    so->unlock(tap_lock);
+	} else {
+	    sub->dropped += len;
+	}
+	so->unlock(sub->lock);
+
+	if (queued)
+	    sub->ready(sub, sub->cb_data);
+    }
+
+    if (chunk)
+	tap_chunk_put(chunk);
+}
+
+struct tap_chunk *
+tap_sub_next(struct tap_sub *sub)
+{
+    struct tap_chunk *chunk = NULL;
+
+    so->lock(sub->lock);
+    if (sub->qcount > 0) {
+	chunk = sub->queue[sub->qpos];
+	sub->qpos = (sub->qpos + 1) % TAP_QUEUE_LEN;
+	sub->qcount--;
+    }
+    so->unlock(sub->lock);
+    return chunk;
+}
+
+void
+tap_sub_done(struct tap_sub *sub, struct tap_chunk *chunk, gensiods dropped)
+{
+    so->lock(sub->lock);
+    sub->sent += chunk->len - dropped;
+    sub->dropped += dropped;
+    so->unlock(sub->lock);
+    tap_chunk_put(chunk);
+}
+
+void *
+tap_sub_cb_data(struct tap_sub *sub)
+{
+    return sub->cb_data;
+}
+
+const char *
+tap_sub_desc(struct tap_sub *sub)
+{
+    return sub->desc;
+}
+
+const struct tap_filter *
+tap_sub_filter(struct tap_sub *sub)
+{
+    return &sub->filter;
+}
+
+void
+tap_sub_stats(struct tap_sub *sub, gensiods *sent, gensiods *dropped)
+{
+    so->lock(sub->lock);
+    *sent = sub->sent;
+    *dropped = sub->dropped;
+    so->unlock(sub->lock);
+}
@@ -0,0 +1,123 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2001-2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef TAP_H
+#define TAP_H
+
+#include <stdbool.h>
+#include <gensio/gensio.h>
+
+/*
+ * Data taps.  Any number of subscribers may be attached to a port,
+ * each gets the data read from the network and/or the device that
+ * passes its filter.  The data is copied once into a reference
+ * counted chunk and the chunk is put on the queue of every
+ * subscriber that wants it.  Each subscriber has a fixed length
+ * queue, if it is full the data is dropped and counted for that
+ * subscriber only, so a slow subscriber never holds up the port.
+ *
+ * The subscriber list belongs to the port and is protected by the
+ * port lock, tap_add(), tap_remove() and tap_data() must be called
+ * with it held.  The queues are protected by a lock per subscriber,
+ * so they may be drained from anywhere.
+ */
+
+#define TAP_DIR_NET	(1 << 0)	/* Data read from the network. */
+#define TAP_DIR_DEV	(1 << 1)	/* Data read from the device. */
+#define TAP_DIR_BOTH	(TAP_DIR_NET | TAP_DIR_DEV)
+
+struct tap_filter {
+    unsigned int dirs;		/* TAP_DIR_xxx to pass. */
+    char *pattern;		/* If not NULL, only pass chunks with this. */
+    gensiods patternlen;
+    unsigned int sample;	/* Pass one chunk out of every "sample". */
+};
+
+struct tap_chunk {
+    unsigned int refcount;
+    unsigned int dir;
+    gensiods len;
+    unsigned char data[];
+};
+
+struct tap_sub;
+
+/*
+ * Called from tap_data() when data has been queued to the
+ * subscriber, with the port lock held.  The subscriber should pull
+ * the data with tap_sub_next() now or schedule something to do it.
+ */
+typedef void (*tap_ready_cb)(struct tap_sub *sub, void *cb_data);
+
+/* Allocate the tap lock, call before any taps are used. */
+int tap_init(void);
+void tap_shutdown(void);
+
+/*
+ * Parse a filter in the form "dir=net|dev|both,pattern=str,sample=n",
+ * all parts are optional.  "tcp" and "term" may be used for "net" and
+ * "dev".  The filter must be initialized (to the default direction)
+ * before calling this.  Returns NULL on success or an error string.
+ */
+const char *tap_filter_parse(struct tap_filter *f, const char *str);
+void tap_filter_free(struct tap_filter *f);
+
+/* Print the filter into buf, for showing the taps. */
+void tap_filter_str(const struct tap_filter *f, char *buf, size_t len);
+
+/*
+ * Allocate a subscriber.  The filter is taken over by the subscriber,
+ * it will free the pattern.  The description is shown with the port.
+ * If free_cb is not NULL it is called with cb_data when the
+ * subscriber is freed.
+ */
+struct tap_sub *tap_sub_alloc(struct tap_filter *f, const char *desc,
+			      tap_ready_cb ready, void (*free_cb)(void *),
+			      void *cb_data);
+
+/* Free a subscriber, it must not be on a list.  Queued data is freed. */
+void tap_sub_free(struct tap_sub *sub);
+
+void tap_add(struct tap_sub **list, struct tap_sub *sub);
+void tap_remove(struct tap_sub **list, struct tap_sub *sub);
+
+/* Call the function on every subscriber in the list. */
+#define for_each_tap(list, sub) \
+    for ((sub) = (list); (sub); (sub) = tap_sub_list_next(sub))
+struct tap_sub *tap_sub_list_next(struct tap_sub *sub);
+
+/* Hand data in the given direction to all the subscribers. */
+void tap_data(struct tap_sub *list, unsigned int dir,
+	      const unsigned char *buf, gensiods len);
+
+/*
+ * Get the next chunk from the subscriber's queue, NULL if it is
+ * empty.  When the subscriber is done with it, it must call
+ * tap_sub_done() with the number of bytes of it that it dropped.
+ */
+struct tap_chunk *tap_sub_next(struct tap_sub *sub);
+void tap_sub_done(struct tap_sub *sub, struct tap_chunk *chunk,
+		  gensiods dropped);
+
+void *tap_sub_cb_data(struct tap_sub *sub);
+const char *tap_sub_desc(struct tap_sub *sub);
+const struct tap_filter *tap_sub_filter(struct tap_sub *sub);
+void tap_sub_stats(struct tap_sub *sub, gensiods *sent, gensiods *dropped);
+
+#endif /* TAP_H */
@@ -0,0 +1,177 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Benchmark for the remote address trie.  For allow-lists of growing
+ * size this times lookups in the trie against a linear walk of the
+ * same list, which is how remote addresses used to be checked.  The
+ * trie time should stay flat as the list grows.  It also checks that
+ * both give the same answers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "addrtrie.h"
+
+#define NUM_LOOKUPS	100000
+
+struct prefix {
+    struct sockaddr_in6 addr;
+    unsigned int len;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t
+rnd(void)
+{
+    static uint32_t x = 2463534242U;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static void
+rnd_addr(struct sockaddr_in6 *a)
+{
+    unsigned int i;
+
+    memset(a, 0, sizeof(*a));
+    a->sin6_family = AF_INET6;
+    a->sin6_addr.s6_addr[0] = 0x20;
+    a->sin6_addr.s6_addr[1] = 0x01;
+    for (i = 2; i < 16; i++)
+	a->sin6_addr.s6_addr[i] = rnd();
+    a->sin6_port = htons(rnd() % 4 + 1);
+}
+
+static int
+prefix_match(const struct prefix *p, const struct sockaddr_in6 *a)
+{
+    const uint8_t *x = p->addr.sin6_addr.s6_addr, *y = a->sin6_addr.s6_addr;
+    unsigned int bytes = p->len / 8, bits = p->len % 8;
+
+    if (memcmp(x, y, bytes) != 0)
+	return 0;
+    if (bits && ((x[bytes] ^ y[bytes]) & (0xff << (8 - bits))))
+	return 0;
+    return 1;
+}
+
+static int
+linear_match(const struct prefix *list, unsigned int n,
+	     const struct sockaddr_in6 *a)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+	if (prefix_match(&list[i], a))
+	    return 1;
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    static const unsigned int sizes[] = { 1, 10, 100, 1000, 10000 };
+    struct sockaddr_in6 *probes;
+    struct prefix *list;
+    struct addrtrie *t;
+    unsigned int s, i, n, hits, lhits;
+    uint64_t start, trie_ns, linear_ns;
+
+    probes = malloc(NUM_LOOKUPS * sizeof(*probes));
+    list = malloc(sizes[4] * sizeof(*list));
+    if (!probes || !list) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+    }
+
+    printf("%8s %12s %12s %8s %10s\n", "prefixes", "trie ns", "linear ns",
+	   "hits", "trie mem");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+	n = sizes[s];
+	t = addrtrie_alloc();
+	if (!t) {
+	    fprintf(stderr, "Out of memory\n");
+	    return 1;
+	}
+	for (i = 0; i < n; i++) {
+	    rnd_addr(&list[i].addr);
+	    list[i].len = 32 + rnd() % 33;
+	    if (addrtrie_add(t, (struct sockaddr *) &list[i].addr,
+			     list[i].len, 0)) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	    }
+	}
+
+	/* Half the probes are in a listed prefix. */
+	for (i = 0; i < NUM_LOOKUPS; i++) {
+	    rnd_addr(&probes[i]);
+	    if (i % 2)
+		memcpy(probes[i].sin6_addr.s6_addr,
+		       list[rnd() % n].addr.sin6_addr.s6_addr, 8);
+	}
+
+	hits = 0;
+	start = now_ns();
+	for (i = 0; i < NUM_LOOKUPS; i++)
+	    hits += addrtrie_match(t, (struct sockaddr *) &probes[i],
+				   sizeof(probes[i]));
+	trie_ns = now_ns() - start;
+
+	lhits = 0;
+	start = now_ns();
+	for (i = 0; i < NUM_LOOKUPS; i++)
+	    lhits += linear_match(list, n, &probes[i]);
+	linear_ns = now_ns() - start;
+
+	if (hits != lhits) {
+	    fprintf(stderr, "Trie and linear results differ: %u %u\n",
+		    hits, lhits);
+	    return 1;
+	}
+	printf("%8u %12.1f %12.1f %8u %10lu\n", n,
+	       (double) trie_ns / NUM_LOOKUPS,
+	       (double) linear_ns / NUM_LOOKUPS, hits,
+	       (unsigned long) addrtrie_size(t));
+	addrtrie_free(t);
+    }
+
+    free(probes);
+    free(list);
+    return 0;
+}
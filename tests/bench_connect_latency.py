@@ -0,0 +1,56 @@
+#!/usr/bin/python
+#
+# Measure the time from starting a connection to ser2net until the
+# first byte arrives, with and without keep-device-open.  The banner is
+# only sent after the device is ready, so it is used as the first byte.
+#
+# This is a benchmark, not a test, it is not run by "make check".  Run
+# it like the tests, with SER2NET_EXEC pointing to the ser2net to use.
+#
+
+import sys
+import time
+import gensio
+import utils
+
+o = utils.o
+
+count = 100
+if len(sys.argv) > 1:
+    count = int(sys.argv[1])
+
+io1str = "tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+def percentile(vals, pct):
+    return vals[min(len(vals) - 1, int(len(vals) * pct / 100.0))]
+
+def measure(name, config):
+    ser2net = utils.Ser2netDaemon(o, config)
+    io2 = utils.alloc_io(o, io2str)
+    times = []
+    try:
+        for i in range(0, count):
+            start = time.time()
+            io1 = utils.alloc_io(o, io1str, do_open = False)
+            io1.handler.set_compare("B", start_reader = False)
+            io1.open_s()
+            io1.read_cb_enable(True)
+            if (io1.handler.wait_timeout(2000) == 0):
+                raise Exception("%s: Timed out waiting for the first byte" %
+                                name)
+            times.append((time.time() - start) * 1000000.0)
+            utils.io_close(io1)
+    finally:
+        utils.io_close(io2)
+        ser2net.terminate()
+
+    times.sort()
+    print("%-20s connects=%d mean=%dus p50=%dus p99=%dus max=%dus" %
+          (name, count, sum(times) / len(times), percentile(times, 50),
+           percentile(times, 99), times[-1]))
+
+measure("open per connect",
+        "BANNER:b:B\n3023:raw:100:/dev/ttyPipeA0:b 9600N81\n")
+measure("keep-device-open",
+        "BANNER:b:B\n3023:raw:100:/dev/ttyPipeA0:b 9600N81 keep-device-open\n")
@@ -0,0 +1,78 @@
+#!/usr/bin/python
+#
+# Per-chunk cost of the data path stages.  This runs ser2net-bench
+# bulk transfers with small writes on a port with no optional
+# features, which gets the minimal read handlers, and on a port with
+# tracing, a tap file, and closeon, which runs every stage, and prints
+# the ser2net CPU time per MB and per chunk for each.
+#
+# The per-chunk number uses the client's write count, the kernel may
+# merge or split writes before ser2net reads them, so it is an
+# estimate.  Use the same sizes when comparing runs.
+#
+# This is a benchmark, not a test, it is not run by "make check".
+# Build ser2net-bench with "make ser2net-bench" first, then run it like:
+#
+#   SER2NET_EXEC=./ser2net python tests/bench_data_path.py -s 1 -s 64
+#
+
+import os
+import sys
+import json
+import argparse
+import subprocess
+
+VARIANTS = [
+    ("minimal", ["chardelay: false"]),
+    ("full", ["chardelay: false", "tr: /dev/null", "tw: /dev/null",
+              "tb: /dev/null", "tap-file: /dev/null",
+              "closeon: \"~~never~~\""]),
+]
+
+def run_bench(args, size, opts):
+    cmd = [args.bench, "-t", "tcp", "-p", "bulk", "-D", args.direction,
+           "-n", str(args.ports), "-s", str(size),
+           "-d", str(args.duration), "-P", str(args.baseport), "-j",
+           "-e", args.ser2net]
+    for opt in opts:
+        cmd += ["-O", opt]
+    out = subprocess.check_output(cmd)
+    return json.loads(out.decode().strip().split("\n")[-1])
+
+def main():
+    parser = argparse.ArgumentParser(description="ser2net data path cost")
+    parser.add_argument("-b", "--bench",
+                        default=os.path.join(os.path.dirname(
+                            os.path.abspath(__file__)), "ser2net-bench"),
+                        help="ser2net-bench executable")
+    parser.add_argument("-e", "--ser2net",
+                        default=os.getenv("SER2NET_EXEC", "ser2net"),
+                        help="ser2net executable")
+    parser.add_argument("-n", "--ports", type=int, default=1,
+                        help="number of ports")
+    parser.add_argument("-s", "--size", type=int, action="append",
+                        help="write size, may be given more than once,"
+                        " default 16")
+    parser.add_argument("-d", "--duration", type=int, default=10,
+                        help="seconds to run each case")
+    parser.add_argument("-D", "--direction", default="net2dev",
+                        choices=["net2dev", "dev2net"],
+                        help="direction of the traffic")
+    parser.add_argument("-P", "--baseport", type=int, default=5100,
+                        help="first TCP port number to use")
+    args = parser.parse_args()
+    if not args.size:
+        args.size = [16]
+
+    print("%-8s %-8s %10s %12s %14s" % ("size", "path", "MB/s",
+                                        "cpu ms/MB", "cpu us/chunk"))
+    for size in args.size:
+        for (name, opts) in VARIANTS:
+            r = run_bench(args, size, opts)
+            print("%-8d %-8s %10.3f %12.3f %14.3f" %
+                  (size, name, r["mb_per_sec"], r["cpu_ms_per_mb"],
+                   r["cpu_ms_per_mb"] * size / 1000.0))
+            sys.stdout.flush()
+
+if __name__ == "__main__":
+    main()
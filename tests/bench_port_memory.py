@@ -0,0 +1,117 @@
+#!/usr/bin/python
+#
+# Memory benchmark for idle ports.  This configures a lot of ports on
+# pty slaves and measures the RSS of ser2net per port:
+#
+#  * with no port ever used
+#  * after every port has had a connection
+#  * after the idle-release-time has gone by
+#
+# Like scaletest.py this only uses the python standard library and is
+# not run by "make check", run it by hand, like:
+#
+#   SER2NET_EXEC=./ser2net python tests/bench_port_memory.py -n 2000
+#
+# Note that memory freed by ser2net is not always given back to the
+# system by malloc, so the last number may not go all the way down,
+# but the memory will be reused.
+#
+
+import os
+import sys
+import time
+import json
+import socket
+import argparse
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import scaletest
+
+def connect_all(baseport, nports):
+    """Connect to each port, wait for the banner, and disconnect."""
+    failures = 0
+    for i in range(0, nports):
+        try:
+            s = socket.create_connection(("localhost", baseport + i), 5)
+        except socket.error:
+            failures += 1
+            continue
+        try:
+            s.settimeout(5)
+            if s.recv(1) != b"B":
+                failures += 1
+        except socket.error:
+            failures += 1
+        finally:
+            s.close()
+    return failures
+
+def main():
+    parser = argparse.ArgumentParser(description="ser2net idle port memory")
+    parser.add_argument("-n", "--ports", type=int, default=1000,
+                        help="number of ports to create")
+    parser.add_argument("-p", "--baseport", type=int, default=10000,
+                        help="first TCP port number to use")
+    parser.add_argument("-e", "--ser2net",
+                        default=os.getenv("SER2NET_EXEC", "ser2net"),
+                        help="ser2net executable")
+    parser.add_argument("-r", "--release-time", type=int, default=2,
+                        help="idle-release-time to configure, in seconds")
+    parser.add_argument("-O", "--option", action="append", default=[],
+                        help="extra option line for each port's options")
+    parser.add_argument("-o", "--output", help="write the JSON here")
+    args = parser.parse_args()
+
+    scaletest.raise_fd_limit(args.ports * 2 + 100)
+    options = args.option + ["idle-release-time: %d" % args.release_time]
+    results = { "ports": args.ports, "options": options }
+
+    ptys = scaletest.PtyPorts(args.ports)
+    cfile = tempfile.NamedTemporaryFile(mode="w+", suffix=".yaml")
+    try:
+        scaletest.write_config(cfile, ptys.devnames[0:1], args.baseport,
+                               options)
+        s = scaletest.Ser2net(args.ser2net, cfile.name)
+        base_rss = s.rss_kb()
+        s.stop()
+        results["baseline_rss_kb"] = base_rss
+
+        scaletest.write_config(cfile, ptys.devnames, args.baseport, options)
+        s = scaletest.Ser2net(args.ser2net, cfile.name)
+        try:
+            def per_port(rss):
+                if args.ports < 2:
+                    return 0.0
+                return (rss - base_rss) * 1024.0 / (args.ports - 1)
+
+            rss = s.rss_kb()
+            results["never_used_rss_kb"] = rss
+            results["never_used_bytes_per_port"] = per_port(rss)
+
+            results["connect_failures"] = connect_all(args.baseport,
+                                                      args.ports)
+            # Let the ports finish closing.
+            time.sleep(1)
+            rss = s.rss_kb()
+            results["after_use_rss_kb"] = rss
+            results["after_use_bytes_per_port"] = per_port(rss)
+
+            time.sleep(args.release_time + 2)
+            rss = s.rss_kb()
+            results["after_release_rss_kb"] = rss
+            results["after_release_bytes_per_port"] = per_port(rss)
+        finally:
+            s.stop()
+    finally:
+        cfile.close()
+        ptys.close()
+
+    out = json.dumps(results, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(out + "\n")
+    print(out)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+#!/usr/bin/python
+#
+# CPU cost of the relay option.  This runs ser2net-bench bulk transfers
+# over TCP with the normal data path and with relay set, and prints the
+# throughput and the ser2net CPU time per MB for each write size.
+#
+# This is a benchmark, not a test, it is not run by "make check".
+# Build ser2net-bench with "make ser2net-bench" first, then run it like:
+#
+#   SER2NET_EXEC=./ser2net python tests/bench_relay.py -s 64 -s 4096
+#
+
+import os
+import sys
+import json
+import argparse
+import subprocess
+
+def run_bench(args, size, relay):
+    cmd = [args.bench, "-t", args.type, "-p", "bulk", "-D", args.direction,
+           "-n", str(args.ports), "-s", str(size),
+           "-d", str(args.duration), "-P", str(args.baseport), "-j",
+           "-e", args.ser2net, "-O", "relay: %s" % str(relay).lower()]
+    out = subprocess.check_output(cmd)
+    return json.loads(out.decode().strip().split("\n")[-1])
+
+def main():
+    parser = argparse.ArgumentParser(description="ser2net relay CPU use")
+    parser.add_argument("-b", "--bench",
+                        default=os.path.join(os.path.dirname(
+                            os.path.abspath(__file__)), "ser2net-bench"),
+                        help="ser2net-bench executable")
+    parser.add_argument("-e", "--ser2net",
+                        default=os.getenv("SER2NET_EXEC", "ser2net"),
+                        help="ser2net executable")
+    parser.add_argument("-t", "--type", default="tcp",
+                        choices=["tcp", "telnet"],
+                        help="network side to use")
+    parser.add_argument("-n", "--ports", type=int, default=1,
+                        help="number of ports")
+    parser.add_argument("-s", "--size", type=int, action="append",
+                        help="write size, may be given more than once,"
+                        " default 1024")
+    parser.add_argument("-d", "--duration", type=int, default=10,
+                        help="seconds to run each case")
+    parser.add_argument("-D", "--direction", default="both",
+                        choices=["net2dev", "dev2net", "both"],
+                        help="direction of the traffic")
+    parser.add_argument("-P", "--baseport", type=int, default=5100,
+                        help="first TCP port number to use")
+    args = parser.parse_args()
+    if not args.size:
+        args.size = [1024]
+
+    print("%-8s %-8s %10s %12s" % ("size", "path", "MB/s", "cpu ms/MB"))
+    for size in args.size:
+        for relay in [False, True]:
+            r = run_bench(args, size, relay)
+            print("%-8d %-8s %10.3f %12.3f" %
+                  (size, relay and "relay" or "normal", r["mb_per_sec"],
+                   r["cpu_ms_per_mb"]))
+            sys.stdout.flush()
+
+if __name__ == "__main__":
+    main()
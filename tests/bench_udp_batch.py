@@ -0,0 +1,68 @@
+#!/usr/bin/python
+#
+# UDP throughput benchmark for the udp-batch option.  This runs
+# ser2net-bench with small datagrams from the network to the device,
+# once with every datagram written to the device by itself and once
+# for each batch time given, and prints the datagram rate and the
+# ser2net CPU use for each.
+#
+# This is a benchmark, not a test, it is not run by "make check".
+# Build ser2net-bench with "make ser2net-bench" first, then run it like:
+#
+#   SER2NET_EXEC=./ser2net python tests/bench_udp_batch.py -s 32
+#
+
+import os
+import sys
+import json
+import argparse
+import subprocess
+
+def run_bench(args, batch):
+    cmd = [args.bench, "-t", "udp", "-p", "bulk", "-D", args.direction,
+           "-n", str(args.ports), "-s", str(args.size),
+           "-d", str(args.duration), "-P", str(args.baseport), "-j",
+           "-e", args.ser2net]
+    if batch:
+        cmd += ["-O", "udp-batch: %d" % batch]
+    out = subprocess.check_output(cmd)
+    return json.loads(out.decode().strip().split("\n")[-1])
+
+def main():
+    parser = argparse.ArgumentParser(description="ser2net UDP batching")
+    parser.add_argument("-b", "--bench",
+                        default=os.path.join(os.path.dirname(
+                            os.path.abspath(__file__)), "ser2net-bench"),
+                        help="ser2net-bench executable")
+    parser.add_argument("-e", "--ser2net",
+                        default=os.getenv("SER2NET_EXEC", "ser2net"),
+                        help="ser2net executable")
+    parser.add_argument("-n", "--ports", type=int, default=1,
+                        help="number of ports")
+    parser.add_argument("-s", "--size", type=int, default=32,
+                        help="datagram size")
+    parser.add_argument("-d", "--duration", type=int, default=10,
+                        help="seconds to run each case")
+    parser.add_argument("-D", "--direction", default="net2dev",
+                        choices=["net2dev", "dev2net", "both"],
+                        help="direction of the traffic")
+    parser.add_argument("-P", "--baseport", type=int, default=5100,
+                        help="first UDP port number to use")
+    parser.add_argument("-t", "--batch", type=int, action="append",
+                        help="udp-batch time in microseconds to try, may"
+                        " be given more than once, default 1000")
+    args = parser.parse_args()
+    if not args.batch:
+        args.batch = [1000]
+
+    print("%-12s %12s %12s %10s %12s" % ("udp-batch", "sent/s", "recv/s",
+                                         "MB/s", "cpu ms/MB"))
+    for batch in [0] + args.batch:
+        r = run_bench(args, batch)
+        print("%-12s %12.0f %12.0f %10.3f %12.3f" %
+              (batch and ("%dus" % batch) or "off", r["net_writes_per_sec"],
+               r["net_reads_per_sec"], r["mb_per_sec"], r["cpu_ms_per_mb"]))
+        sys.stdout.flush()
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,280 @@
+#!/usr/bin/python
+#
+# Scale test for ser2net.  This creates a lot of pty pairs, uses the
+# pty slaves as serial devices for ser2net, and measures how ser2net
+# behaves with that many ports:
+#
+#  * startup time, from exec until ser2net says it is ready
+#  * RSS per port, both total/ports and the increase over a one port
+#    ser2net
+#  * SIGHUP reload time, until a port added to the config accepts
+#  * idle CPU use with no clients connected
+#  * connect to banner latency while a lot of clients connect and
+#    disconnect as fast as they can (a reconnect storm)
+#
+# The results are written as JSON so they can be compared between
+# versions.  This only uses the python standard library, it does not
+# need the gensio python module or serialsim.  It is not run by
+# "make check", run it by hand, like:
+#
+#   SER2NET_EXEC=./ser2net python tests/scaletest.py -n 2000
+#
+
+import os
+import sys
+import pty
+import tty
+import time
+import json
+import errno
+import signal
+import select
+import socket
+import resource
+import tempfile
+import argparse
+import subprocess
+
+def now():
+    return time.monotonic()
+
+def percentile(vals, pct):
+    if not vals:
+        return 0.0
+    vals = sorted(vals)
+    return vals[min(len(vals) - 1, int(len(vals) * pct / 100.0))]
+
+def raise_fd_limit(needed):
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < needed:
+        if hard != resource.RLIM_INFINITY and hard < needed:
+            raise Exception("Need %d file descriptors, hard limit is %d" %
+                            (needed, hard))
+        resource.setrlimit(resource.RLIMIT_NOFILE, (needed, hard))
+
+class PtyPorts:
+    """A set of pty pairs, the slaves are the serial devices."""
+
+    def __init__(self, count):
+        self.masters = []
+        self.devnames = []
+        for i in range(0, count):
+            master, slave = pty.openpty()
+            tty.setraw(slave)
+            self.devnames.append(os.ttyname(slave))
+            # ser2net will open the slave itself, we only keep the
+            # master so the pty stays around.
+            os.close(slave)
+            self.masters.append(master)
+
+    def close(self):
+        for m in self.masters:
+            os.close(m)
+        self.masters = []
+
+def write_config(f, devnames, baseport, extra):
+    f.seek(0)
+    f.truncate()
+    f.write("%YAML 1.1\n---\n")
+    for i, dev in enumerate(devnames):
+        f.write("connection: &scale%d\n" % i)
+        f.write("  accepter: tcp,localhost,%d\n" % (baseport + i))
+        f.write("  connector: serialdev,%s,115200n81,local\n" % dev)
+        f.write("  options:\n")
+        f.write("    banner: B\n")
+        f.write("    kickolduser: true\n")
+        for e in extra:
+            f.write("    %s\n" % e)
+    f.flush()
+
+class Ser2net:
+    def __init__(self, prog, cfgname):
+        start = now()
+        self.proc = subprocess.Popen([prog, "-n", "-r", "-c", cfgname],
+                                     stdout=subprocess.PIPE)
+        line = self.proc.stdout.readline()
+        if not line.startswith(b"Ready"):
+            self.stop()
+            raise Exception("ser2net did not start: %s" % line)
+        self.startup_time = now() - start
+        self.pid = self.proc.pid
+
+    def rss_kb(self):
+        with open("/proc/%d/status" % self.pid) as f:
+            for l in f:
+                if l.startswith("VmRSS:"):
+                    return int(l.split()[1])
+        return 0
+
+    def cpu_secs(self):
+        with open("/proc/%d/stat" % self.pid) as f:
+            s = f.read()
+        fields = s[s.rindex(")") + 2:].split()
+        return (int(fields[11]) + int(fields[12])) / float(
+            os.sysconf("SC_CLK_TCK"))
+
+    def stop(self):
+        self.proc.send_signal(signal.SIGTERM)
+        try:
+            self.proc.wait(10)
+        except subprocess.TimeoutExpired:
+            self.proc.kill()
+            self.proc.wait()
+
+def wait_for_accept(port, timeout):
+    """Wait until the given port accepts and sends the banner."""
+    end = now() + timeout
+    while now() < end:
+        try:
+            s = socket.create_connection(("localhost", port), 1)
+        except socket.error:
+            time.sleep(0.001)
+            continue
+        try:
+            s.settimeout(1)
+            if s.recv(1) == b"B":
+                return True
+        except socket.error:
+            pass
+        finally:
+            s.close()
+        time.sleep(0.001)
+    return False
+
+def reconnect_storm(baseport, nports, conns, duration):
+    """Keep "conns" connections in flight to random ports.
+
+    Each one connects, waits for the banner, and closes.  Returns a
+    list of connect to banner times and the number of failures.
+    """
+    lats = []
+    failures = 0
+    inflight = {}
+    poller = select.poll()
+    nextport = 0
+    end = now() + duration
+
+    def start_one():
+        nonlocal nextport, failures
+        port = baseport + (nextport % nports)
+        nextport += 7919 # Spread out over the ports.
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.setblocking(False)
+        err = s.connect_ex(("127.0.0.1", port))
+        if err not in (0, errno.EINPROGRESS):
+            failures += 1
+            s.close()
+            return
+        inflight[s.fileno()] = (s, now())
+        poller.register(s.fileno(), select.POLLIN)
+
+    while now() < end or inflight:
+        while now() < end and len(inflight) < conns:
+            start_one()
+        for fd, ev in poller.poll(100):
+            s, start = inflight.pop(fd)
+            poller.unregister(fd)
+            try:
+                if s.recv(1) == b"B":
+                    lats.append(now() - start)
+                else:
+                    failures += 1
+            except socket.error:
+                failures += 1
+            s.close()
+        # Anything taking more than 5 seconds counts as a failure.
+        for fd, (s, start) in list(inflight.items()):
+            if now() - start > 5:
+                poller.unregister(fd)
+                del inflight[fd]
+                s.close()
+                failures += 1
+    return lats, failures
+
+def main():
+    parser = argparse.ArgumentParser(description="ser2net scale test")
+    parser.add_argument("-n", "--ports", type=int, default=1000,
+                        help="number of ports to create")
+    parser.add_argument("-p", "--baseport", type=int, default=10000,
+                        help="first TCP port number to use")
+    parser.add_argument("-e", "--ser2net",
+                        default=os.getenv("SER2NET_EXEC", "ser2net"),
+                        help="ser2net executable")
+    parser.add_argument("--idle-time", type=float, default=5.0,
+                        help="seconds to measure idle CPU")
+    parser.add_argument("--storm-time", type=float, default=10.0,
+                        help="seconds to run the reconnect storm")
+    parser.add_argument("--storm-conns", type=int, default=64,
+                        help="connections in flight during the storm")
+    parser.add_argument("--no-baseline", action="store_true",
+                        help="skip the one port run for marginal RSS")
+    parser.add_argument("-O", "--option", action="append", default=[],
+                        help="extra option line for each port's options")
+    parser.add_argument("-o", "--output", help="write the JSON here")
+    args = parser.parse_args()
+
+    raise_fd_limit(args.ports * 2 + args.storm_conns + 100)
+    results = { "ports": args.ports, "options": args.option }
+
+    ptys = PtyPorts(args.ports + 1)
+    cfile = tempfile.NamedTemporaryFile(mode="w+", suffix=".yaml")
+    try:
+        if not args.no_baseline:
+            write_config(cfile, ptys.devnames[0:1], args.baseport, args.option)
+            s = Ser2net(args.ser2net, cfile.name)
+            base_rss = s.rss_kb()
+            s.stop()
+            results["baseline_rss_kb"] = base_rss
+
+        write_config(cfile, ptys.devnames[0:args.ports], args.baseport,
+                     args.option)
+        s = Ser2net(args.ser2net, cfile.name)
+        try:
+            results["startup_secs"] = s.startup_time
+            rss = s.rss_kb()
+            results["rss_kb"] = rss
+            results["rss_kb_per_port"] = rss / float(args.ports)
+            if not args.no_baseline and args.ports > 1:
+                results["marginal_rss_kb_per_port"] = (
+                    (rss - base_rss) / float(args.ports - 1))
+
+            cpu = s.cpu_secs()
+            time.sleep(args.idle_time)
+            results["idle_cpu_percent"] = ((s.cpu_secs() - cpu) * 100.0 /
+                                           args.idle_time)
+
+            # Add a port and reload, the reload is done when it answers.
+            write_config(cfile, ptys.devnames, args.baseport, args.option)
+            start = now()
+            s.proc.send_signal(signal.SIGHUP)
+            if not wait_for_accept(args.baseport + args.ports, 60):
+                raise Exception("New port did not come up after SIGHUP")
+            results["reload_secs"] = now() - start
+            results["rss_kb_after_reload"] = s.rss_kb()
+
+            cpu = s.cpu_secs()
+            lats, failures = reconnect_storm(args.baseport, args.ports,
+                                             args.storm_conns,
+                                             args.storm_time)
+            results["storm_cpu_secs"] = s.cpu_secs() - cpu
+            results["storm_connects"] = len(lats)
+            results["storm_failures"] = failures
+            results["storm_connects_per_sec"] = len(lats) / args.storm_time
+            results["storm_latency_p50_ms"] = percentile(lats, 50) * 1000
+            results["storm_latency_p99_ms"] = percentile(lats, 99) * 1000
+            results["storm_latency_p999_ms"] = percentile(lats, 99.9) * 1000
+            results["storm_latency_max_ms"] = max(lats or [0]) * 1000
+        finally:
+            s.stop()
+    finally:
+        cfile.close()
+        ptys.close()
+
+    out = json.dumps(results, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(out + "\n")
+    print(out)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,937 @@
+/*
+ *  ser2net - A program for allowing telnet connection to serial ports
+ *  Copyright (C) 2020  Corey Minyard <minyard@acm.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Load generator and latency benchmark for ser2net.
+ *
+ * This creates a number of pty pairs to act as serial devices, writes
+ * a ser2net config for them, starts ser2net, and then pushes data
+ * through it with network clients on one side and the pty master on
+ * the other.  It only needs libc, so it can be run anywhere ser2net
+ * runs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include <pty.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define BENCH_BUFSIZE	65536
+
+enum bench_type { BENCH_TCP, BENCH_UDP, BENCH_TELNET };
+static const char *type_str[] = { "tcp", "udp", "telnet" };
+
+enum bench_pattern { PAT_BULK, PAT_ECHO, PAT_BURSTY };
+static const char *pattern_str[] = { "bulk", "echo", "bursty" };
+
+#define DIR_NET_TO_DEV	(1 << 0)
+#define DIR_DEV_TO_NET	(1 << 1)
+
+/* Telnet receive states. */
+#define TN_DATA		0
+#define TN_IAC		1
+#define TN_OPT		2
+#define TN_SB		3
+#define TN_SB_IAC	4
+
+#define TN_IAC_C	255
+#define TN_DONT		254
+#define TN_DO		253
+#define TN_WONT		252
+#define TN_WILL		251
+#define TN_SB_C		250
+#define TN_SE		240
+
+struct bench_port {
+    unsigned int num;
+    int master;			/* pty master, the "serial device" end. */
+    int slave;			/* Held open so the master doesn't get EIO. */
+    char devname[64];
+    int sock;			/* Network client. */
+
+    uint64_t net_tx, net_rx;	/* Bytes written/read on the network. */
+    uint64_t net_txmsgs, net_rxmsgs; /* Writes/reads, datagrams for UDP. */
+    uint64_t dev_tx, dev_rx;	/* Bytes written/read on the pty. */
+
+    /* Data the device side needs to echo back. */
+    unsigned char *ebuf;
+    size_t elen;
+
+    /* Echo and bursty state. */
+    uint64_t send_time;		/* When the outstanding data was sent. */
+    size_t outstanding;		/* Bytes we are waiting to get back. */
+    size_t sent_pos;		/* How much of the request has been sent. */
+    uint64_t next_send;		/* Earliest time to send the next request. */
+    unsigned int timeouts;
+
+    /* Telnet receive parsing. */
+    int tn_state;
+    unsigned char tn_cmd;
+};
+
+static enum bench_type btype = BENCH_TCP;
+static enum bench_pattern pattern = PAT_BULK;
+static unsigned int direction = DIR_NET_TO_DEV | DIR_DEV_TO_NET;
+static unsigned int nports = 1;
+static unsigned int duration = 10;
+static size_t chunksize = 1024;
+static size_t burstsize = 4096;
+static unsigned int burst_interval = 100; /* milliseconds */
+static unsigned int baseport = 5100;
+static const char *ser2net_prog;
+static const char **extra_opts;
+static unsigned int num_extra_opts;
+static bool keep_config;
+static bool json_out;
+static bool verbose;
+
+static struct bench_port *ports;
+static pid_t ser2net_pid = -1;
+static char cfgname[] = "/tmp/ser2net-bench-XXXXXX";
+static unsigned char pattern_data[BENCH_BUFSIZE];
+
+static uint64_t *lat_samples;
+static size_t lat_count, lat_size;
+
+static void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "ser2net-bench: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    if (ser2net_pid > 0)
+	kill(ser2net_pid, SIGKILL);
+    if (!keep_config)
+	unlink(cfgname);
+    exit(1);
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+add_latency(uint64_t ns)
+{
+    if (lat_count == lat_size) {
+	size_t nsize = lat_size ? lat_size * 2 : 4096;
+	uint64_t *n = realloc(lat_samples, nsize * sizeof(*n));
+
+	if (!n)
+	    fatal("Out of memory saving latency samples");
+	lat_samples = n;
+	lat_size = nsize;
+    }
+    lat_samples[lat_count++] = ns;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t v1 = *(const uint64_t *) a, v2 = *(const uint64_t *) b;
+
+    if (v1 < v2)
+	return -1;
+    return v1 > v2;
+}
+
+static uint64_t
+percentile(double pct)
+{
+    size_t i;
+
+    if (!lat_count)
+	return 0;
+    i = (size_t) (lat_count * pct / 100.0);
+    if (i >= lat_count)
+	i = lat_count - 1;
+    return lat_samples[i];
+}
+
+static void
+set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+	fatal("Unable to set fd nonblocking: %s", strerror(errno));
+}
+
+static void
+setup_ptys(void)
+{
+    unsigned int i;
+    struct termios t;
+
+    for (i = 0; i < nports; i++) {
+	struct bench_port *p = &ports[i];
+
+	p->num = i;
+	p->sock = -1;
+	if (openpty(&p->master, &p->slave, p->devname, NULL, NULL) == -1)
+	    fatal("Unable to allocate pty %u: %s", i, strerror(errno));
+	if (tcgetattr(p->slave, &t) == 0) {
+	    cfmakeraw(&t);
+	    tcsetattr(p->slave, TCSANOW, &t);
+	}
+	set_nonblock(p->master);
+	p->ebuf = malloc(BENCH_BUFSIZE);
+	if (!p->ebuf)
+	    fatal("Out of memory allocating port buffers");
+    }
+}
+
+static void
+write_config(void)
+{
+    unsigned int i, j;
+    FILE *f;
+    int fd;
+
+    fd = mkstemp(cfgname);
+    if (fd == -1)
+	fatal("Unable to create config file: %s", strerror(errno));
+    f = fdopen(fd, "w");
+    if (!f)
+	fatal("Unable to open config file: %s", strerror(errno));
+
+    fprintf(f, "%%YAML 1.1\n---\n");
+    for (i = 0; i < nports; i++) {
+	const char *acc = "tcp";
+
+	if (btype == BENCH_UDP)
+	    acc = "udp";
+	else if (btype == BENCH_TELNET)
+	    acc = "telnet,tcp";
+	fprintf(f, "connection: &bench%u\n", i);
+	fprintf(f, "  accepter: %s,localhost,%u\n", acc, baseport + i);
+	fprintf(f, "  connector: serialdev,%s,115200n81,local\n",
+		ports[i].devname);
+	fprintf(f, "  options:\n");
+	fprintf(f, "    kickolduser: true\n");
+	for (j = 0; j < num_extra_opts; j++)
+	    fprintf(f, "    %s\n", extra_opts[j]);
+    }
+    fclose(f);
+}
+
+static void
+start_ser2net(void)
+{
+    int pfd[2];
+    char buf[128];
+    size_t len = 0;
+    uint64_t end;
+
+    if (pipe(pfd) == -1)
+	fatal("Unable to create pipe: %s", strerror(errno));
+
+    ser2net_pid = fork();
+    if (ser2net_pid == -1)
+	fatal("Unable to fork: %s", strerror(errno));
+    if (ser2net_pid == 0) {
+	unsigned int i;
+
+	/* The child doesn't need our ptys. */
+	for (i = 0; i < nports; i++) {
+	    close(ports[i].master);
+	    close(ports[i].slave);
+	}
+	dup2(pfd[1], 1);
+	close(pfd[0]);
+	close(pfd[1]);
+	execlp(ser2net_prog, ser2net_prog, "-n", "-r", "-c", cfgname,
+	       (char *) NULL);
+	fprintf(stderr, "Unable to run %s: %s\n", ser2net_prog,
+		strerror(errno));
+	_exit(1);
+    }
+    close(pfd[1]);
+
+    /* Wait for ser2net to tell us it is ready. */
+    end = now_ns() + 30 * 1000000000ULL;
+    while (!memchr(buf, '\n', len)) {
+	struct pollfd pf = { .fd = pfd[0], .events = POLLIN };
+	ssize_t rv;
+
+	if (now_ns() > end)
+	    fatal("Timed out waiting for ser2net to start");
+	if (poll(&pf, 1, 100) <= 0)
+	    continue;
+	rv = read(pfd[0], buf + len, sizeof(buf) - len - 1);
+	if (rv <= 0)
+	    fatal("ser2net exited during startup");
+	len += rv;
+	if (len >= sizeof(buf) - 1)
+	    break;
+    }
+    buf[len] = '\0';
+    if (!strstr(buf, "Ready"))
+	fatal("Unexpected output from ser2net: %s", buf);
+    close(pfd[0]);
+}
+
+static void
+stop_ser2net(void)
+{
+    int status, i;
+
+    if (ser2net_pid <= 0)
+	return;
+    kill(ser2net_pid, SIGTERM);
+    for (i = 0; i < 500; i++) {
+	if (waitpid(ser2net_pid, &status, WNOHANG) == ser2net_pid)
+	    goto out;
+	usleep(10000);
+    }
+    kill(ser2net_pid, SIGKILL);
+    waitpid(ser2net_pid, &status, 0);
+ out:
+    ser2net_pid = -1;
+}
+
+static void
+connect_clients(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < nports; i++) {
+	struct bench_port *p = &ports[i];
+	struct sockaddr_in addr;
+	int one = 1;
+
+	p->sock = socket(AF_INET, btype == BENCH_UDP ? SOCK_DGRAM : SOCK_STREAM,
+			 0);
+	if (p->sock == -1)
+	    fatal("Unable to allocate socket: %s", strerror(errno));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(baseport + i);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(p->sock, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+	    fatal("Unable to connect to port %u: %s", baseport + i,
+		  strerror(errno));
+	if (btype != BENCH_UDP)
+	    setsockopt(p->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	set_nonblock(p->sock);
+    }
+}
+
+/* Reply to telnet option negotiation, only binary and SGA are allowed. */
+static void
+telnet_reply(struct bench_port *p, unsigned char cmd, unsigned char opt)
+{
+    unsigned char reply[3] = { TN_IAC_C, 0, opt };
+    bool ok = opt == 0 || opt == 3;
+
+    switch (cmd) {
+    case TN_DO: reply[1] = ok ? TN_WILL : TN_WONT; break;
+    case TN_WILL: reply[1] = ok ? TN_DO : TN_DONT; break;
+    default: return;
+    }
+    if (write(p->sock, reply, 3) != 3 && verbose)
+	fprintf(stderr, "Telnet reply write failed on port %u\n", p->num);
+}
+
+/* Strip telnet commands from received data, return the data length. */
+static size_t
+telnet_filter(struct bench_port *p, unsigned char *buf, size_t len)
+{
+    size_t i, out = 0;
+
+    for (i = 0; i < len; i++) {
+	unsigned char c = buf[i];
+
+	switch (p->tn_state) {
+	case TN_DATA:
+	    if (c == TN_IAC_C)
+		p->tn_state = TN_IAC;
+	    else
+		buf[out++] = c;
+	    break;
+
+	case TN_IAC:
+	    if (c == TN_IAC_C) {
+		buf[out++] = c;
+		p->tn_state = TN_DATA;
+	    } else if (c >= TN_WILL && c <= TN_DONT) {
+		p->tn_cmd = c;
+		p->tn_state = TN_OPT;
+	    } else if (c == TN_SB_C) {
+		p->tn_state = TN_SB;
+	    } else {
+		p->tn_state = TN_DATA;
+	    }
+	    break;
+
+	case TN_OPT:
+	    telnet_reply(p, p->tn_cmd, c);
+	    p->tn_state = TN_DATA;
+	    break;
+
+	case TN_SB:
+	    if (c == TN_IAC_C)
+		p->tn_state = TN_SB_IAC;
+	    break;
+
+	case TN_SB_IAC:
+	    p->tn_state = c == TN_SE ? TN_DATA : TN_SB;
+	    break;
+	}
+    }
+
+    return out;
+}
+
+static ssize_t
+net_read(struct bench_port *p, unsigned char *buf, size_t len)
+{
+    ssize_t rv = read(p->sock, buf, len);
+
+    if (rv > 0 && btype == BENCH_TELNET)
+	rv = telnet_filter(p, buf, rv);
+    if (rv > 0) {
+	p->net_rx += rv;
+	p->net_rxmsgs++;
+    }
+    return rv;
+}
+
+static ssize_t
+net_write(struct bench_port *p, const unsigned char *buf, size_t len)
+{
+    ssize_t rv = write(p->sock, buf, len);
+
+    if (rv > 0) {
+	p->net_tx += rv;
+	p->net_txmsgs++;
+    }
+    return rv;
+}
+
+/*
+ * Make sure the whole path works and the device is open in ser2net
+ * before timing anything.  Each client sends one byte and we wait for
+ * it to come out of the pty.  For UDP this is also what makes ser2net
+ * see the client.
+ */
+static void
+sync_ports(void)
+{
+    unsigned int i, left = nports;
+    unsigned char c = 'S', buf[256];
+    uint64_t end = now_ns() + 10 * 1000000000ULL;
+    uint64_t resend = 0;
+    bool *done = calloc(nports, sizeof(bool));
+
+    if (!done)
+	fatal("Out of memory");
+
+    while (left) {
+	uint64_t now = now_ns();
+
+	if (now > end)
+	    fatal("Timed out waiting for %u ports to come up", left);
+	if (now > resend) {
+	    for (i = 0; i < nports; i++) {
+		if (!done[i] && write(ports[i].sock, &c, 1) != 1 &&
+				errno != EAGAIN)
+		    fatal("Write error on port %u: %s", i, strerror(errno));
+	    }
+	    resend = now + 1000000000ULL;
+	}
+	for (i = 0; i < nports; i++) {
+	    ssize_t rv;
+
+	    if (done[i])
+		continue;
+	    rv = read(ports[i].master, buf, sizeof(buf));
+	    if (rv > 0) {
+		done[i] = true;
+		left--;
+	    }
+	    /* Throw away banners and such. */
+	    while (read(ports[i].sock, buf, sizeof(buf)) > 0)
+		;
+	}
+	usleep(1000);
+    }
+    free(done);
+}
+
+static long
+proc_cpu_ticks(void)
+{
+    char fname[64], buf[1024], *s;
+    unsigned long utime, stime;
+    FILE *f;
+
+    snprintf(fname, sizeof(fname), "/proc/%d/stat", ser2net_pid);
+    f = fopen(fname, "r");
+    if (!f)
+	return -1;
+    if (!fgets(buf, sizeof(buf), f)) {
+	fclose(f);
+	return -1;
+    }
+    fclose(f);
+    /* Skip past the command name, it may have spaces in it. */
+    s = strrchr(buf, ')');
+    if (!s)
+	return -1;
+    if (sscanf(s + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	       &utime, &stime) != 2)
+	return -1;
+    return utime + stime;
+}
+
+static long
+proc_rss_kb(void)
+{
+    char fname[64], buf[256];
+    long rss = -1;
+    FILE *f;
+
+    snprintf(fname, sizeof(fname), "/proc/%d/status", ser2net_pid);
+    f = fopen(fname, "r");
+    if (!f)
+	return -1;
+    while (fgets(buf, sizeof(buf), f)) {
+	if (sscanf(buf, "VmRSS: %ld", &rss) == 1)
+	    break;
+    }
+    fclose(f);
+    return rss;
+}
+
+static void
+handle_dev_side(struct bench_port *p, short revents)
+{
+    unsigned char buf[BENCH_BUFSIZE];
+    ssize_t rv;
+
+    if (revents & POLLIN) {
+	if (pattern == PAT_BULK) {
+	    rv = read(p->master, buf, sizeof(buf));
+	    if (rv > 0)
+		p->dev_rx += rv;
+	} else if (p->elen < BENCH_BUFSIZE) {
+	    rv = read(p->master, p->ebuf + p->elen, BENCH_BUFSIZE - p->elen);
+	    if (rv > 0) {
+		p->dev_rx += rv;
+		p->elen += rv;
+	    }
+	}
+    }
+
+    if (revents & POLLOUT) {
+	if (pattern == PAT_BULK) {
+	    rv = write(p->master, pattern_data, chunksize);
+	    if (rv > 0)
+		p->dev_tx += rv;
+	} else if (p->elen) {
+	    rv = write(p->master, p->ebuf, p->elen);
+	    if (rv > 0) {
+		p->dev_tx += rv;
+		p->elen -= rv;
+		memmove(p->ebuf, p->ebuf + rv, p->elen);
+	    }
+	}
+    }
+}
+
+static void
+handle_net_side(struct bench_port *p, short revents, uint64_t now)
+{
+    unsigned char buf[BENCH_BUFSIZE];
+    size_t reqsize = pattern == PAT_BURSTY ? burstsize : chunksize;
+    ssize_t rv;
+
+    if (revents & POLLIN) {
+	rv = net_read(p, buf, sizeof(buf));
+	if (rv > 0 && pattern != PAT_BULK && p->outstanding) {
+	    if ((size_t) rv >= p->outstanding) {
+		p->outstanding = 0;
+		add_latency(now - p->send_time);
+	    } else {
+		p->outstanding -= rv;
+	    }
+	}
+    }
+
+    if (!(revents & POLLOUT))
+	return;
+
+    if (pattern == PAT_BULK) {
+	net_write(p, pattern_data, chunksize);
+	return;
+    }
+
+    if (p->sent_pos == 0 && (p->outstanding || now < p->next_send))
+	return;
+
+    if (p->sent_pos == 0) {
+	p->send_time = now;
+	p->outstanding = reqsize;
+	if (pattern == PAT_BURSTY)
+	    p->next_send = now + burst_interval * 1000000ULL;
+    }
+    /* UDP has to send the whole thing as one packet. */
+    rv = net_write(p, pattern_data, reqsize - p->sent_pos);
+    if (rv > 0) {
+	p->sent_pos += rv;
+	if (p->sent_pos >= reqsize)
+	    p->sent_pos = 0;
+    }
+}
+
+static void
+run_traffic(uint64_t end)
+{
+    struct pollfd *pfds = calloc(nports * 2, sizeof(*pfds));
+    unsigned int i;
+
+    if (!pfds)
+	fatal("Out of memory");
+
+    for (i = 0; i < nports; i++) {
+	pfds[i * 2].fd = ports[i].master;
+	pfds[i * 2 + 1].fd = ports[i].sock;
+    }
+
+    for (;;) {
+	uint64_t now = now_ns();
+
+	if (now >= end)
+	    break;
+
+	for (i = 0; i < nports; i++) {
+	    struct bench_port *p = &ports[i];
+	    short dev_events = POLLIN, net_events = POLLIN;
+
+	    if (pattern == PAT_BULK) {
+		if (direction & DIR_DEV_TO_NET)
+		    dev_events |= POLLOUT;
+		if (direction & DIR_NET_TO_DEV)
+		    net_events |= POLLOUT;
+	    } else {
+		if (p->elen)
+		    dev_events |= POLLOUT;
+		if (p->outstanding && now - p->send_time > 1000000000ULL) {
+		    /* Lost data (UDP) or a stall, count it and go on. */
+		    p->timeouts++;
+		    p->outstanding = 0;
+		    p->sent_pos = 0;
+		}
+		if (p->sent_pos || (!p->outstanding && now >= p->next_send))
+		    net_events |= POLLOUT;
+	    }
+	    pfds[i * 2].events = dev_events;
+	    pfds[i * 2 + 1].events = net_events;
+	}
+
+	if (poll(pfds, nports * 2, pattern == PAT_BURSTY ? 1 : 100) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fatal("poll error: %s", strerror(errno));
+	}
+
+	now = now_ns();
+	for (i = 0; i < nports; i++) {
+	    if (pfds[i * 2].revents)
+		handle_dev_side(&ports[i], pfds[i * 2].revents);
+	    if (pfds[i * 2 + 1].revents)
+		handle_net_side(&ports[i], pfds[i * 2 + 1].revents, now);
+	}
+    }
+    free(pfds);
+}
+
+static void
+report(uint64_t elapsed_ns, long cpu_ticks, long rss_kb)
+{
+    uint64_t net_tx = 0, net_rx = 0, dev_tx = 0, dev_rx = 0;
+    uint64_t net_txmsgs = 0, net_rxmsgs = 0;
+    unsigned int i, timeouts = 0;
+    double secs = elapsed_ns / 1e9, mb, cpu_ms_per_mb = 0;
+    long tick = sysconf(_SC_CLK_TCK);
+
+    for (i = 0; i < nports; i++) {
+	net_tx += ports[i].net_tx;
+	net_rx += ports[i].net_rx;
+	net_txmsgs += ports[i].net_txmsgs;
+	net_rxmsgs += ports[i].net_rxmsgs;
+	dev_tx += ports[i].dev_tx;
+	dev_rx += ports[i].dev_rx;
+	timeouts += ports[i].timeouts;
+    }
+    /* Count what made it through ser2net. */
+    mb = (dev_rx + net_rx) / 1e6;
+    if (mb > 0 && cpu_ticks >= 0)
+	cpu_ms_per_mb = cpu_ticks * 1000.0 / tick / mb;
+
+    qsort(lat_samples, lat_count, sizeof(*lat_samples), cmp_u64);
+
+    if (json_out) {
+	printf("{\"type\":\"%s\",\"pattern\":\"%s\",\"ports\":%u,"
+	       "\"seconds\":%.3f,\"mb_per_sec\":%.3f,"
+	       "\"net_to_dev_mb_per_sec\":%.3f,\"dev_to_net_mb_per_sec\":%.3f,"
+	       "\"latency_samples\":%lu,\"latency_p50_us\":%.1f,"
+	       "\"latency_p99_us\":%.1f,\"latency_p999_us\":%.1f,"
+	       "\"timeouts\":%u,\"cpu_ms_per_mb\":%.3f,\"rss_kb\":%ld,"
+	       "\"rss_kb_per_port\":%.1f,\"net_writes_per_sec\":%.1f,"
+	       "\"net_reads_per_sec\":%.1f}\n",
+	       type_str[btype], pattern_str[pattern], nports, secs, mb / secs,
+	       dev_rx / 1e6 / secs, net_rx / 1e6 / secs,
+	       (unsigned long) lat_count, percentile(50) / 1e3,
+	       percentile(99) / 1e3, percentile(99.9) / 1e3, timeouts,
+	       cpu_ms_per_mb, rss_kb, (double) rss_kb / nports,
+	       net_txmsgs / secs, net_rxmsgs / secs);
+	return;
+    }
+
+    printf("ser2net-bench: %s %s, %u port%s, %.1f seconds\n",
+	   type_str[btype], pattern_str[pattern], nports,
+	   nports == 1 ? "" : "s", secs);
+    printf("  throughput: %.3f MB/s (net to dev %.3f, dev to net %.3f)\n",
+	   mb / secs, dev_rx / 1e6 / secs, net_rx / 1e6 / secs);
+    if (btype == BENCH_UDP)
+	printf("  datagrams: %.0f/s sent, %.0f/s received\n",
+	       net_txmsgs / secs, net_rxmsgs / secs);
+    if (pattern != PAT_BULK)
+	printf("  latency: p50 %.1fus, p99 %.1fus, p999 %.1fus"
+	       " (%lu samples, %u timeouts)\n",
+	       percentile(50) / 1e3, percentile(99) / 1e3,
+	       percentile(99.9) / 1e3, (unsigned long) lat_count, timeouts);
+    if (cpu_ticks >= 0)
+	printf("  cpu: %.3f ms per MB\n", cpu_ms_per_mb);
+    if (rss_kb >= 0)
+	printf("  memory: %ld kB RSS, %.1f kB per port\n", rss_kb,
+	       (double) rss_kb / nports);
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+"%s: Valid parameters are:\n"
+"  -e <ser2net> - The ser2net to run, default is $SER2NET_EXEC or ser2net\n"
+"  -n <ports> - The number of pty ports to create, default 1\n"
+"  -t tcp|udp|telnet - The network side to use, default tcp\n"
+"  -p bulk|echo|bursty - The traffic pattern, default bulk\n"
+"  -D both|net2dev|dev2net - Direction for bulk transfers, default both\n"
+"  -d <seconds> - How long to run, default 10\n"
+"  -s <size> - Write size for bulk, request size for echo, default 1024\n"
+"  -B <size> - Burst size for bursty, default 4096\n"
+"  -I <ms> - Time between bursts for bursty, default 100\n"
+"  -P <port> - First network port number to use, default 5100\n"
+"  -O <option> - Add \"option\" to each port's options in the config,\n"
+"     like -O \"chardelay: false\".  May be given more than once\n"
+"  -j - Output the results as a JSON object\n"
+"  -k - Keep the generated config file\n"
+"  -v - Print more information\n", name);
+    exit(1);
+}
+
+static const char *
+get_arg(int argc, char *argv[], int *i)
+{
+    if (*i + 1 >= argc)
+	usage(argv[0]);
+    (*i)++;
+    return argv[*i];
+}
+
+static int
+lookup(const char *names[], unsigned int count, const char *str)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+	if (strcmp(names[i], str) == 0)
+	    return i;
+    }
+    return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int i, v;
+    uint64_t start, end;
+    long cpu_start, cpu_end, rss;
+
+    ser2net_prog = getenv("SER2NET_EXEC");
+    if (!ser2net_prog)
+	ser2net_prog = "ser2net";
+
+    for (i = 1; i < argc; i++) {
+	if (argv[i][0] != '-' || strlen(argv[i]) != 2)
+	    usage(argv[0]);
+
+	switch (argv[i][1]) {
+	case 'e':
+	    ser2net_prog = get_arg(argc, argv, &i);
+	    break;
+
+	case 'n':
+	    nports = strtoul(get_arg(argc, argv, &i), NULL, 0);
+	    break;
+
+	case 't':
+	    v = lookup(type_str, 3, get_arg(argc, argv, &i));
+	    if (v < 0)
+		usage(argv[0]);
+	    btype = v;
+	    break;
+
+	case 'p':
+	    v = lookup(pattern_str, 3, get_arg(argc, argv, &i));
+	    if (v < 0)
+		usage(argv[0]);
+	    pattern = v;
+	    break;
+
+	case 'D': {
+	    const char *d = get_arg(argc, argv, &i);
+
+	    if (strcmp(d, "both") == 0)
+		direction = DIR_NET_TO_DEV | DIR_DEV_TO_NET;
+	    else if (strcmp(d, "net2dev") == 0)
+		direction = DIR_NET_TO_DEV;
+	    else if (strcmp(d, "dev2net") == 0)
+		direction = DIR_DEV_TO_NET;
+	    else
+		usage(argv[0]);
+	    break;
+	}
+
+	case 'd':
+	    duration = strtoul(get_arg(argc, argv, &i), NULL, 0);
+	    break;
+
+	case 's':
+	    chunksize = strtoul(get_arg(argc, argv, &i), NULL, 0);
+	    break;
+
+	case 'B':
+	    burstsize = strtoul(get_arg(argc, argv, &i), NULL, 0);
+	    break;
+
+	case 'I':
+	    burst_interval = strtoul(get_arg(argc, argv, &i), NULL, 0);
+	    break;
+
+	case 'P':
+	    baseport = strtoul(get_arg(argc, argv, &i), NULL, 0);
+	    break;
+
+	case 'O':
+	    extra_opts = realloc(extra_opts,
+				 (num_extra_opts + 1) * sizeof(char *));
+	    if (!extra_opts)
+		fatal("Out of memory");
+	    extra_opts[num_extra_opts++] = get_arg(argc, argv, &i);
+	    break;
+
+	case 'j':
+	    json_out = true;
+	    break;
+
+	case 'k':
+	    keep_config = true;
+	    break;
+
+	case 'v':
+	    verbose = true;
+	    break;
+
+	default:
+	    usage(argv[0]);
+	}
+    }
+
+    if (nports == 0 || duration == 0)
+	usage(argv[0]);
+    if (chunksize == 0 || chunksize > BENCH_BUFSIZE)
+	fatal("Size must be between 1 and %d", BENCH_BUFSIZE);
+    if (burstsize == 0 || burstsize > BENCH_BUFSIZE)
+	fatal("Burst size must be between 1 and %d", BENCH_BUFSIZE);
+
+    /* Printable data, so telnet doesn't need escaping. */
+    for (i = 0; i < BENCH_BUFSIZE; i++)
+	pattern_data[i] = 'a' + (i % 26);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    ports = calloc(nports, sizeof(*ports));
+    if (!ports)
+	fatal("Out of memory allocating ports");
+
+    setup_ptys();
+    write_config();
+    if (verbose)
+	fprintf(stderr, "Config is in %s\n", cfgname);
+    start_ser2net();
+    connect_clients();
+    sync_ports();
+
+    rss = proc_rss_kb();
+    cpu_start = proc_cpu_ticks();
+    start = now_ns();
+    run_traffic(start + duration * 1000000000ULL);
+    end = now_ns();
+    cpu_end = proc_cpu_ticks();
+
+    report(end - start, (cpu_start < 0 || cpu_end < 0) ? -1 :
+	   cpu_end - cpu_start, rss);
+
+    stop_ser2net();
+    if (keep_config)
+	fprintf(stderr, "Config kept in %s\n", cfgname);
+    else
+	unlink(cfgname);
+    return 0;
+}
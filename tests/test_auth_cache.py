@@ -0,0 +1,122 @@
+#!/usr/bin/python
+
+import os
+import time
+import shutil
+import socket
+import tempfile
+import utils
+
+o = utils.o
+
+authdir = tempfile.mkdtemp()
+
+def set_password(user, pw):
+    d = os.path.join(authdir, user)
+    if not os.path.isdir(d):
+        os.mkdir(d)
+    f = open(os.path.join(d, "password"), "w")
+    f.write(pw + "\n")
+    f.close()
+
+config = ("%%YAML 1.1\n"
+          "---\n"
+          "admin:\n"
+          "  accepter: tcp,localhost,3030\n"
+          "connection: &con1\n"
+          "  accepter: certauth(enable-password),"
+          "ssl(key=%s/key.pem,cert=%s/cert.pem),tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81,local\n"
+          "  options:\n"
+          "    authdir: %s\n" % (utils.keydir, utils.keydir, authdir))
+
+print("auth cache:\n  config=%s" % config)
+
+def login(user, pw):
+    """Log in to the port, return True if it was allowed"""
+    iostr = ("certauth(username=%s,password=%s),ssl(CA=%s/CA.pem),"
+             "tcp,localhost,3023" % (user, pw, utils.keydir))
+    try:
+        io = utils.alloc_io(o, iostr)
+    except Exception:
+        return False
+    utils.io_close(io)
+    time.sleep(0.2)
+    return True
+
+def showauth():
+    s = socket.create_connection(("localhost", 3030), 5)
+    f = s.makefile("r")
+    s.sendall(b"showauth\r\n")
+    stats = {}
+    while "invalidations" not in stats:
+        line = f.readline()
+        if not line:
+            raise Exception("Controller closed the connection")
+        if ":" in line:
+            (name, val) = line.split(":", 1)
+            val = val.strip()
+            if val.isdigit():
+                stats[name.strip()] = int(val)
+    s.close()
+    return stats
+
+def inotify_watches(pid):
+    """Count the inotify watches the process holds"""
+    count = 0
+    fddir = "/proc/%d/fd" % pid
+    for fd in os.listdir(fddir):
+        try:
+            if os.readlink(os.path.join(fddir, fd)) != "anon_inode:inotify":
+                continue
+            f = open("/proc/%d/fdinfo/%s" % (pid, fd))
+        except OSError:
+            continue
+        for line in f:
+            if line.startswith("inotify wd:"):
+                count += 1
+        f.close()
+    return count
+
+set_password("user1", "pw1")
+set_password("user2", "pw2")
+ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+try:
+    if not login("user1", "pw1"):
+        raise Exception("First login refused")
+    first = showauth()
+
+    # Nothing changed, so the second login comes from the cache.
+    if not login("user1", "pw1"):
+        raise Exception("Second login refused")
+    second = showauth()
+    if second["hits"] <= first["hits"]:
+        raise Exception("Second login was not a cache hit: %s" % str(second))
+    if second["misses"] != first["misses"]:
+        raise Exception("Second login read the files: %s" % str(second))
+
+    if not login("user2", "pw2"):
+        raise Exception("Second user refused")
+    watches = inotify_watches(ser2net.pid)
+
+    # Changing the key file must drop the cached password.
+    set_password("user1", "newpw")
+    time.sleep(0.2)
+    if login("user1", "pw1"):
+        raise Exception("Old password still accepted")
+    if not login("user1", "newpw"):
+        raise Exception("New password refused")
+    third = showauth()
+    if third["invalidations"] <= second["invalidations"]:
+        raise Exception("Cache was not invalidated: %s" % str(third))
+
+    # The watches for the dropped entries must be gone, only the
+    # authdir and user1's directory are watched now.
+    after = inotify_watches(ser2net.pid)
+    if after >= watches:
+        raise Exception("Inotify watches were not removed: %d then %d" %
+                        (watches, after))
+finally:
+    ser2net.terminate()
+    shutil.rmtree(authdir)
+print("  Success!")
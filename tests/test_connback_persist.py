@@ -0,0 +1,64 @@
+#!/usr/bin/python
+
+import time
+import socket
+import utils
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "connection: &con1\n"
+          "  accepter: tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "  options:\n"
+          "    remaddr: \"!127.0.0.1,3040\"\n"
+          "    connback-persist: true\n"
+          "    connback-retry-max: 2\n")
+
+print("connect back persist:\n  config=%s" % config)
+
+l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+l.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+l.bind(("127.0.0.1", 3040))
+l.listen(1)
+l.settimeout(10)
+
+ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+try:
+    # No data is sent to the device, the connection should come anyway.
+    try:
+        (c, addr) = l.accept()
+    except socket.timeout:
+        raise Exception("Connect back was not dialed at startup")
+    c.close()
+
+    # Dropping it must cause a redial.
+    try:
+        (c, addr) = l.accept()
+    except socket.timeout:
+        raise Exception("Connect back was not redialed")
+    c.close()
+
+    # Refuse the redials for a while, the backoff doubles but stops at
+    # connback-retry-max, so once the address is back the redial must
+    # come within that plus the one second port timer.
+    l.close()
+    time.sleep(8)
+    l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    l.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    l.bind(("127.0.0.1", 3040))
+    l.listen(1)
+    l.settimeout(4)
+    start = time.time()
+    try:
+        (c, addr) = l.accept()
+    except socket.timeout:
+        raise Exception("Redial backoff went past connback-retry-max")
+    print("  redialed %.1f seconds after the address came back" %
+          (time.time() - start))
+    c.close()
+finally:
+    ser2net.terminate()
+    l.close()
+print("  Success!")
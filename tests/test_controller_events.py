@@ -0,0 +1,85 @@
+#!/usr/bin/python
+
+import socket
+import utils
+
+# The connect back of con2 is refused until after the subscribe.
+cb = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+cb.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+cb.bind(("127.0.0.1", 3041))
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "admin:\n"
+          "  accepter: tcp,localhost,3030\n"
+          "connection: &con1\n"
+          "  accepter: tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "connection: &con2\n"
+          "  accepter: tcp,localhost,3024\n"
+          "  connector: serialdev,/dev/ttyPipeA1,9600N81\n"
+          "  options:\n"
+          "    remaddr: \"!127.0.0.1,3041\"\n"
+          "    connback-persist: true\n"
+          "    connback-retry-max: 1\n")
+
+print("controller events:\n  config=%s" % config)
+
+def read_event(f):
+    while True:
+        line = f.readline()
+        if not line:
+            raise Exception("Controller closed the connection")
+        # The prompt may be in front of it.
+        i = line.find("event ")
+        if i >= 0:
+            return line[i:].strip().split(" ", 5)
+
+ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+try:
+    s = socket.create_connection(("localhost", 3030), 5)
+    f = s.makefile("r")
+    s.sendall(b"subscribe connect,disconnect\r\n")
+    line = f.readline()
+    while "subscribed:" not in line:
+        line = f.readline()
+        if not line:
+            raise Exception("No response to subscribe")
+    if line.split(":")[1].split() != ["connect", "disconnect"]:
+        raise Exception("Bad subscription: %s" % line)
+
+    c = socket.create_connection(("localhost", 3023), 5)
+    ev = read_event(f)
+    if ev[1] != "1" or ev[3] != "connect" or ev[4] != "con1":
+        raise Exception("Bad connect event: %s" % str(ev))
+    if len(ev) < 6 or not ev[5].startswith("remote="):
+        raise Exception("No remote address in connect event: %s" % str(ev))
+    c.close()
+    ev = read_event(f)
+    if ev[1] != "2" or ev[3] != "disconnect" or ev[4] != "con1":
+        raise Exception("Bad disconnect event: %s" % str(ev))
+    if float(ev[2]) <= 0:
+        raise Exception("Bad event time: %s" % str(ev))
+
+
+    # A connect back gets the same pair of events, failed dials get
+    # none.
+    cb.listen(1)
+    cb.settimeout(5)
+    (c, addr) = cb.accept()
+    ev = read_event(f)
+    if ev[3] != "connect" or ev[4] != "con2":
+        raise Exception("Bad connect back connect event: %s" % str(ev))
+    c.close()
+    ev = read_event(f)
+    if ev[3] != "disconnect" or ev[4] != "con2":
+        raise Exception("Bad connect back disconnect event: %s" % str(ev))
+
+    s.sendall(b"unsubscribe\r\nexit\r\n")
+    s.close()
+finally:
+    ser2net.terminate()
+    cb.close()
+print("  Success!")
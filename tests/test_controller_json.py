@@ -0,0 +1,86 @@
+#!/usr/bin/python
+
+import socket
+import utils
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "admin:\n"
+          "  accepter: tcp,localhost,3030\n"
+          "connection: &con1\n"
+          "  accepter: tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "connection: &con2\n"
+          "  accepter: tcp,localhost,3024\n"
+          "  connector: serialdev,/dev/ttyPipeA1,9600N81\n")
+
+print("controller json:\n  config=%s" % config)
+
+ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+try:
+    s = socket.create_connection(("localhost", 3030), 5)
+    f = s.makefile("r")
+
+    # Text mode refuses a line with too many tokens instead of
+    # dropping the extra ones.
+    s.sendall(b"showport" + b" x" * 20 + b"\r\n")
+    line = ""
+    while "Too many arguments" not in line:
+        line = f.readline()
+        if not line or "Invalid port" in line:
+            raise Exception("Too many arguments not refused: %s" % line)
+    s.close()
+
+    admin = utils.AdminJson()
+    resp = admin.hello
+    if not resp.get("done") or "version" not in resp:
+        raise Exception("Bad response to json: %s" % str(resp))
+
+    # Send several requests without waiting for the responses.
+    admin.s.sendall(b'{"id":1,"cmd":"showport"}\n'
+                    b'{"id":"two","cmd":"showport","args":["con2"]}\n'
+                    b'{"id":3,"cmd":"version"}\n'
+                    b'{"id":4,"cmd":"nosuchcommand"}\n'
+                    b'{"id":5,"cmd":\n')
+
+    names = []
+    resp = admin.read()
+    while "port" in resp:
+        if resp["id"] != 1:
+            raise Exception("Bad id in port record: %s" % str(resp))
+        names.append(resp["port"]["name"])
+        resp = admin.read()
+    if resp["id"] != 1 or not resp["done"] or resp["count"] != 2:
+        raise Exception("Bad end of showport: %s" % str(resp))
+    if sorted(names) != ["con1", "con2"]:
+        raise Exception("Bad port names: %s" % str(names))
+
+    resp = admin.read()
+    if resp["id"] != "two" or resp["port"]["name"] != "con2":
+        raise Exception("Bad single port record: %s" % str(resp))
+    resp = admin.read()
+    if resp["id"] != "two" or not resp["done"]:
+        raise Exception("Bad end of single showport: %s" % str(resp))
+
+    resp = admin.read()
+    if resp["id"] != 3 or "ser2net version" not in resp["output"]:
+        raise Exception("Bad version response: %s" % str(resp))
+
+    resp = admin.read()
+    if resp["id"] != 4 or resp.get("error") is not True:
+        raise Exception("Bad unknown command response: %s" % str(resp))
+
+    resp = admin.read()
+    if resp["id"] != 5 or "error" not in resp:
+        raise Exception("Bad invalid request response: %s" % str(resp))
+    admin.close()
+
+    # A one-shot request on its own connection.
+    recs = utils.admin_json("showport", ["con1"])
+    if len(recs) != 1 or recs[0]["port"]["name"] != "con1":
+        raise Exception("Bad one-shot showport records: %s" % str(recs))
+finally:
+    ser2net.terminate()
+print("  Success!")
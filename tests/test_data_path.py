@@ -0,0 +1,55 @@
+#!/usr/bin/python
+
+import utils
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "admin:\n"
+          "  accepter: tcp,localhost,3030\n"
+          "connection: &con1\n"
+          "  accepter: tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81,local\n"
+          "  options:\n"
+          "    chardelay: false\n")
+io1str = "tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("data path selection:\n  config=%s  io1=%s\n  io2=%s" %
+      (config, io1str, io2str))
+
+def data_path(admin):
+    port = admin.showport("con1")
+    return (port["device_data_path"], port["network_data_path"])
+
+def check(admin, expect):
+    got = data_path(admin)
+    if got != expect:
+        raise Exception("Expected data path %s, got %s" %
+                        (str(expect), str(got)))
+
+ser2net, io1, io2 = utils.setup_2_ser2net(o, config, io1str, io2str,
+                                          yaml = True)
+admin = None
+try:
+    admin = utils.AdminJson()
+    utils.test_dataxfer(io1, io2, "Network to device")
+    utils.test_dataxfer(io2, io1, "Device to network")
+    check(admin, ("minimal", "minimal"))
+
+    # A monitor adds a tap stage to both directions.
+    admin.cmd("monitor", ["both", "con1"])
+    check(admin, ("tap", "tap"))
+    utils.test_dataxfer(io1, io2, "Tapped to device")
+    utils.test_dataxfer(io2, io1, "Tapped to network")
+
+    admin.cmd("monitor", ["stop"])
+    check(admin, ("minimal", "minimal"))
+    utils.test_dataxfer(io1, io2, "Network to device again")
+    utils.test_dataxfer(io2, io1, "Device to network again")
+finally:
+    if admin:
+        admin.close()
+    utils.finish_2_ser2net(ser2net, io1, io2)
+print("  Success!")
@@ -0,0 +1,66 @@
+#!/usr/bin/python
+
+import signal
+import gensio
+import utils
+
+o = utils.o
+
+config = ("3023:raw:100:/dev/ttyPipeA0:9600N81 keep-device-open"
+          " keep-open-backlog=32\n")
+io1str = "tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("Keep device open:\n  config=%s  io1=%s\n  io2=%s" %
+      (config, io1str, io2str))
+
+ser2net, io1, io2 = utils.setup_2_ser2net(o, config, io1str, io2str)
+try:
+    print("  first connection")
+    utils.test_dataxfer(io1, io2, "Data before the close")
+    utils.test_dataxfer(io2, io1, "Data before the close")
+    utils.io_close(io1)
+
+    # Nobody is connected now, the data should go into the backlog.
+    # Only the last 32 bytes are kept.
+    print("  write with nobody connected")
+    io2.handler.set_write_data("This part gets dropped, " +
+                               "this part is saved in the backlog")
+    if (io2.handler.wait_timeout(1000) == 0):
+        raise Exception("Timed out writing to the idle device")
+    gensio.waiter(o).wait_timeout(1, 200)
+
+    print("  second connection gets the backlog")
+    io1 = utils.alloc_io(o, io1str)
+    io1.closeme = True
+    io1.handler.set_compare("this part is saved in the backlog"[-32:])
+    if (io1.handler.wait_timeout(1000) == 0):
+        raise Exception("Timed out waiting for the backlog at byte %d" %
+                        io1.handler.compared)
+
+    print("  data still flows")
+    utils.test_dataxfer(io1, io2, "Data after the reconnect")
+    utils.test_dataxfer(io2, io1, "Data after the reconnect")
+    utils.io_close(io1)
+
+    # A reload with the same config must leave the idle device open,
+    # the backlog saved before it is still there after it.
+    print("  reload while idle keeps the device and backlog")
+    io2.handler.set_write_data("Saved across the reload")
+    if (io2.handler.wait_timeout(1000) == 0):
+        raise Exception("Timed out writing to the idle device")
+    gensio.waiter(o).wait_timeout(1, 200)
+    ser2net.signal(signal.SIGHUP)
+    gensio.waiter(o).wait_timeout(1, 500)
+
+    io1 = utils.alloc_io(o, io1str)
+    io1.closeme = True
+    io1.handler.set_compare("Saved across the reload")
+    if (io1.handler.wait_timeout(1000) == 0):
+        raise Exception("Timed out waiting for the backlog after the"
+                        " reload at byte %d" % io1.handler.compared)
+    utils.test_dataxfer(io1, io2, "Data after the reload")
+    utils.test_dataxfer(io2, io1, "Data after the reload")
+finally:
+    utils.finish_2_ser2net(ser2net, io1, io2)
+print("  Success!")
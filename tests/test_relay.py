@@ -0,0 +1,64 @@
+#!/usr/bin/python
+
+import utils
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "admin:\n"
+          "  accepter: tcp,localhost,3030\n"
+          "connection: &con1\n"
+          "  accepter: tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81,local\n"
+          "  options:\n"
+          "    relay: true\n")
+io1str = "tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("relay:\n  config=%s  io1=%s\n  io2=%s" % (config, io1str, io2str))
+
+def relay_bytes(admin):
+    (recs, mons) = admin.cmd("showport", ["con1"])
+    for r in recs:
+        if "port" in r:
+            return (r["port"]["relay_bytes"], mons)
+    raise Exception("No port in showport output: %s" % str(recs))
+
+ser2net, io1, io2 = utils.setup_2_ser2net(o, config, io1str, io2str,
+                                          yaml = True)
+admin = None
+try:
+    admin = utils.AdminJson()
+    utils.test_dataxfer(io1, io2, "Network to device")
+    utils.test_dataxfer(io2, io1, "Device to network")
+    (count, mons) = relay_bytes(admin)
+    if count != 34:
+        raise Exception("Expected 34 relayed bytes, got %d" % count)
+
+    # A monitor needs to see the data, so the relay has to stop.
+    admin.cmd("monitor", ["term", "con1"])
+    utils.test_dataxfer(io2, io1, "Monitored data")
+    (count2, mons) = relay_bytes(admin)
+    if count2 != count:
+        raise Exception("Relay was used with a monitor: %d" % count2)
+    data = "".join([m["data"] for m in mons])
+    while data != "Monitored data":
+        resp = admin.read()
+        if "monitor" in resp:
+            data += resp["data"]
+        if len(data) > len("Monitored data"):
+            raise Exception("Bad monitor data: %s" % data)
+
+    # And come back when the monitor is gone.
+    admin.cmd("monitor", ["stop"])
+    utils.test_dataxfer(io2, io1, "Relayed again")
+    (count3, mons) = relay_bytes(admin)
+    if count3 != count + 13:
+        raise Exception("Relay not used after the monitor stopped: %d"
+                        % count3)
+finally:
+    if admin:
+        admin.close()
+    utils.finish_2_ser2net(ser2net, io1, io2)
+print("  Success!")
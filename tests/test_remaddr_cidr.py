@@ -0,0 +1,80 @@
+#!/usr/bin/python
+
+import socket
+import utils
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "connection: &con1\n"
+          "  accepter: tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "  options:\n"
+          "    remaddr: 10.0.0.0/8;ipv4,127.0.0.0/8,0\n"
+          "connection: &con2\n"
+          "  accepter: tcp,localhost,3024\n"
+          "  connector: serialdev,/dev/ttyPipeA1,9600N81\n"
+          "  options:\n"
+          "    remaddr: 10.0.0.0/8;192.168.0.0/16\n"
+          "connection: &con3\n"
+          "  accepter: tcp,localhost,3025\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "  options:\n"
+          "    remaddr: \"ipv4,0.0.0.0/0,0\"\n"
+          "connection: &con4\n"
+          "  accepter: tcp,ipv6,::1,3026\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "  options:\n"
+          "    remaddr: \"ipv6,fd00::/8,0;ipv6,::/64,0\"\n"
+          "connection: &con5\n"
+          "  accepter: tcp,ipv6,::1,3027\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "  options:\n"
+          "    remaddr: \"ipv6,fd00::/8,0;ipv6,2001:db8::/32,0\"\n"
+          "connection: &con6\n"
+          "  accepter: tcp,ipv6,::1,3028\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "  options:\n"
+          "    remaddr: \"ipv6,::/0,0\"\n")
+
+print("remaddr CIDR:\n  config=%s" % config)
+
+def try_connect(port, host = "127.0.0.1"):
+    s = socket.create_connection((host, port), 5)
+    s.settimeout(1)
+    try:
+        data = s.recv(100)
+    except socket.timeout:
+        data = None
+    s.close()
+    return data
+
+ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+try:
+    data = try_connect(3023)
+    if data:
+        raise Exception("Connection in 127.0.0.0/8 refused: %s" % data)
+    data = try_connect(3024)
+    if not data or b"denied" not in data:
+        raise Exception("Connection outside the prefixes allowed: %s" %
+                        str(data))
+
+    # These may get "device already in use" while the last one's
+    # device closes, only a denial matters.
+    data = try_connect(3025)
+    if data and b"denied" in data:
+        raise Exception("Connection refused by 0.0.0.0/0: %s" % data)
+    data = try_connect(3026, "::1")
+    if data and b"denied" in data:
+        raise Exception("Connection from ::1 refused by ::/64: %s" % data)
+    data = try_connect(3027, "::1")
+    if not data or b"denied" not in data:
+        raise Exception("Connection from ::1 outside the IPv6 prefixes"
+                        " allowed: %s" % str(data))
+    data = try_connect(3028, "::1")
+    if data and b"denied" in data:
+        raise Exception("Connection from ::1 refused by ::/0: %s" % data)
+finally:
+    ser2net.terminate()
+print("  Success!")
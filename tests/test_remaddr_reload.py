@@ -0,0 +1,137 @@
+#!/usr/bin/python
+
+import os
+import sys
+import time
+import signal
+import socket
+import utils
+
+o = utils.o
+
+# The name is pointed at different addresses through /etc/hosts, so
+# this needs to be able to write that.
+hostsfile = "/etc/hosts"
+hostname = "ser2net-remaddr-test"
+if not os.access(hostsfile, os.W_OK):
+    print("remaddr reload: can't write %s, skipping" % hostsfile)
+    sys.exit(77)
+f = open(hostsfile)
+orig_hosts = f.read()
+f.close()
+
+def set_host(addr):
+    f = open(hostsfile, "w")
+    f.write(orig_hosts)
+    if orig_hosts and not orig_hosts.endswith("\n"):
+        f.write("\n")
+    f.write("%s %s\n" % (addr, hostname))
+    f.close()
+
+def make_config(ttl):
+    return ("%%YAML 1.1\n"
+            "---\n"
+            "default:\n"
+            "  name: resolver-ttl\n"
+            "  value: %d\n"
+            "admin:\n"
+            "  accepter: tcp,localhost,3030\n"
+            "connection: &con1\n"
+            "  accepter: tcp,127.0.0.1,3023\n"
+            "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+            "  options:\n"
+            "    remaddr: ipv4,%s,0;ipv4,localhost,0\n" % (ttl, hostname))
+
+def denied(src):
+    """Connect from the given source address, True if it was denied"""
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.settimeout(5)
+    s.bind((src, 0))
+    s.connect(("127.0.0.1", 3023))
+    s.settimeout(1)
+    try:
+        data = s.recv(100)
+    except socket.timeout:
+        data = None
+    s.close()
+    # A connection may get "device already in use" while the last
+    # one's device closes, only a denial matters.
+    return data is not None and b"denied" in data
+
+def check(allowed, refused):
+    if denied(allowed):
+        raise Exception("Connection from %s refused" % allowed)
+    time.sleep(0.2)
+    if not denied(refused):
+        raise Exception("Connection from %s allowed" % refused)
+    time.sleep(0.2)
+
+def showresolver():
+    s = socket.create_connection(("localhost", 3030), 5)
+    f = s.makefile("r")
+    s.sendall(b"showresolver\r\n")
+    stats = {}
+    while "last batch" not in stats:
+        line = f.readline()
+        if not line:
+            raise Exception("Controller closed the connection")
+        if ":" in line:
+            (name, val) = line.split(":", 1)
+            val = val.split()
+            if val and val[0].isdigit():
+                stats[name.strip()] = int(val[0])
+    s.close()
+    return stats
+
+def reload(ser2net):
+    ser2net.signal(signal.SIGHUP)
+    time.sleep(1)
+
+try:
+    # With no time to live, a reread looks the name up again and the
+    # new address takes effect.
+    set_host("127.0.0.2")
+    config = make_config(0)
+    print("remaddr reload:\n  config=%s" % config)
+    ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+    try:
+        check("127.0.0.2", "127.0.0.3")
+        before = showresolver()
+        set_host("127.0.0.3")
+        time.sleep(1.1)
+        reload(ser2net)
+        check("127.0.0.3", "127.0.0.2")
+        after = showresolver()
+        if after["lookups"] <= before["lookups"]:
+            raise Exception("Reread did not look the names up: %s" %
+                            str(after))
+    finally:
+        ser2net.terminate()
+
+    # Within the time to live the cached address is used, and the
+    # names are looked up together.
+    set_host("127.0.0.2")
+    config = make_config(3600)
+    print("remaddr reload cached:\n  config=%s" % config)
+    ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+    try:
+        before = showresolver()
+        if before["last batch"] != 2:
+            raise Exception("Names were not looked up together: %s" %
+                            str(before))
+        check("127.0.0.2", "127.0.0.3")
+        set_host("127.0.0.3")
+        reload(ser2net)
+        check("127.0.0.2", "127.0.0.3")
+        after = showresolver()
+        if after["hits"] <= before["hits"]:
+            raise Exception("Reread did not use the cache: %s" % str(after))
+        if after["lookups"] != before["lookups"]:
+            raise Exception("Reread looked cached names up: %s" % str(after))
+    finally:
+        ser2net.terminate()
+finally:
+    f = open(hostsfile, "w")
+    f.write(orig_hosts)
+    f.close()
+print("  Success!")
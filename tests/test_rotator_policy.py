@@ -0,0 +1,133 @@
+#!/usr/bin/python
+
+import socket
+import time
+import utils
+
+o = utils.o
+
+def make_config(policy, maxcon = 1):
+    config = ("%YAML 1.1\n"
+              "---\n"
+              "admin:\n"
+              "  accepter: tcp,localhost,3030\n")
+    for i in range(0, 3):
+        config += ("connection: &con%d\n"
+                   "  accepter: tcp,localhost,%d\n"
+                   "  connector: serialdev,/dev/ttyPipeA%d,9600N81\n"
+                   "  options:\n"
+                   "    max-connections: %d\n" % (i + 1, 3023 + i, i, maxcon))
+    config += ("rotator: &rot1\n"
+               "  accepter: tcp,localhost,3026\n"
+               "  connections: [ *con1, *con2, *con3 ]\n"
+               "  options:\n"
+               "    policy: %s\n" % policy)
+    return config
+
+def rot_connect():
+    s = socket.create_connection(("127.0.0.1", 3026), 5)
+    s.settimeout(1)
+    try:
+        data = s.recv(100)
+    except socket.timeout:
+        data = None
+    return (s, data)
+
+def port_of(s):
+    """Return the name of the port the rotator gave the socket"""
+    lport = ",%d" % s.getsockname()[1]
+    for r in utils.admin_json("showport"):
+        if "port" not in r:
+            continue
+        for c in r["port"]["connections"]:
+            if c["remote"].endswith(lport):
+                return r["port"]["name"]
+    raise Exception("Rotator connection not on any port")
+
+def expect_port(name):
+    (s, data) = rot_connect()
+    if data:
+        raise Exception("Rotator connection refused: %s" % data)
+    got = port_of(s)
+    if got != name:
+        raise Exception("Expected the rotator to pick %s, got %s" %
+                        (name, got))
+    return s
+
+def close_all(socks):
+    for s in socks:
+        s.close()
+    time.sleep(0.5)
+
+def send_to_device(s, name, count):
+    s.sendall(b"x" * count)
+    for i in range(0, 50):
+        if utils.admin_showport(name)["device_bytes_written"] >= count:
+            return
+        time.sleep(0.1)
+    raise Exception("Data did not reach the device on %s" % name)
+
+def run_policy(policy, test, maxcon = 1):
+    config = make_config(policy, maxcon)
+    print("rotator policy %s:\n  config=%s" % (policy, config))
+    ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+    try:
+        test()
+    finally:
+        ser2net.terminate()
+
+def test_round_robin():
+    # Fill every port, then free the second and first.  Round robin
+    # picks up after the last port handed out, so the first is next.
+    s1 = expect_port("con1")
+    s2 = expect_port("con2")
+    s3 = expect_port("con3")
+    (s, data) = rot_connect()
+    s.close()
+    if not data or b"No free port" not in data:
+        raise Exception("Fourth rotator connection allowed: %s" % str(data))
+    close_all([s2])
+    close_all([s1])
+    s1 = expect_port("con1")
+    s2 = expect_port("con2")
+    close_all([s1, s2, s3])
+
+def test_lru():
+    # Same as above, but the port freed longest ago comes first.
+    s1 = expect_port("con1")
+    s2 = expect_port("con2")
+    s3 = expect_port("con3")
+    close_all([s2])
+    close_all([s1])
+    s2 = expect_port("con2")
+    s1 = expect_port("con1")
+    close_all([s1, s2, s3])
+
+def test_least_bytes():
+    # The port that has moved the fewest device bytes comes first,
+    # ties go to the earlier port.
+    s1 = expect_port("con1")
+    s2 = expect_port("con2")
+    send_to_device(s2, "con2", 100)
+    close_all([s2])
+    close_all([s1])
+    s1 = expect_port("con1")
+    s3 = expect_port("con3")
+    s2 = expect_port("con2")
+    close_all([s1, s2, s3])
+
+def test_least_bytes_shared():
+    # A port with room for more stays free while it is used, its bytes
+    # must still count when one of its connections goes away.
+    s1 = expect_port("con1")
+    s2 = expect_port("con1")
+    send_to_device(s1, "con1", 100)
+    close_all([s1])
+    s3 = expect_port("con2")
+    close_all([s2, s3])
+
+run_policy("round-robin", test_round_robin)
+run_policy("lru", test_lru)
+run_policy("least-bytes", test_least_bytes)
+run_policy("least-bytes", test_least_bytes_shared, maxcon = 3)
+print("  Success!")
@@ -0,0 +1,64 @@
+#!/usr/bin/python
+
+import gensio
+import utils
+from serialsim import *
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "admin:\n"
+          "  accepter: tcp,localhost,3030\n"
+          "connection: &con1\n"
+          "  accepter: telnet(rfc2217),tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81,local\n"
+          "  options:\n"
+          "    state-coalesce: 500\n")
+io1str = "telnet(rfc2217),tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("modemstate coalescing:\n  config=%s  io1=%s\n  io2=%s" %
+      (config, io1str, io2str))
+
+ser2net, io1, io2 = utils.setup_2_ser2net(o, config, io1str, io2str,
+                                          do_io1_open = False, yaml = True)
+try:
+    set_remote_null_modem(io2.remote_id(), False);
+    set_remote_modem_ctl(io2.remote_id(), (SERIALSIM_TIOCM_CAR |
+                                           SERIALSIM_TIOCM_CTS |
+                                           SERIALSIM_TIOCM_DSR |
+                                           SERIALSIM_TIOCM_RNG) << 16)
+
+    io1.handler.set_expected_modemstate(0)
+    io1.open_s()
+    io1.read_cb_enable(True);
+    if (io1.handler.wait_timeout(2000) == 0):
+        raise Exception("Timed out waiting for the first modemstate")
+
+    # The first change goes out right away.
+    io1.handler.set_expected_modemstate(gensio.SERGENSIO_MODEMSTATE_CD_CHANGED |
+                                        gensio.SERGENSIO_MODEMSTATE_CD)
+    set_remote_modem_ctl(io2.remote_id(), ((SERIALSIM_TIOCM_CAR << 16) |
+                                           SERIALSIM_TIOCM_CAR))
+    if (io1.handler.wait_timeout(2000) == 0):
+        raise Exception("Timed out waiting for the first CD change")
+
+    # Flapping CD inside the window must come out as one report with
+    # the final state.  Without coalescing the first flap (CD off)
+    # would not match.
+    io1.handler.set_expected_modemstate(gensio.SERGENSIO_MODEMSTATE_CD_CHANGED |
+                                        gensio.SERGENSIO_MODEMSTATE_CD)
+    for i in range(0, 4):
+        set_remote_modem_ctl(io2.remote_id(), SERIALSIM_TIOCM_CAR << 16)
+        set_remote_modem_ctl(io2.remote_id(), ((SERIALSIM_TIOCM_CAR << 16) |
+                                               SERIALSIM_TIOCM_CAR))
+    if (io1.handler.wait_timeout(2000) == 0):
+        raise Exception("Timed out waiting for the merged CD change")
+
+    port = utils.admin_showport("con1")
+    if port["modemstate_suppressed"] < 1:
+        raise Exception("No modemstate changes were merged: %s" % str(port))
+finally:
+    utils.finish_2_ser2net(ser2net, io1, io2, handle_except = False)
+print("  Success!")
@@ -0,0 +1,94 @@
+#!/usr/bin/python
+
+import time
+import socket
+import struct
+import utils
+
+o = utils.o
+
+shmname = "/ser2net_test_stats"
+shmfile = "/dev/shm" + shmname
+config = "3023:raw:100:/dev/ttyPipeA0:9600N81\n"
+io1str = "tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("shared memory stats:\n  config=%s  io1=%s\n  io2=%s" %
+      (config, io1str, io2str))
+
+# See stats.h for the layout.
+HDR = struct.Struct("=IIIIIIQ")
+SLOT = struct.Struct("=Q64sIIIIQQQQQQQQQQ")
+
+def read_stats():
+    with open(shmfile, "rb") as f:
+        data = f.read()
+    (magic, version, hdrsize, slotsize, nslots,
+     pid, start) = HDR.unpack_from(data, 0)
+    if magic != 0x53324e53 or version != 1:
+        raise Exception("Bad stats header: %x %d" % (magic, version))
+    ports = {}
+    for i in range(nslots):
+        v = SLOT.unpack_from(data, hdrsize + i * slotsize)
+        if not v[2]:
+            continue
+        name = v[1].split(b"\0")[0].decode()
+        ports[name] = { "connections": v[5],
+                        "total_connections": v[6],
+                        "net_bytes_in": v[8],
+                        "net_bytes_out": v[9],
+                        "dev_bytes_in": v[10],
+                        "dev_bytes_out": v[11] }
+    return ports
+
+ser2net, io1, io2 = utils.setup_2_ser2net(o, config, io1str, io2str,
+                                          extra_args = "-S " + shmname)
+try:
+    utils.test_dataxfer(io1, io2, "Network to device")
+    utils.test_dataxfer(io2, io1, "Device to network")
+    s = read_stats()["3023"]
+    if s["connections"] != 1 or s["total_connections"] != 1:
+        raise Exception("Bad connection counts: %s" % str(s))
+    if (s["net_bytes_in"] != 17 or s["dev_bytes_out"] != 17 or
+            s["dev_bytes_in"] != 17 or s["net_bytes_out"] != 17):
+        raise Exception("Bad byte counts: %s" % str(s))
+finally:
+    utils.finish_2_ser2net(ser2net, io1, io2)
+
+# A connect back is counted when it comes up and when it goes down,
+# and dials that fail are not counted at all.
+cbconfig = ("%YAML 1.1\n"
+            "---\n"
+            "connection: &con1\n"
+            "  accepter: tcp,localhost,3023\n"
+            "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+            "  options:\n"
+            "    remaddr: \"!127.0.0.1,3040\"\n"
+            "    connback-persist: true\n")
+print("  connect back:\n  config=%s" % cbconfig)
+
+l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+l.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+l.bind(("127.0.0.1", 3040))
+l.listen(1)
+l.settimeout(10)
+ser2net = utils.Ser2netDaemon(o, cbconfig, extra_args = "-S " + shmname,
+                              yaml = True)
+try:
+    (c, addr) = l.accept()
+    time.sleep(0.5)
+    s = read_stats()["con1"]
+    if s["connections"] != 1 or s["total_connections"] != 1:
+        raise Exception("Bad connect back counts: %s" % str(s))
+    # Refuse the redials, then drop the connection.
+    l.close()
+    c.close()
+    time.sleep(2)
+    s = read_stats()["con1"]
+    if s["connections"] != 0 or s["total_connections"] != 1:
+        raise Exception("Bad counts after the connect back closed: %s" %
+                        str(s))
+finally:
+    ser2net.terminate()
+    l.close()
+print("  Success!")
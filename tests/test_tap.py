@@ -0,0 +1,46 @@
+#!/usr/bin/python
+
+import os
+import gensio
+import utils
+
+o = utils.o
+
+tapfile = os.path.abspath("tap_test.out")
+config = ("%%YAML 1.1\n"
+          "---\n"
+          "connection: &con1\n"
+          "  accepter: tcp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81\n"
+          "  options:\n"
+          "    kickolduser: true\n"
+          "    tap-file: %s\n"
+          "    tap-filter: dir=dev\n" % tapfile)
+io1str = "tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("tap file:\n  config=%s  io1=%s\n  io2=%s" %
+      (config, io1str, io2str))
+
+if os.path.exists(tapfile):
+    os.unlink(tapfile)
+
+ser2net, io1, io2 = utils.setup_2_ser2net(o, config, io1str, io2str,
+                                          yaml = True)
+try:
+    utils.test_dataxfer(io1, io2, "Network to device")
+    utils.test_dataxfer(io2, io1, "Device to network")
+    utils.test_dataxfer(io2, io1, "Second read")
+    # Let ser2net write the file.
+    gensio.waiter(o).wait_timeout(1, 200)
+finally:
+    utils.finish_2_ser2net(ser2net, io1, io2)
+
+try:
+    with open(tapfile, "rb") as f:
+        data = f.read()
+    if data != b"Device to networkSecond read":
+        raise Exception("Bad data in tap file: %s" % data)
+finally:
+    os.unlink(tapfile)
+print("  Success!")
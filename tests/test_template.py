@@ -0,0 +1,33 @@
+#!/usr/bin/python
+
+import utils
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "template:\n"
+          "  name: tmpl$(i)\n"
+          "  range: 3023-3024\n"
+          "  accepter: tcp,localhost,$(i)\n"
+          "  connector: serialdev,/dev/ttyPipeA$(i-3023),9600N81\n"
+          "  options:\n"
+          "    banner: \"\\\\N\\\\r\\\\n\"\n"
+          "    kickolduser: true\n")
+io1str = "tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("template:\n  config=%s  io1=%s\n  io2=%s" %
+      (config, io1str, io2str))
+
+ser2net, io1, io2 = utils.setup_2_ser2net(o, config, io1str, io2str,
+                                          yaml = True)
+try:
+    io1.handler.set_compare("tmpl3023\r\n")
+    if (io1.handler.wait_timeout(1000) == 0):
+        raise Exception("Timeout waiting for template port banner")
+    utils.test_dataxfer(io1, io2, "Network to device")
+    utils.test_dataxfer(io2, io1, "Device to network")
+finally:
+    utils.finish_2_ser2net(ser2net, io1, io2)
+print("  Success!")
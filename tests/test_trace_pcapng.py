@@ -0,0 +1,51 @@
+#!/usr/bin/python
+
+import os
+import gensio
+import utils
+import tracereplay
+
+o = utils.o
+
+tracefile = os.path.abspath("trace_pcapng_test.pcapng")
+config = ("TRACEFILE:tb1:%s\n"
+          "3023:raw:100:/dev/ttyPipeA0:9600N81 tb=tb1 trace-format=pcapng\n"
+          % tracefile)
+io1str = "tcp,localhost,3023"
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("pcapng trace:\n  config=%s  io1=%s\n  io2=%s" %
+      (config, io1str, io2str))
+
+if os.path.exists(tracefile):
+    os.unlink(tracefile)
+
+ser2net, io1, io2 = utils.setup_2_ser2net(o, config, io1str, io2str)
+try:
+    utils.test_dataxfer(io1, io2, "Network to device")
+    utils.test_dataxfer(io2, io1, "Device to network")
+    utils.io_close(io1)
+    io1.closeme = False
+    # Let ser2net write the close.
+    gensio.waiter(o).wait_timeout(1, 200)
+finally:
+    utils.finish_2_ser2net(ser2net, io1, io2)
+
+try:
+    events = tracereplay.parse_trace(tracefile)
+    kinds = [e.kind for e in events]
+    if kinds[0] != "open" or kinds[-1] != "close":
+        raise Exception("Trace not bracketed by open and close: %s" %
+                        str(kinds))
+    netdata = b"".join(e.data for e in events if e.kind == tracereplay.NET)
+    devdata = b"".join(e.data for e in events if e.kind == tracereplay.DEV)
+    if netdata != b"Network to device":
+        raise Exception("Bad network data in trace: %s" % netdata)
+    if devdata != b"Device to network":
+        raise Exception("Bad device data in trace: %s" % devdata)
+    for i in range(1, len(events)):
+        if events[i].t < events[i - 1].t:
+            raise Exception("Trace timestamps go backwards")
+finally:
+    os.unlink(tracefile)
+print("  Success!")
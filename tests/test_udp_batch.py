@@ -0,0 +1,56 @@
+#!/usr/bin/python
+
+import socket
+import utils
+
+o = utils.o
+
+config = ("%YAML 1.1\n"
+          "---\n"
+          "admin:\n"
+          "  accepter: tcp,localhost,3030\n"
+          "connection: &con1\n"
+          "  accepter: udp,localhost,3023\n"
+          "  connector: serialdev,/dev/ttyPipeA0,9600N81,local\n"
+          "  options:\n"
+          "    udp-batch: 20000\n")
+io2str = "serialdev,/dev/ttyPipeB0,9600N81"
+
+print("udp batching:\n  config=%s  io2=%s" % (config, io2str))
+
+ser2net = utils.Ser2netDaemon(o, config, yaml = True)
+io2 = utils.alloc_io(o, io2str)
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+try:
+    s.settimeout(5)
+
+    # All the datagrams must come out of the device in order.
+    count = 50
+    data = "".join(["%03d," % i for i in range(0, count)])
+    io2.handler.set_compare(data)
+    for i in range(0, count):
+        s.sendto(("%03d," % i).encode(), ("localhost", 3023))
+    if (io2.handler.wait_timeout(5000) == 0):
+        raise Exception("Timed out waiting for the batched data at byte %d" %
+                        io2.handler.compared)
+
+    port = utils.admin_showport("con1")
+    if port["udp_batch_datagrams"] < 2:
+        raise Exception("Datagrams were not batched: %s" % str(port))
+    if port["udp_batch_writes"] >= port["udp_batch_datagrams"]:
+        raise Exception("Batching did not save any writes: %s" % str(port))
+
+    # The other way goes straight out.
+    io2.handler.set_write_data("Back to the net")
+    if (io2.handler.wait_timeout(1000) == 0):
+        raise Exception("Timed out writing to the device")
+    got = b""
+    while len(got) < len("Back to the net"):
+        got += s.recv(1024)
+    if got != b"Back to the net":
+        raise Exception("Bad data from the device: %s" % str(got))
+finally:
+    s.close()
+    utils.io_close(io2)
+    ser2net.terminate()
+print("  Success!")
@@ -0,0 +1,388 @@
+#!/usr/bin/python
+#
+# Replay a ser2net trace file against ser2net.
+#
+# This reads a trace written with the tb option (or tr and tw) with
+# hexdump set, so each line says which direction the data went, or
+# with trace-format set to pcapng, and re-injects it: data that came
+# from the device ("term" lines, pcapng interface 0) is
+# written into a pty that ser2net uses as its device, data that came
+# from the network ("tcp" lines) is written on a TCP connection to
+# ser2net.  Everything is checked to come out the other side, in
+# order, and stalls are reported.
+#
+# If the trace has timestamps, the original timing is kept (text
+# timestamps are only to the second, pcapng timestamps are in
+# nanoseconds), -s makes it go N times faster, -s 0 sends
+# everything as fast as possible.  OPEN and CLOSE lines in the trace
+# reconnect and disconnect the network side.
+#
+# By default this creates the pty, writes a config and starts its own
+# ser2net ($SER2NET_EXEC or ser2net).  To use an already running
+# ser2net, give --link with the device path the ser2net connection
+# uses (a symlink to the pty is made there) and --port for the
+# ser2net TCP port.
+#
+# This only uses the python standard library.
+#
+
+import os
+import re
+import sys
+import pty
+import tty
+import time
+import errno
+import select
+import signal
+import socket
+import struct
+import argparse
+import tempfile
+import subprocess
+
+data_re = re.compile(r"^(?:(\d{4}/\d\d/\d\d \d\d:\d\d:\d\d) )?(term|tcp ) "
+                     r"((?:[0-9a-f]{2} )+)")
+open_re = re.compile(r"^(\d{4}/\d\d/\d\d \d\d:\d\d:\d\d) OPEN \((.*)\)$")
+close_re = re.compile(r"^(\d{4}/\d\d/\d\d \d\d:\d\d:\d\d) CLOSE (\S+) "
+                      r"\((.*)\)$")
+
+DEV = "term"
+NET = "tcp"
+
+class Event:
+    def __init__(self, t, kind, data = b""):
+        self.t = t          # Seconds from the start of the trace, or None
+        self.kind = kind    # DEV, NET, "open", or "close"
+        self.data = data
+
+def parse_time(s):
+    if not s:
+        return None
+    return time.mktime(time.strptime(s, "%Y/%m/%d %H:%M:%S"))
+
+def parse_text_trace(f):
+    """Parse a hexdump trace, returns a list of Events."""
+    events = []
+    for line in f:
+        line = line.decode("latin-1").rstrip("\n")
+        m = data_re.match(line)
+        if m:
+            kind = DEV if m.group(2) == "term" else NET
+            data = bytes(bytearray(int(x, 16) for x in m.group(3).split()))
+            t = parse_time(m.group(1))
+            last = events[-1] if events else None
+            # Lines are 8 bytes long, put the pieces of a read back
+            # together.
+            if last and last.kind == kind and last.t == t:
+                last.data += data
+            else:
+                events.append(Event(t, kind, data))
+            continue
+        m = open_re.match(line)
+        if m:
+            events.append(Event(parse_time(m.group(1)), "open", m.group(2)))
+            continue
+        m = close_re.match(line)
+        if m:
+            # Only a netcon close is a disconnect, a port close is
+            # written after the users are already gone.
+            if m.group(2) == "netcon":
+                events.append(Event(parse_time(m.group(1)), "close",
+                                    m.group(3)))
+            continue
+    return events
+
+PCAPNG_SHB = 0x0a0d0d0a
+PCAPNG_IDB = 1
+PCAPNG_EPB = 6
+
+def pcapng_options(data, bo):
+    """Return a dictionary of option code to list of values."""
+    opts = {}
+    pos = 0
+    while pos + 4 <= len(data):
+        code, olen = struct.unpack(bo + "HH", data[pos:pos + 4])
+        if code == 0:
+            break
+        opts.setdefault(code, []).append(data[pos + 4:pos + 4 + olen])
+        pos += 4 + ((olen + 3) & ~3)
+    return opts
+
+def parse_pcapng_trace(f):
+    """Parse a trace written with trace-format: pcapng.
+
+    Interface 0 is the device, the others are network connections.
+    Events are empty packets with a comment.
+    """
+    events = []
+    ifaces = []
+    bo = "<"
+    while True:
+        hdr = f.read(8)
+        if len(hdr) < 8:
+            break
+        btype = struct.unpack("<I", hdr[0:4])[0]
+        if btype == PCAPNG_SHB:
+            magic = f.read(4)
+            bo = "<" if struct.unpack("<I", magic)[0] == 0x1a2b3c4d else ">"
+            blen = struct.unpack(bo + "I", hdr[4:8])[0]
+            body = magic + f.read(blen - 12)
+            ifaces = []
+            continue
+        btype, blen = struct.unpack(bo + "II", hdr)
+        body = f.read(blen - 8)
+        if btype == PCAPNG_IDB:
+            opts = pcapng_options(body[8:-4], bo)
+            resol = 6
+            if 9 in opts:
+                resol = bytearray(opts[9][0])[0]
+            offset = 0
+            if 14 in opts:
+                offset = struct.unpack(bo + "q", opts[14][0])[0]
+            # Only power of 10 resolutions are written by ser2net.
+            ifaces.append((10.0 ** -(resol & 0x7f), offset))
+        elif btype == PCAPNG_EPB:
+            ifidx, tsh, tsl, caplen = struct.unpack(bo + "IIII", body[0:16])
+            data = body[20:20 + caplen]
+            opts = pcapng_options(body[20 + ((caplen + 3) & ~3):-4], bo)
+            scale, offset = ifaces[ifidx]
+            t = ((tsh << 32) | tsl) * scale + offset
+            if 1 in opts:
+                comment = opts[1][0].decode("latin-1")
+                if comment.startswith("OPEN "):
+                    events.append(Event(t, "open", comment[5:]))
+                elif comment.startswith("CLOSE netcon "):
+                    events.append(Event(t, "close", comment[13:]))
+            elif data:
+                events.append(Event(t, DEV if ifidx == 0 else NET, data))
+    return events
+
+def parse_trace(fname):
+    with open(fname, "rb") as f:
+        if f.read(4) == struct.pack("<I", PCAPNG_SHB):
+            f.seek(0)
+            events = parse_pcapng_trace(f)
+        else:
+            f.seek(0)
+            events = parse_text_trace(f)
+    if not events:
+        raise Exception("No data found in %s, was hexdump or pcapng set?" %
+                        fname)
+    start = None
+    for e in events:
+        if e.t is not None:
+            if start is None:
+                start = e.t
+            e.t -= start
+    return events
+
+class Replayer:
+    def __init__(self, master, port, timeout):
+        self.master = master
+        self.port = port
+        self.timeout = timeout
+        self.sock = None
+        self.expect = { DEV: bytearray(), NET: bytearray() }
+        self.sent = { DEV: 0, NET: 0 }
+        self.received = { DEV: 0, NET: 0 }
+        self.mismatches = 0
+        self.stalls = 0
+        self.connects = 0
+        self.last_progress = time.monotonic()
+
+    def connect(self):
+        if self.sock:
+            return
+        end = time.monotonic() + self.timeout
+        while True:
+            try:
+                self.sock = socket.create_connection(("localhost",
+                                                      self.port), 1)
+                break
+            except socket.error:
+                if time.monotonic() > end:
+                    raise
+                time.sleep(0.01)
+        self.sock.setblocking(False)
+        self.connects += 1
+
+    def disconnect(self):
+        # Let everything in flight show up before closing.
+        self.drain()
+        if self.sock:
+            self.sock.close()
+            self.sock = None
+        self.expect[DEV] = bytearray()
+        self.expect[NET] = bytearray()
+
+    def got(self, kind, data):
+        """Data came out of ser2net, kind is where it came from."""
+        self.received[kind] += len(data)
+        exp = self.expect[kind]
+        n = min(len(exp), len(data))
+        if exp[:n] != data[:n] or len(data) > len(exp):
+            self.mismatches += 1
+        del exp[:n]
+        self.last_progress = time.monotonic()
+
+    def poll(self, wait):
+        fds = [self.master]
+        if self.sock:
+            fds.append(self.sock)
+        r, w, x = select.select(fds, [], [], wait)
+        if self.master in r:
+            try:
+                self.got(NET, os.read(self.master, 65536))
+            except OSError as e:
+                if e.errno != errno.EIO:
+                    raise
+        if self.sock and self.sock in r:
+            try:
+                data = self.sock.recv(65536)
+            except socket.error:
+                data = b""
+            if data:
+                self.got(DEV, data)
+            else:
+                self.sock.close()
+                self.sock = None
+
+    def pending(self):
+        return len(self.expect[DEV]) + len(self.expect[NET])
+
+    def drain(self):
+        """Wait for everything sent to come out the other side."""
+        while self.pending():
+            if time.monotonic() - self.last_progress > self.timeout:
+                self.stalls += 1
+                print("Stall: waiting for %d bytes from the device and %d"
+                      " from the network" % (len(self.expect[DEV]),
+                                             len(self.expect[NET])))
+                self.expect[DEV] = bytearray()
+                self.expect[NET] = bytearray()
+                return
+            self.poll(0.1)
+
+    def send(self, kind, data):
+        # ser2net throws away device data with nobody connected.
+        self.connect()
+        if not self.pending():
+            self.last_progress = time.monotonic()
+        self.expect[kind] += data
+        self.sent[kind] += len(data)
+        while data:
+            try:
+                if kind == DEV:
+                    n = os.write(self.master, data)
+                else:
+                    n = self.sock.send(data)
+            except (OSError, socket.error) as e:
+                if e.errno not in (errno.EAGAIN, errno.EWOULDBLOCK):
+                    raise
+                n = 0
+            data = data[n:]
+            if data:
+                # Don't deadlock against our own unread data.
+                self.poll(0.01)
+                if time.monotonic() - self.last_progress > self.timeout:
+                    self.stalls += 1
+                    print("Stall: unable to write to the %s side" %
+                          ("device" if kind == DEV else "network"))
+                    return
+
+    def wait_until(self, when):
+        while True:
+            left = when - time.monotonic()
+            if left <= 0:
+                return
+            self.poll(min(left, 0.1))
+
+def write_config(f, devname, port):
+    f.write("%YAML 1.1\n---\n")
+    f.write("connection: &replay\n")
+    f.write("  accepter: tcp,localhost,%d\n" % port)
+    f.write("  connector: serialdev,%s,115200n81,local\n" % devname)
+    f.write("  options:\n")
+    f.write("    kickolduser: true\n")
+    # So the device is ready before the first connection comes in.
+    f.write("    keep-device-open: true\n")
+    f.flush()
+
+def main():
+    parser = argparse.ArgumentParser(description="replay a ser2net trace")
+    parser.add_argument("trace", help="trace file, written with hexdump"
+                        " or in pcapng format")
+    parser.add_argument("-s", "--speed", type=float, default=1.0,
+                        help="speed multiplier, 0 means no delays")
+    parser.add_argument("-p", "--port", type=int, default=5200,
+                        help="ser2net TCP port")
+    parser.add_argument("-l", "--link",
+                        help="make a symlink to the pty here and use a"
+                        " running ser2net")
+    parser.add_argument("-e", "--ser2net",
+                        default=os.getenv("SER2NET_EXEC", "ser2net"),
+                        help="ser2net executable")
+    parser.add_argument("-t", "--timeout", type=float, default=5.0,
+                        help="seconds without progress that is a stall")
+    args = parser.parse_args()
+
+    events = parse_trace(args.trace)
+
+    master, slave = pty.openpty()
+    tty.setraw(slave)
+    devname = os.ttyname(slave)
+    os.close(slave)
+
+    proc = None
+    cfile = None
+    try:
+        if args.link:
+            if os.path.lexists(args.link):
+                os.unlink(args.link)
+            os.symlink(devname, args.link)
+            devname = args.link
+        else:
+            cfile = tempfile.NamedTemporaryFile(mode="w+", suffix=".yaml")
+            write_config(cfile, devname, args.port)
+            proc = subprocess.Popen([args.ser2net, "-n", "-r", "-c",
+                                     cfile.name], stdout=subprocess.PIPE)
+            if not proc.stdout.readline().startswith(b"Ready"):
+                raise Exception("ser2net did not start")
+
+        r = Replayer(master, args.port, args.timeout)
+        start = time.monotonic()
+        for e in events:
+            if e.t is not None and args.speed > 0:
+                r.wait_until(start + e.t / args.speed)
+            if e.kind == "open":
+                r.disconnect()
+                r.connect()
+            elif e.kind == "close":
+                r.disconnect()
+            else:
+                r.send(e.kind, e.data)
+        r.drain()
+        elapsed = time.monotonic() - start
+
+        print("Replayed %d events in %.3f seconds" % (len(events), elapsed))
+        print("  device to network: %d bytes sent, %d received" %
+              (r.sent[DEV], r.received[DEV]))
+        print("  network to device: %d bytes sent, %d received" %
+              (r.sent[NET], r.received[NET]))
+        print("  connections: %d, mismatches: %d, stalls: %d" %
+              (r.connects, r.mismatches, r.stalls))
+        if r.mismatches or r.stalls:
+            sys.exit(1)
+    finally:
+        if proc:
+            proc.send_signal(signal.SIGTERM)
+            proc.wait()
+        if cfile:
+            cfile.close()
+        if args.link and os.path.islink(args.link):
+            os.unlink(args.link)
+        os.close(master)
+
+if __name__ == "__main__":
+    main()
@@ -6,6 +6,8 @@
 #
 
 import os
+import json
+import socket
 import gensio
 import tempfile
 import signal
@@ -399,18 +401,22 @@ class Ser2netDaemon:
     set it back to True when done.
     """
 
-    def __init__(self, o, configdata, extra_args = ""):
+    def __init__(self, o, configdata, extra_args = "", yaml = False):
         """Create a running ser2net program
 
         The given config data is written to a file and used as the config file.
         It is started with the -r and -d options set, you can supply extra
-        options if you like as a string.
+        options if you like as a string.  If yaml is True the config data
+        is in YAML format.
         """
         
         prog = os.getenv("SER2NET_EXEC")
         if (not prog):
             prog = "ser2net"
-        self.cfile = tempfile.NamedTemporaryFile(mode="w+")
+        if yaml:
+            self.cfile = tempfile.NamedTemporaryFile(mode="w+", suffix=".yaml")
+        else:
+            self.cfile = tempfile.NamedTemporaryFile(mode="w+")
         self.cfile.write(configdata)
         self.cfile.flush()
         self.o = o
@@ -576,7 +582,7 @@ def io_close(io, timeout = 1000):
     return
 
 def setup_2_ser2net(o, config, io1str, io2str, do_io1_open = True,
-                    extra_args = ""):
+                    extra_args = "", yaml = False):
     """Setup a ser2net daemon and two gensio connections
 
     Create a ser2net daemon instance with the given config and two
@@ -591,7 +597,7 @@ def setup_2_ser2net(o, config, io1str, io2str, do_io1_open = True,
     """
     io1 = None
     io2 = None
-    ser2net = Ser2netDaemon(o, config, extra_args = extra_args)
+    ser2net = Ser2netDaemon(o, config, extra_args = extra_args, yaml = yaml)
     try:
         if (io1str):
             io1 = alloc_io(o, io1str, do_io1_open)
@@ -635,6 +641,81 @@ def finish_2_ser2net(ser2net, io1, io2, handle_except = True):
     return
 
 
+class AdminJson:
+    """A connection to the ser2net admin port in JSON mode
+
+    The connection is switched to JSON mode when it is created.
+    Requests go out with cmd(), which returns a tuple of the records
+    for that request (not including the final "done" record) and any
+    monitor records that came in while waiting.
+    """
+    def __init__(self, port = 3030, host = "localhost"):
+        self.s = socket.create_connection((host, port), 5)
+        self.f = self.s.makefile("r")
+        self.s.sendall(b"json\r\n")
+        # Skip the prompt before the switch to JSON.
+        self.hello = None
+        while self.hello is None:
+            line = self.f.readline()
+            if not line:
+                raise Exception("Controller closed the connection")
+            if line.startswith("{"):
+                self.hello = json.loads(line)
+        self.id = 0
+
+    def read(self):
+        line = self.f.readline()
+        if not line:
+            raise Exception("Controller closed the connection")
+        return json.loads(line)
+
+    def cmd(self, cmd, args = []):
+        self.id += 1
+        self.s.sendall((json.dumps({"id": self.id, "cmd": cmd, "args": args})
+                        + "\n").encode())
+        recs = []
+        mons = []
+        while True:
+            resp = self.read()
+            if "monitor" in resp:
+                mons.append(resp)
+            elif resp.get("id") == self.id and resp.get("done"):
+                return (recs, mons)
+            else:
+                recs.append(resp)
+
+    def showport(self, name):
+        """Return the port record for the given port"""
+        (recs, mons) = self.cmd("showport", [name])
+        for r in recs:
+            if "port" in r:
+                return r["port"]
+        raise Exception("No port in showport output: %s" % str(recs))
+
+    def close(self):
+        self.s.close()
+
+def admin_json(cmd, args = [], port = 3030):
+    """Run one admin command over a new JSON connection
+
+    Returns the records for the command, without the final "done"
+    record.
+    """
+    admin = AdminJson(port)
+    try:
+        (recs, mons) = admin.cmd(cmd, args)
+    finally:
+        admin.close()
+    return recs
+
+def admin_showport(name, port = 3030):
+    """Return the port record for the given port from a new connection"""
+    admin = AdminJson(port)
+    try:
+        return admin.showport(name)
+    finally:
+        admin.close()
+
 keydir = os.getenv("keydir")
 if not keydir:
     if (not keydir):
@@ -102,9 +102,18 @@ struct alias {
     char *name;
     char *value;
     unsigned int namelen;
+    unsigned int valuelen;
+    unsigned int hash;
     struct alias *next;
 };
 
+/*
+ * Aliases are kept in a hash table, it is grown when it has as many
+ * entries as buckets.  Connection names are aliases, too, so there
+ * can be a lot of them.
+ */
+#define ALIAS_HASH_INITIAL	64
+
 struct yfile {
     char *name;
     char *value;
@@ -164,6 +173,7 @@ struct yconf {
     char *connector;
     char *value;
     char *class;
+    char *range;
 
     unsigned int timeout;
     bool enable;
@@ -178,7 +188,9 @@ struct yconf {
     unsigned int curr_option;
     unsigned int options_len;
 
-    struct alias *aliases;
+    struct alias **alias_hash;
+    unsigned int alias_hash_size;
+    unsigned int num_aliases;
 
     struct yfile *files;
 
@@ -206,6 +218,7 @@ yconf_cleanup_main(struct yconf *y)
     dofree(&y->connector);
     dofree(&y->value);
     dofree(&y->class);
+    dofree(&y->range);
     dofree(&y->optionname);
     if (y->options) {
 	unsigned int i;
@@ -240,20 +253,86 @@ syslog_eprint(struct absout *e, const char *str, ...)
     syslog(LOG_ERR, "%s on line %lu column %lu", buf,
 	   (unsigned long) y->e.start_mark.line,
 	   (unsigned long) y->e.start_mark.column);
+    config_errors++;
     return 0;
 }
 
+/* FNV-1a */
+static unsigned int
+alias_hash(const char *name, unsigned int len)
+{
+    unsigned int h = 2166136261U;
+
+    while (len--) {
+	h ^= (unsigned char) *name++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
 static struct alias *
 lookup_alias_len(struct yconf *y, const char *name, unsigned int len)
 {
+    unsigned int h = alias_hash(name, len);
     struct alias *a;
 
-    a = y->aliases;
-    while (a && (a->namelen != len || strncmp(a->name, name, len) != 0))
+    if (!y->alias_hash)
+	return NULL;
+
+    a = y->alias_hash[h & (y->alias_hash_size - 1)];
+    while (a && (a->hash != h || a->namelen != len ||
+		 strncmp(a->name, name, len) != 0))
 	a = a->next;
     return a;
 }
 
+static int
+grow_alias_hash(struct yconf *y)
+{
+    unsigned int i, new_size;
+    struct alias **new_hash, *a;
+
+    if (y->alias_hash_size)
+	new_size = y->alias_hash_size * 2;
+    else
+	new_size = ALIAS_HASH_INITIAL;
+    new_hash = calloc(new_size, sizeof(*new_hash));
+    if (!new_hash)
+	return -1;
+
+    for (i = 0; i < y->alias_hash_size; i++) {
+	while ((a = y->alias_hash[i])) {
+	    y->alias_hash[i] = a->next;
+	    a->next = new_hash[a->hash & (new_size - 1)];
+	    new_hash[a->hash & (new_size - 1)] = a;
+	}
+    }
+    free(y->alias_hash);
+    y->alias_hash = new_hash;
+    y->alias_hash_size = new_size;
+    return 0;
+}
+
+static void
+free_aliases(struct yconf *y)
+{
+    unsigned int i;
+    struct alias *a;
+
+    for (i = 0; i < y->alias_hash_size; i++) {
+	while ((a = y->alias_hash[i])) {
+	    y->alias_hash[i] = a->next;
+	    free(a->name);
+	    free(a->value);
+	    free(a);
+	}
+    }
+    free(y->alias_hash);
+    y->alias_hash = NULL;
+    y->alias_hash_size = 0;
+    y->num_aliases = 0;
+}
+
 static struct alias *
 lookup_alias(struct yconf *y, const char *name)
 {
@@ -283,6 +362,12 @@ add_alias(struct yconf *y, const char *iname, const char *ivalue)
 	free(a->name);
 	free(a->value);
     } else {
+	if (y->num_aliases >= y->alias_hash_size && grow_alias_hash(y)) {
+	    free(name);
+	    free(value);
+	    y->eout->out(y->eout, "Out of memory allocating alias table");
+	    return -1;
+	}
 	a = malloc(sizeof(*a));
 	if (!a) {
 	    free(name);
@@ -290,12 +375,15 @@ add_alias(struct yconf *y, const char *iname, const char *ivalue)
 	    y->eout->out(y->eout, "Out of memory allocating alias");
 	    return -1;
 	}
-	a->next = y->aliases;
-	y->aliases = a;
+	a->namelen = strlen(name);
+	a->hash = alias_hash(name, a->namelen);
+	a->next = y->alias_hash[a->hash & (y->alias_hash_size - 1)];
+	y->alias_hash[a->hash & (y->alias_hash_size - 1)] = a;
+	y->num_aliases++;
     }
     a->name = name;
     a->value = value;
-    a->namelen = strlen(name);
+    a->valuelen = strlen(value);
     return 0;
 }
 
@@ -307,7 +395,7 @@ lookup_filename_len(struct yconf *y, const char *filename, unsigned int len)
     char *name, *value = NULL;
     struct stat stat;
 
-    while (f && f->namelen == len && strncmp(f->name, filename, len) != 0)
+    while (f && (f->namelen != len || strncmp(f->name, filename, len) != 0))
 	f = f->next;
     if (f)
 	return f;
@@ -373,19 +461,16 @@ add_option(struct yconf *y, const char *name, const char *option,
 	   const char *place)
 {
     if (y->curr_option >= y->options_len) {
-	unsigned int new_len = y->options_len + 10;
-	char **new_options = malloc(sizeof(char *) * new_len);
+	unsigned int new_len = y->options_len * 2;
+	char **new_options = realloc(y->options, sizeof(char *) * new_len);
 
 	if (!new_options) {
 	    y->eout->out(y->eout,
 			 "Out of memory allocating option array for %s", place);
 	    return -1;
 	}
-	memcpy(new_options, y->options, sizeof(char *) * y->options_len);
-	free(y->options);
 	y->options = new_options;
 	y->options_len = new_len;
-	    
     }
 
     if (name) {
@@ -414,8 +499,9 @@ static int
 add_connection(struct yconf *y, const char *connection, const char *place)
 {
     if (y->curr_connection >= y->connections_len) {
-	unsigned int new_len = y->connections_len + 10;
-	char **new_connections = malloc(sizeof(char *) * new_len);
+	unsigned int new_len = y->connections_len * 2;
+	char **new_connections = realloc(y->connections,
+					 sizeof(char *) * new_len);
 
 	if (!new_connections) {
 	    y->eout->out(y->eout,
@@ -423,12 +509,8 @@ add_connection(struct yconf *y, const char *connection, const char *place)
 			 place);
 	    return -1;
 	}
-	memcpy(new_connections, y->connections,
-	       sizeof(char *) * y->connections_len);
-	free(y->connections);
 	y->connections = new_connections;
 	y->connections_len = new_len;
-	    
     }
 
     if (connection) {
@@ -452,7 +534,8 @@ enum main_keytypes {
     MAIN_KEYTYPE_driver,
     MAIN_KEYTYPE_connector,
     MAIN_KEYTYPE_value,
-    MAIN_KEYTYPE_class
+    MAIN_KEYTYPE_class,
+    MAIN_KEYTYPE_range
 };
 
 #define DECL_KEYVAL(type)						\
@@ -466,6 +549,7 @@ DECL_KEYVAL(driver);
 DECL_KEYVAL(connector);
 DECL_KEYVAL(value);
 DECL_KEYVAL(class);
+DECL_KEYVAL(range);
 
 #define KEYVAL_OFFSET(y)			\
     ((char **) (((char *) (y)) + (y)->keyval_info->keyval_offset))
@@ -505,6 +589,27 @@ static struct scalar_next_state sc_connection[] = {
     {}
 };
 
+static struct option_info template_option_info = {
+    "template",
+    IN_MAIN_MAP,
+};
+
+static struct scalar_next_state sc_template[] = {
+    { "name", IN_MAIN_MAP_KEYVAL, WHICH_INFO_KEYVAL,
+      .keyval_info = &keyval_name },
+    { "range", IN_MAIN_MAP_KEYVAL, WHICH_INFO_KEYVAL,
+      .keyval_info = &keyval_range },
+    { "accepter", IN_MAIN_MAP_KEYVAL, WHICH_INFO_KEYVAL,
+      .keyval_info = &keyval_accepter },
+    { "timeout", IN_CONNSPEC_TIMEOUT },
+    { "enable", IN_CONNSPEC_ENABLE },
+    { "connector", IN_MAIN_MAP_KEYVAL, WHICH_INFO_KEYVAL,
+      .keyval_info = &keyval_connector },
+    { "options", IN_OPTIONS, WHICH_INFO_OPTION,
+      .option_info = &template_option_info },
+    {}
+};
+
 static struct option_info rotator_option_info = {
     "rotator",
     IN_MAIN_MAP,
@@ -546,7 +651,8 @@ enum main_map_types {
     MAIN_MAP_CONNECTION,
     MAIN_MAP_ROTATOR,
     MAIN_MAP_LED,
-    MAIN_MAP_ADMIN
+    MAIN_MAP_ADMIN,
+    MAIN_MAP_TEMPLATE
 };
 
 static struct map_info sc_default_map = {
@@ -561,6 +667,10 @@ static struct map_info sc_connection_map = {
     "connection", sc_connection, MAIN_LEVEL, MAIN_MAP_CONNECTION, true
 };
 
+static struct map_info sc_template_map = {
+    "template", sc_template, MAIN_LEVEL, MAIN_MAP_TEMPLATE, false
+};
+
 static struct map_info sc_rotator_map = {
     "rotator", sc_rotator, MAIN_LEVEL, MAIN_MAP_ROTATOR, true
 };
@@ -580,6 +690,8 @@ static struct scalar_next_state sc_main[] = {
       .map_info = &sc_deldefault_map },
     { "connection", IN_MAIN_NAME, WHICH_INFO_MAP,
       .map_info = &sc_connection_map },
+    { "template", IN_MAIN_NAME, WHICH_INFO_MAP,
+      .map_info = &sc_template_map },
     { "rotator", IN_MAIN_NAME, WHICH_INFO_MAP, .map_info = &sc_rotator_map },
     { "led", IN_MAIN_NAME, WHICH_INFO_MAP, .map_info = &sc_led_map },
     { "admin", IN_MAIN_NAME, WHICH_INFO_MAP, .map_info = &sc_admin_map },
@@ -626,119 +738,132 @@ scalar_next_state(struct yconf *y,
     y->state = PARSE_ERR;
 }
 
+struct scalar_out {
+    char *buf;
+    unsigned int len;
+    unsigned int size;
+};
+
+static int
+scalar_append(struct scalar_out *o, const char *s, unsigned int len)
+{
+    if (o->len + len + 1 > o->size) {
+	unsigned int new_size = o->size * 2;
+	char *new_buf;
+
+	if (new_size < o->len + len + 1)
+	    new_size = o->len + len + 1;
+	new_buf = realloc(o->buf, new_size);
+	if (!new_buf)
+	    return -1;
+	o->buf = new_buf;
+	o->size = new_size;
+    }
+    memcpy(o->buf + o->len, s, len);
+    o->len += len;
+    return 0;
+}
+
 /*
  * Convert *(xxx) into the alias text and *{filename} into the
- * file's contents.
+ * file's contents.  '**' is a '*', '*(*' is '*(' and '*{*' is '*{'.
+ * This is done in one pass, copying the text between the '*'s in
+ * blocks.
  */
 static char *
 process_scalar(struct yconf *y, const char *iscalar)
 {
     struct absout *eout = y->eout;
-    const char *s, *start = NULL;
-    char *rv = NULL, *out = NULL;
-    unsigned int len = 0, alen;
-    int state = 0;
-
- restart:
-    for (s = iscalar; *s; s++) {
-	if (state == 0) {
-	    if (*s == '*')
-		state = 1;
-	    else {
-		if (out)
-		    *out++ = *s;
-		len++;
-	    }
-	} else if (state == 1) {
-	    /* Last character was a '*' */
-	    if (*s == '(') {
-		start = s + 1;
-		state = 2;
-	    } else if (*s == '{') {
-		start = s + 1;
-		state = 3;
-	    } else if (*s == '*') {
-		if (out)
-		    *out++ = *s;
-		len++; /* Stay in state 1 */
-	    } else {
-		if (out) {
-		    *out++ = '*';
-		    *out++ = *s;
-		}
-		len += 2;
-		state = 0;
-	    }
-	} else if (state == 2) {
-	    /* We are in a '*(' */
-	    if (start == s && *s == '*') {
-		/* '*(*' outputs a '*(' */
-		if (out) {
-		    *out++ = '*';
-		    *out++ = '(';
-		}
-		len += 2;
-		state = 0;
-	    } else if (!*s) {
+    struct scalar_out o;
+    const char *s = iscalar, *p, *start, *end;
+
+    /* Most scalars have nothing to expand. */
+    if (!strchr(iscalar, '*')) {
+	o.buf = strdup(iscalar);
+	if (!o.buf)
+	    eout->out(eout, "Out of memory processing string '%s'", iscalar);
+	return o.buf;
+    }
+
+    o.len = 0;
+    o.size = strlen(iscalar) + 1;
+    o.buf = malloc(o.size);
+    if (!o.buf)
+	goto out_nomem;
+
+    while (*s) {
+	p = strchr(s, '*');
+	if (!p) {
+	    if (scalar_append(&o, s, strlen(s)))
+		goto out_nomem;
+	    break;
+	}
+	if (scalar_append(&o, s, p - s))
+	    goto out_nomem;
+	s = p + 1;
+
+	/* Last character was a '*' */
+	while (*s == '*') {
+	    if (scalar_append(&o, "*", 1))
+		goto out_nomem;
+	    s++;
+	}
+
+	if (*s != '(' && *s != '{') {
+	    if (scalar_append(&o, "*", 1))
+		goto out_nomem;
+	    continue;
+	}
+
+	start = s + 1;
+	if (*start == '*') {
+	    /* '*(*' outputs a '*(', '*{*' outputs a '*{' */
+	    if (scalar_append(&o, s - 1, 2))
+		goto out_nomem;
+	    s = start + 1;
+	    continue;
+	}
+
+	if (*s == '(') {
+	    struct alias *a;
+
+	    end = strchr(start, ')');
+	    if (!end) {
 		eout->out(eout, "Missing ')' for alias at '%s'", start - 2);
 		goto out_err;
-	    } else if (*s == ')') {
-		struct alias *a = lookup_alias_len(y, start, s - start);
-		if (!a) {
-		    eout->out(eout, "unknown alias at '%s'", start - 2);
-		    goto out_err;
-		}
-		alen = strlen(a->value);
-		if (out) {
-		    memcpy(out, a->value, alen);
-		    out += alen;
-		}
-		len += alen;
-		state = 0;
 	    }
-	} else if (state == 3) {
-	    /* We are in a '*{' */
-	    if (start == s && *s == '*') {
-		/* '*{*' outputs a '*{' */
-		if (out) {
-		    *out++ = '*';
-		    *out++ = '{';
-		}
-		len += 2;
-		state = 0;
-	    } else if (!*s) {
+	    a = lookup_alias_len(y, start, end - start);
+	    if (!a) {
+		eout->out(eout, "unknown alias at '%s'", start - 2);
+		goto out_err;
+	    }
+	    if (scalar_append(&o, a->value, a->valuelen))
+		goto out_nomem;
+	} else {
+	    struct yfile *f;
+
+	    end = strchr(start, '}');
+	    if (!end) {
 		eout->out(eout, "Missing '}' for filename at '%s'", start - 2);
 		goto out_err;
-	    } else if (*s == '}') {
-		struct yfile *f = lookup_filename_len(y, start, s - start);
-		if (!f)
-		    goto out_err;
-		alen = strlen(f->value);
-		if (out) {
-		    memcpy(out, f->value, alen);
-		    out += alen;
-		}
-		len += alen;
-		state = 0;
 	    }
+	    f = lookup_filename_len(y, start, end - start);
+	    if (!f)
+		goto out_err;
+	    if (scalar_append(&o, f->value, strlen(f->value)))
+		goto out_nomem;
 	}
+	s = end + 1;
     }
-    if (!out) {
-	out = malloc(len + 1);
-	if (!out) {
-	    eout->out(eout, "Out of memory processing string '%s'", iscalar);
-	    return NULL;
-	}
-	rv = out;
-	goto restart;
-    }
-    *out = '\0';
+    o.buf[o.len] = '\0';
 
-    return rv;
+    return o.buf;
 
+ out_nomem:
+    eout->out(eout, "Out of memory processing string '%s'", iscalar);
  out_err:
-    if (rv)
-	free(rv);
+    if (o.buf)
+	free(o.buf);
     return NULL;
 }
 
@@ -919,6 +1044,126 @@ yhandle_mapping_start(struct yconf *y)
     return 0;
 }
 
+/*
+ * Replace $(i) in a template string with the instance number, and
+ * $(i+N) or $(i-N) with the instance number plus or minus N.
+ */
+static char *
+template_expand(struct absout *eout, const char *str, long i)
+{
+    struct scalar_out o;
+    const char *s = str, *p;
+    char *end, num[32];
+    long n;
+
+    o.len = 0;
+    o.size = strlen(str) + 16;
+    o.buf = malloc(o.size);
+    if (!o.buf)
+	goto out_nomem;
+
+    while ((p = strstr(s, "$(i"))) {
+	if (scalar_append(&o, s, p - s))
+	    goto out_nomem;
+	p += 3;
+	n = 0;
+	if (*p == '+' || *p == '-') {
+	    n = strtol(p, &end, 10);
+	    if (end == p + 1)
+		goto out_inval;
+	    p = end;
+	}
+	if (*p != ')')
+	    goto out_inval;
+	snprintf(num, sizeof(num), "%ld", i + n);
+	if (scalar_append(&o, num, strlen(num)))
+	    goto out_nomem;
+	s = p + 1;
+    }
+    if (scalar_append(&o, s, strlen(s)))
+	goto out_nomem;
+    o.buf[o.len] = '\0';
+    return o.buf;
+
+ out_inval:
+    eout->out(eout, "Invalid template parameter in '%s'", str);
+    free(o.buf);
+    return NULL;
+
+ out_nomem:
+    eout->out(eout, "Out of memory expanding template string '%s'", str);
+    if (o.buf)
+	free(o.buf);
+    return NULL;
+}
+
+static int
+template_range(struct absout *eout, const char *range,
+	       long *first, long *last)
+{
+    const char *s;
+    char *end;
+
+    *first = strtol(range, &end, 0);
+    if (end == range)
+	goto out_inval;
+    if (*end == '\0') {
+	*last = *first;
+	return 0;
+    }
+    if (*end != '-')
+	goto out_inval;
+    s = end + 1;
+    *last = strtol(s, &end, 0);
+    if (end == s || *end != '\0' || *last < *first)
+	goto out_inval;
+    return 0;
+
+ out_inval:
+    eout->out(eout, "Invalid template range '%s', must be <n> or <n>-<m>",
+	      range);
+    return -1;
+}
+
+/*
+ * The options are only handled once, in port_template_alloc(), and
+ * each port created from the template shares them.
+ */
+static void
+yhandle_template(struct yconf *y)
+{
+    struct absout *eout = y->eout;
+    struct port_template *t;
+    char *name, *accepter, *connector;
+    long i, first, last;
+
+    if (template_range(eout, y->range, &first, &last))
+	return;
+
+    t = port_template_alloc(eout, y->enable ? "raw" : "off", y->timeout,
+			    (const char **) y->options);
+    if (!t)
+	return;
+
+    for (i = first; i <= last; i++) {
+	name = template_expand(eout, y->name, i);
+	accepter = template_expand(eout, y->accepter, i);
+	connector = template_expand(eout, y->connector, i);
+	if (name && accepter && connector)
+	    port_template_instantiate(eout, t, name, accepter, connector);
+	if (name)
+	    free(name);
+	if (accepter)
+	    free(accepter);
+	if (connector)
+	    free(connector);
+	if (!name || !accepter || !connector)
+	    break;
+    }
+
+    port_template_free(t);
+}
+
 static int
 yhandle_mapping_end(struct yconf *y)
 {
@@ -992,6 +1237,31 @@ yhandle_mapping_end(struct yconf *y)
 	    yconf_cleanup_main(y);
 	    break;
 	
+	case MAIN_MAP_TEMPLATE:
+	    if (!y->name) {
+		eout->out(eout, "No name given in template");
+		return -1;
+	    }
+	    if (!y->range) {
+		eout->out(eout, "No range given in template");
+		return -1;
+	    }
+	    if (!y->accepter) {
+		eout->out(eout, "No accepter given in template");
+		return -1;
+	    }
+	    if (!y->connector) {
+		eout->out(eout, "No connector given in template");
+		return -1;
+	    }
+	    /* NULL terminate the options. */
+	    if (add_option(y, NULL, NULL, "template"))
+		return -1;
+	    yhandle_template(y);
+	    y->state = MAIN_LEVEL;
+	    yconf_cleanup_main(y);
+	    break;
+
 	case MAIN_MAP_ROTATOR:
 	    if (!y->name) {
 		eout->out(eout, "No name given in rotator");
@@ -1195,13 +1465,7 @@ yaml_readconfig(FILE *f)
     yconf_cleanup_main(&y);
     free(y.options);
     free(y.connections);
-    while (y.aliases) {
-	struct alias *a = y.aliases;
-	y.aliases = a->next;
-	free(a->name);
-	free(a->value);
-	free(a);
-    }
+    free_aliases(&y);
 
     while (y.files) {
 	struct yfile *f = y.files;